@@ -0,0 +1,134 @@
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+#include <adb-lite/frame_diff.hpp>
+#include <adb-lite/image.hpp>
+
+#include "pixel_kernels.hpp"
+
+using clock_type = std::chrono::steady_clock;
+
+/// Size of a 1080p RGBA frame.
+static constexpr uint32_t width = 1080;
+static constexpr uint32_t height = 1920;
+static constexpr size_t frame_size = size_t(width) * height * 4;
+
+/// Run a kernel for a while, and report the source bytes per second.
+static void report(const std::string& name, const std::function<void()>& run) {
+    // Warm up the caches and the clocks.
+    run();
+
+    size_t rounds = 0;
+    const auto start = clock_type::now();
+    auto elapsed = clock_type::duration::zero();
+    while (elapsed < std::chrono::milliseconds(500)) {
+        run();
+        rounds++;
+        elapsed = clock_type::now() - start;
+    }
+
+    const auto seconds = std::chrono::duration<double>(elapsed).count();
+    const auto rate = frame_size * rounds / seconds / 1e9;
+    const auto frame = seconds / rounds * 1e3;
+
+    std::cout << std::left << std::setw(24) << name << std::right
+              << std::fixed << std::setprecision(2) << std::setw(8) << rate
+              << " GB/s" << std::setw(10) << frame << " ms/frame"
+              << std::endl;
+}
+
+int main() {
+    std::vector<uint8_t> src(frame_size);
+    for (size_t i = 0; i < src.size(); i++) {
+        src[i] = static_cast<uint8_t>(i * 7 + i / 4099);
+    }
+
+    const size_t pixels = size_t(width) * height;
+    std::vector<uint8_t> bgr(pixels * 3);
+    std::vector<uint8_t> gray(pixels);
+    std::vector<uint16_t> sums(width * 4);
+    std::vector<uint8_t> line(width * 4);
+
+    // Results of the scalar kernels, which the others must match.
+    const auto& scalar = adb::pixel::scalar_kernels();
+    std::vector<uint8_t> bgr_expected(bgr.size());
+    std::vector<uint8_t> gray_expected(gray.size());
+    scalar.to_bgr(src.data(), bgr_expected.data(), pixels, true);
+    scalar.to_gray(src.data(), gray_expected.data(), pixels, true);
+
+    // Column sums of boxes of 2 rows.
+    std::vector<uint16_t> box_sums(width * 4);
+    for (size_t i = 0; i < box_sums.size(); i++) {
+        box_sums[i] = static_cast<uint16_t>(src[i] + src[i + width * 4]);
+    }
+    std::vector<uint8_t> line_expected(line.size());
+    scalar.average(box_sums.data(), line_expected.data(), width / 2, 2);
+
+    // Hashes of 64-pixel tiles, with a narrower last one.
+    const size_t tiles = (width + 63) / 64;
+    const auto hash_frame = [&](const adb::pixel::kernels& kernels) {
+        std::vector<uint64_t> hashes(tiles * ((height + 63) / 64));
+        for (uint32_t y = 0; y < height; y++) {
+            kernels.hash_tiles(src.data() + y * width * 4, width * 4, 256,
+                               hashes.data() + y / 64 * tiles);
+        }
+        return hashes;
+    };
+    const auto hashes_expected = hash_frame(scalar);
+
+    for (const auto kernels : adb::pixel::supported_kernels()) {
+        const std::string name = kernels->name;
+
+        kernels->to_bgr(src.data(), bgr.data(), pixels, true);
+        kernels->to_gray(src.data(), gray.data(), pixels, true);
+        kernels->average(box_sums.data(), line.data(), width / 2, 2);
+        if (bgr != bgr_expected || gray != gray_expected ||
+            line != line_expected || hash_frame(*kernels) != hashes_expected) {
+            std::cerr << name << ": results differ from scalar" << std::endl;
+            return 1;
+        }
+
+        report(name + " rgba->bgr", [&] {
+            kernels->to_bgr(src.data(), bgr.data(), pixels, true);
+        });
+        report(name + " rgba->gray", [&] {
+            kernels->to_gray(src.data(), gray.data(), pixels, true);
+        });
+        report(name + " accumulate", [&] {
+            for (uint32_t y = 0; y < height; y++) {
+                kernels->accumulate(src.data() + y * width * 4, sums.data(),
+                                    width * 4);
+            }
+        });
+        report(name + " average /2", [&] {
+            for (uint32_t y = 0; y < height; y += 2) {
+                kernels->average(box_sums.data(), line.data(), width / 2, 2);
+            }
+        });
+        report(name + " hash tiles", [&] { hash_frame(*kernels); });
+    }
+
+    const adb::image_view frame = {src.data(), width, height, width * 4,
+                                   adb::pixel_format::rgba_8888};
+    std::vector<uint8_t> output;
+    for (const uint32_t scale : {1, 2, 3}) {
+        const auto suffix = " /" + std::to_string(scale);
+        report("convert bgr" + suffix, [&] {
+            adb::convert_image(frame, adb::pixel_format::bgr_888, scale,
+                               output);
+        });
+        report("convert gray" + suffix, [&] {
+            adb::convert_image(frame, adb::pixel_format::gray_8, scale,
+                               output);
+        });
+    }
+
+    const auto diff = adb::frame_diff::create();
+    report("frame diff", [&] { diff->update(frame); });
+
+    return 0;
+}
@@ -31,6 +31,11 @@ int main() {
     client->push("screenshot.png", "/data/local/tmp/screenshot.png", 0644, ec,
                  timeout);
 
+    // Raw pixels skip the PNG encoding, and the buffer is reused.
+    std::vector<uint8_t> pixels;
+    const auto image = client->screencap(pixels, ec, timeout);
+    std::cout << image.width << "x" << image.height << std::endl;
+
     std::cout << client->shell("ls -l /data/local/tmp", ec, timeout)
               << std::endl;
 
@@ -41,10 +46,10 @@ int main() {
     //     "/data/local/tmp/minitouch -d /dev/input/event1 -i");
     // std::cout << minitouch->read(3) << std::endl;
 
-    // minitouch->write("d 0 14000 25000 1024\n");
-    // minitouch->write("c\n");
-    // minitouch->write("u 0\n");
-    // minitouch->write("c\n");
+    // auto injector = client->open_input_injector(minitouch);
+    // injector->schedule(adb::swipe(0, 14000, 25000, 14000, 5000,
+    //                               std::chrono::milliseconds(300)));
+    // injector->wait(timeout);
 
     std::cout << client->disconnect(ec, timeout) << std::endl;
     return 0;
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <system_error>
+
+#include "image.hpp"
+
+namespace adb {
+
+/// A frame published by a capture_stream.
+struct captured_frame {
+    /// Pixels of the frame. Empty if no frame has been captured yet.
+    image_view image;
+
+    /// Number of the frame, from 1. 0 if no frame has been captured yet.
+    uint64_t sequence = 0;
+
+    /// Time the capture was requested, just before the screen was read.
+    std::chrono::steady_clock::time_point timestamp;
+
+    /// Time from the request to the last pixel received.
+    std::chrono::steady_clock::duration latency{0};
+};
+
+/// Background capture of the screen into a triple buffer.
+/**
+ * @note Captures run back to back on the event loop of the client. A
+ * finished frame is published by swapping it with the middle buffer, so the
+ * consumer always finds the most recent frame without waiting or locking.
+ * @note The capture stops when the handle is destroyed.
+ */
+class capture_stream {
+  public:
+    virtual ~capture_stream() = default;
+
+    /// Get the most recent complete frame.
+    /**
+     * @return The newest frame, or the previous one again if no frame has
+     * been published since.
+     * @note The pixels stay valid until the next call. Call it from one
+     * thread at a time.
+     */
+    virtual captured_frame latest() = 0;
+
+    /// Set the target frame rate.
+    /**
+     * @param frame_rate Frames per second to aim for. 0 captures back to back.
+     */
+    virtual void set_frame_rate(const double frame_rate) = 0;
+
+    /// Stop capturing after the current frame.
+    virtual void pause() = 0;
+
+    /// Start capturing again.
+    virtual void resume() = 0;
+
+    /// Check whether the stream is paused.
+    virtual bool paused() const = 0;
+
+    /// Get the error of the last failed capture.
+    /**
+     * @return The error, or an empty error_code if the last capture succeeded.
+     * @note Failed captures are retried after a short delay.
+     */
+    virtual std::error_code error() const = 0;
+
+    /// Stop capturing for good.
+    virtual void close() = 0;
+
+  protected:
+    capture_stream() = default;
+};
+
+} // namespace adb
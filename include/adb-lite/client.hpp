@@ -1,12 +1,26 @@
 #pragma once
 
+#include <chrono>
 #include <filesystem>
+#include <functional>
 #include <memory>
 #include <string>
 #include <string_view>
 #include <system_error>
+#include <vector>
 
+#include "capture_stream.hpp"
+#include "frame_diff.hpp"
+#include "image.hpp"
+#include "input_injector.hpp"
 #include "io_handle.hpp"
+#include "logcat_stream.hpp"
+#include "property_map.hpp"
+#include "receive_channel.hpp"
+#include "remote_index.hpp"
+#include "screen_record.hpp"
+#include "shell_session.hpp"
+#include "tunnel.hpp"
 
 namespace adb {
 
@@ -36,6 +50,189 @@ std::string devices(std::error_code& ec, const int64_t timeout);
  */
 void kill_server(std::error_code& ec, const int64_t timeout);
 
+/// Retrieve the version of an adb server.
+/**
+ * @return 4-byte string of the version number.
+ * @param server Address of the server, as for client::create().
+ * @param ec std::error_code to indicate what error occurred, if any.
+ * asio::error::invalid_argument if the address is malformed.
+ * @param timeout Timeout in milliseconds.
+ */
+std::string version(const std::string_view server, std::error_code& ec,
+                    const int64_t timeout);
+
+/// Retrieve the Android devices of an adb server.
+/**
+ * @return A string of the list of devices.
+ * @param server Address of the server, as for client::create().
+ * @param ec std::error_code to indicate what error occurred, if any.
+ * asio::error::invalid_argument if the address is malformed.
+ * @param timeout Timeout in milliseconds.
+ */
+std::string devices(const std::string_view server, std::error_code& ec,
+                    const int64_t timeout);
+
+/// Kill an adb server if it is running.
+/**
+ * @param server Address of the server, as for client::create().
+ * @param ec std::error_code to indicate what error occurred, if any.
+ * asio::error::invalid_argument if the address is malformed.
+ * @param timeout Timeout in milliseconds.
+ */
+void kill_server(const std::string_view server, std::error_code& ec,
+                 const int64_t timeout);
+
+/// Counters of the coalescing of identical requests in flight.
+struct coalescing_stats {
+    /// Requests made with coalescing enabled.
+    uint64_t requests = 0;
+
+    /// Round-trips to adb made for them.
+    uint64_t round_trips = 0;
+
+    /// Requests that shared the round-trip of an identical one.
+    uint64_t saved = 0;
+};
+
+/// Enable the coalescing of version() and devices().
+/**
+ * @param enabled Whether concurrent identical calls share one round-trip
+ * to the adb server. Disabled by default.
+ */
+void set_coalescing(const bool enabled);
+
+/// Get the counters of the coalescing of requests in the process.
+/**
+ * @return Counters of the free functions and of the clients that enabled
+ * coalescing.
+ */
+coalescing_stats coalescing_counters();
+
+/// Credentials to authenticate with adbd directly.
+struct adbd_auth {
+    /// Sign the 20-byte AUTH token with the private key of the host.
+    /**
+     * @note Typically RSA with SHA-1 padding, using `~/.android/adbkey`.
+     */
+    std::function<std::string(std::string_view token)> sign;
+
+    /// Public key of the host, in the format of `~/.android/adbkey.pub`.
+    /**
+     * @note Sent if the signature is rejected, so the user can accept it on
+     * the device.
+     */
+    std::string public_key;
+};
+
+/// Statistics of a file transfer with the sync service.
+struct sync_stats {
+    /// Version of the sync protocol used, 1 or 2.
+    int version = 1;
+
+    /// Whether the content was compressed with LZ4 on the wire.
+    bool compressed = false;
+
+    /// Size of the file.
+    uint64_t file_bytes = 0;
+
+    /// Size of the content on the wire, after compression.
+    uint64_t wire_bytes = 0;
+
+    /// Seconds taken by the transfer.
+    double elapsed = 0;
+
+    /// Ratio of the file size to the size on the wire.
+    double compression_ratio = 1;
+
+    /// Average throughput of the file content, in bytes per second.
+    double throughput = 0;
+};
+
+/// Statistics of an install of packages.
+struct install_stats {
+    /// Size of the APKs.
+    uint64_t bytes = 0;
+
+    /// Seconds taken to stream the APKs to the package manager.
+    double transfer = 0;
+
+    /// Seconds taken by the package manager after the last byte, to verify
+    /// and commit the packages.
+    double verification = 0;
+
+    /// Id of the install session, or 0 if a single APK was installed.
+    int64_t session = 0;
+};
+
+/// Settings of the traffic scheduler of a device.
+/**
+ * @note Operations are either interactive, e.g. shell() and the writes of
+ * an interactive_shell(), or bulk, e.g. exec(), screencap(), push() and
+ * pull().
+ */
+struct scheduler_config {
+    /// Bulk operations running at the same time, or 0 for no limit. Others
+    /// wait in FIFO order.
+    uint32_t max_bulk_streams = 0;
+
+    /// Rate of the bulk data in bytes per second, or 0 for no limit.
+    double bulk_rate = 0;
+
+    /// Rate of the bulk data while interactive traffic is active, or 0 for
+    /// no limit.
+    double contended_rate = 0;
+
+    /// Bulk bytes that may be moved at once above the rate.
+    size_t burst = 256 * 1024;
+
+    /// Milliseconds after an interactive write during which interactive
+    /// traffic is still considered active.
+    int64_t interactive_window = 200;
+};
+
+/// Metrics of the traffic scheduler of a device.
+struct scheduler_stats {
+    /// Interactive operations in progress.
+    uint32_t interactive_active = 0;
+
+    /// Bulk operations in progress.
+    uint32_t bulk_active = 0;
+
+    /// Bulk operations waiting for their turn.
+    uint32_t bulk_queued = 0;
+
+    /// Operations admitted so far.
+    uint64_t interactive_total = 0;
+    uint64_t bulk_total = 0;
+
+    /// Seconds bulk operations waited for their turn, in total and at most.
+    double bulk_wait = 0;
+    double bulk_wait_max = 0;
+
+    /// Seconds bulk data was held back by the rate limit, in total.
+    double paced = 0;
+
+    /// Bytes of bulk data counted by the rate limit.
+    uint64_t paced_bytes = 0;
+};
+
+/// Metrics of the cache of the shell commands of a client.
+struct cache_stats {
+    /// Calls answered from the cache, and calls that went to the device.
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+
+    /// Results held now, and their size in bytes.
+    size_t entries = 0;
+    size_t bytes = 0;
+
+    /// Results dropped to stay within the size limit.
+    uint64_t evictions = 0;
+
+    /// Times the whole cache was cleared, e.g. by root() or a re-attach.
+    uint64_t invalidations = 0;
+};
+
 /// A client for the Android Debug Bridge.
 class client {
   public:
@@ -44,8 +241,41 @@ class client {
      * @param serial serial number of the device.
      * @note If the serial is empty, the unique device will be used. If there
      * are multiple devices, an exception will be thrown.
+     * @note The adb server is `127.0.0.1:5037`, unless the environment sets
+     * `ADB_SERVER_SOCKET`, e.g. `tcp:127.0.0.1:5038`, or
+     * `ANDROID_ADB_SERVER_PORT`, as for the adb command line. A malformed
+     * `ADB_SERVER_SOCKET` falls back to `127.0.0.1:5037`, not to the port.
      */
     static std::shared_ptr<client> create(const std::string_view serial);
+
+    /// Create a client for a device of a specific adb server.
+    /**
+     * @param serial serial number of the device.
+     * @param server Address of the server, `[tcp:][host:]port`, e.g.
+     * `tcp:127.0.0.1:5038`. The host is an IP address, in brackets for IPv6,
+     * or `localhost`, and defaults to `127.0.0.1`.
+     * @throw std::system_error Thrown if the address is malformed.
+     * @note Every stream of a device passes through its server, so devices
+     * spread over several servers do not contend for one process. See
+     * server_shards.
+     */
+    static std::shared_ptr<client> create(const std::string_view serial,
+                                          const std::string_view server);
+
+    /// Create a client that talks to adbd directly, without the adb server.
+    /**
+     * @param address Address of the device, `host[:port]`. The port defaults
+     * to 5555. It is also used as the serial.
+     * @param auth Credentials if the device requires authentication.
+     * @throw std::system_error Thrown if the local endpoint cannot be opened.
+     * @note All streams of the client are multiplexed over one TCP connection
+     * to adbd, which is established on demand and re-established after the
+     * device restarts adbd. The event loop must be started first.
+     * @note Host services are emulated for the single device, e.g. connect()
+     * and wait_for_device() report the state of the direct connection.
+     */
+    static std::shared_ptr<client> create_direct(const std::string_view address,
+                                                 adbd_auth auth = {});
     virtual ~client() = default;
 
     /// Connect to the device.
@@ -67,6 +297,62 @@ class client {
     virtual std::string disconnect(std::error_code& ec,
                                    const int64_t timeout) = 0;
 
+    /// Enable the coalescing of identical requests of the device.
+    /**
+     * @param enabled Whether concurrent calls of shell() or exec() with the
+     * same command, on clients of the same serial, share one round-trip and
+     * all get its result. Disabled by default.
+     * @note Only enable it for read-only commands, e.g. `getprop` or
+     * `wm size`. A joined call waits within its own timeout.
+     */
+    virtual void set_coalescing(const bool enabled) = 0;
+
+    /// Cache the output of an idempotent shell command.
+    /**
+     * @param command Command exactly as given to shell(), e.g.
+     * `getprop ro.build.version.sdk` or `wm size`.
+     * @param ttl Time a result stays valid, or 0 to stop caching it.
+     * @note Only successful results are kept. The cache is cleared by
+     * connect(), disconnect(), root() and unroot(), and when the adb server
+     * sees the device detach or attach again.
+     */
+    virtual void cache_command(const std::string_view command,
+                               const std::chrono::milliseconds ttl) = 0;
+
+    /// Limit the size of the cache of the shell commands.
+    /**
+     * @param bytes Size of the results and their commands, 1 MiB by default.
+     * The least recently used results are dropped to stay within it.
+     */
+    virtual void set_cache_limit(const size_t bytes) = 0;
+
+    /// Drop the results of the cache of the shell commands.
+    /**
+     * @note The commands stay cached from their next call.
+     */
+    virtual void invalidate_cache() = 0;
+
+    /// Get the metrics of the cache of the shell commands.
+    virtual cache_stats cache_counters() = 0;
+
+    /// Fail the pending operations as soon as the device goes away.
+    /**
+     * @param enabled Whether to watch the state of the device on the adb
+     * server. Disabled by default.
+     * @note When the device goes offline or detaches, or the adb server is
+     * lost, the operations of the client in progress fail at once with
+     * asio::error::connection_aborted instead of waiting out their timeout,
+     * and the reads of its io_handle return as if the stream was closed.
+     * @note The streams of the client end the same way: logcat_stream and
+     * shell_session at once, while capture_stream and screen_record fail
+     * what is in progress and keep trying at their retry pace.
+     * @note The watch does not run for a client of create_direct(). Its
+     * connection to the device uses TCP keepalive and a user timeout, so a
+     * dead device is noticed in about 10 seconds anyway. Through an adb
+     * server, the sockets end at the server and only the watch notices.
+     */
+    virtual void monitor_liveness(const bool enabled) = 0;
+
     /// Send an one-shot shell command to the device.
     /**
      * @param command Command to execute.
@@ -75,6 +361,9 @@ class client {
      * @param timeout Timeout in milliseconds.
      * @param recv_by_socket Whether to receive the output by socket.
      * @note Equivalent to `adb -s <serial> shell <command>` without stdin.
+     * @note If recv_by_socket is true, the command should pipe into
+     * `nc -w 3 <host> <port>`. The port will be replaced by the one of a
+     * channel opened for this request.
      */
     virtual std::string shell(const std::string_view command,
                               std::error_code& ec, const int64_t timeout,
@@ -88,11 +377,172 @@ class client {
      * @param timeout Timeout in milliseconds.
      * @param recv_by_socket Whether to receive the output by socket.
      * @note Equivalent to `adb -s <serial> exec-out <command>` without stdin.
+     * @note See shell() for the form of the command if recv_by_socket is true.
      */
     virtual std::string exec(const std::string_view command,
                              std::error_code& ec, const int64_t timeout,
                              const bool recv_by_socket = false) = 0;
 
+    /// Capture the screen of the device as raw pixels.
+    /**
+     * @return View of the pixels in the buffer. Empty if an error occurred.
+     * @param buffer Buffer owned by the caller, grown if it is too small.
+     * Reuse it across captures to avoid reallocations.
+     * @param ec std::error_code to indicate what error occurred, if any.
+     * @param timeout Timeout in milliseconds.
+     * @param method Service used to capture the screen.
+     * @note Unlike `exec("screencap -p")`, the device does not encode PNG and
+     * the pixels are received into the buffer without copies. The view is
+     * valid until the buffer is modified.
+     */
+    virtual image_view screencap(std::vector<uint8_t>& buffer,
+                                 std::error_code& ec, const int64_t timeout,
+                                 const capture_method method =
+                                     capture_method::screencap) = 0;
+
+    /// Capture the screen of the device, and convert the pixels.
+    /**
+     * @return View of the converted pixels in the buffer. Empty if an error
+     * occurred.
+     * @param buffer Buffer owned by the caller, grown if it is too small.
+     * @param format Format to convert to, e.g. pixel_format::bgr_888 or
+     * pixel_format::gray_8. pixel_format::unknown keeps the format.
+     * @param scale Factor to divide the width and the height by.
+     * @param ec std::error_code to indicate what error occurred, if any.
+     * @param timeout Timeout in milliseconds.
+     * @param method Service used to capture the screen.
+     * @note Pixels are converted in bands while the rest of the image is
+     * received, as convert_image() would. The first `screencap` capture of a
+     * device converts after receiving, to learn its header size.
+     */
+    virtual image_view screencap(std::vector<uint8_t>& buffer,
+                                 const pixel_format format,
+                                 const uint32_t scale, std::error_code& ec,
+                                 const int64_t timeout,
+                                 const capture_method method =
+                                     capture_method::screencap) = 0;
+
+    /// Capture the screen of the device, and report the transfer.
+    /**
+     * @return View of the converted pixels in the buffer. Empty if an error
+     * occurred.
+     * @param buffer Buffer owned by the caller, grown if it is too small.
+     * @param format Format to convert to. pixel_format::unknown keeps the
+     * format.
+     * @param scale Factor to divide the width and the height by.
+     * @param ec std::error_code to indicate what error occurred, if any.
+     * @param timeout Timeout in milliseconds.
+     * @param method Service used to capture the screen.
+     * @param stats Sizes on the wire and after decompression, e.g. to choose
+     * capture_method::compressed on slow links.
+     */
+    virtual image_view screencap(std::vector<uint8_t>& buffer,
+                                 const pixel_format format,
+                                 const uint32_t scale, std::error_code& ec,
+                                 const int64_t timeout,
+                                 const capture_method method,
+                                 capture_stats& stats) = 0;
+
+    /// Choose the fastest way to take a screenshot of the device.
+    /**
+     * @return The method with the lowest median latency whose screenshots
+     * have consistent dimensions, with the measurements of all methods.
+     * @param ec std::error_code to indicate what error occurred, if any.
+     * @param timeout Timeout in milliseconds of each capture.
+     * @param socket_host Address of this host seen by the device, to try
+     * screenshot_method::raw_socket with `nc`. Skipped if empty.
+     * @param rounds Captures of each method.
+     * @param ttl Time the choice is reused for.
+     * @note The choice is shared by the clients of the same device on the
+     * same adb server in the process. It is measured again when it expires,
+     * or when the connection of the device changes, e.g. from USB to Wi-Fi.
+     */
+    virtual screenshot_choice
+    select_screenshot(std::error_code& ec, const int64_t timeout,
+                      const std::string_view socket_host = {},
+                      const int rounds = 3,
+                      const std::chrono::seconds ttl =
+                          std::chrono::minutes(10)) = 0;
+
+    /// Compare a frame of the device with the previous one.
+    /**
+     * @return Changes from the frame given to the previous call.
+     * @param frame Frame of the device, e.g. from screencap().
+     * @note The client keeps one frame_diff with 64-pixel tiles, so only the
+     * tile hashes of one frame are kept per device. Use frame_diff::create()
+     * for other tile sizes, or to track several streams.
+     */
+    virtual frame_changes diff_frame(const image_view& frame) = 0;
+
+    /// Capture the screen continuously in the background.
+    /**
+     * @return A capture_stream holding the most recent frame.
+     * @param format Format to convert to. pixel_format::unknown keeps the
+     * format of the device.
+     * @param scale Factor to divide the width and the height by.
+     * @param frame_rate Frames per second to aim for. 0 captures back to back.
+     * @param method Service used to capture the screen.
+     * @note Captures run on the event loop of the client, which must be
+     * started. Each frame is captured as screencap() would.
+     */
+    virtual std::shared_ptr<capture_stream> open_capture_stream(
+        const pixel_format format = pixel_format::unknown,
+        const uint32_t scale = 1, const double frame_rate = 0,
+        const capture_method method = capture_method::screencap) = 0;
+
+    /// Stream the device log as structured records.
+    /**
+     * @return A logcat_stream retaining the last records that passed the
+     * filter.
+     * @param handler Function called on the event loop with each record that
+     * passes the filter. May be empty to only retain the records.
+     * @param filter Filter applied before the records are delivered or
+     * retained. Its buffers are the ones read on the device.
+     * @param retention Bytes of records to retain, in their binary form.
+     * @note Equivalent to `adb exec-out logcat -B`. The event loop of the
+     * client must be started.
+     */
+    virtual std::shared_ptr<logcat_stream>
+    open_logcat(logcat_stream::handler_t handler, const log_filter& filter = {},
+                const size_t retention = 1024 * 1024) = 0;
+
+    /// Record the screen as an H.264 stream of NAL units.
+    /**
+     * @return A screen_record whose readers get the units as they arrive.
+     * @param bit_rate Bit rate of the encoder in bits per second. 0 for the
+     * default of the device.
+     * @param width Width of the video. 0 for the size of the display.
+     * @param height Height of the video. 0 for the size of the display.
+     * @param capacity Number of units kept for the readers.
+     * @note Equivalent to `adb exec-out screenrecord --output-format=h264 -`.
+     * The units are not decoded. The recording runs on the event loop of the
+     * client, which must be started.
+     */
+    virtual std::shared_ptr<screen_record>
+    open_screen_record(const uint32_t bit_rate = 0, const uint32_t width = 0,
+                       const uint32_t height = 0,
+                       const size_t capacity = 256) = 0;
+
+    /// Configure the traffic scheduler of the device.
+    /**
+     * @param config Settings, shared by all the clients of the device in the
+     * process.
+     * @note Bulk operations wait for their turn within their timeout, and
+     * their data is paced with a token bucket, slower while interactive
+     * traffic is active. This bounds what interactive requests queue behind
+     * in the adb server and on the link.
+     * @note Nothing is limited until this is called, e.g. with
+     * `max_bulk_streams = 2` and `contended_rate = 8 * 1024 * 1024`.
+     */
+    virtual void configure_scheduler(const scheduler_config& config) = 0;
+
+    /// Get the metrics of the traffic scheduler of the device.
+    /**
+     * @return Queue depths now, and wait times since the start of the
+     * process.
+     */
+    virtual scheduler_stats traffic_stats() = 0;
+
     /// Send a file to the device.
     /**
      * @return true if the file is successfully sent.
@@ -106,6 +556,208 @@ class client {
     virtual bool push(const std::filesystem::path& src, const std::string& dst,
                       int perm, std::error_code& ec, const int64_t timeout) = 0;
 
+    /// Send a file to the device, and report the transfer.
+    /**
+     * @return true if the file is successfully sent.
+     * @param src Path to the source file.
+     * @param dst Path to the destination file.
+     * @param perm Permission of the destination file.
+     * @param ec std::error_code to indicate what error occurred, if any.
+     * @param timeout Timeout in milliseconds.
+     * @param stats Statistics of the transfer.
+     * @note Sync v2 is used if the device supports it, and the content is
+     * compressed with LZ4 if the device supports `sendrecv_v2_lz4`.
+     */
+    virtual bool push(const std::filesystem::path& src, const std::string& dst,
+                      int perm, std::error_code& ec, const int64_t timeout,
+                      sync_stats& stats) = 0;
+
+    /// Receive a file from the device.
+    /**
+     * @return true if the file is successfully received.
+     * @param src Path to the source file on the device.
+     * @param dst Path to the destination file.
+     * @param ec std::error_code to indicate what error occurred, if any.
+     * @param timeout Timeout in milliseconds.
+     * @note Equivalent to `adb -s <serial> pull <src> <dst>`.
+     */
+    virtual bool pull(const std::string& src, const std::filesystem::path& dst,
+                      std::error_code& ec, const int64_t timeout) = 0;
+
+    /// Receive a file from the device, and report the transfer.
+    /**
+     * @return true if the file is successfully received.
+     * @param src Path to the source file on the device.
+     * @param dst Path to the destination file.
+     * @param ec std::error_code to indicate what error occurred, if any.
+     * @param timeout Timeout in milliseconds.
+     * @param stats Statistics of the transfer.
+     * @note See push() for the choice of the protocol.
+     */
+    virtual bool pull(const std::string& src, const std::filesystem::path& dst,
+                      std::error_code& ec, const int64_t timeout,
+                      sync_stats& stats) = 0;
+
+    /// List a directory tree of the device.
+    /**
+     * @return Index of the entries below the root, or nullptr on error.
+     * @param root Path to the directory on the device, e.g. `/sdcard`.
+     * @param ec std::error_code to indicate what error occurred, if any.
+     * Set to asio::error::not_found if the root does not exist.
+     * @param timeout Timeout in milliseconds of the whole walk.
+     * @param connections Sync connections listing directories at once.
+     * @note Directories are listed with sync LIST requests, or LIS2 with
+     * 64-bit sizes and times if the device supports `ls_v2`. Symbolic links
+     * are listed, but not followed. Unreadable directories appear empty.
+     */
+    virtual std::shared_ptr<remote_index>
+    walk(const std::string& root, std::error_code& ec, const int64_t timeout,
+         const size_t connections = 4) = 0;
+
+    /// Install a package on the device.
+    /**
+     * @return Output of the package manager, e.g. `Success` or
+     * `Failure [INSTALL_FAILED_VERSION_DOWNGRADE]`.
+     * @param apks Paths to the APKs of the package, the base APK and any
+     * split APKs.
+     * @param options Options of `pm install`, e.g. `-r -t`.
+     * @param ec std::error_code to indicate what error occurred, if any.
+     * Set to asio::error::fault if the package manager refused the package.
+     * @param timeout Timeout in milliseconds of the whole install.
+     * @note Equivalent to `adb -s <serial> install-multiple <apks>`. The APKs
+     * are streamed from disk to `cmd package`, so nothing is written to the
+     * storage of the device before the install. Requires Android 7.0.
+     */
+    virtual std::string
+    install(const std::vector<std::filesystem::path>& apks,
+            const std::string_view options, std::error_code& ec,
+            const int64_t timeout) = 0;
+
+    /// Install a package on the device, and report the time taken.
+    /**
+     * @return Output of the package manager.
+     * @param apks Paths to the APKs of the package.
+     * @param options Options of `pm install`.
+     * @param ec std::error_code to indicate what error occurred, if any.
+     * @param timeout Timeout in milliseconds of the whole install.
+     * @param stats Statistics of the install.
+     * @note A single APK is streamed with `cmd package install`, so the
+     * verification includes the wait for the package manager to read the
+     * end of the APK. Several APKs are written to a session, which is
+     * committed once they are all streamed.
+     */
+    virtual std::string
+    install(const std::vector<std::filesystem::path>& apks,
+            const std::string_view options, std::error_code& ec,
+            const int64_t timeout, install_stats& stats) = 0;
+
+    /// Get the features usable with the device.
+    /**
+     * @return Features supported by both the device and the adb server, e.g.
+     * `shell_v2` and `sendrecv_v2`.
+     * @param ec std::error_code to indicate what error occurred, if any.
+     * @param timeout Timeout in milliseconds.
+     * @note Equivalent to `adb -s <serial> features`. The result is cached
+     * until the device is reconnected or adbd restarts with root() or
+     * unroot().
+     */
+    virtual std::vector<std::string> features(std::error_code& ec,
+                                              const int64_t timeout) = 0;
+
+    /// Get the system properties of the device.
+    /**
+     * @return Snapshot of all the properties, or nullptr if they cannot be
+     * read.
+     * @param ec std::error_code to indicate what error occurred, if any.
+     * @param timeout Timeout in milliseconds.
+     * @param refresh Whether to read them again, even if a snapshot is kept.
+     * @note One `getprop` reads all the properties, instead of one shell()
+     * per property. The snapshot is kept until refreshed, or until the cache
+     * of the shell commands is invalidated, e.g. by root().
+     */
+    virtual std::shared_ptr<const property_map>
+    properties(std::error_code& ec, const int64_t timeout,
+               const bool refresh = false) = 0;
+
+    /// Forward a local socket to a socket on the device.
+    /**
+     * @return The allocated port if local is `tcp:0`, otherwise empty.
+     * @param local Local socket, e.g. `tcp:1313`.
+     * @param remote Remote socket, e.g. `localabstract:minitouch`.
+     * @param ec std::error_code to indicate what error occurred, if any.
+     * @param timeout Timeout in milliseconds.
+     * @note Equivalent to `adb -s <serial> forward <local> <remote>`.
+     */
+    virtual std::string forward(const std::string_view local,
+                                const std::string_view remote,
+                                std::error_code& ec, const int64_t timeout) = 0;
+
+    /// Remove a forward of the device.
+    /**
+     * @param local Local socket of the forward.
+     * @param ec std::error_code to indicate what error occurred, if any.
+     * @param timeout Timeout in milliseconds.
+     * @note Equivalent to `adb -s <serial> forward --remove <local>`.
+     */
+    virtual void forward_remove(const std::string_view local,
+                                std::error_code& ec, const int64_t timeout) = 0;
+
+    /// List the forwards of the adb server.
+    /**
+     * @return Lines of `<serial> <local> <remote>`.
+     * @param ec std::error_code to indicate what error occurred, if any.
+     * @param timeout Timeout in milliseconds.
+     * @note Equivalent to `adb -s <serial> forward --list`.
+     */
+    virtual std::string forward_list(std::error_code& ec,
+                                     const int64_t timeout) = 0;
+
+    /// Reverse a socket on the device to a local socket.
+    /**
+     * @return The allocated port if remote is `tcp:0`, otherwise empty.
+     * @param remote Remote socket, e.g. `tcp:8080`.
+     * @param local Local socket, e.g. `tcp:8080`.
+     * @param ec std::error_code to indicate what error occurred, if any.
+     * @param timeout Timeout in milliseconds.
+     * @note Equivalent to `adb -s <serial> reverse <remote> <local>`.
+     */
+    virtual std::string reverse(const std::string_view remote,
+                                const std::string_view local,
+                                std::error_code& ec, const int64_t timeout) = 0;
+
+    /// Remove a reverse of the device.
+    /**
+     * @param remote Remote socket of the reverse.
+     * @param ec std::error_code to indicate what error occurred, if any.
+     * @param timeout Timeout in milliseconds.
+     * @note Equivalent to `adb -s <serial> reverse --remove <remote>`.
+     */
+    virtual void reverse_remove(const std::string_view remote,
+                                std::error_code& ec, const int64_t timeout) = 0;
+
+    /// List the reverses of the device.
+    /**
+     * @return Lines of `<transport> <remote> <local>`.
+     * @param ec std::error_code to indicate what error occurred, if any.
+     * @param timeout Timeout in milliseconds.
+     * @note Equivalent to `adb -s <serial> reverse --list`.
+     */
+    virtual std::string reverse_list(std::error_code& ec,
+                                     const int64_t timeout) = 0;
+
+    /// Open an in-process tunnel from a local port to a device service.
+    /**
+     * @return A tunnel relaying connections on the event loop of the client.
+     * @param local_port Port on 127.0.0.1 to listen on. 0 to pick any.
+     * @param remote Device service, e.g. `tcp:1717` or `localabstract:minicap`.
+     * @param ec std::error_code to indicate what error occurred, if any.
+     * @note Unlike forward(), the relay runs in this process and reports its
+     * throughput. The adb server is still used for the device streams.
+     */
+    virtual std::shared_ptr<tunnel> open_tunnel(const uint16_t local_port,
+                                                const std::string_view remote,
+                                                std::error_code& ec) = 0;
+
     /// Set the user of adbd to root on the device.
     /**
      * @param ec std::error_code to indicate what error occurred, if any.
@@ -138,6 +790,41 @@ class client {
     interactive_shell(const std::string_view command, std::error_code& ec,
                       const int64_t timeout) = 0;
 
+    /// Schedule input events on an interactive connection.
+    /**
+     * @return An input_injector writing to the handle.
+     * @param handle Connection to minitouch or MaaTouch, e.g. opened by
+     * interactive_shell().
+     * @param frame_rate Frames per second. Events in the same frame are
+     * written together.
+     * @note The timer runs on the event loop of the client.
+     */
+    virtual std::shared_ptr<input_injector>
+    open_input_injector(std::shared_ptr<io_handle> handle,
+                        const double frame_rate = 120) = 0;
+
+    /// Open a long-lived shell session on the device.
+    /**
+     * @return A shell_session to run commands without spawning a new process
+     * for each of them.
+     * @param ec std::error_code to indicate what error occurred, if any.
+     * @param timeout Timeout in milliseconds.
+     * @note The session keeps one adb stream open until it is destroyed.
+     */
+    virtual std::shared_ptr<shell_session>
+    open_shell_session(std::error_code& ec, const int64_t timeout) = 0;
+
+    /// Open a channel to receive data from the device by socket.
+    /**
+     * @return A receive_channel listening on its own port.
+     * @param ec std::error_code to indicate what error occurred, if any.
+     * @param sink Function called with each chunk of data. If empty, the data
+     * is collected and returned by receive_channel::receive().
+     * @note The transfer runs on the event loop of the client.
+     */
+    virtual std::shared_ptr<receive_channel>
+    open_channel(std::error_code& ec, receive_channel::sink_t sink = {}) = 0;
+
     /// Start the event loop for the client.
     /**
      * @note A thread will be created to run the event loop.
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "image.hpp"
+
+namespace adb {
+
+/// Rectangle of an image, in pixels.
+struct image_rect {
+    uint32_t x = 0;
+    uint32_t y = 0;
+    uint32_t width = 0;
+    uint32_t height = 0;
+};
+
+/// Changes of a frame from the previous one.
+struct frame_changes {
+    /// Whether anything changed. If false, the frame can be skipped.
+    bool changed = false;
+
+    /// Changed tiles, in row-major order.
+    std::vector<image_rect> tiles;
+
+    /// Changed tiles merged into rectangles, which cover the same area.
+    std::vector<image_rect> regions;
+
+    /// Fraction of the tiles that changed, from 0 to 1.
+    double ratio = 0;
+};
+
+/// Detector of the changes between consecutive frames.
+/**
+ * @note Only a hash per tile of the previous frame is kept, so a frame costs
+ * one SIMD pass over its pixels and no copy.
+ */
+class frame_diff {
+  public:
+    virtual ~frame_diff() = default;
+
+    /// Create a frame_diff.
+    /**
+     * @return A frame_diff without a previous frame.
+     * @param tile_size Width and height of the tiles in pixels, from 8.
+     */
+    static std::shared_ptr<frame_diff> create(const uint32_t tile_size = 64);
+
+    /// Compare a frame with the previous one, and remember it.
+    /**
+     * @return Changes from the previous frame. Everything changed if there
+     * is no previous frame, or if its size or format is different.
+     * @param frame Frame to compare.
+     */
+    virtual frame_changes update(const image_view& frame) = 0;
+
+    /// Forget the previous frame.
+    virtual void reset() = 0;
+
+  protected:
+    frame_diff() = default;
+};
+
+} // namespace adb
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+#include "image.hpp"
+
+namespace adb {
+
+/// A frame in a shared memory ring.
+struct shared_frame {
+    /// Pixels of the frame, in the ring or in the buffer of the caller.
+    image_view image;
+
+    /// Number of the frame, from 1. 0 if there is no frame.
+    uint64_t sequence = 0;
+
+    /// Capture time of the frame, comparable across processes on the host.
+    std::chrono::steady_clock::time_point timestamp;
+};
+
+/// Writer of frames into a POSIX shared memory ring.
+/**
+ * @note Each slot has a seqlock header, so readers in other processes never
+ * block the writer, and detect frames overwritten while they read them.
+ * @note The segment is unlinked when the publisher is destroyed. Readers
+ * still attached see it as closed.
+ */
+class frame_publisher {
+  public:
+    virtual ~frame_publisher() = default;
+
+    /// Create a shared memory ring, replacing one of the same name.
+    /**
+     * @return A frame_publisher, or nullptr if an error occurred.
+     * @param name Name of the segment, e.g. the serial of the device.
+     * @param frame_size Largest frame in bytes that a slot can hold.
+     * @param slots Number of slots. Readers can catch up with a writer that
+     * is at most this many frames ahead.
+     * @param ec std::error_code to indicate what error occurred, if any.
+     */
+    static std::shared_ptr<frame_publisher>
+    create(const std::string_view name, const size_t frame_size,
+           const uint32_t slots, std::error_code& ec);
+
+    /// Copy a frame into the next slot.
+    /**
+     * @return Sequence number of the frame, or 0 if it does not fit in a
+     * slot.
+     * @param frame Frame to publish.
+     * @param timestamp Capture time of the frame.
+     */
+    virtual uint64_t publish(const image_view& frame,
+                             const std::chrono::steady_clock::time_point
+                                 timestamp = std::chrono::steady_clock::now()) =
+        0;
+
+    /// Get the sequence number of the last published frame.
+    virtual uint64_t sequence() const = 0;
+
+  protected:
+    frame_publisher() = default;
+};
+
+/// Reader of a shared memory ring written by a frame_publisher.
+class frame_reader {
+  public:
+    /// Function called with a frame in shared memory.
+    typedef std::function<void(const shared_frame&)> reader_t;
+
+    virtual ~frame_reader() = default;
+
+    /// Attach to a shared memory ring.
+    /**
+     * @return A frame_reader, or nullptr if an error occurred.
+     * @param name Name given to frame_publisher::create().
+     * @param ec std::error_code to indicate what error occurred, if any.
+     */
+    static std::shared_ptr<frame_reader> open(const std::string_view name,
+                                              std::error_code& ec);
+
+    /// Read a frame in place, without copying it.
+    /**
+     * @return true if the frame was read intact. false if it is not in the
+     * ring, or was overwritten while it was read, in which case anything
+     * derived from it must be discarded.
+     * @param sequence Sequence number of the frame. 0 for the latest one.
+     * @param reader Function called with the frame.
+     */
+    virtual bool read(const uint64_t sequence, const reader_t& reader) = 0;
+
+    /// Copy the latest frame out of the ring.
+    /**
+     * @return The frame with its pixels in the buffer. Its sequence is 0 if
+     * there is no frame yet, or the publisher has closed.
+     * @param buffer Buffer owned by the caller, grown if it is too small.
+     */
+    virtual shared_frame copy_latest(std::vector<uint8_t>& buffer) = 0;
+
+    /// Get the sequence number of the last published frame.
+    virtual uint64_t sequence() const = 0;
+
+    /// Check whether the publisher has closed the ring.
+    virtual bool closed() const = 0;
+
+  protected:
+    frame_reader() = default;
+};
+
+} // namespace adb
@@ -0,0 +1,174 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <system_error>
+#include <vector>
+
+namespace adb {
+
+/// Pixel formats of captured images, as numbered by Android.
+enum class pixel_format : uint32_t {
+    unknown = 0,
+    rgba_8888 = 1,
+    rgbx_8888 = 2,
+    rgb_888 = 3,
+    rgb_565 = 4,
+    bgra_8888 = 5,
+    rgba_fp16 = 0x16,
+    rgba_1010102 = 0x2b,
+
+    // Formats produced by convert_image(), which Android does not number.
+    bgr_888 = 0x10000,
+    gray_8 = 0x10001,
+};
+
+/// Get the size of a pixel.
+/**
+ * @return Bytes per pixel, or 0 if the format is unknown.
+ */
+constexpr uint32_t bytes_per_pixel(const pixel_format format) {
+    switch (format) {
+    case pixel_format::rgba_8888:
+    case pixel_format::rgbx_8888:
+    case pixel_format::bgra_8888:
+    case pixel_format::rgba_1010102:
+        return 4;
+    case pixel_format::rgb_888:
+    case pixel_format::bgr_888:
+        return 3;
+    case pixel_format::rgb_565:
+        return 2;
+    case pixel_format::rgba_fp16:
+        return 8;
+    case pixel_format::gray_8:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+/// Non-owning view of the pixels of an image.
+struct image_view {
+    /// First byte of the first row.
+    const uint8_t* data = nullptr;
+
+    uint32_t width = 0;
+    uint32_t height = 0;
+
+    /// Bytes from the start of a row to the start of the next one.
+    uint32_t stride = 0;
+
+    pixel_format format = pixel_format::unknown;
+
+    /// Get the size of the pixels in bytes.
+    size_t size() const { return static_cast<size_t>(stride) * height; }
+
+    /// Check whether the view is empty, e.g. after a failed capture.
+    bool empty() const { return data == nullptr; }
+};
+
+/// Convert an image to another format, and shrink it by an integer factor.
+/**
+ * @return View of the converted image in the buffer. Empty if the conversion
+ * is not supported.
+ * @param src Image of rgba_8888, rgbx_8888 or bgra_8888 pixels.
+ * @param format Format to convert to: bgr_888, gray_8, or the format of src
+ * to only shrink the image.
+ * @param scale Factor from 1 to 16 to divide the width and the height by.
+ * Each pixel is the average of a box of scale x scale pixels, and the pixels
+ * left over at the right and the bottom are dropped.
+ * @param buffer Buffer to receive the image, grown if it is too small.
+ * @note SSE2, SSSE3 or AVX2 kernels are picked at runtime, if supported.
+ */
+image_view convert_image(const image_view& src, const pixel_format format,
+                         const uint32_t scale, std::vector<uint8_t>& buffer);
+
+/// Services that capture the screen.
+enum class capture_method {
+    /// Raw output of `screencap`, without PNG encoding.
+    screencap,
+
+    /// The `framebuffer:` service of adbd.
+    framebuffer,
+
+    /// Output of `screencap` compressed on the device by `lz4 -1` if present,
+    /// otherwise `gzip -1`, and decompressed while it is received.
+    compressed,
+};
+
+/// Sizes of a capture on the wire and after decompression.
+struct capture_stats {
+    /// Compressor used on the device, `lz4` or `gzip`. Empty if none.
+    std::string compressor;
+
+    /// Bytes of the image received from the device.
+    uint64_t wire_bytes = 0;
+
+    /// Bytes of the image after decompression, headers included.
+    uint64_t decoded_bytes = 0;
+
+    /// Seconds from the request to the last pixel.
+    double elapsed = 0;
+
+    /// Ratio of the decoded size to the size on the wire.
+    double compression_ratio = 1;
+};
+
+/// Ways to take a screenshot, compared by client::select_screenshot().
+enum class screenshot_method {
+    /// `exec("screencap -p")`, encoded as PNG on the device.
+    png,
+
+    /// screencap() with capture_method::screencap.
+    raw,
+
+    /// `exec("screencap | nc -w 3 <host> <port>")` received by socket.
+    raw_socket,
+
+    /// screencap() with capture_method::compressed.
+    compressed,
+
+    /// screencap() with capture_method::framebuffer.
+    framebuffer,
+};
+
+/// Measurements of one screenshot method.
+struct screenshot_benchmark {
+    screenshot_method method = screenshot_method::raw;
+
+    /// Error of the first failed capture. The method is not used if set.
+    std::error_code error;
+
+    /// Dimensions of the screenshots.
+    uint32_t width = 0;
+    uint32_t height = 0;
+
+    /// Whether every capture had the dimensions agreed by the methods.
+    bool consistent = false;
+
+    /// Median time of a capture, in milliseconds.
+    double latency = 0;
+
+    /// Bytes received for one capture.
+    uint64_t wire_bytes = 0;
+};
+
+/// Fastest screenshot method of a device.
+struct screenshot_choice {
+    /// Method with the lowest latency among the consistent ones.
+    screenshot_method method = screenshot_method::raw;
+
+    /// Connection of the device when it was measured, e.g. `usb:1-1`.
+    std::string connection;
+
+    /// Time of the measurements.
+    std::chrono::steady_clock::time_point measured;
+
+    /// Measurements of every method, in the order of screenshot_method.
+    std::vector<screenshot_benchmark> benchmarks;
+};
+
+} // namespace adb
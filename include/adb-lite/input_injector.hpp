@@ -0,0 +1,110 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace adb {
+
+/// One input event of the minitouch protocol, which MaaTouch also speaks.
+struct input_event {
+    /// Time of the event, from the start of its sequence.
+    std::chrono::microseconds at{0};
+
+    /// Command without the trailing newline, e.g. `d 0 100 200 50`.
+    std::string command;
+
+    /// Touch contact of the event, or -1 if it is not a touch event.
+    /**
+     * @note Touch events are committed with `c`. Events of the same contact
+     * in one frame are committed one by one, so no move is lost.
+     */
+    int contact = -1;
+
+    /// Touch down.
+    static input_event down(std::chrono::microseconds at, int contact, int x,
+                            int y, int pressure = 50);
+
+    /// Touch move.
+    static input_event move(std::chrono::microseconds at, int contact, int x,
+                            int y, int pressure = 50);
+
+    /// Touch up.
+    static input_event up(std::chrono::microseconds at, int contact);
+
+    /// Key press or release, supported by MaaTouch.
+    static input_event key(std::chrono::microseconds at, int keycode,
+                           bool pressed);
+
+    /// Release all contacts.
+    static input_event reset(std::chrono::microseconds at);
+};
+
+/// Build a swipe gesture.
+/**
+ * @return Down, moves and up of one contact, evenly spaced in time.
+ * @param contact Touch contact.
+ * @param x0,y0 Start point.
+ * @param x1,y1 End point.
+ * @param duration Duration of the swipe.
+ * @param steps Number of moves.
+ */
+std::vector<input_event> swipe(int contact, int x0, int y0, int x1, int y1,
+                               std::chrono::microseconds duration,
+                               int steps = 20);
+
+/// Timing counters of an input_injector.
+struct input_stats {
+    /// Events written.
+    uint64_t events = 0;
+
+    /// Writes issued, each carrying the events of one frame.
+    uint64_t batches = 0;
+
+    /// Average delay of the writes after their frame time, in microseconds.
+    double mean_jitter = 0;
+
+    /// 99th percentile of the delay, in microseconds.
+    double p99_jitter = 0;
+
+    /// Largest delay, in microseconds.
+    double max_jitter = 0;
+};
+
+/// Scheduler of input events on an interactive connection.
+/**
+ * @note Event times are quantized to a grid of frames from the time the
+ * sequence is scheduled. All events of a frame go out in one write when a
+ * timer on the event loop of the client fires, so gestures replay the same
+ * way every time.
+ */
+class input_injector {
+  public:
+    virtual ~input_injector() = default;
+
+    /// Schedule a sequence of events.
+    /**
+     * @param events Events with times relative to now.
+     * @note Sequences scheduled at overlapping times are merged.
+     */
+    virtual void schedule(std::vector<input_event> events) = 0;
+
+    /// Wait until all scheduled events are written.
+    /**
+     * @return true if done. false if timeout or the connection has failed.
+     * @param timeout Timeout in milliseconds.
+     */
+    virtual bool wait(const int64_t timeout) = 0;
+
+    /// Drop the events not written yet.
+    virtual void cancel() = 0;
+
+    /// Get the timing counters.
+    virtual input_stats stats() const = 0;
+
+  protected:
+    input_injector() = default;
+};
+
+} // namespace adb
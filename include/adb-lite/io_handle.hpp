@@ -1,5 +1,6 @@
 #pragma once
 
+#include <span>
 #include <string>
 #include <string_view>
 
@@ -20,17 +21,79 @@ class io_handle {
      * @throw std::runtime_error Thrown on socket failure.
      * @note Typically used to write stdin of a shell command.
      * @note The data should end with a newline.
+     * @note Blocks until all data is written, after the data queued by
+     * write_async().
      */
     virtual void write(const std::string_view data) = 0;
 
+    /// Queue data to be written in the background.
+    /**
+     * @return false if the connection has failed, or the data would take the
+     * queue above the high-water mark. The data is not queued then.
+     * @param data Data to write.
+     * @note Writes are done on the event loop of the client. Data queued
+     * while a write is in progress goes out in the next gather write.
+     * @note Data still queued when the handle is destroyed is written before
+     * the connection is closed.
+     */
+    virtual bool write_async(const std::string_view data) = 0;
+
+    /// Wait until all queued data is written.
+    /**
+     * @return true if the queue is empty. false if timeout or the connection
+     * has failed.
+     * @param timeout Timeout in milliseconds. 0 means no timeout.
+     */
+    virtual bool flush(unsigned timeout = 0) = 0;
+
+    /// Set the limit of the data queued by write_async().
+    /**
+     * @param bytes Size above which write_async() refuses data. Defaults to
+     * 1 MB.
+     */
+    virtual void set_high_water_mark(size_t bytes) = 0;
+
     /// Read data from the adb connection.
     /**
-     * @param timeout Timeout in seconds. 0 means no timeout.
+     * @param timeout Timeout in milliseconds. 0 means no timeout.
      * @return Data read. Empty if timeout or the connection is closed.
      * @note Typically used to read stdout of a shell command.
+     * @note After read_ahead(), all buffered data is returned.
      */
     virtual std::string read(unsigned timeout = 0) = 0;
 
+    /// Read data from the adb connection into a buffer.
+    /**
+     * @param buffer Buffer to fill.
+     * @param timeout Timeout in milliseconds. 0 means no timeout.
+     * @return Bytes read. 0 if timeout or the connection is closed.
+     * @note Returns as soon as any data is available. With a timeout and
+     * without read_ahead(), the event loop of the client must be running.
+     */
+    virtual size_t read(std::span<char> buffer, unsigned timeout = 0) = 0;
+
+    /// Read data up to a delimiter, e.g. a line.
+    /**
+     * @param delimiter Delimiter of the frames. Must not be empty.
+     * @param timeout Timeout in milliseconds. 0 means no timeout.
+     * @return Data including the delimiter. Empty if timeout. If the
+     * connection is closed, the rest of the data without a delimiter.
+     * @note Starts read_ahead() if not yet. A frame longer than the read-ahead
+     * buffer is returned in pieces of the buffer size.
+     */
+    virtual std::string read_until(const std::string_view delimiter,
+                                   unsigned timeout = 0) = 0;
+
+    /// Keep reading the connection in the background.
+    /**
+     * @param capacity Size of the ring buffer, rounded up to a power of 2.
+     * @note Data is read on the event loop of the client while the caller is
+     * busy, so that reads become copies from the buffer. Reading pauses while
+     * the buffer is full.
+     * @note Has no effect if already started.
+     */
+    virtual void read_ahead(size_t capacity = 1 << 20) = 0;
+
   protected:
     io_handle() = default;
 };
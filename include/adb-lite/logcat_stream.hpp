@@ -0,0 +1,133 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+namespace adb {
+
+/// Priority of a log record, as in android/log.h.
+enum class log_priority : uint8_t {
+    unknown = 0,
+    verbose = 2,
+    debug = 3,
+    info = 4,
+    warn = 5,
+    error = 6,
+    fatal = 7,
+};
+
+/// Log buffer of a record, as in `logcat -b`.
+enum class log_buffer : uint8_t {
+    main = 0,
+    radio = 1,
+    events = 2,
+    system = 3,
+    crash = 4,
+    stats = 5,
+    security = 6,
+    kernel = 7,
+};
+
+/// A record of the binary output of `logcat -B`.
+/**
+ * @note The tag and the message point into a buffer of the stream, and are
+ * only valid during the call of the handler.
+ */
+struct log_record {
+    int32_t pid = 0;
+    uint32_t tid = 0;
+
+    /// User of the process. The effective user on devices with version 2
+    /// records, and 0 on the other devices older than Android 7.
+    uint32_t uid = 0;
+
+    /// Time the record was logged on the device.
+    std::chrono::system_clock::time_point timestamp;
+
+    log_priority priority = log_priority::unknown;
+    log_buffer buffer = log_buffer::main;
+
+    std::string_view tag;
+
+    /// Message without its trailing newline. For the binary buffers, i.e.
+    /// events, stats and security, the raw payload, and the tag is empty.
+    std::string_view message;
+};
+
+/// Filter applied to the records before they are delivered or retained.
+struct log_filter {
+    /// Lowest priority to keep.
+    log_priority min_priority = log_priority::unknown;
+
+    /// Process to keep, or 0 for every process.
+    int32_t pid = 0;
+
+    /// Tags to keep, or empty for every tag.
+    std::vector<std::string> tags;
+
+    /// Buffers to read, as a mask of 1 << log_buffer. The default is the one
+    /// of logcat: main, system and crash.
+    uint32_t buffers = 1 << static_cast<int>(log_buffer::main) |
+                       1 << static_cast<int>(log_buffer::system) |
+                       1 << static_cast<int>(log_buffer::crash);
+};
+
+/// Counters of a logcat_stream.
+struct logcat_stats {
+    /// Bytes received from the device.
+    uint64_t bytes = 0;
+
+    /// Records parsed.
+    uint64_t records = 0;
+
+    /// Records that passed the filter.
+    uint64_t matched = 0;
+
+    /// Records currently retained.
+    uint64_t retained = 0;
+};
+
+/// Structured stream of the device log, parsed from `logcat -B`.
+/**
+ * @note Records are parsed in place as the binary stream arrives, without
+ * any text formatting on the device or parsing of text on the host.
+ * @note The stream stops when the handle is destroyed.
+ */
+class logcat_stream {
+  public:
+    /// Function called with each record.
+    typedef std::function<void(const log_record&)> handler_t;
+
+    virtual ~logcat_stream() = default;
+
+    /// Visit the retained records, from the oldest.
+    /**
+     * @param handler Function called with each record. The stream is locked
+     * during the calls.
+     */
+    virtual void recent(const handler_t& handler) const = 0;
+
+    /// Get the counters of the stream.
+    virtual logcat_stats stats() const = 0;
+
+    /// Get the error that ended the stream.
+    /**
+     * @return The error, or an empty error_code if the stream is running.
+     * @note asio::error::eof if logcat has exited, e.g. when the device is
+     * disconnected.
+     */
+    virtual std::error_code error() const = 0;
+
+    /// Stop the stream for good.
+    virtual void close() = 0;
+
+  protected:
+    logcat_stream() = default;
+};
+
+} // namespace adb
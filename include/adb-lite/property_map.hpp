@@ -0,0 +1,61 @@
+#pragma once
+
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace adb {
+
+/// System property of a device.
+struct property {
+    std::string_view name;
+    std::string_view value;
+};
+
+/// Snapshot of the system properties of a device.
+/**
+ * @note The names and values are views of one buffer owned by the snapshot,
+ * valid as long as it is alive.
+ */
+class property_map {
+  public:
+    virtual ~property_map() = default;
+
+    /// Parse the output of `getprop`.
+    /**
+     * @return Snapshot of the properties, e.g. `[ro.product.model]: [Pixel]`
+     * lines. Lines of another form are skipped.
+     * @param output Output of `getprop`, taken over by the snapshot.
+     */
+    static std::shared_ptr<property_map> parse(std::string output);
+
+    /// Get the value of a property.
+    /**
+     * @return Value of the property, or std::nullopt if it is not set.
+     * @param name Name of the property, e.g. `ro.build.version.sdk`.
+     */
+    virtual std::optional<std::string_view>
+    get(const std::string_view name) const = 0;
+
+    /// Get the value of a property, or a fallback.
+    /**
+     * @return Value of the property, or fallback if it is not set.
+     * @param name Name of the property.
+     * @param fallback Value if the property is not set.
+     */
+    virtual std::string_view get(const std::string_view name,
+                                 const std::string_view fallback) const = 0;
+
+    /// Get all the properties.
+    /**
+     * @return Properties sorted by name.
+     */
+    virtual const std::vector<property>& entries() const = 0;
+
+  protected:
+    property_map() = default;
+};
+
+} // namespace adb
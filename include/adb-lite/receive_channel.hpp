@@ -0,0 +1,50 @@
+#pragma once
+
+#include <functional>
+#include <string>
+#include <string_view>
+#include <system_error>
+
+namespace adb {
+
+/// A local port that receives one inbound transfer from the device.
+/**
+ * @note Each channel listens on its own ephemeral port, so any number of
+ * channels can be open on the same client at the same time.
+ * @note The device side is usually `<command> | nc -w 3 <host> <port>`, where
+ * host is the address of this machine as seen from the device.
+ */
+class receive_channel {
+  public:
+    /// Function called with each chunk of data as it arrives.
+    typedef std::function<void(std::string_view)> sink_t;
+
+    virtual ~receive_channel() = default;
+
+    /// Get the local port of the channel.
+    /**
+     * @return Port number to which the device should connect.
+     */
+    virtual uint16_t port() const = 0;
+
+    /// Build the nc command that sends to this channel.
+    /**
+     * @param host Address of this machine as seen from the device.
+     * @return A command like `nc -w 3 <host> <port>`, to be piped into.
+     */
+    virtual std::string nc_command(const std::string_view host) const = 0;
+
+    /// Wait for the transfer to complete.
+    /**
+     * @return Data received, or empty if the channel has a sink.
+     * @param ec std::error_code to indicate what error occurred, if any.
+     * @param timeout Timeout in milliseconds.
+     * @note The channel is closed on return.
+     */
+    virtual std::string receive(std::error_code& ec, const int64_t timeout) = 0;
+
+  protected:
+    receive_channel() = default;
+};
+
+} // namespace adb
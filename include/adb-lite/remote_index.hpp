@@ -0,0 +1,132 @@
+#pragma once
+
+#include <compare>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+namespace adb {
+
+/// Entry of a directory tree on the device.
+struct remote_entry {
+    /// Full path of the entry, e.g. `/sdcard/DCIM/a.jpg`.
+    std::string_view path;
+
+    /// Mode of the entry, with the file type bits of `st_mode`.
+    uint32_t mode = 0;
+
+    /// Size of the entry in bytes.
+    uint64_t size = 0;
+
+    /// Time of the last modification, in seconds since the Unix epoch.
+    int64_t mtime = 0;
+
+    /// Check whether the entry is a directory.
+    bool is_directory() const { return (mode & 0170000) == 0040000; }
+
+    /// Check whether the entry is a regular file.
+    bool is_regular() const { return (mode & 0170000) == 0100000; }
+
+    /// Check whether the entry is a symbolic link, which is not followed.
+    bool is_symlink() const { return (mode & 0170000) == 0120000; }
+};
+
+/// Flat index of a directory tree on the device.
+/**
+ * @note The entries are sorted by path, and their paths are views of one
+ * buffer owned by the index, valid as long as it is alive.
+ */
+class remote_index {
+  public:
+    /// Iterator over the entries of an index.
+    class iterator {
+      public:
+        typedef std::random_access_iterator_tag iterator_category;
+        typedef remote_entry value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef const remote_entry* pointer;
+        typedef remote_entry reference;
+
+        iterator() = default;
+        iterator(const remote_index* index, const size_t pos)
+            : m_index(index), m_pos(pos) {}
+
+        remote_entry operator*() const { return (*m_index)[m_pos]; }
+        remote_entry operator[](const difference_type n) const {
+            return (*m_index)[m_pos + n];
+        }
+
+        iterator& operator++() {
+            m_pos++;
+            return *this;
+        }
+        iterator& operator--() {
+            m_pos--;
+            return *this;
+        }
+        iterator operator++(int) { return {m_index, m_pos++}; }
+        iterator operator--(int) { return {m_index, m_pos--}; }
+
+        iterator& operator+=(const difference_type n) {
+            m_pos += n;
+            return *this;
+        }
+        iterator& operator-=(const difference_type n) {
+            m_pos -= n;
+            return *this;
+        }
+        iterator operator+(const difference_type n) const {
+            return {m_index, m_pos + n};
+        }
+        iterator operator-(const difference_type n) const {
+            return {m_index, m_pos - n};
+        }
+        difference_type operator-(const iterator& other) const {
+            return static_cast<difference_type>(m_pos - other.m_pos);
+        }
+
+        auto operator<=>(const iterator& other) const {
+            return m_pos <=> other.m_pos;
+        }
+        bool operator==(const iterator& other) const {
+            return m_pos == other.m_pos;
+        }
+
+      private:
+        const remote_index* m_index = nullptr;
+        size_t m_pos = 0;
+    };
+
+    virtual ~remote_index() = default;
+
+    /// Get the number of entries.
+    virtual size_t size() const = 0;
+
+    /// Get an entry.
+    /**
+     * @return The entry at the position, in the order of the paths.
+     * @param pos Position of the entry, less than size().
+     */
+    virtual remote_entry operator[](const size_t pos) const = 0;
+
+    /// Get the entries whose path matches a glob pattern.
+    /**
+     * @return Matching entries, sorted by path.
+     * @param pattern Pattern of the full paths. `*` and `?` match within a
+     * path component, `**` matches across components, and `[...]` matches a
+     * set of characters, e.g. `**.jpg` for the JPEG files of the tree.
+     */
+    virtual std::vector<remote_entry>
+    glob(const std::string_view pattern) const = 0;
+
+    iterator begin() const { return {this, 0}; }
+    iterator end() const { return {this, size()}; }
+
+  protected:
+    remote_index() = default;
+};
+
+} // namespace adb
@@ -0,0 +1,137 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <system_error>
+
+namespace adb {
+
+/// A NAL unit of the H.264 stream of `screenrecord`.
+struct nal_unit {
+    /// Bytes of the unit, from its Annex-B start code.
+    std::span<const uint8_t> data;
+
+    /// Keeps the bytes alive while the unit is held.
+    std::shared_ptr<const void> owner;
+
+    /// nal_unit_type, e.g. 1 for slices, 5 for IDR slices, 7 for SPS and 8
+    /// for PPS.
+    uint8_t type = 0;
+
+    /// Whether the unit is an IDR slice, decodable without previous units.
+    bool keyframe = false;
+
+    /// Whether the unit was published at a pause of the device, before the
+    /// start of the next unit was seen.
+    /**
+     * @note Such a unit is usually whole, e.g. the last slice before the
+     * screen goes still, but a stall of the link may have cut it short. The
+     * rest is then dropped, and screen_record_stats::truncated counts it.
+     */
+    bool truncated = false;
+
+    /// Number of the unit in the stream, from 1.
+    uint64_t sequence = 0;
+
+    /// Number of the recording, from 1. Increased at each restart.
+    uint32_t recording = 0;
+
+    /// Time the first byte of the unit was received.
+    std::chrono::steady_clock::time_point arrival;
+};
+
+/// Counters of a screen_record.
+struct screen_record_stats {
+    /// NAL units received.
+    uint64_t units = 0;
+
+    /// IDR slices received.
+    uint64_t keyframes = 0;
+
+    /// Bytes of the NAL units received.
+    uint64_t bytes = 0;
+
+    /// Recordings started, including restarts at the time limit.
+    uint32_t recordings = 0;
+
+    /// Units published at a pause and found cut short afterwards, when the
+    /// rest of them arrived. See nal_unit::truncated.
+    uint64_t truncated = 0;
+
+    /// Units lost by the readers, in total. See nal_reader::dropped().
+    uint64_t dropped = 0;
+};
+
+/// Consumer of the NAL units of a screen_record.
+/**
+ * @note A reader starts at the next parameter sets or keyframe, and is
+ * given the current SPS and PPS before a keyframe, so it can always start
+ * decoding. A reader that falls behind by more than the capacity of the ring
+ * skips to the next keyframe in the same way.
+ */
+class nal_reader {
+  public:
+    virtual ~nal_reader() = default;
+
+    /// Get the next NAL unit.
+    /**
+     * @return false if no unit arrived before the timeout, or if the stream
+     * is closed and every unit has been read.
+     * @param unit Unit to fill. It shares the bytes of the ring.
+     * @param timeout Timeout in milliseconds. 0 does not wait.
+     */
+    virtual bool next(nal_unit& unit, const int64_t timeout) = 0;
+
+    /// Get the number of units lost by this reader.
+    /**
+     * @return Units overwritten before they were read, or skipped while
+     * waiting for a keyframe.
+     */
+    virtual uint64_t dropped() const = 0;
+
+  protected:
+    nal_reader() = default;
+};
+
+/// H.264 stream of the screen, recorded with `screenrecord`.
+/**
+ * @note The Annex-B stream is split into NAL units as it is received, into a
+ * ring of the most recent units. The bytes are received in place and shared
+ * with the readers, so a unit is only copied when it crosses the end of a
+ * block of the ring.
+ * @note The recording restarts when the device ends it at its time limit.
+ * @note The recording stops when the handle is destroyed.
+ */
+class screen_record {
+  public:
+    virtual ~screen_record() = default;
+
+    /// Attach a reader to the stream.
+    /**
+     * @return A reader starting at the next parameter sets or keyframe.
+     */
+    virtual std::shared_ptr<nal_reader> attach() = 0;
+
+    /// Get the counters of the stream.
+    virtual screen_record_stats stats() const = 0;
+
+    /// Get the error of the last failed recording.
+    /**
+     * @return The error, or an empty error_code if the recording is running.
+     * @note Failed recordings are started again after a short delay.
+     */
+    virtual std::error_code error() const = 0;
+
+    /// Stop recording for good.
+    /**
+     * @note Readers get the units left in the ring, then next() fails.
+     */
+    virtual void close() = 0;
+
+  protected:
+    screen_record() = default;
+};
+
+} // namespace adb
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace adb {
+
+class client;
+
+/// Assignment of devices to several adb servers.
+/**
+ * @note Serials are spread by rendezvous hashing, so a device stays on the
+ * same server across processes, and adding or removing a server only moves
+ * the devices it gains or loses.
+ * @note Each server sees only the devices connected through it, e.g. with
+ * client::connect() for network devices and emulators.
+ */
+class server_shards {
+  public:
+    /// Create an assignment over adb servers.
+    /**
+     * @param servers Addresses of the servers, as for client::create(), e.g.
+     * `tcp:127.0.0.1:5037` and `tcp:127.0.0.1:5038`.
+     * @throw std::system_error Thrown if an address is malformed or none is
+     * given.
+     */
+    static std::shared_ptr<server_shards>
+    create(std::vector<std::string> servers);
+
+    virtual ~server_shards() = default;
+
+    /// Get the addresses of the servers.
+    virtual const std::vector<std::string>& servers() const = 0;
+
+    /// Get the server of a device.
+    /**
+     * @return Address of the server, one of servers().
+     * @param serial Serial of the device.
+     */
+    virtual const std::string& assign(const std::string_view serial) const = 0;
+
+    /// Create a client for a device, on its server.
+    /**
+     * @param serial Serial of the device.
+     */
+    virtual std::shared_ptr<client>
+    create_client(const std::string_view serial) const = 0;
+
+  protected:
+    server_shards() = default;
+};
+
+} // namespace adb
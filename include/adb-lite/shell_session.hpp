@@ -0,0 +1,110 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+namespace adb {
+
+class client;
+
+/// Result of a command executed in a shell session.
+struct shell_result {
+    /// Output of the command, with stderr merged into stdout.
+    std::string output;
+
+    /// Exit status of the command. -1 if it is unknown.
+    int exit_code = -1;
+};
+
+/// A long-lived shell process that runs commands one after another.
+/**
+ * @note Each command is followed by a unique sentinel, which is used to split
+ * the outputs and collect the exit codes. No new process or adb stream is
+ * created per command.
+ * @note Commands do not receive stdin. Redirect it inside the command if
+ * needed.
+ */
+class shell_session {
+  public:
+    virtual ~shell_session() = default;
+
+    /// Run a command in the session.
+    /**
+     * @param command Command to execute.
+     * @return Output and exit code of the command.
+     * @param ec std::error_code to indicate what error occurred, if any.
+     * @param timeout Timeout in milliseconds.
+     */
+    virtual shell_result run(const std::string_view command,
+                             std::error_code& ec, const int64_t timeout) = 0;
+
+    /// Run several commands in the session with a single write.
+    /**
+     * @param commands Commands to execute, in order.
+     * @return Results of the commands, in the same order.
+     * @param ec std::error_code to indicate what error occurred, if any.
+     * @param timeout Timeout in milliseconds for the whole batch.
+     * @note On error, the results of completed commands are still returned.
+     */
+    virtual std::vector<shell_result>
+    run_batch(const std::vector<std::string>& commands, std::error_code& ec,
+              const int64_t timeout) = 0;
+
+    /// Check whether the session can accept more commands.
+    /**
+     * @return false if the shell process or the connection has gone away.
+     */
+    virtual bool alive() const = 0;
+
+  protected:
+    shell_session() = default;
+};
+
+/// A pool of shell sessions on the same device.
+/**
+ * @note Sessions are opened lazily, up to the size of the pool. A session
+ * that breaks is dropped and replaced on demand.
+ * @note The pool is thread-safe. Each session serves one caller at a time.
+ */
+class shell_pool {
+  public:
+    /// Create a pool of shell sessions.
+    /**
+     * @param client Client of the device. It should have been started.
+     * @param size Maximum number of concurrent sessions.
+     */
+    static std::shared_ptr<shell_pool> create(std::shared_ptr<client> client,
+                                              const size_t size);
+    virtual ~shell_pool() = default;
+
+    /// Run a command in an idle session of the pool.
+    /**
+     * @param command Command to execute.
+     * @return Output and exit code of the command.
+     * @param ec std::error_code to indicate what error occurred, if any.
+     * @param timeout Timeout in milliseconds, including the wait for an idle
+     * session.
+     */
+    virtual shell_result run(const std::string_view command,
+                             std::error_code& ec, const int64_t timeout) = 0;
+
+    /// Run several commands in an idle session of the pool.
+    /**
+     * @param commands Commands to execute, in order.
+     * @return Results of the commands, in the same order.
+     * @param ec std::error_code to indicate what error occurred, if any.
+     * @param timeout Timeout in milliseconds, including the wait for an idle
+     * session.
+     */
+    virtual std::vector<shell_result>
+    run_batch(const std::vector<std::string>& commands, std::error_code& ec,
+              const int64_t timeout) = 0;
+
+  protected:
+    shell_pool() = default;
+};
+
+} // namespace adb
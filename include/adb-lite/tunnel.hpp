@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstdint>
+
+namespace adb {
+
+/// Traffic counters of a tunnel.
+struct tunnel_stats {
+    /// Bytes relayed from local sockets to the device.
+    uint64_t bytes_sent = 0;
+
+    /// Bytes relayed from the device to local sockets.
+    uint64_t bytes_received = 0;
+
+    /// Number of connections currently relayed.
+    uint32_t active_connections = 0;
+
+    /// Number of connections accepted since the tunnel was opened.
+    uint32_t total_connections = 0;
+
+    /// Seconds since the tunnel was opened.
+    double elapsed = 0;
+
+    /// Average throughput to the device, in bytes per second.
+    double send_rate = 0;
+
+    /// Average throughput from the device, in bytes per second.
+    double receive_rate = 0;
+};
+
+/// An in-process proxy from a local port to a service on the device.
+/**
+ * @note Each accepted connection opens its own adb stream to the device
+ * service, and the payload is relayed in both directions on the event loop of
+ * the client. On Linux, the payload is moved with splice() and never enters
+ * user space.
+ * @note The tunnel is closed when the handle is destroyed.
+ */
+class tunnel {
+  public:
+    virtual ~tunnel() = default;
+
+    /// Get the local port of the tunnel.
+    /**
+     * @return Port number on 127.0.0.1 accepting connections.
+     */
+    virtual uint16_t port() const = 0;
+
+    /// Get the traffic counters of the tunnel.
+    /**
+     * @return Counters accumulated since the tunnel was opened.
+     */
+    virtual tunnel_stats stats() const = 0;
+
+    /// Stop accepting connections and close the relayed ones.
+    virtual void close() = 0;
+
+  protected:
+    tunnel() = default;
+};
+
+} // namespace adb
@@ -0,0 +1,315 @@
+#include <charconv>
+#include <iomanip>
+#include <sstream>
+
+#include <asio/post.hpp>
+#include <asio/read.hpp>
+#include <asio/write.hpp>
+
+#include "adbd_bridge.hpp"
+
+namespace adb {
+
+using asio::ip::tcp;
+
+/// Version of the adb server reported by the bridge.
+static constexpr auto server_version = "0029";
+
+/// Encode a protocol string with its hex length.
+static inline std::string encode(const std::string_view body) {
+    std::stringstream ss;
+    ss << std::setfill('0') << std::setw(4) << std::hex << body.size() << body;
+    return ss.str();
+}
+
+adbd_bridge_session::adbd_bridge_session(std::shared_ptr<adbd_bridge> bridge,
+                                         tcp::socket&& socket)
+    : m_bridge(std::move(bridge)), m_socket(std::move(socket)) {}
+
+void adbd_bridge_session::start() { read_request(); }
+
+void adbd_bridge_session::on_open() {
+    m_opened = true;
+    m_queue.push_back({"OKAY", false});
+    write_next();
+    relay();
+}
+
+void adbd_bridge_session::on_data(std::string&& data) {
+    // The device gets its OKAY after the data has reached the socket.
+    m_queue.push_back({std::move(data), true});
+    write_next();
+}
+
+void adbd_bridge_session::on_ready() { relay(); }
+
+void adbd_bridge_session::on_close() {
+    m_closed = true;
+    m_id = 0;
+
+    if (!m_opened) {
+        reply("FAIL" + encode("closed"));
+        return;
+    }
+
+    if (!m_writing && m_queue.empty()) {
+        close();
+    }
+}
+
+void adbd_bridge_session::read_request() {
+    auto length = asio::buffer(m_length);
+    asio::async_read(m_socket, length, [self = shared_from_this()](
+                                           const auto& ec, auto) {
+        if (ec) {
+            self->close();
+            return;
+        }
+
+        size_t size = 0;
+        const auto first = self->m_length.data();
+        const auto last = first + self->m_length.size();
+        if (std::from_chars(first, last, size, 16).ptr != last) {
+            self->close();
+            return;
+        }
+
+        self->m_request.resize(size);
+        auto request = asio::buffer(self->m_request);
+        asio::async_read(self->m_socket, request,
+                         [self](const auto& ec, auto) {
+                             if (ec) {
+                                 self->close();
+                                 return;
+                             }
+                             self->handle_request();
+                         });
+    });
+}
+
+void adbd_bridge_session::handle_request() {
+    const auto& request = m_request;
+    const auto starts_with = [&](const std::string_view prefix) {
+        return request.compare(0, prefix.size(), prefix) == 0;
+    };
+
+    auto& transport = m_bridge->m_transport;
+
+    // There is only one device behind the bridge.
+    if (starts_with("host:transport")) {
+        reply("OKAY", true);
+        return;
+    }
+
+    if (request == "host:version") {
+        reply("OKAY" + encode(server_version));
+        return;
+    }
+
+    if (request == "host:host-features") {
+        reply("OKAY" + encode(adbd_host_features));
+        return;
+    }
+
+    if (request == "host:kill") {
+        reply("OKAY");
+        return;
+    }
+
+    if (starts_with("host:disconnect:")) {
+        transport->disconnect();
+        reply("OKAY" + encode("disconnected " + m_bridge->m_address));
+        return;
+    }
+
+    if (starts_with("host")) {
+        transport->connect([self = shared_from_this()](const auto& ec) {
+            self->handle_online(ec);
+        });
+        return;
+    }
+
+    transport->connect([self = shared_from_this()](const auto& ec) {
+        if (ec) {
+            self->reply("FAIL" + encode(ec.message()));
+            return;
+        }
+
+        auto& transport = self->m_bridge->m_transport;
+        self->m_id = transport->open(self->m_request, self);
+    });
+}
+
+void adbd_bridge_session::handle_online(const std::error_code& ec) {
+    const auto& request = m_request;
+    const auto& address = m_bridge->m_address;
+    const auto& transport = m_bridge->m_transport;
+
+    const auto ends_with = [&](const std::string_view suffix) {
+        return request.size() >= suffix.size() &&
+               request.compare(request.size() - suffix.size(), suffix.size(),
+                               suffix) == 0;
+    };
+
+    if (request.starts_with("host:connect:")) {
+        const auto message = ec ? "failed to connect to " + address + ": " +
+                                      ec.message()
+                                : "connected to " + address;
+        reply("OKAY" + encode(message));
+        return;
+    }
+
+    if (request.starts_with("host:devices")) {
+        reply("OKAY" + encode(address + "\t" + transport->state() + "\n"));
+        return;
+    }
+
+    if (ec) {
+        reply("FAIL" + encode(ec.message()));
+        return;
+    }
+
+    if (ends_with(":get-state")) {
+        reply("OKAY" + encode(transport->state()));
+        return;
+    }
+
+    if (ends_with(":features")) {
+        std::string features;
+        for (const auto& feature : transport->features()) {
+            features += (features.empty() ? "" : ",") + feature;
+        }
+        reply("OKAY" + encode(features));
+        return;
+    }
+
+    reply("FAIL" + encode("not supported by the direct transport"));
+}
+
+void adbd_bridge_session::reply(std::string&& data, const bool keep_open) {
+    auto buffer = std::make_shared<std::string>(std::move(data));
+    asio::async_write(m_socket, asio::buffer(*buffer),
+                      [self = shared_from_this(), buffer,
+                       keep_open](const auto& ec, auto) {
+                          if (ec || !keep_open) {
+                              self->close();
+                              return;
+                          }
+                          self->read_request();
+                      });
+}
+
+void adbd_bridge_session::write_next() {
+    if (m_writing || m_queue.empty()) {
+        return;
+    }
+
+    m_writing = true;
+    const auto& data = m_queue.front().data;
+    asio::async_write(m_socket, asio::buffer(data),
+                      [self = shared_from_this()](const auto& ec, auto) {
+                          self->m_writing = false;
+                          if (ec) {
+                              self->close();
+                              return;
+                          }
+
+                          const auto ack = self->m_queue.front().ack;
+                          self->m_queue.pop_front();
+                          if (ack && self->m_id != 0) {
+                              self->m_bridge->m_transport->ack(self->m_id);
+                          }
+
+                          if (self->m_closed && self->m_queue.empty()) {
+                              self->close();
+                              return;
+                          }
+                          self->write_next();
+                      });
+}
+
+void adbd_bridge_session::relay() {
+    if (m_closed || m_id == 0) {
+        return;
+    }
+
+    m_outbound.resize(m_bridge->m_transport->max_payload());
+    m_socket.async_read_some(asio::buffer(m_outbound),
+                             [self = shared_from_this()](const auto& ec,
+                                                         auto size) {
+                                 if (ec) {
+                                     self->close();
+                                     return;
+                                 }
+
+                                 if (self->m_closed || self->m_id == 0) {
+                                     return;
+                                 }
+
+                                 auto& transport = self->m_bridge->m_transport;
+                                 const auto data = self->m_outbound.data();
+                                 transport->write(self->m_id,
+                                                  std::string(data, size));
+                             });
+}
+
+void adbd_bridge_session::close() {
+    asio::error_code ignored;
+    m_socket.close(ignored);
+
+    if (m_id != 0) {
+        m_bridge->m_transport->close(m_id);
+        m_id = 0;
+    }
+}
+
+adbd_bridge::pointer adbd_bridge::create(asio::io_context& context,
+                                         const std::string_view address,
+                                         adbd_auth auth) {
+    auto bridge = std::make_shared<adbd_bridge>(context, address, auth);
+
+    const auto localhost = asio::ip::address_v4::loopback();
+    const auto endpoint = tcp::endpoint(localhost, 0);
+
+    auto& acceptor = bridge->m_acceptor;
+    acceptor.open(endpoint.protocol());
+    acceptor.bind(endpoint);
+    acceptor.listen(asio::socket_base::max_listen_connections);
+
+    bridge->accept();
+    return bridge;
+}
+
+adbd_bridge::adbd_bridge(asio::io_context& context,
+                         const std::string_view address, adbd_auth auth)
+    : m_context(context), m_acceptor(context), m_address(address) {
+    m_transport =
+        std::make_shared<adbd_transport>(context, address, std::move(auth));
+}
+
+void adbd_bridge::close() {
+    asio::post(m_context, [self = shared_from_this()] {
+        asio::error_code ignored;
+        self->m_acceptor.close(ignored);
+        self->m_transport->disconnect();
+    });
+}
+
+void adbd_bridge::accept() {
+    m_acceptor.async_accept([self = shared_from_this()](const auto& ec,
+                                                        auto socket) {
+        if (ec) {
+            return;
+        }
+
+        asio::error_code ignored;
+        socket.set_option(tcp::no_delay(true), ignored);
+
+        auto session =
+            std::make_shared<adbd_bridge_session>(self, std::move(socket));
+        session->start();
+        self->accept();
+    });
+}
+
+} // namespace adb
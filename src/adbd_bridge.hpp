@@ -0,0 +1,124 @@
+#pragma once
+
+#include "adbd_transport.hpp"
+
+namespace adb {
+
+class adbd_bridge;
+
+/// One smart socket connection served by an adbd_bridge.
+class adbd_bridge_session
+    : public adbd_stream_handler,
+      public std::enable_shared_from_this<adbd_bridge_session> {
+  public:
+    adbd_bridge_session(std::shared_ptr<adbd_bridge> bridge,
+                        asio::ip::tcp::socket&& socket);
+
+    /// Start reading requests.
+    void start();
+
+    void on_open() override;
+    void on_data(std::string&& data) override;
+    void on_ready() override;
+    void on_close() override;
+
+  private:
+    std::shared_ptr<adbd_bridge> m_bridge;
+    asio::ip::tcp::socket m_socket;
+
+    /// Buffer of the request being read.
+    std::array<char, 4> m_length;
+    std::string m_request;
+
+    /// Local id of the logical stream, 0 if not opened.
+    uint32_t m_id = 0;
+
+    /// Whether the logical stream has been accepted by the device.
+    bool m_opened = false;
+
+    /// Whether the logical stream has been closed by the device.
+    bool m_closed = false;
+
+    /// Data to be written to the socket.
+    struct chunk {
+        std::string data;
+
+        /// Whether to acknowledge the device after the write.
+        bool ack;
+    };
+    std::deque<chunk> m_queue;
+    bool m_writing = false;
+
+    /// Buffer of the data read from the socket.
+    std::vector<char> m_outbound;
+
+    /// Read the next host request.
+    void read_request();
+
+    /// Serve a host request, or open a device service.
+    void handle_request();
+
+    /// Serve a host request after the connection attempt to adbd.
+    void handle_online(const std::error_code& ec);
+
+    /// Write a reply, and then read the next request or close.
+    void reply(std::string&& data, const bool keep_open = false);
+
+    /// Write the next queued chunk to the socket.
+    void write_next();
+
+    /// Relay the data from the socket to the device.
+    void relay();
+
+    /// Close the socket and the logical stream.
+    void close();
+};
+
+/// Local endpoint that serves the smart socket protocol of the adb server,
+/// on top of an adbd_transport.
+/**
+ * @note This lets client_handle work unchanged with a direct connection. Host
+ * services are answered by the bridge, and device services are opened as
+ * logical streams on the single connection to adbd.
+ */
+class adbd_bridge : public std::enable_shared_from_this<adbd_bridge> {
+  public:
+    typedef std::shared_ptr<adbd_bridge> pointer;
+
+    /// Create a bridge listening on an ephemeral port of 127.0.0.1.
+    /**
+     * @param context io_context to run the bridge on.
+     * @param address Address of adbd, `host[:port]`.
+     * @param auth Credentials to authenticate with adbd.
+     * @throw std::system_error Thrown if the port cannot be opened.
+     */
+    static pointer create(asio::io_context& context,
+                          const std::string_view address, adbd_auth auth);
+
+    adbd_bridge(asio::io_context& context, const std::string_view address,
+                adbd_auth auth);
+
+    /// Get the endpoint to be used in place of the adb server.
+    asio::ip::tcp::endpoint endpoint() const {
+        return m_acceptor.local_endpoint();
+    }
+
+    /// Stop accepting connections and disconnect from adbd.
+    void close();
+
+  private:
+    friend class adbd_bridge_session;
+
+    asio::io_context& m_context;
+    asio::ip::tcp::acceptor m_acceptor;
+
+    /// Address of adbd, which is also the serial of the device.
+    const std::string m_address;
+
+    std::shared_ptr<adbd_transport> m_transport;
+
+    /// Accept the next connection.
+    void accept();
+};
+
+} // namespace adb
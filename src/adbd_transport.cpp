@@ -0,0 +1,419 @@
+#include <asio/connect.hpp>
+#include <asio/read.hpp>
+#include <asio/write.hpp>
+
+#include "adbd_transport.hpp"
+#include "protocol.hpp"
+
+namespace adb {
+
+using asio::ip::tcp;
+
+/// Commands of the adbd wire protocol.
+namespace command {
+static constexpr uint32_t CNXN = 0x4e584e43;
+static constexpr uint32_t AUTH = 0x48545541;
+static constexpr uint32_t OPEN = 0x4e45504f;
+static constexpr uint32_t OKAY = 0x59414b4f;
+static constexpr uint32_t CLSE = 0x45534c43;
+static constexpr uint32_t WRTE = 0x45545257;
+static constexpr uint32_t STLS = 0x534c5453;
+} // namespace command
+
+/// Protocol version which no longer requires payload checksums.
+static constexpr uint32_t version_skip_checksum = 0x01000001;
+
+/// Maximum payload size proposed to the device.
+static constexpr uint32_t host_max_payload = 256 * 1024;
+
+/// Types of AUTH packets.
+static constexpr uint32_t auth_token = 1;
+static constexpr uint32_t auth_signature = 2;
+static constexpr uint32_t auth_public_key = 3;
+
+static inline void put_u32(char* p, const uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        p[i] = static_cast<char>((value >> (i * 8)) & 0xff);
+    }
+}
+
+static inline uint32_t get_u32(const char* p) {
+    uint32_t value = 0;
+    for (int i = 3; i >= 0; i--) {
+        value = (value << 8) | static_cast<uint8_t>(p[i]);
+    }
+    return value;
+}
+
+adbd_transport::adbd_transport(asio::io_context& context,
+                               const std::string_view address, adbd_auth auth)
+    : m_context(context), m_socket(context), m_auth(std::move(auth)) {
+    // host, host:port or [ipv6]:port
+    auto colon = address.rfind(':');
+    if (!address.empty() && address.front() == '[') {
+        const auto bracket = address.find(']');
+        m_host = address.substr(1, bracket - 1);
+        colon = address.find(':', bracket);
+    } else if (colon != std::string_view::npos) {
+        m_host = address.substr(0, colon);
+    } else {
+        m_host = address;
+    }
+
+    m_port = colon == std::string_view::npos
+                 ? "5555"
+                 : std::string(address.substr(colon + 1));
+}
+
+void adbd_transport::connect(callback_t&& callback) {
+    if (m_status == status::online) {
+        callback({});
+        return;
+    }
+
+    m_waiters.push_back(std::move(callback));
+    if (m_status != status::offline) {
+        return;
+    }
+
+    m_status = status::connecting;
+    m_signed = m_key_sent = false;
+    m_version = 0;
+    const auto generation = ++m_generation;
+
+    // The resolver and the transport live until the attempt is resolved.
+    auto resolver = std::make_shared<tcp::resolver>(m_context);
+    auto self = shared_from_this();
+    resolver->async_resolve(m_host, m_port, [this, self, resolver, generation](
+                                                const auto& ec, auto results) {
+        if (generation != m_generation) {
+            return;
+        }
+
+        if (ec) {
+            fail(ec);
+            return;
+        }
+
+        const auto connected = [this, self, generation](const auto& ec, auto) {
+            if (generation != m_generation) {
+                return;
+            }
+
+            if (ec) {
+                fail(ec);
+                return;
+            }
+
+            asio::error_code ignored;
+            m_socket.set_option(tcp::no_delay(true), ignored);
+            protocol::set_liveness(m_socket);
+
+            adbd_packet cnxn;
+            cnxn.command = command::CNXN;
+            cnxn.arg0 = version_skip_checksum;
+            cnxn.arg1 = host_max_payload;
+            cnxn.payload = std::string("host::features=") + adbd_host_features;
+            send(std::move(cnxn));
+
+            receive();
+        };
+
+        asio::async_connect(m_socket, results, connected);
+    });
+}
+
+void adbd_transport::disconnect() {
+    fail(asio::error::connection_aborted);
+}
+
+uint32_t adbd_transport::open(const std::string_view service,
+                              std::shared_ptr<adbd_stream_handler> handler) {
+    const auto local_id = m_next_id++;
+    m_streams[local_id] = {0, std::move(handler)};
+
+    adbd_packet open;
+    open.command = command::OPEN;
+    open.arg0 = local_id;
+    open.payload = std::string(service) + '\0';
+    send(std::move(open));
+
+    return local_id;
+}
+
+void adbd_transport::write(const uint32_t local_id, std::string&& data) {
+    const auto it = m_streams.find(local_id);
+    if (it == m_streams.end()) {
+        return;
+    }
+
+    adbd_packet wrte;
+    wrte.command = command::WRTE;
+    wrte.arg0 = local_id;
+    wrte.arg1 = it->second.remote_id;
+    wrte.payload = std::move(data);
+    send(std::move(wrte));
+}
+
+void adbd_transport::ack(const uint32_t local_id) {
+    const auto it = m_streams.find(local_id);
+    if (it == m_streams.end()) {
+        return;
+    }
+
+    send({command::OKAY, local_id, it->second.remote_id, {}});
+}
+
+void adbd_transport::close(const uint32_t local_id) {
+    const auto it = m_streams.find(local_id);
+    if (it == m_streams.end()) {
+        return;
+    }
+
+    send({command::CLSE, local_id, it->second.remote_id, {}});
+    m_streams.erase(it);
+}
+
+std::string adbd_transport::state() const {
+    switch (m_status) {
+    case status::online:
+        return "device";
+    case status::connecting:
+        return "connecting";
+    case status::unauthorized:
+        return "unauthorized";
+    default:
+        return "offline";
+    }
+}
+
+void adbd_transport::resolve(const std::error_code& error) {
+    auto waiters = std::move(m_waiters);
+    m_waiters.clear();
+
+    for (auto& waiter : waiters) {
+        waiter(error);
+    }
+}
+
+void adbd_transport::fail(const std::error_code& error) {
+    // Handlers of the old connection are ignored from now on.
+    m_generation++;
+    m_status = status::offline;
+
+    asio::error_code ignored;
+    m_socket.close(ignored);
+    m_outgoing.clear();
+    m_writing = false;
+
+    auto streams = std::move(m_streams);
+    m_streams.clear();
+    for (auto& [id, stream] : streams) {
+        stream.handler->on_close();
+    }
+
+    resolve(error);
+}
+
+void adbd_transport::send(adbd_packet&& packet) {
+    uint32_t check = 0;
+    if (m_version < version_skip_checksum) {
+        for (const auto c : packet.payload) {
+            check += static_cast<uint8_t>(c);
+        }
+    }
+
+    std::array<char, 24> header;
+    put_u32(header.data(), packet.command);
+    put_u32(header.data() + 4, packet.arg0);
+    put_u32(header.data() + 8, packet.arg1);
+    put_u32(header.data() + 12, static_cast<uint32_t>(packet.payload.size()));
+    put_u32(header.data() + 16, check);
+    put_u32(header.data() + 20, packet.command ^ 0xffffffff);
+
+    m_outgoing.emplace_back(header, std::move(packet.payload));
+    flush();
+}
+
+void adbd_transport::flush() {
+    if (m_writing || m_outgoing.empty()) {
+        return;
+    }
+
+    // Gather all queued packets into one write.
+    std::vector<asio::const_buffer> buffers;
+    for (const auto& [header, payload] : m_outgoing) {
+        buffers.push_back(asio::buffer(header));
+        if (!payload.empty()) {
+            buffers.push_back(asio::buffer(payload));
+        }
+    }
+
+    const auto count = m_outgoing.size();
+    const auto generation = m_generation;
+    m_writing = true;
+
+    asio::async_write(m_socket, buffers,
+                      [=, this, self = shared_from_this()](const auto& ec,
+                                                           auto) {
+                          if (generation != m_generation) {
+                              return;
+                          }
+
+                          if (ec) {
+                              fail(ec);
+                              return;
+                          }
+
+                          m_outgoing.erase(m_outgoing.begin(),
+                                           m_outgoing.begin() + count);
+                          m_writing = false;
+                          flush();
+                      });
+}
+
+void adbd_transport::receive() {
+    const auto generation = m_generation;
+
+    auto header = asio::buffer(m_header);
+    asio::async_read(m_socket, header, [=, this, self = shared_from_this()](
+                                           const auto& ec, auto) {
+        if (generation != m_generation) {
+            return;
+        }
+
+        if (ec) {
+            fail(ec);
+            return;
+        }
+
+        const auto p = m_header.data();
+        m_incoming.command = get_u32(p);
+        m_incoming.arg0 = get_u32(p + 4);
+        m_incoming.arg1 = get_u32(p + 8);
+        const auto length = get_u32(p + 12);
+
+        if (get_u32(p + 20) != (m_incoming.command ^ 0xffffffff) ||
+            length > host_max_payload) {
+            fail(asio::error::invalid_argument);
+            return;
+        }
+
+        m_incoming.payload.resize(length);
+        auto payload = asio::buffer(m_incoming.payload);
+        // The transport is kept alive while the payload is read into it.
+        asio::async_read(m_socket, payload, [=, this, self = std::move(self)](
+                                                const auto& ec, auto) {
+            if (generation != m_generation) {
+                return;
+            }
+
+            if (ec) {
+                fail(ec);
+                return;
+            }
+
+            dispatch(std::move(m_incoming));
+            if (generation == m_generation) {
+                receive();
+            }
+        });
+    });
+}
+
+void adbd_transport::dispatch(adbd_packet&& packet) {
+    switch (packet.command) {
+    case command::CNXN:
+        handshake(packet);
+        return;
+    case command::AUTH:
+        authenticate(packet);
+        return;
+    case command::STLS:
+        // TLS is used by wireless debugging, which is not supported.
+        fail(asio::error::operation_not_supported);
+        return;
+    default:
+        break;
+    }
+
+    const auto it = m_streams.find(packet.arg1);
+    if (it == m_streams.end()) {
+        // The stream has been closed locally.
+        if (packet.command == command::WRTE) {
+            send({command::CLSE, 0, packet.arg0, {}});
+        }
+        return;
+    }
+
+    auto& stream = it->second;
+    auto handler = stream.handler;
+
+    switch (packet.command) {
+    case command::OKAY:
+        if (stream.remote_id == 0) {
+            stream.remote_id = packet.arg0;
+            handler->on_open();
+        } else {
+            handler->on_ready();
+        }
+        break;
+    case command::WRTE:
+        handler->on_data(std::move(packet.payload));
+        break;
+    case command::CLSE:
+        m_streams.erase(it);
+        handler->on_close();
+        break;
+    default:
+        break;
+    }
+}
+
+void adbd_transport::authenticate(const adbd_packet& packet) {
+    if (packet.arg0 != auth_token) {
+        return;
+    }
+
+    if (!m_signed && m_auth.sign) {
+        m_signed = true;
+        send({command::AUTH, auth_signature, 0, m_auth.sign(packet.payload)});
+        return;
+    }
+
+    if (!m_key_sent && !m_auth.public_key.empty()) {
+        // The device prompts the user to accept the key.
+        m_key_sent = true;
+        m_status = status::unauthorized;
+        send({command::AUTH, auth_public_key, 0, m_auth.public_key + '\0'});
+        return;
+    }
+
+    fail(asio::error::access_denied);
+}
+
+void adbd_transport::handshake(const adbd_packet& packet) {
+    m_version = packet.arg0;
+    m_max_payload = std::min<size_t>(packet.arg1, host_max_payload);
+
+    // device::ro.product.name=...;ro.product.model=...;features=a,b,c
+    m_features.clear();
+    auto banner = std::string_view(packet.payload);
+    banner = banner.substr(0, banner.find('\0'));
+    const auto key = std::string_view("features=");
+    auto pos = banner.find(key);
+    if (pos != std::string_view::npos) {
+        pos += key.size();
+        const auto end = std::min(banner.find(';', pos), banner.size());
+        while (pos < end) {
+            const auto comma = std::min(banner.find(',', pos), end);
+            m_features.emplace_back(banner.substr(pos, comma - pos));
+            pos = comma + 1;
+        }
+    }
+
+    m_status = status::online;
+    resolve({});
+}
+
+} // namespace adb
@@ -0,0 +1,190 @@
+#pragma once
+
+#include <deque>
+#include <map>
+#include <vector>
+
+#include <asio/ip/tcp.hpp>
+
+#include "client.hpp"
+
+namespace adb {
+
+/// Features of this host, sent with CNXN and reported as host-features.
+static constexpr auto adbd_host_features =
+    "cmd,stat_v2,ls_v2,sendrecv_v2,sendrecv_v2_lz4";
+
+/// Packet of the adbd wire protocol.
+struct adbd_packet {
+    uint32_t command = 0;
+    uint32_t arg0 = 0;
+    uint32_t arg1 = 0;
+    std::string payload;
+};
+
+/// Receiver of the events of a logical stream on an adbd_transport.
+/**
+ * @note All methods are called on the event loop of the transport.
+ */
+class adbd_stream_handler {
+  public:
+    virtual ~adbd_stream_handler() = default;
+
+    /// The device has accepted the stream.
+    virtual void on_open() = 0;
+
+    /// The device has sent data on the stream.
+    /**
+     * @note The device will not send more until adbd_transport::ack() is
+     * called, which is how the receiving side applies flow control.
+     */
+    virtual void on_data(std::string&& data) = 0;
+
+    /// The device is ready for the next write.
+    virtual void on_ready() = 0;
+
+    /// The stream has been closed by the device or the transport.
+    virtual void on_close() = 0;
+};
+
+/// Connection that speaks the adbd wire protocol directly to a device.
+/**
+ * @note Logical streams are multiplexed over one TCP connection. Each stream
+ * has at most one WRTE in flight in each direction.
+ * @note All methods must be called on the event loop of the transport.
+ */
+class adbd_transport : public std::enable_shared_from_this<adbd_transport> {
+  public:
+    typedef std::shared_ptr<adbd_transport> pointer;
+
+    /// Function called when the connection attempt is resolved.
+    typedef std::function<void(const std::error_code&)> callback_t;
+
+    /// Construct a transport.
+    /**
+     * @param context io_context to run the transport on.
+     * @param address Address of adbd, `host[:port]`. The port defaults to 5555.
+     * @param auth Credentials to authenticate with adbd.
+     */
+    adbd_transport(asio::io_context& context, const std::string_view address,
+                   adbd_auth auth);
+
+    /// Connect and authenticate if not connected yet.
+    /**
+     * @param callback Function called when the transport is online, or when
+     * the attempt has failed.
+     */
+    void connect(callback_t&& callback);
+
+    /// Close the connection and all its streams.
+    void disconnect();
+
+    /// Open a logical stream to a device service.
+    /**
+     * @return Local id of the stream.
+     * @param service Service to open, e.g. `shell:ls`.
+     * @param handler Receiver of the events of the stream.
+     * @note The transport must be online.
+     */
+    uint32_t open(const std::string_view service,
+                  std::shared_ptr<adbd_stream_handler> handler);
+
+    /// Write data to a stream.
+    /**
+     * @note Wait for on_ready() before the next write.
+     * @note The data should not be larger than max_payload().
+     */
+    void write(const uint32_t local_id, std::string&& data);
+
+    /// Acknowledge the data received on a stream, to receive more.
+    void ack(const uint32_t local_id);
+
+    /// Close a stream.
+    void close(const uint32_t local_id);
+
+    /// Get the state of the device, as listed by `adb devices`.
+    std::string state() const;
+
+    /// Get the features advertised by the device.
+    const std::vector<std::string>& features() const { return m_features; }
+
+    /// Get the maximum payload size of a packet.
+    size_t max_payload() const { return m_max_payload; }
+
+  private:
+    /// State of a logical stream.
+    struct stream {
+        uint32_t remote_id = 0;
+        std::shared_ptr<adbd_stream_handler> handler;
+    };
+
+    enum class status { offline, connecting, unauthorized, online };
+
+    asio::io_context& m_context;
+    asio::ip::tcp::socket m_socket;
+
+    std::string m_host;
+    std::string m_port;
+
+    adbd_auth m_auth;
+
+    status m_status = status::offline;
+
+    /// Generation of the connection, to ignore handlers of closed ones.
+    uint64_t m_generation = 0;
+
+    /// Functions waiting for the connection attempt.
+    std::vector<callback_t> m_waiters;
+
+    /// Whether the signature has been sent for the current attempt.
+    bool m_signed = false;
+
+    /// Whether the public key has been sent for the current attempt.
+    bool m_key_sent = false;
+
+    /// Protocol version of the device.
+    uint32_t m_version = 0;
+
+    /// Maximum payload size, negotiated with CNXN.
+    size_t m_max_payload = 4096;
+
+    std::vector<std::string> m_features;
+
+    /// Streams by their local ids.
+    std::map<uint32_t, stream> m_streams;
+    uint32_t m_next_id = 1;
+
+    /// Header and payload of the packet being received.
+    std::array<char, 24> m_header;
+    adbd_packet m_incoming;
+
+    /// Packets waiting to be written, with their encoded headers.
+    std::deque<std::pair<std::array<char, 24>, std::string>> m_outgoing;
+    bool m_writing = false;
+
+    /// Resolve the connection attempt.
+    void resolve(const std::error_code& error);
+
+    /// Close the socket and all streams.
+    void fail(const std::error_code& error);
+
+    /// Queue a packet to the device.
+    void send(adbd_packet&& packet);
+
+    /// Write the queued packets.
+    void flush();
+
+    /// Receive the next packet.
+    void receive();
+
+    /// Handle a received packet.
+    void dispatch(adbd_packet&& packet);
+
+    /// Handle an AUTH packet during the connection.
+    void authenticate(const adbd_packet& packet);
+
+    /// Handle the CNXN reply of the device.
+    void handshake(const adbd_packet& packet);
+};
+
+} // namespace adb
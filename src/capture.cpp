@@ -0,0 +1,495 @@
+#include <algorithm>
+#include <cstring>
+
+#include "capture_impl.hpp"
+
+namespace adb {
+
+/// Size of the `screencap` header with the color space, which newer devices
+/// append to width, height and format.
+static constexpr size_t screencap_header_size = 16;
+
+/// Size of the color space field of the `screencap` header.
+static constexpr size_t color_space_size = 4;
+
+/// Bytes of the bands of rows converted while receiving, which stay in the
+/// cache until they are converted.
+static constexpr size_t band_size = 128 * 1024;
+
+/// Bytes of compressed output received at a time. Each chunk is decoded
+/// while the next one is in flight.
+static constexpr size_t chunk_size = 64 * 1024;
+
+/// Pipe `screencap` through the fastest compressor on the device.
+static constexpr auto compressed_command =
+    "exec:screencap | if command -v lz4 >/dev/null; then lz4 -1 -c; "
+    "else gzip -1; fi";
+
+/// Versions of the `framebuffer:` header.
+namespace framebuffer_version {
+/// Legacy header of RGB565 images: size, width and height.
+static constexpr uint32_t legacy = 16;
+/// Header with bpp, size, width, height and the offsets of the channels.
+static constexpr uint32_t v1 = 1;
+/// Header of v1 with the color space after bpp.
+static constexpr uint32_t v2 = 2;
+} // namespace framebuffer_version
+
+/// Decode a little-endian 32-bit field of an image header.
+static inline uint32_t header_u32(const char* p) {
+    uint32_t value = 0;
+    for (int i = 3; i >= 0; i--) {
+        value = (value << 8) | static_cast<uint8_t>(p[i]);
+    }
+    return value;
+}
+
+/// Get the pixel format described by a `framebuffer:` header.
+/**
+ * @return Format of the pixels, or pixel_format::unknown.
+ * @param bpp Bits per pixel.
+ * @param red_offset Bit offset of the red channel.
+ * @param alpha_length Bits of the alpha channel.
+ */
+static pixel_format framebuffer_format(const uint32_t bpp,
+                                       const uint32_t red_offset,
+                                       const uint32_t alpha_length) {
+    switch (bpp) {
+    case 16:
+        return pixel_format::rgb_565;
+    case 24:
+        return pixel_format::rgb_888;
+    case 32:
+        if (red_offset == 16) {
+            return pixel_format::bgra_8888;
+        }
+        if (red_offset == 0) {
+            return alpha_length == 0 ? pixel_format::rgbx_8888
+                                     : pixel_format::rgba_8888;
+        }
+        return pixel_format::unknown;
+    default:
+        return pixel_format::unknown;
+    }
+}
+
+capture_handle::capture_handle(asio::io_context& context,
+                               const asio::ip::tcp::endpoint& endpoint)
+    : client_handle(context, endpoint) {}
+
+void capture_handle::set_conversion(const pixel_format format,
+                                    const uint32_t scale) {
+    m_format = format;
+    m_scale = scale;
+    m_converting = format != pixel_format::unknown || scale != 1;
+}
+
+void capture_handle::capture(const std::string_view serial,
+                             const capture_method method,
+                             std::vector<uint8_t>& buffer,
+                             const callback_t&& callback) {
+    m_pixels = &buffer;
+
+    connect_device(serial, [=, this, callback = std::move(callback)] {
+        if (method == capture_method::framebuffer) {
+            read_framebuffer(std::move(callback));
+        } else {
+            m_compressed = method == capture_method::compressed;
+            read_screencap(std::move(callback));
+        }
+    });
+}
+
+capture_stats capture_handle::stats() const {
+    capture_stats stats;
+    if (m_codec == codec::gzip) {
+        stats.compressor = "gzip";
+    } else if (m_codec == codec::lz4) {
+        stats.compressor = "lz4";
+    }
+
+    stats.wire_bytes = m_wire_bytes;
+    stats.decoded_bytes = m_decoded_bytes;
+    stats.compression_ratio =
+        m_wire_bytes == 0 ? 1 : static_cast<double>(m_decoded_bytes) /
+                                    m_wire_bytes;
+    return stats;
+}
+
+image_view capture_handle::timed_capture(const std::string_view serial,
+                                         const capture_method method,
+                                         std::vector<uint8_t>& buffer,
+                                         std::error_code& ec,
+                                         const int64_t timeout) {
+    capture(serial, method, buffer, [this] { finish(); });
+
+    run(timeout);
+
+    ec = error();
+    return image();
+}
+
+#define CB this, callback = std::move(callback)
+
+void capture_handle::read_screencap(const callback_t&& callback) {
+    const auto request = m_compressed ? compressed_command : "exec:screencap";
+    host_request(request, [CB] {
+        // Older devices send a 12-byte header. Until the size is known, 16
+        // bytes are read, and the stream size tells them apart at the end.
+        const auto header =
+            m_header_size != 0 ? m_header_size : screencap_header_size;
+
+        read(m_image_header.data(), header, [=, CB] {
+            if (m_error) {
+                callback();
+                return;
+            }
+
+            if (m_read < header) {
+                m_error = asio::error::invalid_argument;
+                callback();
+                return;
+            }
+
+            const auto p = m_image_header.data();
+            const auto format = static_cast<pixel_format>(header_u32(p + 8));
+            const auto bpp = bytes_per_pixel(format);
+            if (bpp == 0) {
+                m_error = asio::error::operation_not_supported;
+                callback();
+                return;
+            }
+
+            const auto width = header_u32(p);
+            m_view = {nullptr, width, header_u32(p + 4), width * bpp, format};
+
+            if (m_header_size == 0) {
+                read_pixels_after_header(std::move(callback));
+            } else {
+                read_pixels(std::move(callback));
+            }
+        });
+    });
+}
+
+void capture_handle::read_framebuffer(const callback_t&& callback) {
+    host_request("framebuffer:", [CB] {
+        read(m_image_header.data(), 4, [CB] {
+            if (m_error) {
+                callback();
+                return;
+            }
+
+            if (m_read < 4) {
+                m_error = asio::error::eof;
+                callback();
+                return;
+            }
+
+            const auto version = header_u32(m_image_header.data());
+            read_framebuffer_header(version, std::move(callback));
+        });
+    });
+}
+
+void capture_handle::read_framebuffer_header(const uint32_t version,
+                                             const callback_t&& callback) {
+    // Fields after the version.
+    size_t fields = 0;
+    switch (version) {
+    case framebuffer_version::legacy:
+        fields = 3;
+        break;
+    case framebuffer_version::v1:
+        fields = 12;
+        break;
+    case framebuffer_version::v2:
+        fields = 13;
+        break;
+    default:
+        m_error = asio::error::operation_not_supported;
+        callback();
+        return;
+    }
+
+    read(m_image_header.data() + 4, fields * 4, [=, CB] {
+        if (m_error) {
+            callback();
+            return;
+        }
+
+        if (m_read < fields * 4) {
+            m_error = asio::error::eof;
+            callback();
+            return;
+        }
+
+        const auto field = [this](const size_t i) {
+            return header_u32(m_image_header.data() + 4 + i * 4);
+        };
+
+        uint32_t size = 0;
+        auto format = pixel_format::rgb_565;
+        if (version == framebuffer_version::legacy) {
+            size = field(0);
+            m_view.width = field(1);
+            m_view.height = field(2);
+        } else {
+            // Skip the color space of v2.
+            const size_t base = version == framebuffer_version::v2 ? 2 : 1;
+            size = field(base);
+            m_view.width = field(base + 1);
+            m_view.height = field(base + 2);
+            format = framebuffer_format(field(0), field(base + 3),
+                                        field(base + 10));
+        }
+
+        const auto bpp = bytes_per_pixel(format);
+        if (bpp == 0) {
+            m_error = asio::error::operation_not_supported;
+            callback();
+            return;
+        }
+
+        m_view.format = format;
+        m_view.stride = m_view.width * bpp;
+        if (size < m_view.size()) {
+            m_error = asio::error::invalid_argument;
+            callback();
+            return;
+        }
+
+        read_pixels(std::move(callback));
+    });
+}
+
+void capture_handle::read_pixels(const callback_t&& callback) {
+    if (m_view.size() == 0) {
+        m_error = asio::error::invalid_argument;
+        callback();
+        return;
+    }
+
+    if (m_converting) {
+        if (!start_conversion()) {
+            m_error = asio::error::operation_not_supported;
+            callback();
+            return;
+        }
+
+        const auto rows = std::max<size_t>(band_size / m_view.stride, 1);
+        reserve(m_staging, rows * m_view.stride);
+        read_bands(m_view.height, std::move(callback));
+        return;
+    }
+
+    const auto size = m_view.size();
+    const auto data = reserve(*m_pixels, size);
+    read(data, size, [=, CB] {
+        if (!m_error && m_read < size) {
+            m_error = asio::error::eof;
+        }
+        m_view.data = m_pixels->data();
+        callback();
+    });
+}
+
+void capture_handle::read_pixels_after_header(const callback_t&& callback) {
+    if (m_view.size() == 0) {
+        m_error = asio::error::invalid_argument;
+        callback();
+        return;
+    }
+
+    if (m_converting && !start_conversion()) {
+        m_error = asio::error::operation_not_supported;
+        callback();
+        return;
+    }
+
+    // The pixels are received after room for the color space, so either
+    // header ends up with the pixels in place.
+    const auto target = m_converting ? &m_staging : m_pixels;
+    const auto size = m_view.size();
+    const auto data = reserve(*target, size + color_space_size);
+
+    read(data + color_space_size, size, [=, CB] {
+        if (m_error) {
+            callback();
+            return;
+        }
+
+        const uint8_t* pixels = nullptr;
+        if (m_read == size) {
+            m_header_size = screencap_header_size;
+            pixels = target->data() + color_space_size;
+        } else if (m_read + color_space_size == size) {
+            m_header_size = screencap_header_size - color_space_size;
+            std::memcpy(data, m_image_header.data() + m_header_size,
+                        color_space_size);
+            pixels = target->data();
+        } else {
+            m_error = asio::error::eof;
+            callback();
+            return;
+        }
+
+        if (!m_converting) {
+            m_view.data = pixels;
+            callback();
+            return;
+        }
+
+        m_converter.convert(pixels, m_view.height, m_pixels->data());
+        m_view = m_converter.output();
+        m_view.data = m_pixels->data();
+        callback();
+    });
+}
+
+void capture_handle::read_bands(const size_t rows,
+                                const callback_t&& callback) {
+    if (rows == 0) {
+        m_view = m_converter.output();
+        m_view.data = m_pixels->data();
+        callback();
+        return;
+    }
+
+    const auto band =
+        std::min(rows, std::max<size_t>(band_size / m_view.stride, 1));
+    const auto size = band * m_view.stride;
+
+    const auto data = reinterpret_cast<char*>(m_staging.data());
+    read(data, size, [=, CB] {
+        if (m_error) {
+            callback();
+            return;
+        }
+
+        if (m_read < size) {
+            m_error = asio::error::eof;
+            callback();
+            return;
+        }
+
+        // The band is still in the cache.
+        m_converter.convert(m_staging.data(), band, m_pixels->data());
+        read_bands(rows - band, std::move(callback));
+    });
+}
+
+void capture_handle::read(char* data, const size_t size,
+                          const callback_t&& callback) {
+    m_read = 0;
+    if (m_compressed) {
+        read_decoded(data, size, std::move(callback));
+        return;
+    }
+
+    host_read(data, size, [=, CB] {
+        m_read = received();
+        m_wire_bytes += m_read;
+        m_decoded_bytes += m_read;
+        callback();
+    });
+}
+
+void capture_handle::read_decoded(char* data, const size_t size,
+                                  const callback_t&& callback) {
+    // Take the bytes decoded past the previous read first.
+    const auto left = m_pending.size() - m_pending_pos;
+    const auto n = std::min(size - m_read, left);
+    std::memcpy(data + m_read, m_pending.data() + m_pending_pos, n);
+    m_pending_pos += n;
+    m_read += n;
+
+    if (m_read == size || m_eof || m_error) {
+        callback();
+        return;
+    }
+
+    // The chunk is decoded in the handler, before the next read is issued.
+    // Only the socket buffer of the kernel keeps receiving meanwhile, as a
+    // read issued earlier could not complete on this event loop anyway.
+    m_chunk.resize(chunk_size);
+    host_read(m_chunk.data(), m_chunk.size(), [=, CB] {
+        if (m_error) {
+            callback();
+            return;
+        }
+
+        const auto chunk = std::string_view(m_chunk.data(), received());
+        m_wire_bytes += chunk.size();
+        m_eof = chunk.size() < chunk_size;
+
+        // Decoded bytes go straight to the destination, and the rest waits
+        // for the next read.
+        m_pending.clear();
+        m_pending_pos = 0;
+        const auto sink = [&](std::string_view output) {
+            m_decoded_bytes += output.size();
+
+            const auto n = std::min(size - m_read, output.size());
+            std::memcpy(data + m_read, output.data(), n);
+            m_read += n;
+            m_pending.append(output.substr(n));
+        };
+
+        if (!decode(chunk, sink)) {
+            m_error = m_codec == codec::none
+                          ? asio::error::operation_not_supported
+                          : asio::error::invalid_argument;
+            callback();
+            return;
+        }
+
+        read_decoded(data, size, std::move(callback));
+    });
+}
+
+bool capture_handle::decode(
+    const std::string_view chunk,
+    const std::function<void(std::string_view)>& sink) {
+    if (m_codec == codec::none) {
+        if (chunk.starts_with("\x1f\x8b")) {
+            m_codec = codec::gzip;
+        } else if (chunk.starts_with("\x04\x22\x4d\x18")) {
+            m_codec = codec::lz4;
+        } else {
+            // Errors of the shell, e.g. when gzip is missing.
+            return chunk.empty();
+        }
+    }
+
+    const auto ok = m_codec == codec::gzip ? m_gzip.feed(chunk, sink)
+                                           : m_lz4.feed(chunk, sink);
+    if (!ok) {
+        return false;
+    }
+
+    // A truncated stream must not pass for an image with a short header.
+    if (m_eof) {
+        return m_codec == codec::gzip ? m_gzip.finished() : m_lz4.finished();
+    }
+    return true;
+}
+
+bool capture_handle::start_conversion() {
+    if (!m_converter.reset(m_view, m_format, m_scale)) {
+        return false;
+    }
+
+    reserve(*m_pixels, m_converter.output().size());
+    return true;
+}
+
+char* capture_handle::reserve(std::vector<uint8_t>& buffer,
+                              const size_t size) {
+    if (buffer.size() < size) {
+        buffer.resize(size);
+    }
+    return reinterpret_cast<char*>(buffer.data());
+}
+
+} // namespace adb
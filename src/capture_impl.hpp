@@ -0,0 +1,211 @@
+#pragma once
+
+#include "client_impl.hpp"
+#include "gzip.hpp"
+#include "image.hpp"
+#include "image_convert.hpp"
+#include "lz4.hpp"
+
+namespace adb {
+
+/// Client handle that captures the screen into a buffer of the caller.
+class capture_handle : public client_handle {
+  public:
+    capture_handle(asio::io_context& context,
+                   const asio::ip::tcp::endpoint& endpoint =
+                       protocol::default_endpoint());
+
+    /// Convert the pixels while they are received.
+    /**
+     * @param format Format to convert to. pixel_format::unknown keeps the
+     * format of the device.
+     * @param scale Factor to divide the width and the height by.
+     */
+    void set_conversion(const pixel_format format, const uint32_t scale);
+
+    /// Set the size of the `screencap` header of the device, if known.
+    /**
+     * @param size 12 or 16, or 0 if unknown.
+     * @note If unknown, it is learned from the first capture, which cannot
+     * convert the pixels while they are received.
+     */
+    void set_screencap_header(const size_t size) { m_header_size = size; }
+
+    /// Get the size of the `screencap` header of the device.
+    /**
+     * @return 12 or 16, or 0 if still unknown.
+     */
+    size_t screencap_header() const { return m_header_size; }
+
+    /// Capture the screen of the device asynchronously.
+    /**
+     * @param serial Serial of the device.
+     * @param method Service used to capture the screen.
+     * @param buffer Buffer to receive the pixels, grown if it is too small.
+     * @param callback Function called when the image is received. The result
+     * is available with image() and error().
+     */
+    void capture(const std::string_view serial, const capture_method method,
+                 std::vector<uint8_t>& buffer, const callback_t&& callback);
+
+    /// Get the image of the last capture.
+    /**
+     * @return View of the pixels in the buffer. Empty if an error occurred.
+     */
+    image_view image() const { return m_error ? image_view() : m_view; }
+
+    /// Get the sizes of the last capture.
+    /**
+     * @return Sizes on the wire and after decompression, without the time.
+     */
+    capture_stats stats() const;
+
+    /// Capture the screen of the device.
+    /**
+     * @return View of the pixels in the buffer. Empty if an error occurred.
+     * @param serial Serial of the device.
+     * @param method Service used to capture the screen.
+     * @param buffer Buffer to receive the pixels, grown if it is too small.
+     * @param ec std::error_code to indicate what error occurred, if any.
+     * @param timeout Timeout in milliseconds.
+     */
+    image_view timed_capture(const std::string_view serial,
+                             const capture_method method,
+                             std::vector<uint8_t>& buffer, std::error_code& ec,
+                             const int64_t timeout);
+
+  private:
+    /// Buffer of the caller that receives the pixels.
+    std::vector<uint8_t>* m_pixels = nullptr;
+
+    /// Header of the image, whose size depends on the service.
+    /**
+     * @note The largest one is the version 2 header of `framebuffer:`.
+     */
+    std::array<char, 56> m_image_header;
+
+    /// Size of the `screencap` header, or 0 if unknown.
+    size_t m_header_size = 0;
+
+    /// Image received so far.
+    image_view m_view;
+
+    /// Conversion of the pixels, if any.
+    bool m_converting = false;
+    pixel_format m_format = pixel_format::unknown;
+    uint32_t m_scale = 1;
+    frame_converter m_converter;
+
+    /// Source pixels before conversion.
+    /**
+     * @note Holds a band of rows, or the whole image if the header size has
+     * to be learned first.
+     */
+    std::vector<uint8_t> m_staging;
+
+    /// Compressor of the device output, detected from its magic.
+    enum class codec { none, gzip, lz4 };
+    bool m_compressed = false;
+    codec m_codec = codec::none;
+    gzip::decoder m_gzip;
+    lz4::frame_decoder m_lz4;
+
+    /// Compressed chunk being received.
+    std::string m_chunk;
+
+    /// Decoded bytes not yet read, from m_pending_pos.
+    std::string m_pending;
+    size_t m_pending_pos = 0;
+
+    /// Whether the device has closed the stream.
+    bool m_eof = false;
+
+    /// Bytes given by the last read().
+    size_t m_read = 0;
+
+    uint64_t m_wire_bytes = 0;
+    uint64_t m_decoded_bytes = 0;
+
+    /// Receive bytes of the image, decompressed if needed.
+    /**
+     * @param data Destination of the bytes.
+     * @param size Number of bytes. Fewer are read at the end of the stream,
+     * see m_read.
+     * @param callback Function called when the bytes are read.
+     */
+    void read(char* data, const size_t size, const callback_t&& callback);
+
+    /// Fill the destination of read() from the decoded bytes.
+    /**
+     * @param data Destination of the bytes.
+     * @param size Number of bytes, of which m_read are already read.
+     * @param callback Function called when the bytes are read.
+     */
+    void read_decoded(char* data, const size_t size,
+                      const callback_t&& callback);
+
+    /// Decompress a chunk received from the device.
+    /**
+     * @return false if the chunk is not valid compressed data.
+     * @param chunk Compressed bytes.
+     * @param sink Function called with the decompressed bytes.
+     */
+    bool decode(const std::string_view chunk,
+                const std::function<void(std::string_view)>& sink);
+
+    /// Receive the raw output of `screencap`.
+    /**
+     * @param callback Function called when the image is received.
+     */
+    void read_screencap(const callback_t&& callback);
+
+    /// Receive the output of the `framebuffer:` service.
+    /**
+     * @param callback Function called when the image is received.
+     */
+    void read_framebuffer(const callback_t&& callback);
+
+    /// Receive the header after the version of `framebuffer:`.
+    /**
+     * @param version Version of the header, which has been received.
+     * @param callback Function called when the image is received.
+     */
+    void read_framebuffer_header(const uint32_t version,
+                                 const callback_t&& callback);
+
+    /// Receive the pixels of m_view, once its shape is known.
+    /**
+     * @param callback Function called when the image is received.
+     */
+    void read_pixels(const callback_t&& callback);
+
+    /// Receive the pixels after a `screencap` header of unknown size.
+    /**
+     * @param callback Function called when the image is received.
+     * @note 16 bytes of header have been received, and the last 4 bytes may
+     * be the first pixel.
+     */
+    void read_pixels_after_header(const callback_t&& callback);
+
+    /// Receive and convert bands of rows.
+    /**
+     * @param rows Rows left to receive.
+     * @param callback Function called when the rows are received.
+     */
+    void read_bands(const size_t rows, const callback_t&& callback);
+
+    /// Prepare the conversion of m_view.
+    /**
+     * @return false if the conversion is not supported.
+     */
+    bool start_conversion();
+
+    /// Make sure a buffer can hold the given size.
+    /**
+     * @return Pointer to the start of the buffer.
+     * @note The buffer is only grown, so its allocation is reused.
+     */
+    static char* reserve(std::vector<uint8_t>& buffer, const size_t size);
+};
+
+} // namespace adb
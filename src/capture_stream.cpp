@@ -0,0 +1,184 @@
+#include <algorithm>
+
+#include <asio/post.hpp>
+
+#include "capture_stream_impl.hpp"
+
+namespace adb {
+
+capture_stream_impl::capture_stream_impl(
+    asio::io_context& context, const asio::ip::tcp::endpoint& endpoint,
+    const std::string_view serial, const pixel_format format,
+    const uint32_t scale, const capture_method method,
+    const size_t header_size)
+    : m_context(context), m_endpoint(endpoint), m_serial(serial),
+      m_format(format), m_scale(scale), m_method(method),
+      m_header_size(header_size), m_timeout(context), m_pace(context) {
+    protocol::track(context, this,
+                    [this](const std::error_code& reason) { abort(reason); });
+}
+
+capture_stream_impl::~capture_stream_impl() { protocol::untrack(this); }
+
+void capture_stream_impl::start() {
+    asio::post(m_context, [self = shared_from_this()] {
+        if (!self->m_running) {
+            self->capture();
+        }
+    });
+}
+
+captured_frame capture_stream_impl::latest() {
+    // Take the middle buffer only if the capture has published into it.
+    if (m_shared.load(std::memory_order_acquire) & fresh) {
+        const auto shared =
+            m_shared.exchange(m_front, std::memory_order_acq_rel);
+        m_front = static_cast<uint8_t>(shared & ~fresh);
+    }
+
+    return m_slots[m_front].frame;
+}
+
+void capture_stream_impl::set_frame_rate(const double frame_rate) {
+    using namespace std::chrono;
+    const auto frame_time =
+        frame_rate > 0
+            ? duration_cast<nanoseconds>(duration<double>(1) / frame_rate)
+            : nanoseconds(0);
+    m_frame_time = frame_time.count();
+
+    // Wake up a pending wait, so the new pace applies to it.
+    asio::post(m_context, [self = shared_from_this()] {
+        if (!self->m_handle) {
+            self->m_pace.cancel();
+        }
+    });
+}
+
+void capture_stream_impl::pause() { m_paused = true; }
+
+void capture_stream_impl::resume() {
+    m_paused = false;
+    start();
+}
+
+std::error_code capture_stream_impl::error() const {
+    std::lock_guard lock(m_error_mutex);
+    return m_error;
+}
+
+void capture_stream_impl::close() {
+    m_closed = true;
+
+    asio::post(m_context, [self = shared_from_this()] {
+        self->m_pace.cancel();
+        if (self->m_handle) {
+            self->m_handle->cancel();
+        }
+    });
+}
+
+void capture_stream_impl::capture() {
+    if (m_closed || m_paused) {
+        m_running = false;
+        return;
+    }
+
+    m_running = true;
+    m_start = clock::now();
+
+    m_handle = std::make_unique<capture_handle>(m_context, m_endpoint);
+    m_handle->set_conversion(m_format, m_scale);
+    m_handle->set_screencap_header(m_header_size);
+
+    const auto attempt = ++m_attempt;
+    m_timeout.expires_after(capture_timeout);
+    m_timeout.async_wait([self = shared_from_this(), attempt](const auto& ec) {
+        if (!ec && attempt == self->m_attempt && self->m_handle) {
+            self->m_handle->cancel();
+        }
+    });
+
+    auto& pixels = m_slots[m_back].pixels;
+    m_handle->capture(m_serial, m_method, pixels, [self = shared_from_this()] {
+        // The handle is still in its own handler, so release it afterwards.
+        asio::post(self->m_context, [self] { self->complete(); });
+    });
+}
+
+void capture_stream_impl::complete() {
+    m_timeout.cancel();
+
+    const auto image = m_handle->image();
+    auto ec = m_handle->error();
+    m_header_size = m_handle->screencap_header();
+    m_handle.reset();
+
+    // Only the timeout cancels a capture that is not closed, unless the
+    // device went away. A capture finished before the abort is kept.
+    if (ec == asio::error::operation_aborted) {
+        ec = asio::error::timed_out;
+    }
+    if (ec && m_aborted) {
+        ec = m_aborted;
+    }
+    m_aborted.clear();
+
+    {
+        std::lock_guard lock(m_error_mutex);
+        m_error = ec;
+    }
+    m_failed = static_cast<bool>(ec);
+
+    if (!m_failed) {
+        auto& frame = m_slots[m_back].frame;
+        frame.image = image;
+        frame.sequence = ++m_sequence;
+        frame.timestamp = m_start;
+        frame.latency = clock::now() - m_start;
+
+        // Publish the frame, and take the buffer the consumer left behind.
+        const auto back = static_cast<uint8_t>(m_back | fresh);
+        const auto shared = m_shared.exchange(back, std::memory_order_acq_rel);
+        m_back = static_cast<uint8_t>(shared & ~fresh);
+    }
+
+    schedule();
+}
+
+void capture_stream_impl::schedule() {
+    if (m_closed) {
+        m_running = false;
+        return;
+    }
+
+    const auto frame_time = clock::duration(
+        std::chrono::nanoseconds(m_frame_time.load()));
+    const auto next =
+        m_start + (m_failed ? std::max<clock::duration>(frame_time, retry_delay)
+                            : frame_time);
+
+    if (next <= clock::now()) {
+        capture();
+        return;
+    }
+
+    m_pace.expires_at(next);
+    m_pace.async_wait([self = shared_from_this()](const auto& ec) {
+        // A cancelled wait is armed again, as the frame rate has changed.
+        if (ec) {
+            self->schedule();
+            return;
+        }
+        self->capture();
+    });
+}
+
+void capture_stream_impl::abort(const std::error_code& reason) {
+    if (m_handle) {
+        m_aborted = reason;
+        m_handle->cancel();
+    }
+}
+
+} // namespace adb
@@ -0,0 +1,151 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <memory>
+#include <mutex>
+
+#include <asio/steady_timer.hpp>
+
+#include "capture_impl.hpp"
+#include "capture_stream.hpp"
+
+namespace adb {
+
+/// Pimpl class for capture_stream.
+class capture_stream_impl
+    : public capture_stream,
+      public std::enable_shared_from_this<capture_stream_impl> {
+  public:
+    typedef std::shared_ptr<capture_stream_impl> pointer;
+
+    /// Construct a capture_stream_impl.
+    /**
+     * @param context io_context of the client.
+     * @param endpoint Endpoint of the adb server.
+     * @param serial Serial of the device.
+     * @param format Format to convert to.
+     * @param scale Factor to divide the width and the height by.
+     * @param method Service used to capture the screen.
+     * @param header_size Size of the `screencap` header, or 0 if unknown.
+     */
+    capture_stream_impl(asio::io_context& context,
+                        const asio::ip::tcp::endpoint& endpoint,
+                        const std::string_view serial,
+                        const pixel_format format, const uint32_t scale,
+                        const capture_method method, const size_t header_size);
+    ~capture_stream_impl();
+
+    /// Start capturing.
+    void start();
+
+    captured_frame latest() override;
+    void set_frame_rate(const double frame_rate) override;
+    void pause() override;
+    void resume() override;
+    bool paused() const override { return m_paused; }
+    std::error_code error() const override;
+    void close() override;
+
+  private:
+    typedef std::chrono::steady_clock clock;
+
+    /// Timeout of one capture, after which it is retried.
+    static constexpr auto capture_timeout = std::chrono::seconds(10);
+
+    /// Delay before retrying a failed capture.
+    static constexpr auto retry_delay = std::chrono::milliseconds(200);
+
+    /// Bit of m_shared set when the middle buffer holds an unread frame.
+    static constexpr uint8_t fresh = 4;
+
+    /// One of the three buffers.
+    struct slot {
+        std::vector<uint8_t> pixels;
+        captured_frame frame;
+    };
+
+    asio::io_context& m_context;
+    const asio::ip::tcp::endpoint m_endpoint;
+    const std::string m_serial;
+
+    const pixel_format m_format;
+    const uint32_t m_scale;
+    const capture_method m_method;
+    size_t m_header_size;
+
+    std::array<slot, 3> m_slots;
+
+    /// Buffer being written by the capture, owned by the event loop.
+    uint8_t m_back = 0;
+
+    /// Buffer between the capture and the consumer, with the fresh bit.
+    std::atomic<uint8_t> m_shared = 1;
+
+    /// Buffer returned by latest(), owned by the consumer.
+    uint8_t m_front = 2;
+
+    /// Frames published so far.
+    uint64_t m_sequence = 0;
+
+    /// Target duration of a frame, in nanoseconds. 0 for back to back.
+    std::atomic<int64_t> m_frame_time = 0;
+
+    std::atomic<bool> m_paused = false;
+    std::atomic<bool> m_closed = false;
+
+    /// Whether a capture or a wait is pending, only used on the event loop.
+    bool m_running = false;
+
+    /// Capture in progress, if any.
+    std::unique_ptr<capture_handle> m_handle;
+
+    /// Number of the capture in progress, to ignore stale timeouts.
+    uint64_t m_attempt = 0;
+
+    /// Start time of the capture in progress, or of the last one.
+    clock::time_point m_start;
+
+    /// Whether the last capture has failed.
+    bool m_failed = false;
+
+    /// Reason given by abort_all(), which wins over the error of the capture
+    /// it cancelled.
+    std::error_code m_aborted;
+
+    /// Timer of the timeout of a capture.
+    asio::steady_timer m_timeout;
+
+    /// Timer of the pace between captures.
+    asio::steady_timer m_pace;
+
+    mutable std::mutex m_error_mutex;
+    std::error_code m_error;
+
+    /// Start the next capture, unless paused or closed.
+    /**
+     * @note Called on the event loop.
+     */
+    void capture();
+
+    /// Publish the finished capture and schedule the next one.
+    /**
+     * @note Called on the event loop.
+     */
+    void complete();
+
+    /// Start the next capture at the target pace.
+    /**
+     * @note Called on the event loop.
+     */
+    void schedule();
+
+    /// Fail the capture in progress as the device went away, from
+    /// abort_all(). The next ones are still tried at the retry pace.
+    /**
+     * @param reason Error the capture fails with.
+     */
+    void abort(const std::error_code& reason);
+};
+
+} // namespace adb
@@ -1,140 +1,1188 @@
-#include <regex>
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <map>
+#include <sstream>
 
+#include "capture_impl.hpp"
+#include "capture_stream_impl.hpp"
 #include "client_impl.hpp"
+#include "input_injector_impl.hpp"
 #include "io_handle_impl.hpp"
+#include "logcat_stream_impl.hpp"
+#include "receive_channel_impl.hpp"
+#include "remote_index_impl.hpp"
+#include "screen_record_impl.hpp"
+#include "tunnel_impl.hpp"
+#include "shell_session_impl.hpp"
+#include "singleflight.hpp"
 
 namespace adb {
 
+/// Coalescing of the requests of the process.
+static singleflight coalescer;
+
+/// Whether version() and devices() are coalesced.
+static std::atomic<bool> host_coalescing = false;
+
+/// Request a host service of a server, coalesced if enabled.
+static std::string host_query(const asio::ip::tcp::endpoint& endpoint,
+                              const std::string_view request,
+                              std::error_code& ec, const int64_t timeout) {
+    const auto call = [&](std::error_code& ec) {
+        standalone_handle handle(endpoint);
+        return handle.timed_host_request(request, true, ec, timeout);
+    };
+
+    if (!host_coalescing) {
+        return call(ec);
+    }
+
+    // Keys of the devices are made by device_key().
+    std::ostringstream key;
+    key << endpoint << "\n" << request;
+    return coalescer.run(key.str(), call, ec, timeout);
+}
+
 std::string version(std::error_code& ec, const int64_t timeout) {
-    standalone_handle handle;
-    const auto request = "host:version";
-    return handle.timed_host_request(request, true, ec, timeout);
+    const auto& endpoint = protocol::default_endpoint();
+    return host_query(endpoint, "host:version", ec, timeout);
 }
 
 std::string devices(std::error_code& ec, const int64_t timeout) {
-    standalone_handle handle;
-    const auto request = "host:devices";
-    return handle.timed_host_request(request, true, ec, timeout);
+    const auto& endpoint = protocol::default_endpoint();
+    return host_query(endpoint, "host:devices", ec, timeout);
+}
+
+std::string version(const std::string_view server, std::error_code& ec,
+                    const int64_t timeout) {
+    const auto endpoint = protocol::parse_endpoint(server, ec);
+    if (ec) {
+        return "";
+    }
+    return host_query(endpoint, "host:version", ec, timeout);
+}
+
+std::string devices(const std::string_view server, std::error_code& ec,
+                    const int64_t timeout) {
+    const auto endpoint = protocol::parse_endpoint(server, ec);
+    if (ec) {
+        return "";
+    }
+    return host_query(endpoint, "host:devices", ec, timeout);
 }
 
+void set_coalescing(const bool enabled) { host_coalescing = enabled; }
+
+coalescing_stats coalescing_counters() { return coalescer.stats(); }
+
 void kill_server(std::error_code& ec, const int64_t timeout) {
     standalone_handle handle;
     const auto request = "host:kill";
     handle.timed_host_request(request, false, ec, timeout);
 }
 
+void kill_server(const std::string_view server, std::error_code& ec,
+                 const int64_t timeout) {
+    const auto endpoint = protocol::parse_endpoint(server, ec);
+    if (ec) {
+        return;
+    }
+
+    standalone_handle handle(endpoint);
+    const auto request = "host:kill";
+    handle.timed_host_request(request, false, ec, timeout);
+}
+
 std::shared_ptr<client> client::create(const std::string_view serial) {
     return std::make_shared<client_impl>(serial);
 }
 
+std::shared_ptr<client> client::create(const std::string_view serial,
+                                       const std::string_view server) {
+    std::error_code ec;
+    const auto endpoint = protocol::parse_endpoint(server, ec);
+    if (ec) {
+        throw std::system_error(ec, "invalid adb server address");
+    }
+    return std::make_shared<client_impl>(serial, endpoint);
+}
+
 using asio::ip::tcp;
 
-client_impl::client_impl(const std::string_view serial)
-    : m_serial(serial), m_acceptor(m_context, tcp::endpoint(tcp::v4(), 0)) {}
+std::shared_ptr<client> client::create_direct(const std::string_view address,
+                                              adbd_auth auth) {
+    return std::make_shared<client_impl>(address, std::move(auth));
+}
+
+/// Key of a device of an adb server, as the same serial may be on another
+/// server, e.g. an emulator.
+static std::string device_key(const asio::ip::tcp::endpoint& endpoint,
+                              const std::string_view serial) {
+    std::ostringstream key;
+    key << endpoint << "\n" << serial;
+    return key.str();
+}
+
+client_impl::client_impl(const std::string_view serial,
+                         const asio::ip::tcp::endpoint& endpoint)
+    : m_serial(serial), m_device(device_key(endpoint, serial)),
+      m_scheduler(traffic_scheduler::of(m_device)), m_endpoint(endpoint) {}
+
+client_impl::client_impl(const std::string_view address, adbd_auth auth)
+    : m_serial(address), m_device(address),
+      m_scheduler(traffic_scheduler::of(m_device)),
+      m_bridge(adbd_bridge::create(m_context, address, std::move(auth))),
+      m_endpoint(m_bridge->endpoint()) {}
+
+client_impl::~client_impl() {
+    if (m_watch) {
+        m_watch->close();
+    }
+    if (m_bridge) {
+        m_bridge->close();
+    }
+    stop();
+}
 
 std::string client_impl::connect(std::error_code& ec, const int64_t timeout) {
-    client_handle handle(m_context);
+    reset_features();
+    client_handle handle(m_context, m_endpoint);
     const auto request = "host:connect:" + m_serial;
-    return handle.timed_host_request(request, true, ec, timeout);
+    const auto result = handle.timed_host_request(request, true, ec, timeout);
+    m_cache.invalidate();
+    return result;
 }
 
 std::string client_impl::disconnect(std::error_code& ec,
                                     const int64_t timeout) {
-    client_handle handle(m_context);
+    reset_features();
+    client_handle handle(m_context, m_endpoint);
     const auto request = "host:disconnect:" + m_serial;
-    return handle.timed_host_request(request, true, ec, timeout);
+    const auto result = handle.timed_host_request(request, true, ec, timeout);
+    m_cache.invalidate();
+    return result;
+}
+
+void client_impl::set_coalescing(const bool enabled) {
+    m_coalescing = enabled;
+}
+
+void client_impl::cache_command(const std::string_view command,
+                                const std::chrono::milliseconds ttl) {
+    m_cache.enroll(command, ttl);
+    if (ttl.count() <= 0 || m_bridge) {
+        return;
+    }
+
+    watch_device();
+}
+
+void client_impl::set_cache_limit(const size_t bytes) { m_cache.limit(bytes); }
+
+void client_impl::invalidate_cache() { m_cache.invalidate(); }
+
+cache_stats client_impl::cache_counters() { return m_cache.stats(); }
+
+void client_impl::monitor_liveness(const bool enabled) {
+    m_liveness = enabled;
+    if (enabled) {
+        watch_device();
+    }
+}
+
+void client_impl::watch_device() {
+    // A device behind the bridge is only reconnected by the client itself.
+    if (m_bridge) {
+        return;
+    }
+
+    std::call_once(m_watch_once, [this] {
+        m_watch = std::make_shared<attach_watch>(
+            m_context, m_endpoint, m_serial,
+            [this](const std::string& state) { on_device_state(state); });
+        m_watch->start();
+    });
+}
+
+void client_impl::on_device_state(const std::string& state) {
+    m_cache.invalidate();
+
+    // Nothing in progress can complete without the device.
+    if (m_liveness && state != "device") {
+        protocol::abort_all(m_context, asio::error::connection_aborted);
+    }
 }
 
 std::string client_impl::shell(const std::string_view command,
                                std::error_code& ec, const int64_t timeout,
                                const bool recv_by_socket) {
-    client_handle handle(m_context);
+    std::string result;
+    uint64_t generation = 0;
+    if (m_cache.lookup(command, result, generation)) {
+        ec.clear();
+        return result;
+    }
 
-    if (recv_by_socket) {
-        const auto request = std::string("shell:") + nc_command(command);
-        return handle.timed_device_request(m_serial, request, m_context,
-                                           m_acceptor, ec, timeout);
-    } else {
-        const auto request = std::string("shell:") + command.data();
-        return handle.timed_device_request(m_serial, request, ec, timeout);
+    const auto request = "shell:" + std::string(command);
+    result = coalesce(request, recv_by_socket, ec, timeout,
+                      [&](std::error_code& ec) {
+        const auto ticket =
+            m_scheduler->admit(traffic_class::interactive, timeout, ec);
+        if (!ticket) {
+            return std::string();
+        }
+
+        if (recv_by_socket) {
+            return socket_request("shell:", command, ec,
+                                  ticket.remaining(timeout));
+        }
+
+        client_handle handle(m_context, m_endpoint);
+        return handle.timed_device_request(m_serial, request, ec,
+                                           ticket.remaining(timeout));
+    });
+
+    if (!ec) {
+        m_cache.store(command, result, generation);
     }
+    return result;
 }
 
 std::string client_impl::exec(const std::string_view command,
                               std::error_code& ec, const int64_t timeout,
                               const bool recv_by_socket) {
-    client_handle handle(m_context);
+    const auto request = "exec:" + std::string(command);
+    return coalesce(request, recv_by_socket, ec, timeout,
+                    [&](std::error_code& ec) {
+        const auto ticket =
+            m_scheduler->admit(traffic_class::bulk, timeout, ec);
+        if (!ticket) {
+            return std::string();
+        }
+
+        if (recv_by_socket) {
+            return socket_request("exec:", command, ec,
+                                  ticket.remaining(timeout));
+        }
+
+        client_handle handle(m_context, m_endpoint);
+        handle.set_pacer(pacer());
+        return handle.timed_device_request(m_serial, request, ec,
+                                           ticket.remaining(timeout));
+    });
+}
+
+std::string client_impl::coalesce(const std::string_view request,
+                                  const bool recv_by_socket,
+                                  std::error_code& ec, const int64_t timeout,
+                                  const singleflight::call_t& call) {
+    if (!m_coalescing) {
+        return call(ec);
+    }
+
+    const auto mode = recv_by_socket ? "\nsocket\n" : "\n";
+    const auto key = m_device + mode + std::string(request);
+    return coalescer.run(key, call, ec, timeout);
+}
+
+image_view client_impl::screencap(std::vector<uint8_t>& buffer,
+                                  std::error_code& ec, const int64_t timeout,
+                                  const capture_method method) {
+    return screencap(buffer, pixel_format::unknown, 1, ec, timeout, method);
+}
+
+image_view client_impl::screencap(std::vector<uint8_t>& buffer,
+                                  const pixel_format format,
+                                  const uint32_t scale, std::error_code& ec,
+                                  const int64_t timeout,
+                                  const capture_method method) {
+    capture_stats stats;
+    return screencap(buffer, format, scale, ec, timeout, method, stats);
+}
+
+image_view client_impl::screencap(std::vector<uint8_t>& buffer,
+                                  const pixel_format format,
+                                  const uint32_t scale, std::error_code& ec,
+                                  const int64_t timeout,
+                                  const capture_method method,
+                                  capture_stats& stats) {
+    const auto start = std::chrono::steady_clock::now();
+
+    const auto ticket = m_scheduler->admit(traffic_class::bulk, timeout, ec);
+    if (!ticket) {
+        return {};
+    }
+
+    capture_handle handle(m_context, m_endpoint);
+    handle.set_conversion(format, scale);
+    handle.set_screencap_header(m_screencap_header);
+    handle.set_pacer(pacer());
+
+    const auto image = handle.timed_capture(m_serial, method, buffer, ec,
+                                            ticket.remaining(timeout));
+    m_screencap_header = handle.screencap_header();
+
+    using namespace std::chrono;
+    stats = handle.stats();
+    stats.elapsed = duration<double>(steady_clock::now() - start).count();
+    return image;
+}
+
+/// Screenshot choices by device key, shared by the clients of the process.
+static std::mutex screenshot_choices_mutex;
+static std::map<std::string, screenshot_choice> screenshot_choices;
 
-    if (recv_by_socket) {
-        const auto request = std::string("exec:") + nc_command(command);
-        return handle.timed_device_request(m_serial, request, m_context,
-                                           m_acceptor, ec, timeout);
+/// Get the dimensions of a PNG image from its IHDR chunk.
+static bool png_size(const std::string_view png, uint32_t& width,
+                     uint32_t& height) {
+    static constexpr std::string_view signature = "\x89PNG\r\n\x1a\n";
+    if (png.size() < 24 || !png.starts_with(signature) ||
+        png.substr(12, 4) != "IHDR") {
+        return false;
+    }
+
+    const auto field = [&png](const size_t pos) {
+        uint32_t value = 0;
+        for (size_t i = 0; i < 4; i++) {
+            value = (value << 8) | static_cast<uint8_t>(png[pos + i]);
+        }
+        return value;
+    };
+
+    width = field(16);
+    height = field(20);
+    return width != 0 && height != 0;
+}
+
+/// Get the dimensions of the raw output of `screencap`.
+/**
+ * @note The header may be 12 or 16 bytes, told apart by the size.
+ */
+static bool raw_size(const std::string_view raw, uint32_t& width,
+                     uint32_t& height) {
+    if (raw.size() < 12) {
+        return false;
+    }
+
+    const auto field = [&raw](const size_t pos) {
+        uint32_t value = 0;
+        for (int i = 3; i >= 0; i--) {
+            value = (value << 8) | static_cast<uint8_t>(raw[pos + i]);
+        }
+        return value;
+    };
+
+    width = field(0);
+    height = field(4);
+    const auto format = static_cast<pixel_format>(field(8));
+    const auto size = size_t(width) * height * bytes_per_pixel(format);
+    if (size == 0 || raw.size() < size) {
+        return false;
+    }
+
+    const auto header = raw.size() - size;
+    return header == 12 || header == 16;
+}
+
+std::string client_impl::connection_type(const int64_t timeout) {
+    if (m_bridge) {
+        return "direct";
+    }
+
+    std::error_code ec;
+    client_handle handle(m_context, m_endpoint);
+    const auto request = "host-serial:" + m_serial + ":get-devpath";
+    const auto devpath = handle.timed_host_request(request, true, ec, timeout);
+    if (!ec && !devpath.empty() && devpath != "unknown") {
+        return devpath;
+    }
+
+    // Network transports have no device path.
+    if (m_serial.find(':') != std::string::npos ||
+        m_serial.ends_with("._tcp")) {
+        return "tcp";
+    }
+    return "unknown";
+}
+
+void client_impl::benchmark_screenshot(const screenshot_method method,
+                                       const std::string_view socket_host,
+                                       std::vector<uint8_t>& buffer,
+                                       screenshot_benchmark& result,
+                                       double& latency,
+                                       const int64_t timeout) {
+    const auto start = std::chrono::steady_clock::now();
+
+    std::error_code ec;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint64_t wire_bytes = 0;
+
+    if (method == screenshot_method::png) {
+        const auto png = exec("screencap -p", ec, timeout, false);
+        wire_bytes = png.size();
+        if (!ec && !png_size(png, width, height)) {
+            ec = asio::error::invalid_argument;
+        }
+    } else if (method == screenshot_method::raw_socket) {
+        // The port is replaced by the one of the channel.
+        const auto command =
+            "screencap | nc -w 3 " + std::string(socket_host) + " 0";
+        const auto raw = exec(command, ec, timeout, true);
+        wire_bytes = raw.size();
+        if (!ec && !raw_size(raw, width, height)) {
+            ec = asio::error::invalid_argument;
+        }
     } else {
-        const auto request = std::string("exec:") + command.data();
-        return handle.timed_device_request(m_serial, request, ec, timeout);
+        auto capture = capture_method::screencap;
+        if (method == screenshot_method::compressed) {
+            capture = capture_method::compressed;
+        } else if (method == screenshot_method::framebuffer) {
+            capture = capture_method::framebuffer;
+        }
+
+        capture_stats stats;
+        const auto image = screencap(buffer, pixel_format::unknown, 1, ec,
+                                     timeout, capture, stats);
+        width = image.width;
+        height = image.height;
+        wire_bytes = stats.wire_bytes;
+    }
+
+    using namespace std::chrono;
+    const auto elapsed = steady_clock::now() - start;
+    latency = duration<double, std::milli>(elapsed).count();
+
+    if (ec) {
+        result.error = ec;
+        result.consistent = false;
+        return;
+    }
+
+    if (result.width == 0) {
+        result.width = width;
+        result.height = height;
+        result.consistent = true;
+    } else if (result.width != width || result.height != height) {
+        result.consistent = false;
     }
+    result.wire_bytes = wire_bytes;
+}
+
+screenshot_choice
+client_impl::select_screenshot(std::error_code& ec, const int64_t timeout,
+                               const std::string_view socket_host,
+                               const int rounds,
+                               const std::chrono::seconds ttl) {
+    using namespace std::chrono;
+    ec.clear();
+
+    const auto connection = connection_type(timeout);
+    {
+        std::lock_guard lock(screenshot_choices_mutex);
+        const auto it = screenshot_choices.find(m_device);
+        if (it != screenshot_choices.end() &&
+            it->second.connection == connection &&
+            steady_clock::now() - it->second.measured < ttl) {
+            return it->second;
+        }
+    }
+
+    static constexpr screenshot_method methods[] = {
+        screenshot_method::png, screenshot_method::raw,
+        screenshot_method::raw_socket, screenshot_method::compressed,
+        screenshot_method::framebuffer};
+
+    screenshot_choice choice;
+    choice.connection = connection;
+
+    std::vector<uint8_t> buffer;
+    for (const auto method : methods) {
+        screenshot_benchmark result;
+        result.method = method;
+
+        if (method == screenshot_method::raw_socket && socket_host.empty()) {
+            result.error = asio::error::operation_not_supported;
+            choice.benchmarks.push_back(result);
+            continue;
+        }
+
+        // A method that fails once is not measured further.
+        std::vector<double> latencies;
+        for (int i = 0; i < std::max(rounds, 1) && !result.error; i++) {
+            double latency = 0;
+            benchmark_screenshot(method, socket_host, buffer, result, latency,
+                                 timeout);
+            latencies.push_back(latency);
+        }
+
+        const auto middle = latencies.begin() + latencies.size() / 2;
+        std::nth_element(latencies.begin(), middle, latencies.end());
+        result.latency = *middle;
+        choice.benchmarks.push_back(result);
+    }
+
+    // The dimensions given by most methods are the right ones.
+    std::map<std::pair<uint32_t, uint32_t>, int> votes;
+    for (const auto& result : choice.benchmarks) {
+        if (result.consistent) {
+            votes[{result.width, result.height}]++;
+        }
+    }
+
+    // Raw screencap works on every device, so its error tells the most.
+    if (votes.empty()) {
+        const auto raw = std::find_if(
+            choice.benchmarks.begin(), choice.benchmarks.end(),
+            [](const auto& result) {
+                return result.method == screenshot_method::raw;
+            });
+        ec = raw != choice.benchmarks.end() ? raw->error : std::error_code();
+        if (!ec) {
+            ec = asio::error::invalid_argument;
+        }
+        return choice;
+    }
+
+    const auto agreed =
+        std::max_element(votes.begin(), votes.end(), [](auto& a, auto& b) {
+            return a.second < b.second;
+        })->first;
+
+    const screenshot_benchmark* best = nullptr;
+    for (auto& result : choice.benchmarks) {
+        result.consistent = result.consistent &&
+                            result.width == agreed.first &&
+                            result.height == agreed.second;
+        if (result.consistent && (!best || result.latency < best->latency)) {
+            best = &result;
+        }
+    }
+
+    choice.method = best->method;
+    choice.measured = steady_clock::now();
+
+    std::lock_guard lock(screenshot_choices_mutex);
+    screenshot_choices[m_device] = choice;
+    return choice;
+}
+
+frame_changes client_impl::diff_frame(const image_view& frame) {
+    std::lock_guard lock(m_frame_diff_mutex);
+    if (!m_frame_diff) {
+        m_frame_diff = frame_diff::create();
+    }
+    return m_frame_diff->update(frame);
+}
+
+std::shared_ptr<capture_stream>
+client_impl::open_capture_stream(const pixel_format format,
+                                 const uint32_t scale, const double frame_rate,
+                                 const capture_method method) {
+    auto impl = std::make_shared<capture_stream_impl>(
+        m_context, m_endpoint, m_serial, format, scale, method,
+        m_screencap_header);
+    impl->set_frame_rate(frame_rate);
+    impl->start();
+
+    // Pending captures keep the stream alive, so close it with the handle.
+    return std::shared_ptr<capture_stream>(
+        impl.get(), [impl](capture_stream*) { impl->close(); });
+}
+
+std::shared_ptr<logcat_stream>
+client_impl::open_logcat(logcat_stream::handler_t handler,
+                         const log_filter& filter, const size_t retention) {
+    auto impl = std::make_shared<logcat_stream_impl>(
+        m_context, m_endpoint, m_serial, std::move(handler), filter, retention);
+    impl->start();
+
+    // Pending reads keep the stream alive, so close it with the handle.
+    return std::shared_ptr<logcat_stream>(
+        impl.get(), [impl](logcat_stream*) { impl->close(); });
+}
+
+std::shared_ptr<screen_record>
+client_impl::open_screen_record(const uint32_t bit_rate, const uint32_t width,
+                                const uint32_t height, const size_t capacity) {
+    auto command = std::string("exec:screenrecord --output-format=h264");
+    if (bit_rate != 0) {
+        command += " --bit-rate " + std::to_string(bit_rate);
+    }
+    if (width != 0 && height != 0) {
+        command += " --size " + std::to_string(width) + "x" +
+                   std::to_string(height);
+    }
+    command += " -";
+
+    auto impl = std::make_shared<screen_record_impl>(m_context, m_endpoint,
+                                                     m_serial, command,
+                                                     capacity);
+    impl->start();
+
+    // Pending reads keep the stream alive, so close it with the handle.
+    return std::shared_ptr<screen_record>(
+        impl.get(), [impl](screen_record*) { impl->close(); });
+}
+
+/// Flags of the sync v2 setup messages.
+namespace sync_flag {
+static constexpr uint32_t none = 0;
+static constexpr uint32_t lz4 = 2;
+} // namespace sync_flag
+
+/// Current time for the DONE sync request.
+static uint32_t now_ts() {
+    using namespace std::chrono;
+    const auto now = system_clock::now().time_since_epoch();
+    const auto ts = duration_cast<seconds>(now).count();
+    return static_cast<uint32_t>(ts);
+}
+
+/// Fill in the sizes and the rates of a finished transfer.
+static void finish_stats(sync_stats& stats, const uint64_t file_bytes,
+                         const uint64_t wire_bytes,
+                         const std::chrono::steady_clock::time_point start) {
+    using namespace std::chrono;
+    const auto elapsed = steady_clock::now() - start;
+
+    stats.file_bytes = file_bytes;
+    stats.wire_bytes = wire_bytes;
+    stats.elapsed = duration<double>(elapsed).count();
+    stats.compression_ratio =
+        wire_bytes == 0 ? 1 : static_cast<double>(file_bytes) / wire_bytes;
+    stats.throughput = stats.elapsed > 0 ? file_bytes / stats.elapsed : 0;
+}
+
+void client_impl::configure_scheduler(const scheduler_config& config) {
+    m_scheduler->configure(config);
+}
+
+scheduler_stats client_impl::traffic_stats() { return m_scheduler->stats(); }
+
+protocol::async_handle::pacer_t client_impl::pacer() const {
+    return [scheduler = m_scheduler](const size_t size) {
+        return scheduler->pace(size);
+    };
 }
 
 bool client_impl::push(const std::filesystem::path& src, const std::string& dst,
                        int perm, std::error_code& ec, const int64_t timeout) {
-    client_handle handle(m_context);
+    sync_stats stats;
+    return push(src, dst, perm, ec, timeout, stats);
+}
 
-    static constexpr auto now_ts = [] {
-        using namespace std::chrono;
-        const auto now = system_clock::now().time_since_epoch();
-        const auto ts = duration_cast<seconds>(now).count();
-        return static_cast<uint32_t>(ts);
-    };
+bool client_impl::push(const std::filesystem::path& src, const std::string& dst,
+                       int perm, std::error_code& ec, const int64_t timeout,
+                       sync_stats& stats) {
+    const auto start = std::chrono::steady_clock::now();
+
+    const auto ticket = m_scheduler->admit(traffic_class::bulk, timeout, ec);
+    if (!ticket) {
+        return false;
+    }
+
+    const auto left = ticket.remaining(timeout);
+    negotiate_sync(stats, left);
+
+    client_handle handle(m_context, m_endpoint);
+    handle.set_pacer(pacer());
 
     const auto send_req = dst + "," + std::to_string(perm);
     const auto req_size = static_cast<uint32_t>(send_req.size());
+    const auto flags = stats.compressed ? sync_flag::lz4 : sync_flag::none;
+    const auto mode = static_cast<uint32_t>(perm);
 
     handle.connect_device(m_serial, [&] {
         // Switch to sync mode
         const auto request = "sync:";
         handle.host_request(request, [&] {
-            // SEND request: destination, permissions
-            handle.sync_request("SEND", req_size, send_req.data(), [&] {
-                handle.sync_send_file(src, [&] {
+            const auto send_file = [&] {
+                handle.sync_send_file(src, stats.compressed, [&] {
                     // DONE request: timestamp
                     handle.sync_request("DONE", now_ts(), nullptr, [&] {
                         handle.sync_response([&] { handle.finish(); });
                     });
                 });
-            });
+            };
+
+            if (stats.version == 2) {
+                // SND2 request: destination, then mode and flags
+                handle.sync_request_v2("SND2", dst, {mode, flags}, send_file);
+            } else {
+                // SEND request: destination, permissions
+                handle.sync_request("SEND", req_size, send_req.data(),
+                                    send_file);
+            }
         });
     });
 
-    handle.run(timeout);
+    handle.run(left);
 
     ec = handle.error();
+    std::error_code size_ec;
+    const auto size = std::filesystem::file_size(src, size_ec);
+    finish_stats(stats, size_ec ? 0 : size, handle.sync_transferred(), start);
     return handle.value() == "OKAY";
 }
 
+bool client_impl::pull(const std::string& src, const std::filesystem::path& dst,
+                       std::error_code& ec, const int64_t timeout) {
+    sync_stats stats;
+    return pull(src, dst, ec, timeout, stats);
+}
+
+bool client_impl::pull(const std::string& src, const std::filesystem::path& dst,
+                       std::error_code& ec, const int64_t timeout,
+                       sync_stats& stats) {
+    const auto start = std::chrono::steady_clock::now();
+
+    const auto ticket = m_scheduler->admit(traffic_class::bulk, timeout, ec);
+    if (!ticket) {
+        return false;
+    }
+
+    const auto left = ticket.remaining(timeout);
+    negotiate_sync(stats, left);
+
+    client_handle handle(m_context, m_endpoint);
+    handle.set_pacer(pacer());
+
+    const auto req_size = static_cast<uint32_t>(src.size());
+    const auto flags = stats.compressed ? sync_flag::lz4 : sync_flag::none;
+
+    handle.connect_device(m_serial, [&] {
+        // Switch to sync mode
+        const auto request = "sync:";
+        handle.host_request(request, [&] {
+            const auto recv_file = [&] {
+                handle.sync_recv_file(dst, stats.compressed,
+                                      [&] { handle.finish(); });
+            };
+
+            if (stats.version == 2) {
+                // RCV2 request: source, then flags
+                handle.sync_request_v2("RCV2", src, {flags}, recv_file);
+            } else {
+                // RECV request: source
+                handle.sync_request("RECV", req_size, src.data(), recv_file);
+            }
+        });
+    });
+
+    handle.run(left);
+
+    ec = handle.error();
+    std::error_code size_ec;
+    if (ec) {
+        // Do not leave a partial file behind.
+        std::filesystem::remove(dst, size_ec);
+    }
+
+    const auto size = std::filesystem::file_size(dst, size_ec);
+    finish_stats(stats, size_ec ? 0 : size, handle.sync_transferred(), start);
+    return !ec;
+}
+
+std::shared_ptr<remote_index> client_impl::walk(const std::string& root,
+                                                std::error_code& ec,
+                                                const int64_t timeout,
+                                                const size_t connections) {
+    const auto ticket = m_scheduler->admit(traffic_class::bulk, timeout, ec);
+    if (!ticket) {
+        return nullptr;
+    }
+
+    const auto left = ticket.remaining(timeout);
+    std::error_code features_ec;
+    const auto supported = features(features_ec, left);
+    const auto v2 = std::find(supported.begin(), supported.end(), "ls_v2") !=
+                    supported.end();
+
+    const auto walker = std::make_shared<remote_walker>(
+        m_context, m_endpoint, m_serial, root, v2, connections);
+    return walker->run(ec, ticket.remaining(timeout));
+}
+
+/// Name of an APK in an install session, unique and safe for the shell.
+static std::string session_name(const size_t index,
+                                const std::filesystem::path& apk) {
+    auto name = std::to_string(index) + "_" + apk.filename().string();
+    std::replace_if(
+        name.begin(), name.end(),
+        [](const char c) {
+            return !std::isalnum(static_cast<unsigned char>(c)) &&
+                   c != '.' && c != '-' && c != '_';
+        },
+        '_');
+    return name;
+}
+
+std::string client_impl::install(const std::vector<std::filesystem::path>& apks,
+                                 const std::string_view options,
+                                 std::error_code& ec, const int64_t timeout) {
+    install_stats stats;
+    return install(apks, options, ec, timeout, stats);
+}
+
+std::string client_impl::install(const std::vector<std::filesystem::path>& apks,
+                                 const std::string_view options,
+                                 std::error_code& ec, const int64_t timeout,
+                                 install_stats& stats) {
+    using namespace std::chrono;
+    const auto deadline = steady_clock::now() + milliseconds(timeout);
+    const auto left = [&] {
+        const auto rest = deadline - steady_clock::now();
+        return std::max<int64_t>(duration_cast<milliseconds>(rest).count(), 0);
+    };
+    const auto succeeded = [](const std::string& output) {
+        return output.starts_with("Success");
+    };
+
+    stats = {};
+    if (apks.empty()) {
+        ec = asio::error::invalid_argument;
+        return "";
+    }
+
+    std::vector<std::string> sizes;
+    for (const auto& apk : apks) {
+        const auto size = std::filesystem::file_size(apk, ec);
+        if (ec) {
+            return "";
+        }
+        sizes.push_back(std::to_string(size));
+        stats.bytes += size;
+    }
+
+    const auto ticket = m_scheduler->admit(traffic_class::bulk, timeout, ec);
+    if (!ticket) {
+        return "";
+    }
+
+    const auto suffix = options.empty() ? "" : " " + std::string(options);
+    const auto start = steady_clock::now();
+    auto sent = start;
+
+    // A single APK is streamed to the install itself.
+    if (apks.size() == 1) {
+        const auto command = "install -S " + sizes.front() + suffix;
+        const auto output =
+            package_command(command, apks.front(), ec, left(), sent);
+        stats.transfer = duration<double>(sent - start).count();
+        const auto verified = steady_clock::now();
+        stats.verification = duration<double>(verified - sent).count();
+        if (!ec && !succeeded(output)) {
+            ec = asio::error::fault;
+        }
+        return output;
+    }
+
+    // Success: created install session [<id>]
+    const auto total = std::to_string(stats.bytes);
+    auto output = package_command("install-create -S " + total + suffix, {},
+                                  ec, left(), sent);
+    const auto id = output.find('[');
+    if (!ec && (!succeeded(output) || id == std::string::npos)) {
+        ec = asio::error::fault;
+    }
+    if (ec) {
+        return output;
+    }
+
+    const auto session = output.substr(id + 1, output.find(']', id) - id - 1);
+    std::from_chars(session.data(), session.data() + session.size(),
+                    stats.session);
+
+    for (size_t i = 0; i < apks.size(); i++) {
+        const auto command = "install-write -S " + sizes[i] + " " + session +
+                             " " + session_name(i, apks[i]) + " -";
+        output = package_command(command, apks[i], ec, left(), sent);
+        if (!ec && !succeeded(output)) {
+            ec = asio::error::fault;
+        }
+        if (ec) {
+            // The session would be kept by the device until it expires.
+            std::error_code abandon_ec;
+            package_command("install-abandon " + session, {}, abandon_ec,
+                            std::max(left(), abandon_timeout), sent);
+            stats.transfer = duration<double>(sent - start).count();
+            return output;
+        }
+    }
+
+    const auto transferred = steady_clock::now();
+    stats.transfer = duration<double>(transferred - start).count();
+
+    output = package_command("install-commit " + session, {}, ec, left(), sent);
+    stats.verification =
+        duration<double>(steady_clock::now() - transferred).count();
+    if (!ec && !succeeded(output)) {
+        ec = asio::error::fault;
+    }
+    return output;
+}
+
+std::string
+client_impl::package_command(const std::string_view command,
+                             const std::filesystem::path& input,
+                             std::error_code& ec, const int64_t timeout,
+                             std::chrono::steady_clock::time_point& sent) {
+    client_handle handle(m_context, m_endpoint);
+    handle.set_pacer(pacer());
+
+    const auto request = "exec:cmd package " + std::string(command);
+    handle.connect_device(m_serial, [&] {
+        handle.host_request(request, [&] {
+            const auto receive = [&] {
+                sent = std::chrono::steady_clock::now();
+                handle.host_data([&] { handle.finish(); });
+            };
+
+            if (input.empty()) {
+                receive();
+                return;
+            }
+            handle.stream_send_file(input, receive);
+        });
+    });
+
+    handle.run(timeout);
+
+    ec = handle.error();
+    return handle.value();
+}
+
+std::vector<std::string> client_impl::features(std::error_code& ec,
+                                               const int64_t timeout) {
+    {
+        std::lock_guard lock(m_features_mutex);
+        if (m_features) {
+            return *m_features;
+        }
+    }
+
+    const auto split = [](const std::string_view list) {
+        std::vector<std::string> result;
+        size_t pos = 0;
+        while (pos < list.size()) {
+            const auto comma = std::min(list.find(',', pos), list.size());
+            if (comma > pos) {
+                result.emplace_back(list.substr(pos, comma - pos));
+            }
+            pos = comma + 1;
+        }
+        return result;
+    };
+
+    client_handle handle(m_context, m_endpoint);
+    const auto request = "host-serial:" + m_serial + ":features";
+    auto result =
+        split(handle.timed_host_request(request, true, ec, timeout));
+    if (ec) {
+        return {};
+    }
+
+    // A feature is usable if the adb server supports it too. Servers that do
+    // not report their features are left out of the check.
+    std::error_code host_ec;
+    client_handle host_handle(m_context, m_endpoint);
+    const auto host_features = split(host_handle.timed_host_request(
+        "host:host-features", true, host_ec, timeout));
+    if (!host_ec) {
+        std::erase_if(result, [&](const std::string& feature) {
+            return std::find(host_features.begin(), host_features.end(),
+                             feature) == host_features.end();
+        });
+    }
+
+    std::lock_guard lock(m_features_mutex);
+    m_features = result;
+    return result;
+}
+
+std::shared_ptr<const property_map>
+client_impl::properties(std::error_code& ec, const int64_t timeout,
+                        const bool refresh) {
+    const auto generation = m_cache.generation();
+    {
+        std::lock_guard lock(m_properties_mutex);
+        if (!refresh && m_properties &&
+            m_properties_generation == generation) {
+            ec.clear();
+            return m_properties;
+        }
+    }
+
+    auto output = shell("getprop", ec, timeout, false);
+    if (ec) {
+        return nullptr;
+    }
+
+    std::shared_ptr<const property_map> snapshot =
+        property_map::parse(std::move(output));
+
+    std::lock_guard lock(m_properties_mutex);
+    m_properties = snapshot;
+    m_properties_generation = generation;
+    return snapshot;
+}
+
+void client_impl::reset_features() {
+    std::lock_guard lock(m_features_mutex);
+    m_features.reset();
+}
+
+void client_impl::negotiate_sync(sync_stats& stats, const int64_t timeout) {
+    std::error_code ec;
+    const auto supported = features(ec, timeout);
+    const auto has = [&](const std::string_view feature) {
+        return std::find(supported.begin(), supported.end(), feature) !=
+               supported.end();
+    };
+
+    stats.version = has("sendrecv_v2") ? 2 : 1;
+    stats.compressed = stats.version == 2 && has("sendrecv_v2_lz4");
+}
+
+/// Parse the replies of a forward request, after its first OKAY.
+/**
+ * @return The protocol string at the end of the replies, if any.
+ * @param reply Data received until the connection is closed.
+ * @param ec std::error_code set to asio::error::fault on FAIL.
+ * @note Forward services reply with OKAY twice, and then the allocated port or
+ * the listing. On FAIL, the returned string is the error message.
+ */
+static std::string forward_reply(std::string_view reply, std::error_code& ec) {
+    while (reply.substr(0, 4) == "OKAY") {
+        reply.remove_prefix(4);
+    }
+
+    if (reply.substr(0, 4) == "FAIL") {
+        ec = asio::error::fault;
+        reply.remove_prefix(4);
+    }
+
+    if (reply.size() < 4) {
+        return "";
+    }
+
+    size_t size = 0;
+    const auto last = reply.data() + 4;
+    if (std::from_chars(reply.data(), last, size, 16).ptr != last) {
+        return "";
+    }
+
+    return std::string(reply.substr(4, size));
+}
+
+std::string client_impl::forward(const std::string_view local,
+                                 const std::string_view remote,
+                                 std::error_code& ec, const int64_t timeout) {
+    const auto request =
+        "forward:" + std::string(local) + ";" + std::string(remote);
+    return forward_request(request, ec, timeout);
+}
+
+void client_impl::forward_remove(const std::string_view local,
+                                 std::error_code& ec, const int64_t timeout) {
+    const auto request = "killforward:" + std::string(local);
+    forward_request(request, ec, timeout);
+}
+
+std::string client_impl::forward_list(std::error_code& ec,
+                                      const int64_t timeout) {
+    return forward_request("list-forward", ec, timeout);
+}
+
+std::string client_impl::reverse(const std::string_view remote,
+                                 const std::string_view local,
+                                 std::error_code& ec, const int64_t timeout) {
+    const auto request =
+        "reverse:forward:" + std::string(remote) + ";" + std::string(local);
+    return reverse_request(request, ec, timeout);
+}
+
+void client_impl::reverse_remove(const std::string_view remote,
+                                 std::error_code& ec, const int64_t timeout) {
+    const auto request = "reverse:killforward:" + std::string(remote);
+    reverse_request(request, ec, timeout);
+}
+
+std::string client_impl::reverse_list(std::error_code& ec,
+                                      const int64_t timeout) {
+    return reverse_request("reverse:list-forward", ec, timeout);
+}
+
+std::shared_ptr<tunnel> client_impl::open_tunnel(const uint16_t local_port,
+                                                 const std::string_view remote,
+                                                 std::error_code& ec) {
+    auto impl = tunnel_impl::create(m_context, m_endpoint, m_serial, remote,
+                                    local_port, ec);
+    if (ec) {
+        return nullptr;
+    }
+
+    // Pending accepts keep the tunnel alive, so close it with the handle.
+    return std::shared_ptr<tunnel>(impl.get(),
+                                   [impl](tunnel*) { impl->close(); });
+}
+
 std::string client_impl::root(std::error_code& ec, const int64_t timeout) {
-    client_handle handle(m_context);
-    return handle.timed_device_request(m_serial, "root:", ec, timeout);
+    reset_features();
+    client_handle handle(m_context, m_endpoint);
+    const auto result =
+        handle.timed_device_request(m_serial, "root:", ec, timeout);
+    m_cache.invalidate();
+    return result;
 }
 
 std::string client_impl::unroot(std::error_code& ec, const int64_t timeout) {
-    client_handle handle(m_context);
-    return handle.timed_device_request(m_serial, "unroot:", ec, timeout);
+    reset_features();
+    client_handle handle(m_context, m_endpoint);
+    const auto result =
+        handle.timed_device_request(m_serial, "unroot:", ec, timeout);
+    m_cache.invalidate();
+    return result;
 }
 
 std::shared_ptr<io_handle>
 client_impl::interactive_shell(const std::string_view command,
                                std::error_code& ec, const int64_t timeout) {
-    client_handle handle(m_context);
+    const auto ticket =
+        m_scheduler->admit(traffic_class::interactive, timeout, ec);
+    client_handle handle(m_context, m_endpoint);
 
     handle.connect_device(m_serial, [=, &handle] {
-        const auto request = std::string("shell:") + command.data();
+        const auto request = "shell:" + std::string(command);
         handle.host_request(request, [&handle] { handle.finish(); });
     });
 
     handle.run(timeout);
 
     ec = handle.error();
-    return std::make_shared<io_handle_impl>(std::move(handle));
+    auto impl = std::make_shared<io_handle_impl>(std::move(handle));
+    impl->set_scheduler(m_scheduler);
+    return impl;
+}
+
+std::shared_ptr<shell_session>
+client_impl::open_shell_session(std::error_code& ec, const int64_t timeout) {
+    auto handle =
+        interactive_shell(shell_session_impl::shell_command, ec, timeout);
+    if (ec) {
+        return nullptr;
+    }
+
+    return std::make_shared<shell_session_impl>(std::move(handle));
+}
+
+std::shared_ptr<input_injector>
+client_impl::open_input_injector(std::shared_ptr<io_handle> handle,
+                                 const double frame_rate) {
+    return std::make_shared<input_injector_impl>(m_context, std::move(handle),
+                                                 frame_rate);
 }
 
 void client_impl::start() {
@@ -157,36 +1205,89 @@ void client_impl::wait_for_device(std::error_code& ec, const int64_t timeout) {
     std::this_thread::sleep_for(std::chrono::seconds(1));
 
     const auto pattern = m_serial + "\tdevice";
-    auto devices_str = devices(ec, timeout);
+    auto devices_str = list_devices(ec, timeout);
     while (devices_str.find(pattern) == std::string::npos) {
         if (ec) {
             return;
         }
         std::this_thread::sleep_for(std::chrono::microseconds(500));
-        devices_str = devices(ec, timeout);
+        devices_str = list_devices(ec, timeout);
     }
 }
 
-std::string client_impl::nc_command(const std::string_view command) {
-    static const std::regex nc_regex(R"((.+nc -w 3 .+ ).+)");
+std::string client_impl::list_devices(std::error_code& ec,
+                                      const int64_t timeout) {
+    // The server of the client, which may not be the default one. The bridge
+    // also runs on the event loop of the client.
+    client_handle handle(m_context, m_endpoint);
+    return handle.timed_host_request("host:devices", true, ec, timeout);
+}
 
-    std::match_results<std::string_view::const_iterator> match;
+std::shared_ptr<receive_channel>
+client_impl::open_channel(std::error_code& ec, receive_channel::sink_t sink) {
+    return receive_channel_impl::create(m_context, std::move(sink), ec);
+}
 
-    if (std::regex_match(command.cbegin(), command.cend(), match, nc_regex)) {
-        const auto prefix = match[1].str();
+std::string client_impl::forward_request(const std::string_view request,
+                                         std::error_code& ec,
+                                         const int64_t timeout) {
+    client_handle handle(m_context, m_endpoint);
+    const auto host_request =
+        "host-serial:" + m_serial + ":" + std::string(request);
+    const auto reply =
+        handle.timed_host_request(host_request, false, ec, timeout);
+    if (ec) {
+        return reply;
+    }
 
-        const auto endpoint = m_acceptor.local_endpoint();
-        const auto port = std::to_string(endpoint.port());
-        const auto suffix = " " + port;
+    return forward_reply(reply, ec);
+}
 
-        return prefix + suffix;
+std::string client_impl::reverse_request(const std::string_view request,
+                                         std::error_code& ec,
+                                         const int64_t timeout) {
+    client_handle handle(m_context, m_endpoint);
+    const auto reply =
+        handle.timed_device_request(m_serial, request, ec, timeout);
+    if (ec) {
+        return reply;
     }
 
-    return "";
+    return forward_reply(reply, ec);
 }
 
-client_handle::client_handle(asio::io_context& context)
-    : async_handle(context) {}
+std::string client_impl::socket_request(const std::string_view service,
+                                        const std::string_view command,
+                                        std::error_code& ec,
+                                        const int64_t timeout) {
+    // Each request listens on its own port, so that concurrent requests
+    // never accept the connections of each other.
+    auto channel = receive_channel_impl::create(m_context, {}, ec);
+    if (ec) {
+        return "";
+    }
+
+    const auto target = channel->retarget(command, ec);
+    if (ec) {
+        channel->close();
+        return "";
+    }
+
+    client_handle handle(m_context, m_endpoint);
+    const auto request = std::string(service) + target;
+    auto result = handle.timed_device_request(m_serial, request, *channel, ec,
+                                              timeout);
+
+    // A failed request never connects, which leaves the accept pending.
+    if (ec) {
+        channel->close();
+    }
+    return result;
+}
+
+client_handle::client_handle(asio::io_context& context,
+                             const asio::ip::tcp::endpoint& endpoint)
+    : async_handle(context, endpoint) {}
 
 void client_handle::oneshot_request(const std::string_view request,
                                     const bool bounded,
@@ -237,36 +1338,27 @@ std::string client_handle::timed_device_request(const std::string_view serial,
 
 std::string client_handle::timed_device_request(const std::string_view serial,
                                                 const std::string_view request,
-                                                asio::io_context& context,
-                                                tcp::acceptor& acceptor,
+                                                receive_channel& channel,
                                                 std::error_code& ec,
                                                 const int64_t timeout) {
-    auto conn = tcp_connection::create(context);
+    using namespace std::chrono;
+    const auto start = steady_clock::now();
 
-    acceptor.async_accept(conn->socket(), [this, conn](const auto& error) {
-        if (error) {
-            m_error = error;
-            finish();
-            return;
-        }
-
-        conn->start([this](const auto& error, auto&& data) {
-            if (error && error != asio::error::eof) {
-                m_error = error;
-            }
-            m_data = std::move(data);
-            finish();
-        });
+    // The stream of the request ends after nc has sent everything.
+    connect_device(serial, [=, this] {
+        oneshot_request(request, false, [this] { finish(); });
     });
 
-    connect_device(serial,
-                   [=, this] { oneshot_request(request, false, [] {}); });
-
     run(timeout);
-    conn->cancel();
 
     ec = error();
-    return value();
+    if (ec) {
+        return "";
+    }
+
+    const auto elapsed = steady_clock::now() - start;
+    const auto left = timeout - duration_cast<milliseconds>(elapsed).count();
+    return channel.receive(ec, std::max<int64_t>(left, 0));
 }
 
 std::string
@@ -1,34 +1,149 @@
 #pragma once
 
+#include <atomic>
+#include <mutex>
+#include <optional>
+
 #include <asio/ip/tcp.hpp>
 #include <asio/read.hpp>
 
+#include "adbd_bridge.hpp"
 #include "client.hpp"
 #include "protocol.hpp"
+#include "result_cache.hpp"
+#include "scheduler.hpp"
+#include "singleflight.hpp"
 
 namespace adb {
 
 /// Pimpl class for client.
 class client_impl : public client {
   public:
-    client_impl(const std::string_view serial);
-    ~client_impl() { stop(); }
+    client_impl(const std::string_view serial,
+                const asio::ip::tcp::endpoint& endpoint =
+                    protocol::default_endpoint());
+    client_impl(const std::string_view address, adbd_auth auth);
+    ~client_impl();
 
     std::string connect(std::error_code& ec, const int64_t timeout) override;
     std::string disconnect(std::error_code& ec, const int64_t timeout) override;
 
+    void set_coalescing(const bool enabled) override;
+
+    void cache_command(const std::string_view command,
+                       const std::chrono::milliseconds ttl) override;
+    void set_cache_limit(const size_t bytes) override;
+    void invalidate_cache() override;
+    cache_stats cache_counters() override;
+
+    void monitor_liveness(const bool enabled) override;
+
     std::string shell(const std::string_view command, std::error_code& ec,
                       const int64_t timeout, const bool recv_by_sock) override;
     std::string exec(const std::string_view command, std::error_code& ec,
                      const int64_t timeout, const bool recv_by_socket) override;
 
+    image_view screencap(std::vector<uint8_t>& buffer, std::error_code& ec,
+                         const int64_t timeout,
+                         const capture_method method) override;
+    image_view screencap(std::vector<uint8_t>& buffer,
+                         const pixel_format format, const uint32_t scale,
+                         std::error_code& ec, const int64_t timeout,
+                         const capture_method method) override;
+    image_view screencap(std::vector<uint8_t>& buffer,
+                         const pixel_format format, const uint32_t scale,
+                         std::error_code& ec, const int64_t timeout,
+                         const capture_method method,
+                         capture_stats& stats) override;
+
+    screenshot_choice
+    select_screenshot(std::error_code& ec, const int64_t timeout,
+                      const std::string_view socket_host, const int rounds,
+                      const std::chrono::seconds ttl) override;
+
+    frame_changes diff_frame(const image_view& frame) override;
+
+    std::shared_ptr<capture_stream>
+    open_capture_stream(const pixel_format format, const uint32_t scale,
+                        const double frame_rate,
+                        const capture_method method) override;
+
+    std::shared_ptr<logcat_stream> open_logcat(logcat_stream::handler_t handler,
+                                               const log_filter& filter,
+                                               const size_t retention) override;
+
+    std::shared_ptr<screen_record>
+    open_screen_record(const uint32_t bit_rate, const uint32_t width,
+                       const uint32_t height, const size_t capacity) override;
+
+    void configure_scheduler(const scheduler_config& config) override;
+    scheduler_stats traffic_stats() override;
+
     bool push(const std::filesystem::path& src, const std::string& dst,
               int perm, std::error_code& ec, const int64_t timeout) override;
+    bool push(const std::filesystem::path& src, const std::string& dst,
+              int perm, std::error_code& ec, const int64_t timeout,
+              sync_stats& stats) override;
+
+    bool pull(const std::string& src, const std::filesystem::path& dst,
+              std::error_code& ec, const int64_t timeout) override;
+    bool pull(const std::string& src, const std::filesystem::path& dst,
+              std::error_code& ec, const int64_t timeout,
+              sync_stats& stats) override;
+
+    std::shared_ptr<remote_index> walk(const std::string& root,
+                                       std::error_code& ec,
+                                       const int64_t timeout,
+                                       const size_t connections) override;
+
+    std::string install(const std::vector<std::filesystem::path>& apks,
+                        const std::string_view options, std::error_code& ec,
+                        const int64_t timeout) override;
+    std::string install(const std::vector<std::filesystem::path>& apks,
+                        const std::string_view options, std::error_code& ec,
+                        const int64_t timeout, install_stats& stats) override;
+
+    std::vector<std::string> features(std::error_code& ec,
+                                      const int64_t timeout) override;
+
+    std::shared_ptr<const property_map>
+    properties(std::error_code& ec, const int64_t timeout,
+               const bool refresh) override;
 
     std::shared_ptr<io_handle>
     interactive_shell(const std::string_view command, std::error_code& ec,
                       const int64_t timeout) override;
 
+    std::shared_ptr<shell_session>
+    open_shell_session(std::error_code& ec, const int64_t timeout) override;
+
+    std::shared_ptr<input_injector>
+    open_input_injector(std::shared_ptr<io_handle> handle,
+                        const double frame_rate) override;
+
+    std::shared_ptr<receive_channel>
+    open_channel(std::error_code& ec, receive_channel::sink_t sink) override;
+
+    std::string forward(const std::string_view local,
+                        const std::string_view remote, std::error_code& ec,
+                        const int64_t timeout) override;
+    void forward_remove(const std::string_view local, std::error_code& ec,
+                        const int64_t timeout) override;
+    std::string forward_list(std::error_code& ec,
+                             const int64_t timeout) override;
+
+    std::string reverse(const std::string_view remote,
+                        const std::string_view local, std::error_code& ec,
+                        const int64_t timeout) override;
+    void reverse_remove(const std::string_view remote, std::error_code& ec,
+                        const int64_t timeout) override;
+    std::string reverse_list(std::error_code& ec,
+                             const int64_t timeout) override;
+
+    std::shared_ptr<tunnel> open_tunnel(const uint16_t local_port,
+                                        const std::string_view remote,
+                                        std::error_code& ec) override;
+
     std::string root(std::error_code& ec, const int64_t timeout) override;
     std::string unroot(std::error_code& ec, const int64_t timeout) override;
 
@@ -42,72 +157,147 @@ class client_impl : public client {
 
     const std::string m_serial;
 
+    /// Key of the device in the process: its server and serial, or its
+    /// address if connected directly.
+    const std::string m_device;
+
+    /// Traffic scheduler of the device, shared with its other clients.
+    const std::shared_ptr<traffic_scheduler> m_scheduler;
+
     std::thread m_thread;
     asio::io_context m_context;
-    asio::ip::tcp::acceptor m_acceptor;
 
-    /// Convert the port of command to the client's one.
-    std::string nc_command(const std::string_view command);
-};
+    /// Bridge to adbd, if the client talks to the device directly.
+    adbd_bridge::pointer m_bridge;
 
-/// TCP connection class for receiving data by nc.
-class tcp_connection : public std::enable_shared_from_this<tcp_connection> {
-  public:
-    typedef std::shared_ptr<tcp_connection> pointer;
-    typedef std::function<void(asio::error_code, std::string&&)> callback_t;
+    /// Endpoint that serves the host requests of the client.
+    const asio::ip::tcp::endpoint m_endpoint;
 
-    static pointer create(asio::io_context& context) {
-        return std::make_shared<tcp_connection>(context);
-    }
+    /// Features of the device, cached after the first query.
+    std::optional<std::vector<std::string>> m_features;
+    std::mutex m_features_mutex;
 
-    tcp_connection(asio::io_context& context) : m_socket(context) {
-        m_buffer = std::make_unique<std::array<char, buf_size>>();
-    }
+    /// Properties of the device, and the generation of the cache when they
+    /// were read.
+    std::shared_ptr<const property_map> m_properties;
+    uint64_t m_properties_generation = 0;
+    std::mutex m_properties_mutex;
 
-    asio::ip::tcp::socket& socket() { return m_socket; }
+    /// Size of the `screencap` header of the device, or 0 if unknown.
+    std::atomic<size_t> m_screencap_header = 0;
 
-    void start(const callback_t&& callback) {
-        m_callback = std::move(callback);
+    /// Tile hashes of the last frame given to diff_frame().
+    std::shared_ptr<frame_diff> m_frame_diff;
+    std::mutex m_frame_diff_mutex;
 
-        asio::async_read(m_socket, asio::buffer(*m_buffer),
-                         std::bind(&tcp_connection::handle_read,
-                                   shared_from_this(), std::placeholders::_1,
-                                   std::placeholders::_2));
-    }
+    /// Results of the cached shell commands.
+    result_cache m_cache;
 
-    void cancel() {
-        asio::error_code ec;
-        m_socket.cancel(ec);
-    }
+    /// Watch of the state of the device, started by the first cached
+    /// command or by monitor_liveness().
+    attach_watch::pointer m_watch;
+    std::once_flag m_watch_once;
 
-  private:
-    void handle_read(const asio::error_code& error, size_t bytes_transferred) {
-        m_data.append(m_buffer->data(), bytes_transferred);
+    /// Whether the operations in progress fail when the device goes away.
+    std::atomic<bool> m_liveness = false;
 
-        if (error) {
-            m_callback(error, std::move(m_data));
-            return;
-        }
+    /// Start the watch of the state of the device, once.
+    void watch_device();
 
-        asio::async_read(m_socket, asio::buffer(*m_buffer),
-                         std::bind(&tcp_connection::handle_read,
-                                   shared_from_this(), std::placeholders::_1,
-                                   std::placeholders::_2));
-    }
+    /// Handle a change of the state of the device, on the event loop.
+    void on_device_state(const std::string& state);
 
-    callback_t m_callback;
+    /// Whether identical requests in flight are coalesced.
+    std::atomic<bool> m_coalescing = false;
 
-    asio::ip::tcp::socket m_socket;
-    std::string m_data;
+    /// Run a device request, or join the identical one in flight.
+    /**
+     * @return Result of the request.
+     * @param request Service requested, e.g. `shell:getprop`.
+     * @param recv_by_socket Whether the request receives by socket, which
+     * reads its output differently.
+     * @param ec std::error_code to indicate what error occurred, if any.
+     * @param timeout Timeout in milliseconds to wait for a joined request.
+     * @param call Function running the request.
+     */
+    std::string coalesce(const std::string_view request,
+                         const bool recv_by_socket, std::error_code& ec,
+                         const int64_t timeout,
+                         const singleflight::call_t& call);
+
+    /// Get the pacer of the bulk data of the device.
+    protocol::async_handle::pacer_t pacer() const;
+
+    /// Describe the connection of the device, e.g. `usb:1-1` or `tcp`.
+    std::string connection_type(const int64_t timeout);
+
+    /// Take one screenshot with a method, and measure it.
+    /**
+     * @param method Method to use.
+     * @param socket_host Address of this host seen by the device.
+     * @param buffer Buffer to receive the pixels.
+     * @param result Measurements to fill in. Dimensions are only set if
+     * the capture succeeds.
+     * @param latency Time of the capture in milliseconds.
+     * @param timeout Timeout in milliseconds.
+     */
+    void benchmark_screenshot(const screenshot_method method,
+                              const std::string_view socket_host,
+                              std::vector<uint8_t>& buffer,
+                              screenshot_benchmark& result, double& latency,
+                              const int64_t timeout);
+
+    /// Forget the cached features, e.g. when adbd restarts.
+    void reset_features();
 
-    static constexpr size_t buf_size = 64000;
-    std::unique_ptr<std::array<char, buf_size>> m_buffer;
+    /// Choose the sync protocol from the features of the device.
+    /**
+     * @param stats Statistics whose version and compressed are set.
+     * @param timeout Timeout in milliseconds to query the features.
+     * @note Sync v1 is used if the features cannot be queried.
+     */
+    void negotiate_sync(sync_stats& stats, const int64_t timeout);
+
+    /// Timeout in milliseconds to abandon a failed install session.
+    static constexpr int64_t abandon_timeout = 2000;
+
+    /// Run a package manager command, with the content of a file as input.
+    /**
+     * @return Output of the command.
+     * @param command Arguments of `cmd package`, e.g. `install-commit 42`.
+     * @param input Path to the file streamed to the command, or empty.
+     * @param ec std::error_code to indicate what error occurred, if any.
+     * @param timeout Timeout in milliseconds.
+     * @param sent Set to the time the input was sent.
+     */
+    std::string package_command(const std::string_view command,
+                                const std::filesystem::path& input,
+                                std::error_code& ec, const int64_t timeout,
+                                std::chrono::steady_clock::time_point& sent);
+
+    /// List the devices known to the endpoint of the client.
+    std::string list_devices(std::error_code& ec, const int64_t timeout);
+
+    /// Send a forward request to the adb server and parse its replies.
+    std::string forward_request(const std::string_view request,
+                                std::error_code& ec, const int64_t timeout);
+
+    /// Send a reverse request to the device and parse its replies.
+    std::string reverse_request(const std::string_view request,
+                                std::error_code& ec, const int64_t timeout);
+
+    /// Request a local service and receive its output by socket.
+    std::string socket_request(const std::string_view service,
+                               const std::string_view command,
+                               std::error_code& ec, const int64_t timeout);
 };
 
 /// Client handle that use async methods to communicate with the adbd.
 class client_handle : public protocol::async_handle {
   public:
-    client_handle(asio::io_context& context);
+    client_handle(asio::io_context& context,
+                  const asio::ip::tcp::endpoint& endpoint =
+                      protocol::default_endpoint());
 
     /// Request a host service on the adbd.
     void oneshot_request(const std::string_view request, const bool bounded,
@@ -152,15 +342,13 @@ class client_handle : public protocol::async_handle {
      * @return Response data of the local service.
      * @param serial Serial of the device.
      * @param request Request to be sent to the device.
-     * @param context io_context to be used for the connection.
-     * @param acceptor Acceptor to be used for the connection.
+     * @param channel Channel that receives the output sent by nc.
      * @param ec std::error_code to indicate what error occurred, if any.
      * @param timeout Timeout in milliseconds.
      */
     std::string timed_device_request(const std::string_view serial,
                                      const std::string_view request,
-                                     asio::io_context& context,
-                                     asio::ip::tcp::acceptor& acceptor,
+                                     receive_channel& channel,
                                      std::error_code& ec,
                                      const int64_t timeout);
 };
@@ -168,7 +356,9 @@ class client_handle : public protocol::async_handle {
 /// Stand-alone client handle that owns its an io_context.
 class standalone_handle {
   public:
-    standalone_handle() : m_handle(m_context){};
+    standalone_handle(const asio::ip::tcp::endpoint& endpoint =
+                          protocol::default_endpoint())
+        : m_handle(m_context, endpoint){};
 
     /// Request a host service on the adbd.
     /**
@@ -0,0 +1,120 @@
+#include <algorithm>
+#include <map>
+
+#include "frame_diff_impl.hpp"
+
+namespace adb {
+
+/// Smallest tile size, below which the hashing is dominated by the folds.
+static constexpr uint32_t min_tile_size = 8;
+
+std::shared_ptr<frame_diff> frame_diff::create(const uint32_t tile_size) {
+    return std::make_shared<frame_diff_impl>(tile_size);
+}
+
+frame_diff_impl::frame_diff_impl(const uint32_t tile_size)
+    : m_tile_size(std::max(tile_size, min_tile_size)) {}
+
+frame_changes frame_diff_impl::update(const image_view& frame) {
+    frame_changes changes;
+
+    const auto bpp = bytes_per_pixel(frame.format);
+    if (frame.empty() || bpp == 0 || frame.size() == 0) {
+        return changes;
+    }
+
+    const auto tile = m_tile_size;
+    const size_t columns = (frame.width + tile - 1) / tile;
+    const size_t rows = (frame.height + tile - 1) / tile;
+
+    m_next.assign(columns * rows, 0);
+    const size_t row_size = static_cast<size_t>(frame.width) * bpp;
+    for (uint32_t y = 0; y < frame.height; y++) {
+        const auto row = frame.data + static_cast<size_t>(y) * frame.stride;
+        const auto hashes = m_next.data() + y / tile * columns;
+        m_kernels.hash_tiles(row, row_size, tile * bpp, hashes);
+    }
+
+    const auto same_shape = m_shape.width == frame.width &&
+                            m_shape.height == frame.height &&
+                            m_shape.format == frame.format;
+
+    // Most frames are identical to the previous one.
+    if (same_shape && m_next == m_hashes) {
+        return changes;
+    }
+
+    std::vector<bool> changed(m_next.size(), true);
+    if (same_shape) {
+        for (size_t i = 0; i < m_next.size(); i++) {
+            changed[i] = m_next[i] != m_hashes[i];
+        }
+    }
+
+    m_hashes.swap(m_next);
+    m_shape = frame;
+    m_shape.data = nullptr;
+
+    collect(changes, changed, columns);
+    return changes;
+}
+
+void frame_diff_impl::reset() {
+    m_shape = {};
+    m_hashes.clear();
+}
+
+void frame_diff_impl::collect(frame_changes& changes,
+                              const std::vector<bool>& changed,
+                              const size_t columns) const {
+    const auto tile = m_tile_size;
+    const auto width = m_shape.width;
+    const auto height = m_shape.height;
+    const auto rows = changed.size() / columns;
+
+    // Regions still open at the previous row of tiles, by their columns.
+    std::map<std::pair<size_t, size_t>, size_t> open;
+
+    for (size_t r = 0; r < rows; r++) {
+        const auto y = static_cast<uint32_t>(r * tile);
+        const auto tile_height = std::min(tile, height - y);
+        std::map<std::pair<size_t, size_t>, size_t> next_open;
+
+        for (size_t c = 0; c < columns;) {
+            if (!changed[r * columns + c]) {
+                c++;
+                continue;
+            }
+
+            // A run of changed tiles in the row.
+            const auto first = c;
+            for (; c < columns && changed[r * columns + c]; c++) {
+                const auto x = static_cast<uint32_t>(c * tile);
+                changes.tiles.push_back(
+                    {x, y, std::min(tile, width - x), tile_height});
+            }
+
+            const auto x = static_cast<uint32_t>(first * tile);
+            const auto run_width = std::min(static_cast<uint32_t>(c * tile),
+                                            width) - x;
+
+            // Runs with the same columns as a region above extend it.
+            const auto span = std::make_pair(first, c);
+            const auto above = open.find(span);
+            if (above != open.end()) {
+                changes.regions[above->second].height += tile_height;
+                next_open[span] = above->second;
+            } else {
+                changes.regions.push_back({x, y, run_width, tile_height});
+                next_open[span] = changes.regions.size() - 1;
+            }
+        }
+
+        open.swap(next_open);
+    }
+
+    changes.changed = !changes.tiles.empty();
+    changes.ratio = static_cast<double>(changes.tiles.size()) / changed.size();
+}
+
+} // namespace adb
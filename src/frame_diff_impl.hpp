@@ -0,0 +1,41 @@
+#pragma once
+
+#include "frame_diff.hpp"
+#include "pixel_kernels.hpp"
+
+namespace adb {
+
+/// Pimpl class for frame_diff.
+class frame_diff_impl : public frame_diff {
+  public:
+    frame_diff_impl(const uint32_t tile_size);
+
+    frame_changes update(const image_view& frame) override;
+    void reset() override;
+
+  private:
+    const pixel::kernels& m_kernels = pixel::best_kernels();
+
+    /// Width and height of the tiles in pixels.
+    const uint32_t m_tile_size;
+
+    /// Shape of the previous frame, whose format is unknown if there is none.
+    image_view m_shape;
+
+    /// Hashes of the tiles of the previous frame, in row-major order.
+    std::vector<uint64_t> m_hashes;
+
+    /// Hashes of the tiles of the current frame.
+    std::vector<uint64_t> m_next;
+
+    /// Collect the changed tiles, and merge them into regions.
+    /**
+     * @param changes Changes to fill in.
+     * @param changed Whether each tile changed, in row-major order.
+     * @param columns Number of tiles in a row.
+     */
+    void collect(frame_changes& changes, const std::vector<bool>& changed,
+                 const size_t columns) const;
+};
+
+} // namespace adb
@@ -0,0 +1,319 @@
+#include <algorithm>
+#include <cstring>
+#include <new>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "frame_share_impl.hpp"
+
+namespace adb {
+
+/// Attempts of copy_latest() when the frame is overwritten while copied.
+static constexpr int copy_attempts = 4;
+
+/// Round a size up to whole cache lines.
+static constexpr size_t align_line(const size_t size) {
+    return (size + 63) / 64 * 64;
+}
+
+/// Get the name of the segment in the POSIX namespace.
+static std::string segment_name(const std::string_view name) {
+    std::string result = "/";
+    for (const auto c : name) {
+        result.push_back(c == '/' ? '_' : c);
+    }
+    return result;
+}
+
+namespace shm {
+
+#if defined(_WIN32)
+
+segment::~segment() = default;
+
+bool segment::create(const std::string&, const size_t, std::error_code& ec) {
+    ec = std::make_error_code(std::errc::not_supported);
+    return false;
+}
+
+bool segment::open(const std::string&, std::error_code& ec) {
+    ec = std::make_error_code(std::errc::not_supported);
+    return false;
+}
+
+void segment::unlink() {}
+
+#else
+
+static std::error_code last_error() {
+    return std::error_code(errno, std::system_category());
+}
+
+segment::~segment() {
+    if (m_data) {
+        ::munmap(m_data, m_size);
+    }
+}
+
+bool segment::create(const std::string& name, const size_t size,
+                     std::error_code& ec) {
+    // Readers of a previous ring keep their mapping and see it closed.
+    ::shm_unlink(name.c_str());
+
+    const auto fd =
+        ::shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        ec = last_error();
+        return false;
+    }
+
+    void* data = MAP_FAILED;
+    if (::ftruncate(fd, static_cast<off_t>(size)) == 0) {
+        data = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+                      0);
+    }
+    if (data == MAP_FAILED) {
+        ec = last_error();
+        ::close(fd);
+        ::shm_unlink(name.c_str());
+        return false;
+    }
+
+    ::close(fd);
+    m_name = name;
+    m_data = static_cast<uint8_t*>(data);
+    m_size = size;
+    return true;
+}
+
+bool segment::open(const std::string& name, std::error_code& ec) {
+    const auto fd = ::shm_open(name.c_str(), O_RDONLY | O_CLOEXEC, 0);
+    if (fd < 0) {
+        ec = last_error();
+        return false;
+    }
+
+    struct stat st = {};
+    void* data = MAP_FAILED;
+    if (::fstat(fd, &st) == 0 && st.st_size > 0) {
+        data = ::mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ,
+                      MAP_SHARED, fd, 0);
+    }
+    if (data == MAP_FAILED) {
+        // An empty segment has not been sized by the publisher yet.
+        ec = st.st_size > 0 ? last_error()
+                            : std::make_error_code(
+                                  std::errc::resource_unavailable_try_again);
+        ::close(fd);
+        return false;
+    }
+
+    ::close(fd);
+    m_data = static_cast<uint8_t*>(data);
+    m_size = static_cast<size_t>(st.st_size);
+    return true;
+}
+
+void segment::unlink() {
+    if (!m_name.empty()) {
+        ::shm_unlink(m_name.c_str());
+        m_name.clear();
+    }
+}
+
+#endif
+
+} // namespace shm
+
+std::shared_ptr<frame_publisher>
+frame_publisher::create(const std::string_view name, const size_t frame_size,
+                        const uint32_t slots, std::error_code& ec) {
+    auto publisher = std::make_shared<frame_publisher_impl>();
+    if (!publisher->init(name, frame_size, slots, ec)) {
+        return nullptr;
+    }
+    return publisher;
+}
+
+frame_publisher_impl::~frame_publisher_impl() {
+    if (m_header) {
+        m_header->closed.store(1, std::memory_order_release);
+    }
+    m_segment.unlink();
+}
+
+bool frame_publisher_impl::init(const std::string_view name,
+                                const size_t frame_size, const uint32_t slots,
+                                std::error_code& ec) {
+    if (frame_size == 0 || slots == 0) {
+        ec = std::make_error_code(std::errc::invalid_argument);
+        return false;
+    }
+
+    const auto stride = sizeof(shm::slot_header) + align_line(frame_size);
+    const auto size = sizeof(shm::ring_header) + stride * slots;
+    if (!m_segment.create(segment_name(name), size, ec)) {
+        return false;
+    }
+
+    // The segment is zeroed, so every slot starts unlocked and empty.
+    const auto base = m_segment.data();
+    m_header = new (base) shm::ring_header{};
+    m_header->version = shm::version;
+    m_header->slots = slots;
+    m_header->frame_size = frame_size;
+    m_header->slot_stride = stride;
+    for (uint32_t i = 0; i < slots; i++) {
+        new (shm::slot_at(m_header, base, i)) shm::slot_header{};
+    }
+
+    m_header->magic.store(shm::magic, std::memory_order_release);
+    return true;
+}
+
+uint64_t frame_publisher_impl::publish(
+    const image_view& frame,
+    const std::chrono::steady_clock::time_point timestamp) {
+    if (frame.empty() || frame.size() > m_header->frame_size) {
+        return 0;
+    }
+
+    const auto sequence = m_sequence + 1;
+    const auto slot = shm::slot_at(m_header, m_segment.data(), sequence);
+
+    // Readers that saw the previous lock value will discard their read.
+    const auto lock = slot->lock.load(std::memory_order_relaxed);
+    slot->lock.store(lock + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    using namespace std::chrono;
+    const auto ns = duration_cast<nanoseconds>(timestamp.time_since_epoch());
+    slot->sequence.store(sequence, std::memory_order_relaxed);
+    slot->timestamp.store(ns.count(), std::memory_order_relaxed);
+    slot->width.store(frame.width, std::memory_order_relaxed);
+    slot->height.store(frame.height, std::memory_order_relaxed);
+    slot->stride.store(frame.stride, std::memory_order_relaxed);
+    slot->format.store(static_cast<uint32_t>(frame.format),
+                       std::memory_order_relaxed);
+
+    const auto pixels = reinterpret_cast<uint8_t*>(slot + 1);
+    std::memcpy(pixels, frame.data, frame.size());
+
+    slot->lock.store(lock + 2, std::memory_order_release);
+    m_header->sequence.store(sequence, std::memory_order_release);
+
+    m_sequence = sequence;
+    return sequence;
+}
+
+std::shared_ptr<frame_reader> frame_reader::open(const std::string_view name,
+                                                 std::error_code& ec) {
+    auto reader = std::make_shared<frame_reader_impl>();
+    if (!reader->init(name, ec)) {
+        return nullptr;
+    }
+    return reader;
+}
+
+bool frame_reader_impl::init(const std::string_view name,
+                             std::error_code& ec) {
+    if (!m_segment.open(segment_name(name), ec)) {
+        return false;
+    }
+
+    if (m_segment.size() < sizeof(shm::ring_header)) {
+        ec = std::make_error_code(std::errc::resource_unavailable_try_again);
+        return false;
+    }
+
+    // The publisher may still be initializing the ring.
+    m_header = reinterpret_cast<const shm::ring_header*>(m_segment.data());
+    if (m_header->magic.load(std::memory_order_acquire) != shm::magic) {
+        ec = std::make_error_code(std::errc::resource_unavailable_try_again);
+        return false;
+    }
+
+    const auto expected =
+        sizeof(shm::ring_header) + m_header->slot_stride * m_header->slots;
+    if (m_header->version != shm::version || m_header->slots == 0 ||
+        m_header->slot_stride <
+            sizeof(shm::slot_header) + m_header->frame_size ||
+        m_segment.size() < expected) {
+        ec = std::make_error_code(std::errc::invalid_argument);
+        return false;
+    }
+
+    return true;
+}
+
+bool frame_reader_impl::read(const uint64_t sequence,
+                             const reader_t& reader) {
+    const auto wanted = sequence != 0 ? sequence : this->sequence();
+    if (wanted == 0 || closed()) {
+        return false;
+    }
+
+    const auto slot = shm::slot_at(m_header, m_segment.data(), wanted);
+    const auto lock = slot->lock.load(std::memory_order_acquire);
+    if ((lock & 1) != 0 ||
+        slot->sequence.load(std::memory_order_relaxed) != wanted) {
+        return false;
+    }
+
+    shared_frame frame;
+    frame.sequence = wanted;
+    frame.timestamp = std::chrono::steady_clock::time_point(
+        std::chrono::nanoseconds(
+            slot->timestamp.load(std::memory_order_relaxed)));
+    frame.image.data = reinterpret_cast<const uint8_t*>(slot + 1);
+    frame.image.width = slot->width.load(std::memory_order_relaxed);
+    frame.image.height = slot->height.load(std::memory_order_relaxed);
+    frame.image.stride = slot->stride.load(std::memory_order_relaxed);
+    frame.image.format = static_cast<pixel_format>(
+        slot->format.load(std::memory_order_relaxed));
+
+    // A torn header could point past the slot.
+    if (frame.image.size() > m_header->frame_size) {
+        return false;
+    }
+
+    reader(frame);
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return slot->lock.load(std::memory_order_relaxed) == lock;
+}
+
+shared_frame frame_reader_impl::copy_latest(std::vector<uint8_t>& buffer) {
+    shared_frame result;
+    for (int i = 0; i < copy_attempts; i++) {
+        const auto copied = read(0, [&](const shared_frame& frame) {
+            const auto size = frame.image.size();
+            if (buffer.size() < size) {
+                buffer.resize(size);
+            }
+            std::memcpy(buffer.data(), frame.image.data, size);
+
+            result = frame;
+            result.image.data = buffer.data();
+        });
+        if (copied) {
+            return result;
+        }
+    }
+    return {};
+}
+
+uint64_t frame_reader_impl::sequence() const {
+    return m_header->sequence.load(std::memory_order_acquire);
+}
+
+bool frame_reader_impl::closed() const {
+    return m_header->closed.load(std::memory_order_acquire) != 0;
+}
+
+} // namespace adb
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <atomic>
+#include <string>
+
+#include "frame_share.hpp"
+
+namespace adb {
+
+/// Layout of the shared memory ring.
+/**
+ * @note The segment is a ring_header followed by the slots. Each slot is a
+ * slot_header followed by the pixels, padded to a cache line.
+ */
+namespace shm {
+
+static constexpr uint32_t magic = 0x6d617266; // "fram"
+static constexpr uint32_t version = 1;
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free,
+              "shared atomics must be address-free");
+
+struct alignas(64) ring_header {
+    /// Set last by the publisher, once the ring is initialized.
+    std::atomic<uint32_t> magic;
+    uint32_t version;
+    uint32_t slots;
+    uint64_t frame_size;
+    uint64_t slot_stride;
+
+    /// Sequence number of the last published frame.
+    std::atomic<uint64_t> sequence;
+
+    /// Set when the publisher is destroyed.
+    std::atomic<uint32_t> closed;
+};
+
+struct alignas(64) slot_header {
+    /// Seqlock, odd while the slot is written.
+    std::atomic<uint64_t> lock;
+
+    std::atomic<uint64_t> sequence;
+    std::atomic<int64_t> timestamp;
+    std::atomic<uint32_t> width;
+    std::atomic<uint32_t> height;
+    std::atomic<uint32_t> stride;
+    std::atomic<uint32_t> format;
+};
+
+/// A mapped shared memory segment.
+class segment {
+  public:
+    segment() = default;
+    segment(const segment&) = delete;
+    segment& operator=(const segment&) = delete;
+    ~segment();
+
+    /// Create a segment, replacing one of the same name.
+    bool create(const std::string& name, const size_t size,
+                std::error_code& ec);
+
+    /// Map an existing segment for reading.
+    bool open(const std::string& name, std::error_code& ec);
+
+    /// Unlink the segment, so it goes away once every process unmaps it.
+    void unlink();
+
+    uint8_t* data() const { return m_data; }
+    size_t size() const { return m_size; }
+
+  private:
+    std::string m_name;
+    uint8_t* m_data = nullptr;
+    size_t m_size = 0;
+};
+
+/// Get the header of the slot of a sequence number.
+inline slot_header* slot_at(const ring_header* header, uint8_t* base,
+                            const uint64_t sequence) {
+    const auto index = sequence % header->slots;
+    const auto offset = sizeof(ring_header) + index * header->slot_stride;
+    return reinterpret_cast<slot_header*>(base + offset);
+}
+
+} // namespace shm
+
+/// Pimpl class for frame_publisher.
+class frame_publisher_impl : public frame_publisher {
+  public:
+    ~frame_publisher_impl();
+
+    /// Create the segment and initialize the ring.
+    bool init(const std::string_view name, const size_t frame_size,
+              const uint32_t slots, std::error_code& ec);
+
+    uint64_t publish(const image_view& frame,
+                     const std::chrono::steady_clock::time_point timestamp)
+        override;
+    uint64_t sequence() const override { return m_sequence; }
+
+  private:
+    shm::segment m_segment;
+    shm::ring_header* m_header = nullptr;
+    uint64_t m_sequence = 0;
+};
+
+/// Pimpl class for frame_reader.
+class frame_reader_impl : public frame_reader {
+  public:
+    /// Map the segment and check its layout.
+    bool init(const std::string_view name, std::error_code& ec);
+
+    bool read(const uint64_t sequence, const reader_t& reader) override;
+    shared_frame copy_latest(std::vector<uint8_t>& buffer) override;
+    uint64_t sequence() const override;
+    bool closed() const override;
+
+  private:
+    shm::segment m_segment;
+    const shm::ring_header* m_header = nullptr;
+};
+
+} // namespace adb
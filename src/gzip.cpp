@@ -0,0 +1,485 @@
+#include <algorithm>
+#include <cstring>
+
+#include "gzip.hpp"
+
+namespace adb::gzip {
+
+/// Size of the history that matches may refer to.
+static constexpr size_t window_size = 32 * 1024;
+
+/// Decoded bytes gathered before they are passed to the sink.
+static constexpr size_t flush_size = 256 * 1024;
+
+/// Longest match of deflate.
+static constexpr size_t max_match = 258;
+
+/// Flags of the gzip header.
+namespace flag {
+static constexpr uint32_t hcrc = 2;
+static constexpr uint32_t extra = 4;
+static constexpr uint32_t name = 8;
+static constexpr uint32_t comment = 16;
+} // namespace flag
+
+/// Base lengths and extra bits of the length symbols from 257.
+static constexpr uint16_t length_base[29] = {
+    3,  4,  5,  6,  7,  8,  9,  10, 11,  13,  15,  17,  19,  23, 27,
+    31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+static constexpr uint8_t length_extra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1,
+                                             1, 1, 2, 2, 2, 2, 3, 3, 3, 3,
+                                             4, 4, 4, 4, 5, 5, 5, 5, 0};
+
+/// Base distances and extra bits of the distance symbols.
+static constexpr uint16_t distance_base[30] = {
+    1,    2,    3,    4,    5,    7,     9,     13,    17,  25,
+    33,   49,   65,   97,   129,  193,   257,   385,   513, 769,
+    1025, 1537, 2049, 3073, 4097, 6145,  8193,  12289, 16385, 24577};
+static constexpr uint8_t distance_extra[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6,
+    6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+/// Order of the code length code lengths of a dynamic block.
+static constexpr uint8_t code_length_order[19] = {
+    16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+bool decoder::feed(std::string_view input, const sink_t& sink) {
+    m_input.erase(0, m_pos);
+    m_pos = 0;
+    m_input.append(input);
+
+    auto status = result::done;
+    while (status == result::done) {
+        switch (m_state) {
+        case state::header:
+            if (m_pos == m_input.size() && m_count == 0) {
+                status = result::more;
+                break;
+            }
+            status = read_header();
+            break;
+        case state::block:
+            status = read_block();
+            break;
+        case state::stored:
+            status = read_stored(sink);
+            break;
+        case state::codes:
+            status = read_codes(sink);
+            break;
+        case state::trailer:
+            status = read_trailer();
+            break;
+        }
+    }
+
+    flush(sink);
+    return status != result::invalid;
+}
+
+bool decoder::need(const unsigned n) {
+    while (m_count <= 56 && m_pos < m_input.size()) {
+        m_bits |= uint64_t(static_cast<uint8_t>(m_input[m_pos++])) << m_count;
+        m_count += 8;
+    }
+    return m_count >= n;
+}
+
+uint32_t decoder::take(const unsigned n) {
+    const auto value = static_cast<uint32_t>(m_bits & ((1ULL << n) - 1));
+    m_bits >>= n;
+    m_count -= n;
+    return value;
+}
+
+int decoder::decode(const table& table) {
+    if (m_count < table.bits) {
+        need(table.bits);
+    }
+
+    // Bits above m_count are zero, so a short code still decodes.
+    const auto entry = table.entries[m_bits & ((1U << table.bits) - 1)];
+    const auto length = entry & 0xff;
+    if (length == 0) {
+        return -2;
+    }
+    if (length > m_count) {
+        return -1;
+    }
+
+    take(length);
+    return static_cast<int>(entry >> 8);
+}
+
+uint8_t* decoder::reserve(const size_t n) {
+    if (m_output.size() < m_end + n) {
+        m_output.resize(std::max(m_end + n, m_output.size() * 2));
+    }
+    return m_output.data() + m_end;
+}
+
+void decoder::flush(const sink_t& sink) {
+    if (m_end > m_flushed) {
+        const auto data = reinterpret_cast<const char*>(m_output.data());
+        sink(std::string_view(data + m_flushed, m_end - m_flushed));
+        m_flushed = m_end;
+    }
+
+    if (m_end > window_size) {
+        std::memmove(m_output.data(), m_output.data() + m_end - window_size,
+                     window_size);
+        m_end = m_flushed = window_size;
+    }
+}
+
+decoder::result decoder::read_header() {
+    const auto start = save();
+    const auto more = [&] {
+        restore(start);
+        return result::more;
+    };
+
+    if (!need(32)) {
+        return more();
+    }
+
+    const auto id1 = take(8);
+    const auto id2 = take(8);
+    const auto method = take(8);
+    const auto flags = take(8);
+    if (id1 != 0x1f || id2 != 0x8b || method != 8) {
+        return result::invalid;
+    }
+
+    // Modification time, extra flags and OS.
+    if (!need(48)) {
+        return more();
+    }
+    take(32);
+    take(16);
+
+    if (flags & flag::extra) {
+        if (!need(16)) {
+            return more();
+        }
+        for (auto size = take(16); size > 0; size--) {
+            if (!need(8)) {
+                return more();
+            }
+            take(8);
+        }
+    }
+
+    for (const auto field : {flag::name, flag::comment}) {
+        if ((flags & field) == 0) {
+            continue;
+        }
+        do {
+            if (!need(8)) {
+                return more();
+            }
+        } while (take(8) != 0);
+    }
+
+    if (flags & flag::hcrc) {
+        if (!need(16)) {
+            return more();
+        }
+        take(16);
+    }
+
+    m_member = m_produced;
+    m_state = state::block;
+    return result::done;
+}
+
+decoder::result decoder::read_block() {
+    const auto start = save();
+    if (!need(3)) {
+        return result::more;
+    }
+
+    m_last = take(1) != 0;
+    const auto type = take(2);
+
+    if (type == 0) {
+        align();
+        if (!need(32)) {
+            restore(start);
+            return result::more;
+        }
+
+        const auto length = take(16);
+        if ((length ^ take(16)) != 0xffff) {
+            return result::invalid;
+        }
+
+        m_stored = length;
+        m_state = state::stored;
+        return result::done;
+    }
+
+    if (type == 1) {
+        uint8_t lengths[288 + 32];
+        std::fill(lengths, lengths + 144, uint8_t(8));
+        std::fill(lengths + 144, lengths + 256, uint8_t(9));
+        std::fill(lengths + 256, lengths + 280, uint8_t(7));
+        std::fill(lengths + 280, lengths + 288, uint8_t(8));
+        std::fill(lengths + 288, lengths + 320, uint8_t(5));
+
+        build(m_lengths, lengths, 288);
+        build(m_distances, lengths + 288, 32);
+        m_state = state::codes;
+        return result::done;
+    }
+
+    if (type == 2) {
+        const auto status = read_dynamic();
+        if (status == result::more) {
+            restore(start);
+        }
+        return status;
+    }
+
+    return result::invalid;
+}
+
+decoder::result decoder::read_dynamic() {
+    if (!need(14)) {
+        return result::more;
+    }
+
+    const auto literals = take(5) + 257;
+    const auto distances = take(5) + 1;
+    const auto code_lengths = take(4) + 4;
+    if (literals > 286 || distances > 30) {
+        return result::invalid;
+    }
+
+    uint8_t lengths[286 + 30] = {};
+    for (size_t i = 0; i < code_lengths; i++) {
+        if (!need(3)) {
+            return result::more;
+        }
+        lengths[code_length_order[i]] = static_cast<uint8_t>(take(3));
+    }
+
+    table codes;
+    if (!build(codes, lengths, 19)) {
+        return result::invalid;
+    }
+
+    std::fill(std::begin(lengths), std::end(lengths), uint8_t(0));
+    for (size_t i = 0; i < literals + distances;) {
+        const auto symbol = decode(codes);
+        if (symbol < 0) {
+            return symbol == -1 ? result::more : result::invalid;
+        }
+
+        if (symbol < 16) {
+            lengths[i++] = static_cast<uint8_t>(symbol);
+            continue;
+        }
+
+        // Repeat the previous length, or zeros.
+        static constexpr unsigned extra[3] = {2, 3, 7};
+        static constexpr unsigned base[3] = {3, 3, 11};
+        const auto code = symbol - 16;
+        if (!need(extra[code])) {
+            return result::more;
+        }
+
+        const auto repeat = base[code] + take(extra[code]);
+        if ((code == 0 && i == 0) || i + repeat > literals + distances) {
+            return result::invalid;
+        }
+
+        const auto length = code == 0 ? lengths[i - 1] : uint8_t(0);
+        std::fill(lengths + i, lengths + i + repeat, length);
+        i += repeat;
+    }
+
+    // The end of block must have a code.
+    if (lengths[256] == 0 || !build(m_lengths, lengths, literals) ||
+        !build(m_distances, lengths + literals, distances)) {
+        return result::invalid;
+    }
+
+    m_state = state::codes;
+    return result::done;
+}
+
+decoder::result decoder::read_stored(const sink_t& sink) {
+    // The bit buffer holds whole bytes after align().
+    while (m_stored > 0 && m_count >= 8) {
+        *reserve(1) = static_cast<uint8_t>(take(8));
+        m_end++;
+        m_produced++;
+        m_stored--;
+    }
+
+    while (m_stored > 0 && m_pos < m_input.size()) {
+        const auto n = std::min({m_stored, m_input.size() - m_pos,
+                                 flush_size});
+        std::memcpy(reserve(n), m_input.data() + m_pos, n);
+        m_pos += n;
+        m_end += n;
+        m_produced += n;
+        m_stored -= n;
+
+        if (m_end >= flush_size) {
+            flush(sink);
+        }
+    }
+
+    if (m_stored > 0) {
+        return result::more;
+    }
+
+    m_state = m_last ? state::trailer : state::block;
+    return result::done;
+}
+
+decoder::result decoder::read_codes(const sink_t& sink) {
+    for (;;) {
+        if (m_end >= flush_size) {
+            flush(sink);
+        }
+
+        const auto start = save();
+        const auto more = [&] {
+            restore(start);
+            return result::more;
+        };
+
+        // A symbol with its distance takes at most 48 bits.
+        need(48);
+
+        const auto symbol = decode(m_lengths);
+        if (symbol < 0) {
+            return symbol == -1 ? more() : result::invalid;
+        }
+
+        if (symbol < 256) {
+            *reserve(1) = static_cast<uint8_t>(symbol);
+            m_end++;
+            m_produced++;
+            continue;
+        }
+
+        if (symbol == 256) {
+            m_state = m_last ? state::trailer : state::block;
+            return result::done;
+        }
+
+        const auto index = static_cast<size_t>(symbol - 257);
+        if (index >= std::size(length_base)) {
+            return result::invalid;
+        }
+        if (m_count < length_extra[index]) {
+            return more();
+        }
+        const size_t length = length_base[index] + take(length_extra[index]);
+
+        const auto code = decode(m_distances);
+        if (code < 0) {
+            return code == -1 ? more() : result::invalid;
+        }
+        if (static_cast<size_t>(code) >= std::size(distance_base)) {
+            return result::invalid;
+        }
+        if (m_count < distance_extra[code]) {
+            return more();
+        }
+        const size_t distance =
+            distance_base[code] + take(distance_extra[code]);
+        if (distance > m_end) {
+            return result::invalid;
+        }
+
+        auto out = reserve(max_match);
+        const auto from = out - distance;
+        if (distance == 1) {
+            std::memset(out, *from, length);
+        } else if (distance >= length) {
+            std::memcpy(out, from, length);
+        } else {
+            // Copy the repeated pattern one period at a time.
+            for (size_t done = 0; done < length; done += distance) {
+                std::memcpy(out + done, from + done,
+                            std::min(distance, length - done));
+            }
+        }
+
+        m_end += length;
+        m_produced += length;
+    }
+}
+
+decoder::result decoder::read_trailer() {
+    align();
+    if (!need(64)) {
+        return result::more;
+    }
+
+    // The CRC is skipped, see the note of the class.
+    take(32);
+    const auto size = take(32);
+    if (size != static_cast<uint32_t>(m_produced - m_member)) {
+        return result::invalid;
+    }
+
+    m_state = state::header;
+    return result::done;
+}
+
+bool decoder::build(table& table, const uint8_t* lengths, const size_t n) {
+    uint16_t counts[16] = {};
+    for (size_t i = 0; i < n; i++) {
+        counts[lengths[i]]++;
+    }
+    counts[0] = 0;
+
+    int left = 1;
+    unsigned bits = 1;
+    for (unsigned length = 1; length < 16; length++) {
+        left = (left << 1) - counts[length];
+        if (left < 0) {
+            return false;
+        }
+        if (counts[length] != 0) {
+            bits = length;
+        }
+    }
+
+    uint32_t next[16] = {};
+    for (unsigned length = 1, code = 0; length < 16; length++) {
+        code = (code + counts[length - 1]) << 1;
+        next[length] = code;
+    }
+
+    // Codes are read from the lowest bit, so they are indexed reversed.
+    table.bits = bits;
+    table.entries.assign(size_t(1) << bits, 0);
+    for (size_t symbol = 0; symbol < n; symbol++) {
+        const unsigned length = lengths[symbol];
+        if (length == 0) {
+            continue;
+        }
+
+        const auto code = next[length]++;
+        uint32_t reversed = 0;
+        for (unsigned i = 0; i < length; i++) {
+            reversed |= ((code >> i) & 1) << (length - 1 - i);
+        }
+
+        const auto entry = static_cast<uint32_t>(symbol << 8 | length);
+        for (auto i = reversed; i < table.entries.size(); i += 1U << length) {
+            table.entries[i] = entry;
+        }
+    }
+
+    return true;
+}
+
+} // namespace adb::gzip
@@ -0,0 +1,130 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace adb::gzip {
+
+/// Streaming decoder of the gzip format.
+/**
+ * @note Input may be split anywhere. Concatenated members are accepted. The
+ * size in the trailer is checked but the CRC is not, as the adb stream is
+ * already reliable.
+ */
+class decoder {
+  public:
+    /// Function called with each chunk of decompressed data.
+    typedef std::function<void(std::string_view)> sink_t;
+
+    /// Feed compressed data to the decoder.
+    /**
+     * @return false if the data is not a valid gzip stream.
+     * @param input Compressed data.
+     * @param sink Function called with the decompressed data.
+     */
+    bool feed(std::string_view input, const sink_t& sink);
+
+    /// Check whether the last member has been completely decoded.
+    bool finished() const {
+        return m_state == state::header && m_pos == m_input.size() &&
+               m_count == 0;
+    }
+
+  private:
+    enum class state { header, block, stored, codes, trailer };
+
+    /// Outcome of a step of the parser.
+    enum class result { done, more, invalid };
+
+    /// Lookup table of a Huffman code, indexed by the next bits.
+    struct table {
+        /// Symbol << 8 | code length. 0 for unused codes.
+        std::vector<uint32_t> entries;
+
+        /// Bits of the index.
+        unsigned bits = 0;
+    };
+
+    /// Position of the parser, to go back when the input runs out.
+    struct mark {
+        size_t pos;
+        uint64_t bits;
+        unsigned count;
+    };
+
+    state m_state = state::header;
+
+    /// Whether the current block is the last one of the member.
+    bool m_last = false;
+
+    /// Input not yet consumed, from m_pos.
+    std::string m_input;
+    size_t m_pos = 0;
+
+    /// Bits read from the input and not yet consumed, from the lowest.
+    uint64_t m_bits = 0;
+    unsigned m_count = 0;
+
+    /// Bytes left in a stored block.
+    size_t m_stored = 0;
+
+    /// Codes of the current compressed block.
+    table m_lengths;
+    table m_distances;
+
+    /// Decoded data, keeping at least the last 32 KB for matches.
+    std::vector<uint8_t> m_output;
+    size_t m_end = 0;
+    size_t m_flushed = 0;
+
+    /// Bytes decoded in total, and before the current member.
+    uint64_t m_produced = 0;
+    uint64_t m_member = 0;
+
+    mark save() const { return {m_pos, m_bits, m_count}; }
+
+    void restore(const mark& mark) {
+        m_pos = mark.pos;
+        m_bits = mark.bits;
+        m_count = mark.count;
+    }
+
+    /// Make sure the bit buffer holds n bits, if the input allows.
+    bool need(const unsigned n);
+
+    /// Consume n bits, which must be in the bit buffer.
+    uint32_t take(const unsigned n);
+
+    /// Drop the bits up to the next byte boundary.
+    void align() { take(m_count % 8); }
+
+    /// Decode one symbol.
+    /**
+     * @return The symbol, -1 if more input is needed, or -2 if invalid.
+     */
+    int decode(const table& table);
+
+    /// Make room for n more bytes of output.
+    uint8_t* reserve(const size_t n);
+
+    /// Pass the new output to the sink, and keep only the window.
+    void flush(const sink_t& sink);
+
+    result read_header();
+    result read_block();
+    result read_dynamic();
+    result read_stored(const sink_t& sink);
+    result read_codes(const sink_t& sink);
+    result read_trailer();
+
+    /// Build the lookup table of a canonical Huffman code.
+    /**
+     * @return false if the code lengths are over-subscribed.
+     */
+    static bool build(table& table, const uint8_t* lengths, const size_t n);
+};
+
+} // namespace adb::gzip
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+namespace adb::h264 {
+
+/// NAL unit types used by the stream.
+namespace nal_type {
+static constexpr uint8_t idr = 5;
+static constexpr uint8_t sps = 7;
+static constexpr uint8_t pps = 8;
+} // namespace nal_type
+
+/// Find the next `00 00 01` start code of an Annex-B stream.
+/**
+ * @return Offset of the first byte of the start code, or npos.
+ * @param data Stream data.
+ * @param from Offset to start from.
+ * @param size Size of the data.
+ * @note Emulation prevention guarantees that the pattern never occurs inside
+ * a NAL unit.
+ */
+inline size_t find_start_code(const uint8_t* data, size_t from,
+                              const size_t size) {
+    // Look for the 01, then check the zeros before it.
+    from += 2;
+    while (from < size) {
+        const auto hit = std::memchr(data + from, 1, size - from);
+        if (hit == nullptr) {
+            break;
+        }
+
+        const auto pos = static_cast<const uint8_t*>(hit) - data;
+        if (data[pos - 1] == 0 && data[pos - 2] == 0) {
+            return pos - 2;
+        }
+        from = pos + 1;
+    }
+    return std::string_view::npos;
+}
+
+/// Get the size of the start code at the beginning of a NAL unit.
+/**
+ * @return 4 for `00 00 00 01`, otherwise 3.
+ * @param data Unit data, starting with a start code.
+ */
+inline size_t start_code_size(const uint8_t* data) {
+    return data[2] == 0 ? 4 : 3;
+}
+
+} // namespace adb::h264
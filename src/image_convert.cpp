@@ -0,0 +1,109 @@
+#include <algorithm>
+#include <cstring>
+
+#include "image_convert.hpp"
+
+namespace adb {
+
+image_view convert_image(const image_view& src, const pixel_format format,
+                         const uint32_t scale, std::vector<uint8_t>& buffer) {
+    frame_converter converter;
+    if (src.empty() || !converter.reset(src, format, scale)) {
+        return {};
+    }
+
+    auto output = converter.output();
+    if (buffer.size() < output.size()) {
+        buffer.resize(output.size());
+    }
+
+    converter.convert(src.data, src.height, buffer.data());
+    output.data = buffer.data();
+    return output;
+}
+
+bool frame_converter::reset(const image_view& src, pixel_format format,
+                            const uint32_t scale) {
+    switch (src.format) {
+    case pixel_format::rgba_8888:
+    case pixel_format::rgbx_8888:
+    case pixel_format::bgra_8888:
+        break;
+    default:
+        return false;
+    }
+
+    if (format == pixel_format::unknown) {
+        format = src.format;
+    }
+    if (format != src.format && format != pixel_format::bgr_888 &&
+        format != pixel_format::gray_8) {
+        return false;
+    }
+
+    if (scale == 0 || scale > max_scale) {
+        return false;
+    }
+
+    m_source = src;
+    m_source.data = nullptr;
+    m_scale = scale;
+    m_row = 0;
+
+    m_output.width = src.width / scale;
+    m_output.height = src.height / scale;
+    m_output.stride = m_output.width * bytes_per_pixel(format);
+    m_output.format = format;
+
+    if (scale > 1) {
+        m_sums.assign(static_cast<size_t>(m_output.width) * scale * 4, 0);
+        m_line.resize(static_cast<size_t>(m_output.width) * 4);
+    }
+
+    return true;
+}
+
+void frame_converter::convert(const uint8_t* src, const size_t rows,
+                              uint8_t* dst) {
+    const auto width = m_output.width;
+
+    for (size_t i = 0; i < rows; i++, m_row++, src += m_source.stride) {
+        const auto row = m_row / m_scale;
+        if (row >= m_output.height) {
+            continue;
+        }
+
+        const auto out = dst + row * m_output.stride;
+        if (m_scale == 1) {
+            emit(src, out);
+            continue;
+        }
+
+        m_kernels.accumulate(src, m_sums.data(), m_sums.size());
+        if ((m_row + 1) % m_scale != 0) {
+            continue;
+        }
+
+        m_kernels.average(m_sums.data(), m_line.data(), width, m_scale);
+        emit(m_line.data(), out);
+        std::fill(m_sums.begin(), m_sums.end(), uint16_t(0));
+    }
+}
+
+void frame_converter::emit(const uint8_t* src, uint8_t* dst) {
+    const auto red_first = m_source.format != pixel_format::bgra_8888;
+
+    switch (m_output.format) {
+    case pixel_format::bgr_888:
+        m_kernels.to_bgr(src, dst, m_output.width, red_first);
+        break;
+    case pixel_format::gray_8:
+        m_kernels.to_gray(src, dst, m_output.width, red_first);
+        break;
+    default:
+        std::memcpy(dst, src, m_output.stride);
+        break;
+    }
+}
+
+} // namespace adb
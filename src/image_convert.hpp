@@ -0,0 +1,69 @@
+#pragma once
+
+#include <vector>
+
+#include "image.hpp"
+#include "pixel_kernels.hpp"
+
+namespace adb {
+
+/// Converter of images that are received row by row.
+/**
+ * @note Rows can be fed in bands of any size, so the conversion runs while
+ * the rest of the image is still on the wire.
+ */
+class frame_converter {
+  public:
+    /// Prepare to convert an image.
+    /**
+     * @return false if the conversion is not supported.
+     * @param src Shape of the source image. Its data is not used.
+     * @param format Format to convert to. pixel_format::unknown keeps the
+     * format of the source.
+     * @param scale Factor to divide the width and the height by.
+     * @note See convert_image() for the supported conversions.
+     */
+    bool reset(const image_view& src, pixel_format format,
+               const uint32_t scale);
+
+    /// Get the shape of the converted image.
+    /**
+     * @note Its data is null, since the converter does not own a buffer.
+     */
+    const image_view& output() const { return m_output; }
+
+    /// Convert the next rows of the source.
+    /**
+     * @param src First byte of the rows.
+     * @param rows Number of rows.
+     * @param dst Buffer of the whole converted image.
+     */
+    void convert(const uint8_t* src, const size_t rows, uint8_t* dst);
+
+    /// Largest factor of the scale.
+    /**
+     * @note Column sums of a box are 16-bit, which allows far more than this.
+     */
+    static constexpr uint32_t max_scale = 16;
+
+  private:
+    const pixel::kernels& m_kernels = pixel::best_kernels();
+
+    image_view m_source;
+    image_view m_output;
+    uint32_t m_scale = 1;
+
+    /// Rows of the source converted so far.
+    size_t m_row = 0;
+
+    /// Column sums of the rows of the current box, one per byte.
+    std::vector<uint16_t> m_sums;
+
+    /// Averaged row, still in the format of the source.
+    std::vector<uint8_t> m_line;
+
+    /// Write a row of the output from a row of 4-byte pixels.
+    void emit(const uint8_t* src, uint8_t* dst);
+};
+
+} // namespace adb
@@ -0,0 +1,224 @@
+#include <algorithm>
+#include <set>
+
+#include <asio/post.hpp>
+
+#include "input_injector_impl.hpp"
+
+namespace adb {
+
+input_event input_event::down(std::chrono::microseconds at, int contact, int x,
+                              int y, int pressure) {
+    return {at,
+            "d " + std::to_string(contact) + " " + std::to_string(x) + " " +
+                std::to_string(y) + " " + std::to_string(pressure),
+            contact};
+}
+
+input_event input_event::move(std::chrono::microseconds at, int contact, int x,
+                              int y, int pressure) {
+    return {at,
+            "m " + std::to_string(contact) + " " + std::to_string(x) + " " +
+                std::to_string(y) + " " + std::to_string(pressure),
+            contact};
+}
+
+input_event input_event::up(std::chrono::microseconds at, int contact) {
+    return {at, "u " + std::to_string(contact), contact};
+}
+
+input_event input_event::key(std::chrono::microseconds at, int keycode,
+                             bool pressed) {
+    return {at, "k " + std::to_string(keycode) + (pressed ? " d" : " u"), -1};
+}
+
+input_event input_event::reset(std::chrono::microseconds at) {
+    return {at, "r", -1};
+}
+
+std::vector<input_event> swipe(int contact, int x0, int y0, int x1, int y1,
+                               std::chrono::microseconds duration,
+                               int steps) {
+    steps = std::max(steps, 1);
+
+    std::vector<input_event> events;
+    events.push_back(input_event::down({}, contact, x0, y0));
+    for (int i = 1; i <= steps; i++) {
+        const auto at = duration * i / steps;
+        const auto x = x0 + (x1 - x0) * i / steps;
+        const auto y = y0 + (y1 - y0) * i / steps;
+        events.push_back(input_event::move(at, contact, x, y));
+    }
+    events.push_back(input_event::up(duration, contact));
+    return events;
+}
+
+/// Number of buckets of the jitter histogram, covering 10 ms.
+static constexpr size_t jitter_buckets = 1000;
+
+input_injector_impl::input_injector_impl(asio::io_context& context,
+                                         std::shared_ptr<io_handle> handle,
+                                         const double frame_rate)
+    : m_handle(std::move(handle)), m_timer(context),
+      m_frame(std::chrono::duration_cast<clock::duration>(
+          std::chrono::duration<double>(1) / std::clamp(frame_rate, 1.0, 1e6))),
+      m_histogram(jitter_buckets + 1) {}
+
+void input_injector_impl::schedule(std::vector<input_event> events) {
+    const auto start = clock::now();
+
+    // Events of a frame are written in the order of their times.
+    std::stable_sort(events.begin(), events.end(),
+                     [](const auto& a, const auto& b) { return a.at < b.at; });
+
+    {
+        std::lock_guard lock(m_mutex);
+        for (auto& event : events) {
+            const auto offset = clock::duration(event.at);
+            const auto time = start + offset / m_frame * m_frame;
+            m_frames[time].push_back(std::move(event));
+        }
+    }
+
+    asio::post(m_timer.get_executor(),
+               [self = shared_from_this()] { self->arm(); });
+}
+
+bool input_injector_impl::wait(const int64_t timeout) {
+    const auto deadline = clock::now() + std::chrono::milliseconds(timeout);
+
+    {
+        std::unique_lock lock(m_mutex);
+        const auto done = [this] { return m_frames.empty() || m_failed; };
+        if (!m_cv.wait_until(lock, deadline, done) || m_failed) {
+            return false;
+        }
+    }
+
+    using namespace std::chrono;
+    const auto left = duration_cast<milliseconds>(deadline - clock::now());
+    return left.count() > 0 &&
+           m_handle->flush(static_cast<unsigned>(left.count()));
+}
+
+void input_injector_impl::cancel() {
+    {
+        std::lock_guard lock(m_mutex);
+        m_frames.clear();
+    }
+    m_cv.notify_all();
+
+    asio::post(m_timer.get_executor(), [self = shared_from_this()] {
+        self->m_timer.cancel();
+        self->m_armed = clock::time_point::max();
+    });
+}
+
+input_stats input_injector_impl::stats() const {
+    std::lock_guard lock(m_mutex);
+    return m_stats;
+}
+
+void input_injector_impl::arm() {
+    clock::time_point next;
+    {
+        std::lock_guard lock(m_mutex);
+        if (m_frames.empty()) {
+            return;
+        }
+        next = m_frames.begin()->first;
+    }
+
+    if (next >= m_armed) {
+        return;
+    }
+
+    // Moving the expiry cancels the previous wait.
+    m_armed = next;
+    m_timer.expires_at(next);
+    m_timer.async_wait([self = shared_from_this()](const auto& ec) {
+        if (ec) {
+            return;
+        }
+
+        self->m_armed = clock::time_point::max();
+        self->dispatch();
+        self->arm();
+    });
+}
+
+void input_injector_impl::dispatch() {
+    const auto now = clock::now();
+
+    std::unique_lock lock(m_mutex);
+    while (!m_frames.empty() && m_frames.begin()->first <= now) {
+        auto node = m_frames.extract(m_frames.begin());
+        const auto& events = node.mapped();
+
+        if (!m_failed && !m_handle->write_async(encode(events))) {
+            m_failed = true;
+        }
+        record(now - node.key(), events.size());
+    }
+    lock.unlock();
+
+    m_cv.notify_all();
+}
+
+std::string
+input_injector_impl::encode(const std::vector<input_event>& events) {
+    std::string data;
+
+    // Contacts changed since the last commit.
+    std::set<int> pending;
+
+    for (const auto& event : events) {
+        if (event.contact >= 0 && pending.contains(event.contact)) {
+            data += "c\n";
+            pending.clear();
+        }
+
+        data += event.command;
+        data += '\n';
+
+        if (event.contact >= 0) {
+            pending.insert(event.contact);
+        }
+    }
+
+    if (!pending.empty()) {
+        data += "c\n";
+    }
+
+    return data;
+}
+
+void input_injector_impl::record(const clock::duration delay,
+                                 const size_t events) {
+    using namespace std::chrono;
+    const auto us = duration<double, std::micro>(delay).count();
+
+    m_stats.events += events;
+    m_stats.batches++;
+    m_jitter_sum += us;
+    m_stats.mean_jitter = m_jitter_sum / m_stats.batches;
+    m_stats.max_jitter = std::max(m_stats.max_jitter, us);
+
+    const auto bucket = static_cast<size_t>(delay / jitter_bucket);
+    m_histogram[std::min(bucket, jitter_buckets)]++;
+
+    // The percentile is the upper bound of the bucket that reaches it.
+    const auto target = (m_stats.batches * 99 + 99) / 100;
+    uint64_t count = 0;
+    for (size_t i = 0; i <= jitter_buckets; i++) {
+        count += m_histogram[i];
+        if (count >= target) {
+            const auto bound = duration<double, std::micro>(jitter_bucket);
+            m_stats.p99_jitter =
+                std::min((i + 1) * bound.count(), m_stats.max_jitter);
+            break;
+        }
+    }
+}
+
+} // namespace adb
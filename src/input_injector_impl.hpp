@@ -0,0 +1,82 @@
+#pragma once
+
+#include <condition_variable>
+#include <map>
+#include <mutex>
+
+#include <asio/steady_timer.hpp>
+
+#include "input_injector.hpp"
+#include "io_handle.hpp"
+
+namespace adb {
+
+/// Pimpl class for input_injector.
+class input_injector_impl
+    : public input_injector,
+      public std::enable_shared_from_this<input_injector_impl> {
+  public:
+    /// Construct an input_injector_impl.
+    /**
+     * @param context io_context of the timer.
+     * @param handle Connection to write the events to.
+     * @param frame_rate Number of frames per second.
+     */
+    input_injector_impl(asio::io_context& context,
+                        std::shared_ptr<io_handle> handle,
+                        const double frame_rate);
+
+    void schedule(std::vector<input_event> events) override;
+    bool wait(const int64_t timeout) override;
+    void cancel() override;
+    input_stats stats() const override;
+
+  private:
+    typedef std::chrono::steady_clock clock;
+
+    std::shared_ptr<io_handle> m_handle;
+
+    asio::steady_timer m_timer;
+
+    /// Expiry of the pending wait of the timer, if any.
+    clock::time_point m_armed = clock::time_point::max();
+
+    /// Duration of a frame.
+    const clock::duration m_frame;
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_cv;
+
+    /// Events waiting to be written, by the time of their frame.
+    std::map<clock::time_point, std::vector<input_event>> m_frames;
+
+    /// Whether writing to the connection has failed.
+    bool m_failed = false;
+
+    /// Histogram of the delays, in buckets of jitter_bucket.
+    static constexpr auto jitter_bucket = std::chrono::microseconds(10);
+    std::vector<uint64_t> m_histogram;
+
+    input_stats m_stats;
+    double m_jitter_sum = 0;
+
+    /// Arm the timer for the earliest frame.
+    /**
+     * @note Called on the event loop.
+     */
+    void arm();
+
+    /// Write the frames that are due.
+    /**
+     * @note Called on the event loop.
+     */
+    void dispatch();
+
+    /// Encode the events of a frame, with their commits.
+    static std::string encode(const std::vector<input_event>& events);
+
+    /// Account a write delayed after its frame time.
+    void record(const clock::duration delay, const size_t events);
+};
+
+} // namespace adb
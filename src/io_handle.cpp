@@ -1,45 +1,373 @@
 #include <future>
 
+#include <asio/post.hpp>
+#include <asio/write.hpp>
+
 #include "io_handle_impl.hpp"
 
-adb::io_handle_impl::io_handle_impl(protocol::async_handle&& handle)
-    : m_socket(std::move(handle.m_socket)) {
-    asio::socket_base::keep_alive option(true);
-    m_socket.set_option(option);
+namespace adb {
+
+using std::chrono::steady_clock;
+
+/// Queued data smaller than this is appended to the previous chunk.
+static constexpr size_t coalesce_size = 16 * 1024;
+
+/// Deadline of a timeout in milliseconds, where 0 means no timeout.
+static inline steady_clock::time_point deadline_of(const unsigned timeout) {
+    if (timeout == 0) {
+        return steady_clock::time_point::max();
+    }
+    return steady_clock::now() + std::chrono::milliseconds(timeout);
+}
+
+io_stream::io_stream(asio::ip::tcp::socket&& socket)
+    : socket(std::move(socket)) {}
+
+void io_stream::start_reading(const size_t capacity) {
+    ring = std::make_unique<spsc_ring>(capacity);
+    asio::post(socket.get_executor(),
+               [self = shared_from_this()] { self->receive(); });
+}
+
+bool io_stream::wait_readable(const size_t size,
+                              const steady_clock::time_point deadline) {
+    if (ring->size() >= size) {
+        return true;
+    }
+
+    const auto ready = [&] { return ring->size() >= size || closed; };
+
+    std::unique_lock lock(m_mutex);
+    m_waiters++;
+    if (deadline == steady_clock::time_point::max()) {
+        m_cv.wait(lock, ready);
+    } else {
+        m_cv.wait_until(lock, deadline, ready);
+    }
+    m_waiters--;
+
+    return ring->size() >= size;
+}
+
+void io_stream::resume_reading() {
+    if (m_paused.exchange(false)) {
+        asio::post(socket.get_executor(),
+                   [self = shared_from_this()] { self->receive(); });
+    }
+}
+
+void io_stream::receive() {
+    auto regions = ring->write_regions();
+    if (regions[0].empty()) {
+        // The consumer may have made room in the meantime, and only one side
+        // gets to resume.
+        m_paused = true;
+        regions = ring->write_regions();
+        if (regions[0].empty() || !m_paused.exchange(false)) {
+            return;
+        }
+    }
+
+    const std::array buffers = {
+        asio::buffer(regions[0].data(), regions[0].size()),
+        asio::buffer(regions[1].data(), regions[1].size()),
+    };
+
+    socket.async_read_some(buffers, [self = shared_from_this()](
+                                        const auto& ec, auto size) {
+        if (ec) {
+            self->closed = true;
+            self->notify();
+            return;
+        }
+
+        self->ring->commit_write(size);
+        self->notify();
+        self->receive();
+    });
+}
+
+bool io_stream::enqueue(const std::string_view data) {
+    {
+        std::lock_guard lock(m_write_mutex);
+        if (m_write_error || m_close_pending) {
+            return false;
+        }
+
+        // A single chunk larger than the mark still goes through alone.
+        const auto size = m_queued_bytes + data.size();
+        if (m_queued_bytes > 0 && size > m_high_water_mark) {
+            return false;
+        }
+
+        if (!m_queue.empty() &&
+            m_queue.back().size() + data.size() <= coalesce_size) {
+            m_queue.back().append(data);
+        } else {
+            m_queue.emplace_back(data);
+        }
+        m_queued_bytes = size;
+
+        if (m_write_active) {
+            return true;
+        }
+        m_write_active = true;
+    }
+
+    // Data queued before the post runs goes out in the same write.
+    asio::post(socket.get_executor(),
+               [self = shared_from_this()] { self->send(); });
+    return true;
+}
+
+bool io_stream::flush(const steady_clock::time_point deadline) {
+    std::unique_lock lock(m_write_mutex);
+    const auto drained = [this] { return m_queued_bytes == 0; };
+
+    if (deadline == steady_clock::time_point::max()) {
+        m_write_cv.wait(lock, drained);
+    } else {
+        m_write_cv.wait_until(lock, deadline, drained);
+    }
+
+    return drained() && !m_write_error;
 }
 
-std::string adb::io_handle_impl::read(unsigned timeout) {
+void io_stream::set_high_water_mark(const size_t bytes) {
+    std::lock_guard lock(m_write_mutex);
+    m_high_water_mark = bytes;
+}
+
+void io_stream::close() {
+    {
+        std::lock_guard lock(m_write_mutex);
+        m_close_pending = true;
+
+        // The last write closes the socket after the queue is drained.
+        if (m_write_active) {
+            return;
+        }
+
+        // Nothing runs on the event loop, so the socket can be closed here.
+        if (!ring) {
+            asio::error_code ignored;
+            socket.close(ignored);
+            return;
+        }
+    }
+
+    // The pending read is cancelled on the event loop.
+    asio::post(socket.get_executor(), [self = shared_from_this()] {
+        asio::error_code ignored;
+        self->socket.close(ignored);
+    });
+}
+
+void io_stream::abort() {
+    // Blocking reads see the end of the stream, and pending writes fail.
+    asio::error_code ignored;
+    socket.shutdown(asio::socket_base::shutdown_both, ignored);
+    closed = true;
+    notify();
+}
+
+void io_stream::send() {
+    std::vector<asio::const_buffer> buffers;
+    {
+        std::lock_guard lock(m_write_mutex);
+        for (auto& data : m_queue) {
+            m_writing.push_back(std::move(data));
+        }
+        m_queue.clear();
+
+        for (const auto& data : m_writing) {
+            buffers.push_back(asio::buffer(data));
+        }
+    }
+
+    asio::async_write(socket, buffers, [self = shared_from_this()](
+                                           const auto& ec, auto) {
+        std::unique_lock lock(self->m_write_mutex);
+        for (const auto& data : self->m_writing) {
+            self->m_queued_bytes -= data.size();
+        }
+        self->m_writing.clear();
+
+        // Data queued after a failure would never be written.
+        if (ec) {
+            self->m_write_error = ec;
+            self->m_queue.clear();
+            self->m_queued_bytes = 0;
+        }
+
+        const auto more = !self->m_queue.empty();
+        const auto close = !more && self->m_close_pending;
+        self->m_write_active = more;
+        lock.unlock();
+        self->m_write_cv.notify_all();
+
+        if (more) {
+            self->send();
+        } else if (close) {
+            asio::error_code ignored;
+            self->socket.close(ignored);
+        }
+    });
+}
+
+void io_stream::notify() {
+    // Pairs with the increment of m_waiters before the check of the buffer.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (m_waiters > 0) {
+        std::lock_guard lock(m_mutex);
+        m_cv.notify_all();
+    }
+}
+
+io_handle_impl::io_handle_impl(protocol::async_handle&& handle)
+    : m_stream(std::make_shared<io_stream>(std::move(handle.m_socket))) {
+    protocol::set_liveness(m_stream->socket);
+
+    // The stream is alive as long as it is registered.
+    auto& context = m_stream->socket.get_executor().context();
+    protocol::track(context, this,
+                    [stream = m_stream.get()](const std::error_code&) {
+                        stream->abort();
+                    });
+}
+
+io_handle_impl::~io_handle_impl() {
+    protocol::untrack(this);
+    m_stream->close();
+}
+
+std::string io_handle_impl::read(unsigned timeout) {
+    if (m_stream->ring) {
+        if (!m_stream->wait_readable(1, deadline_of(timeout))) {
+            return "";
+        }
+
+        std::string data(m_stream->ring->size(), '\0');
+        data.resize(m_stream->ring->read(data.data(), data.size()));
+        m_stream->resume_reading();
+        return data;
+    }
+
     std::array<char, 1024> buffer;
+    const auto bytes_read = read(buffer, timeout);
+    return std::string(buffer.data(), bytes_read);
+}
+
+size_t io_handle_impl::read(std::span<char> buffer, unsigned timeout) {
+    if (m_stream->ring) {
+        if (!m_stream->wait_readable(1, deadline_of(timeout))) {
+            return 0;
+        }
+
+        const auto size = m_stream->ring->read(buffer.data(), buffer.size());
+        m_stream->resume_reading();
+        return size;
+    }
+
+    auto& socket = m_stream->socket;
+    const auto buffers = asio::buffer(buffer.data(), buffer.size());
 
     if (timeout == 0) {
-        const auto bytes_read = m_socket.read_some(asio::buffer(buffer));
-        return std::string(buffer.data(), bytes_read);
+        asio::error_code ec;
+        const auto bytes_read = socket.read_some(buffers, ec);
+        return ec ? 0 : bytes_read;
     }
 
-    std::error_code ec;
     size_t bytes_read = 0;
     std::promise<void> promise;
 
-    const auto buffers = asio::buffer(buffer);
-    m_socket.async_read_some(buffers, [&](const auto& error, auto size) {
-        if (error == asio::error::operation_aborted) {
-            return;
-        }
-
-        ec = error;
-        bytes_read = size;
+    // The handler always runs, also when cancelled, and fills the buffer.
+    socket.async_read_some(buffers, [&](const auto& error, auto size) {
+        bytes_read = error ? 0 : size;
         promise.set_value();
     });
 
     auto future = promise.get_future();
     auto status = future.wait_for(std::chrono::milliseconds(timeout));
     if (status == std::future_status::timeout) {
-        m_socket.cancel();
+        // Cancel on the event loop, and keep the buffer alive until the
+        // handler is done, which may still deliver data received meanwhile.
+        asio::post(socket.get_executor(), [&socket] {
+            asio::error_code ignored;
+            socket.cancel(ignored);
+        });
+        future.wait();
     }
 
-    return std::string(buffer.data(), bytes_read);
+    return bytes_read;
+}
+
+std::string io_handle_impl::read_until(const std::string_view delimiter,
+                                       unsigned timeout) {
+    read_ahead();
+
+    auto& ring = *m_stream->ring;
+    const auto deadline = deadline_of(timeout);
+
+    // Bytes known not to contain the start of the delimiter.
+    size_t scanned = 0;
+
+    while (true) {
+        // Everything has been buffered if the connection was closed before.
+        const bool closed = m_stream->closed;
+        const auto size = ring.size();
+
+        auto length = ring.find(delimiter, scanned);
+        if (length != std::string_view::npos) {
+            length += delimiter.size();
+        } else if (closed || size == ring.capacity()) {
+            length = size;
+        }
+
+        if (length != std::string_view::npos) {
+            std::string frame(length, '\0');
+            ring.read(frame.data(), length);
+            m_stream->resume_reading();
+            return frame;
+        }
+
+        scanned = size >= delimiter.size() ? size - delimiter.size() + 1 : 0;
+        if (!m_stream->wait_readable(size + 1, deadline) &&
+            !m_stream->closed) {
+            return "";
+        }
+    }
+}
+
+void io_handle_impl::read_ahead(size_t capacity) {
+    if (!m_stream->ring) {
+        m_stream->start_reading(capacity);
+    }
 }
 
-void adb::io_handle_impl::write(const std::string_view data) {
-    m_socket.write_some(asio::buffer(data));
+void io_handle_impl::write(const std::string_view data) {
+    if (m_scheduler) {
+        m_scheduler->touch();
+    }
+
+    // Keep the order with the data queued before.
+    m_stream->flush(steady_clock::time_point::max());
+    asio::write(m_stream->socket, asio::buffer(data));
 }
+
+bool io_handle_impl::write_async(const std::string_view data) {
+    if (m_scheduler) {
+        m_scheduler->touch();
+    }
+    return m_stream->enqueue(data);
+}
+
+bool io_handle_impl::flush(unsigned timeout) {
+    return m_stream->flush(deadline_of(timeout));
+}
+
+void io_handle_impl::set_high_water_mark(size_t bytes) {
+    m_stream->set_high_water_mark(bytes);
+}
+
+} // namespace adb
@@ -1,23 +1,149 @@
 #pragma once
 
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
 #include <asio/ip/tcp.hpp>
 
 #include "io_handle.hpp"
 #include "protocol.hpp"
+#include "scheduler.hpp"
+#include "spsc_ring.hpp"
 
 namespace adb {
 
+/// Socket of an io_handle, shared with the handlers on the event loop.
+class io_stream : public std::enable_shared_from_this<io_stream> {
+  public:
+    io_stream(asio::ip::tcp::socket&& socket);
+
+    /// TCP connection to adbd.
+    asio::ip::tcp::socket socket;
+
+    /// Buffer filled by the reads on the event loop, if started.
+    std::unique_ptr<spsc_ring> ring;
+
+    /// Whether the connection has been closed by the device or on error.
+    std::atomic<bool> closed = false;
+
+    /// Start reading into the ring buffer.
+    /**
+     * @param capacity Size of the ring buffer.
+     * @note Called on the thread of the consumer, only once.
+     */
+    void start_reading(const size_t capacity);
+
+    /// Wait until enough data is buffered, or the connection is closed.
+    /**
+     * @return true if at least size bytes are buffered.
+     * @param size Number of bytes to wait for.
+     * @param deadline Time to give up. Waits forever if max().
+     */
+    bool wait_readable(const size_t size,
+                       const std::chrono::steady_clock::time_point deadline);
+
+    /// Resume the reads paused on a full buffer, after data is consumed.
+    void resume_reading();
+
+    /// Queue data to be written on the event loop.
+    /**
+     * @return false if the data is refused.
+     */
+    bool enqueue(const std::string_view data);
+
+    /// Wait until all queued data is written.
+    /**
+     * @return true if the queue is empty.
+     */
+    bool flush(const std::chrono::steady_clock::time_point deadline);
+
+    /// Set the size above which enqueue() refuses data.
+    void set_high_water_mark(const size_t bytes);
+
+    /// Close the socket on the event loop, after the queued data is written.
+    void close();
+
+    /// Shut the connection down at once, waking up the reads and writes.
+    /**
+     * @note Called on the event loop, when the device goes away.
+     */
+    void abort();
+
+  private:
+    /// Whether the reads are paused because the buffer is full.
+    std::atomic<bool> m_paused = false;
+
+    /// Number of consumers waiting on the condition variable.
+    std::atomic<int> m_waiters = 0;
+
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+
+    /// Guard of the write queue.
+    std::mutex m_write_mutex;
+
+    /// Signalled when queued data is written, or the write fails.
+    std::condition_variable m_write_cv;
+
+    /// Data queued but not written yet.
+    std::deque<std::string> m_queue;
+
+    /// Data of the write in progress.
+    std::vector<std::string> m_writing;
+
+    /// Bytes in m_queue and m_writing.
+    size_t m_queued_bytes = 0;
+
+    /// Size above which enqueue() refuses data.
+    size_t m_high_water_mark = 1 << 20;
+
+    /// Whether a write is in progress or posted.
+    bool m_write_active = false;
+
+    /// Whether to close the socket once the queue is drained.
+    bool m_close_pending = false;
+
+    /// Error of the last write.
+    asio::error_code m_write_error;
+
+    /// Read into the free space of the ring buffer.
+    void receive();
+
+    /// Write all queued data with one gather write.
+    void send();
+
+    /// Wake up the waiting consumer, if any.
+    void notify();
+};
+
 /// Pimpl class for io_handle.
 class io_handle_impl : public io_handle {
   public:
     io_handle_impl(protocol::async_handle&& handle);
+    ~io_handle_impl();
 
     void write(const std::string_view data) override;
     std::string read(unsigned timeout = 0) override;
+    size_t read(std::span<char> buffer, unsigned timeout = 0) override;
+    std::string read_until(const std::string_view delimiter,
+                           unsigned timeout = 0) override;
+    void read_ahead(size_t capacity = 1 << 20) override;
+
+    bool write_async(const std::string_view data) override;
+    bool flush(unsigned timeout = 0) override;
+    void set_high_water_mark(size_t bytes) override;
+
+    /// Report the writes as interactive traffic of the device.
+    void set_scheduler(std::shared_ptr<traffic_scheduler> scheduler) {
+        m_scheduler = std::move(scheduler);
+    }
 
   private:
-    /// TCP connection to adbd.
-    asio::ip::tcp::socket m_socket;
+    std::shared_ptr<io_stream> m_stream;
+
+    /// Scheduler of the device, if the handle is an interactive shell.
+    std::shared_ptr<traffic_scheduler> m_scheduler;
 };
 
 } // namespace adb
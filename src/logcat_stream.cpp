@@ -0,0 +1,303 @@
+#include <algorithm>
+#include <cstring>
+
+#include <asio/post.hpp>
+
+#include "logcat_stream_impl.hpp"
+
+namespace adb {
+
+namespace logcat {
+
+/// Names of the buffers for `logcat -b`, indexed by log_buffer.
+static constexpr std::string_view buffer_names[] = {
+    "main", "radio", "events", "system", "crash", "stats", "security", "kernel",
+};
+
+/// Decode a little-endian field of a record header.
+template <typename T> static inline T field(const char* p) {
+    T value = 0;
+    for (int i = sizeof(T) - 1; i >= 0; i--) {
+        value = static_cast<T>((value << 8) | static_cast<uint8_t>(p[i]));
+    }
+    return value;
+}
+
+/// Check whether the payloads of a buffer are binary events.
+static inline bool binary_buffer(const log_buffer buffer) {
+    return buffer == log_buffer::events || buffer == log_buffer::stats ||
+           buffer == log_buffer::security;
+}
+
+size_t parse(const char* data, const size_t size, log_record& record) {
+    if (size < 4) {
+        return 0;
+    }
+
+    // The header size field was padding in version 1.
+    const auto length = field<uint16_t>(data);
+    auto header = static_cast<size_t>(field<uint16_t>(data + 2));
+    if (header == 0) {
+        header = header_v1;
+    }
+    if (header < header_v1 || header > max_header) {
+        return std::string_view::npos;
+    }
+
+    const auto total = header + length;
+    if (size < total) {
+        return 0;
+    }
+
+    // Offset 20 is the euid in version 2 and the lid from version 3, both
+    // with 24-byte headers. An euid is 0, which is also `main`, or a uid far
+    // above the buffer ids, so anything out of range is a version 2 euid.
+    uint32_t lid = 0;
+    uint32_t uid = header >= 28 ? field<uint32_t>(data + 24) : 0;
+    if (header >= 24) {
+        lid = field<uint32_t>(data + 20);
+        if (lid >= std::size(buffer_names)) {
+            uid = header == 24 ? lid : uid;
+            lid = 0;
+        }
+    }
+
+    using namespace std::chrono;
+    const auto time = seconds(field<uint32_t>(data + 12)) +
+                      nanoseconds(field<uint32_t>(data + 16));
+    record.pid = field<int32_t>(data + 4);
+    record.tid = field<uint32_t>(data + 8);
+    record.uid = uid;
+    record.timestamp = system_clock::time_point(
+        duration_cast<system_clock::duration>(time));
+    record.buffer = static_cast<log_buffer>(lid);
+
+    auto payload = std::string_view(data + header, length);
+    if (binary_buffer(record.buffer)) {
+        record.priority = log_priority::info;
+        record.tag = {};
+        record.message = payload;
+        return total;
+    }
+
+    // Text payload: priority, tag and message, each string NUL-terminated.
+    if (payload.empty()) {
+        record.priority = log_priority::unknown;
+        record.tag = {};
+        record.message = {};
+        return total;
+    }
+
+    record.priority = static_cast<log_priority>(payload.front());
+    payload.remove_prefix(1);
+
+    const auto tag_end = payload.find('\0');
+    record.tag = payload.substr(0, tag_end);
+    payload.remove_prefix(std::min(tag_end + 1, payload.size()));
+
+    payload = payload.substr(0, payload.find('\0'));
+    while (!payload.empty() && payload.back() == '\n') {
+        payload.remove_suffix(1);
+    }
+    record.message = payload;
+    return total;
+}
+
+} // namespace logcat
+
+logcat_stream_impl::logcat_stream_impl(asio::io_context& context,
+                                       const asio::ip::tcp::endpoint& endpoint,
+                                       const std::string_view serial,
+                                       handler_t handler,
+                                       const log_filter& filter,
+                                       const size_t retention)
+    : m_context(context), m_serial(serial), m_handler(std::move(handler)),
+      m_filter(filter), m_handle(context, endpoint), m_chunk(chunk_size),
+      m_store(retention) {
+    protocol::track(context, this,
+                    [this](const std::error_code& reason) { abort(reason); });
+}
+
+logcat_stream_impl::~logcat_stream_impl() { protocol::untrack(this); }
+
+void logcat_stream_impl::start() {
+    asio::post(m_context, [self = shared_from_this()] {
+        self->m_handle.connect_device(self->m_serial, [self] {
+            self->m_handle.host_request(command(self->m_filter),
+                                        [self] { self->read(); });
+        });
+    });
+}
+
+void logcat_stream_impl::recent(const handler_t& handler) const {
+    std::lock_guard lock(m_mutex);
+
+    const auto capacity = m_store.size();
+    for (const auto& [pos, size] : m_index) {
+        log_record record;
+        logcat::parse(m_store.data() + pos % capacity, size, record);
+        handler(record);
+    }
+}
+
+logcat_stats logcat_stream_impl::stats() const {
+    std::lock_guard lock(m_mutex);
+    return m_stats;
+}
+
+std::error_code logcat_stream_impl::error() const {
+    std::lock_guard lock(m_mutex);
+    return m_error;
+}
+
+void logcat_stream_impl::close() {
+    m_closed = true;
+
+    asio::post(m_context,
+               [self = shared_from_this()] { self->m_handle.cancel(); });
+}
+
+std::string logcat_stream_impl::command(const log_filter& filter) {
+    std::string command = "exec:logcat -B";
+    if (filter.buffers == log_filter().buffers) {
+        return command;
+    }
+
+    // Only the buffers asked for are read on the device.
+    auto separator = " -b ";
+    for (size_t i = 0; i < std::size(logcat::buffer_names); i++) {
+        if (filter.buffers & (1 << i)) {
+            command += separator;
+            command += logcat::buffer_names[i];
+            separator = ",";
+        }
+    }
+    return command;
+}
+
+void logcat_stream_impl::read() {
+    // The device went away after the last chunk was received.
+    if (m_aborted) {
+        fail(m_aborted);
+        return;
+    }
+
+    const auto data = m_chunk.data() + m_end;
+    m_handle.host_read_some(
+        data, m_chunk.size() - m_end, [self = shared_from_this()] {
+            const auto ec = self->m_handle.error();
+            const auto size = self->m_handle.received();
+            if (self->m_aborted && (ec || size == 0)) {
+                self->fail(self->m_aborted);
+                return;
+            }
+            if (ec || size == 0) {
+                self->fail(ec ? ec : asio::error::eof);
+                return;
+            }
+
+            {
+                std::lock_guard lock(self->m_mutex);
+                self->m_stats.bytes += size;
+            }
+
+            self->m_end += size;
+            if (!self->parse()) {
+                self->fail(asio::error::invalid_argument);
+                return;
+            }
+
+            self->read();
+        });
+}
+
+bool logcat_stream_impl::parse() {
+    const auto data = m_chunk.data();
+    size_t pos = 0;
+    uint64_t records = 0;
+
+    while (!m_closed) {
+        log_record record;
+        const auto size = logcat::parse(data + pos, m_end - pos, record);
+        if (size == std::string_view::npos) {
+            return false;
+        }
+        if (size == 0) {
+            break;
+        }
+
+        records++;
+        if (match(record)) {
+            if (m_handler) {
+                m_handler(record);
+            }
+
+            std::lock_guard lock(m_mutex);
+            m_stats.matched++;
+            retain(data + pos, size);
+        }
+        pos += size;
+    }
+
+    {
+        std::lock_guard lock(m_mutex);
+        m_stats.records += records;
+    }
+
+    // The start of the next record is at most one record, well below the
+    // size of the buffer.
+    std::memmove(data, data + pos, m_end - pos);
+    m_end -= pos;
+    return true;
+}
+
+bool logcat_stream_impl::match(const log_record& record) const {
+    if ((m_filter.buffers & (1 << static_cast<int>(record.buffer))) == 0 ||
+        record.priority < m_filter.min_priority ||
+        (m_filter.pid != 0 && record.pid != m_filter.pid)) {
+        return false;
+    }
+
+    return m_filter.tags.empty() ||
+           std::find(m_filter.tags.begin(), m_filter.tags.end(), record.tag) !=
+               m_filter.tags.end();
+}
+
+void logcat_stream_impl::retain(const char* data, const size_t size) {
+    const auto capacity = m_store.size();
+    if (size > capacity) {
+        return;
+    }
+
+    // Records do not wrap around, so skip the end of the ring if needed.
+    auto pos = m_tail;
+    if (pos % capacity + size > capacity) {
+        pos += capacity - pos % capacity;
+    }
+    const auto end = pos + size;
+
+    while (!m_index.empty() && m_index.front().first + capacity < end) {
+        m_index.pop_front();
+    }
+
+    std::memcpy(m_store.data() + pos % capacity, data, size);
+    m_index.emplace_back(pos, size);
+    m_tail = end;
+    m_stats.retained = m_index.size();
+}
+
+void logcat_stream_impl::fail(const std::error_code& ec) {
+    if (m_closed) {
+        return;
+    }
+
+    std::lock_guard lock(m_mutex);
+    m_error = ec;
+}
+
+void logcat_stream_impl::abort(const std::error_code& reason) {
+    m_aborted = reason;
+    m_handle.cancel();
+}
+
+} // namespace adb
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+
+#include "client_impl.hpp"
+#include "logcat_stream.hpp"
+
+namespace adb {
+
+/// Parser of the `logger_entry` records of `logcat -B`.
+namespace logcat {
+
+/// Size of the header of version 1, which has no header size field.
+static constexpr size_t header_v1 = 20;
+
+/// Largest header accepted, leaving room for versions after the 4th, whose
+/// header is 28 bytes.
+static constexpr size_t max_header = 64;
+
+/// Parse the record at the start of the data.
+/**
+ * @return Size of the record, 0 if more data is needed, or npos if the data
+ * is not a record.
+ * @param data Stream data.
+ * @param size Size of the data.
+ * @param record Record to fill, pointing into the data.
+ */
+size_t parse(const char* data, const size_t size, log_record& record);
+
+} // namespace logcat
+
+/// Pimpl class for logcat_stream.
+class logcat_stream_impl
+    : public logcat_stream,
+      public std::enable_shared_from_this<logcat_stream_impl> {
+  public:
+    /// Construct a logcat_stream_impl.
+    /**
+     * @param context io_context of the client.
+     * @param endpoint Endpoint of the adb server.
+     * @param serial Serial of the device.
+     * @param handler Function called with each record that passes the
+     * filter. May be empty.
+     * @param filter Filter of the records.
+     * @param retention Bytes of records to retain.
+     */
+    logcat_stream_impl(asio::io_context& context,
+                       const asio::ip::tcp::endpoint& endpoint,
+                       const std::string_view serial, handler_t handler,
+                       const log_filter& filter, const size_t retention);
+    ~logcat_stream_impl();
+
+    /// Start streaming.
+    void start();
+
+    void recent(const handler_t& handler) const override;
+    logcat_stats stats() const override;
+    std::error_code error() const override;
+    void close() override;
+
+  private:
+    /// Size of the chunk buffer, which holds many records.
+    static constexpr size_t chunk_size = 256 * 1024;
+
+    asio::io_context& m_context;
+    const std::string m_serial;
+    const handler_t m_handler;
+    const log_filter m_filter;
+
+    client_handle m_handle;
+
+    /// Chunk buffer, reused for every read. Holds the records received and
+    /// the start of an incomplete one.
+    std::vector<char> m_chunk;
+    size_t m_end = 0;
+
+    /// Retained records in their binary form, as a ring of bytes.
+    /**
+     * @note A record never wraps around. If it does not fit before the end
+     * of the ring, it starts at the beginning.
+     */
+    mutable std::mutex m_mutex;
+    std::vector<char> m_store;
+    uint64_t m_tail = 0;
+
+    /// Position and size of each retained record, from the oldest.
+    std::deque<std::pair<uint64_t, size_t>> m_index;
+
+    logcat_stats m_stats;
+    std::error_code m_error;
+
+    /// Reason given by abort_all(), which wins over the error of the read it
+    /// cancelled and ends the stream before the next one. Only used on the
+    /// event loop.
+    std::error_code m_aborted;
+
+    std::atomic<bool> m_closed = false;
+
+    /// Build the logcat command for the buffers of the filter.
+    static std::string command(const log_filter& filter);
+
+    /// Receive the next chunk of the stream.
+    void read();
+
+    /// Parse the records received, and keep the incomplete one.
+    /**
+     * @return false if the stream is not made of records.
+     */
+    bool parse();
+
+    /// Check whether a record passes the filter.
+    bool match(const log_record& record) const;
+
+    /// Copy a record into the retention ring, evicting the oldest ones.
+    /**
+     * @note Called with the mutex held.
+     */
+    void retain(const char* data, const size_t size);
+
+    /// End the stream with an error.
+    void fail(const std::error_code& ec);
+
+    /// End the stream as the device went away, from abort_all().
+    /**
+     * @param reason Error the stream ends with.
+     */
+    void abort(const std::error_code& reason);
+};
+
+} // namespace adb
@@ -0,0 +1,379 @@
+#include <algorithm>
+#include <cstring>
+
+#include "lz4.hpp"
+
+namespace adb::lz4 {
+
+static constexpr uint32_t frame_magic = 0x184d2204;
+
+/// Skippable frames have magic numbers 0x184d2a50 to 0x184d2a5f.
+static constexpr uint32_t skippable_magic = 0x184d2a50;
+
+/// Matches are at least 4 bytes, the last 5 bytes are always literals, and
+/// the last match starts at least 12 bytes before the end of the block.
+static constexpr size_t min_match = 4;
+static constexpr size_t last_literals = 5;
+static constexpr size_t match_find_limit = 12;
+
+static constexpr size_t max_offset = 65535;
+static constexpr size_t hash_log = 14;
+
+/// Size of the history kept for linked blocks.
+static constexpr size_t window_size = 64 * 1024;
+
+static inline uint32_t read_u32(const char* p) {
+    uint32_t value = 0;
+    for (int i = 3; i >= 0; i--) {
+        value = (value << 8) | static_cast<uint8_t>(p[i]);
+    }
+    return value;
+}
+
+static inline void append_u32(std::string& out, const uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        out.push_back(static_cast<char>((value >> (i * 8)) & 0xff));
+    }
+}
+
+static inline uint32_t rotl(const uint32_t x, const int r) {
+    return (x << r) | (x >> (32 - r));
+}
+
+/// XXH32 of less than 16 bytes, which covers every frame descriptor.
+static uint32_t xxh32_short(const char* p, const size_t size) {
+    static constexpr uint32_t prime1 = 2654435761U;
+    static constexpr uint32_t prime2 = 2246822519U;
+    static constexpr uint32_t prime3 = 3266489917U;
+    static constexpr uint32_t prime4 = 668265263U;
+    static constexpr uint32_t prime5 = 374761393U;
+
+    uint32_t h = prime5 + static_cast<uint32_t>(size);
+    size_t i = 0;
+    for (; i + 4 <= size; i += 4) {
+        h += read_u32(p + i) * prime3;
+        h = rotl(h, 17) * prime4;
+    }
+    for (; i < size; i++) {
+        h += static_cast<uint8_t>(p[i]) * prime5;
+        h = rotl(h, 11) * prime1;
+    }
+
+    h ^= h >> 15;
+    h *= prime2;
+    h ^= h >> 13;
+    h *= prime3;
+    h ^= h >> 16;
+    return h;
+}
+
+static inline void append_length(std::string& out, size_t length) {
+    for (; length >= 255; length -= 255) {
+        out.push_back(static_cast<char>(255));
+    }
+    out.push_back(static_cast<char>(length));
+}
+
+/// Append one sequence of literals and an optional match.
+static void append_sequence(std::string& out, const char* literals,
+                            const size_t literal_length, const size_t offset,
+                            const size_t match_length) {
+    const auto literal_code = std::min<size_t>(literal_length, 15);
+    const auto match_code =
+        offset == 0 ? 0 : std::min<size_t>(match_length - min_match, 15);
+    out.push_back(static_cast<char>((literal_code << 4) | match_code));
+
+    if (literal_code == 15) {
+        append_length(out, literal_length - 15);
+    }
+    out.append(literals, literal_length);
+
+    if (offset == 0) {
+        return;
+    }
+
+    out.push_back(static_cast<char>(offset & 0xff));
+    out.push_back(static_cast<char>(offset >> 8));
+    if (match_code == 15) {
+        append_length(out, match_length - min_match - 15);
+    }
+}
+
+/// Compress one independent block with greedy hash matching.
+static void compress_block(const char* src, const size_t size,
+                           std::vector<int32_t>& table, std::string& out) {
+    std::fill(table.begin(), table.end(), -1);
+
+    size_t anchor = 0;
+    if (size > match_find_limit) {
+        const auto limit = size - match_find_limit;
+        const auto match_limit = size - last_literals;
+
+        size_t ip = 0;
+        while (ip < limit) {
+            const auto sequence = read_u32(src + ip);
+            const auto hash = (sequence * 2654435761U) >> (32 - hash_log);
+            const auto ref = table[hash];
+            table[hash] = static_cast<int32_t>(ip);
+
+            if (ref < 0 || ip - ref > max_offset ||
+                read_u32(src + ref) != sequence) {
+                // Skip faster through data that does not compress.
+                ip += 1 + ((ip - anchor) >> 6);
+                continue;
+            }
+
+            auto length = min_match;
+            while (ip + length < match_limit &&
+                   src[ref + length] == src[ip + length]) {
+                length++;
+            }
+
+            append_sequence(out, src + anchor, ip - anchor, ip - ref, length);
+            ip += length;
+            anchor = ip;
+        }
+    }
+
+    append_sequence(out, src + anchor, size - anchor, 0, 0);
+}
+
+void frame_encoder::begin(std::string& output) {
+    if (m_started) {
+        return;
+    }
+    m_started = true;
+    m_table.resize(size_t{1} << hash_log);
+
+    // Version 1, independent blocks, no checksums, 64 KB blocks.
+    append_u32(output, frame_magic);
+    const char descriptor[] = {0x60, 0x40};
+    output.append(descriptor, sizeof(descriptor));
+    output.push_back(static_cast<char>(
+        (xxh32_short(descriptor, sizeof(descriptor)) >> 8) & 0xff));
+}
+
+void frame_encoder::write(std::string_view input, std::string& output) {
+    begin(output);
+
+    std::string block;
+    while (!input.empty()) {
+        const auto chunk = input.substr(0, block_size);
+        input.remove_prefix(chunk.size());
+
+        block.clear();
+        compress_block(chunk.data(), chunk.size(), m_table, block);
+
+        // Incompressible data is stored as is.
+        if (block.size() >= chunk.size()) {
+            append_u32(output,
+                       static_cast<uint32_t>(chunk.size()) | 0x80000000U);
+            output.append(chunk);
+        } else {
+            append_u32(output, static_cast<uint32_t>(block.size()));
+            output.append(block);
+        }
+    }
+}
+
+void frame_encoder::finish(std::string& output) {
+    begin(output);
+    append_u32(output, 0);
+    m_started = false;
+}
+
+bool frame_decoder::feed(std::string_view input, const sink_t& sink) {
+    m_input.append(input);
+    return parse(sink);
+}
+
+bool frame_decoder::parse(const sink_t& sink) {
+    size_t pos = 0;
+    const auto available = [&] { return m_input.size() - pos; };
+    const auto data = [&] { return m_input.data() + pos; };
+
+    bool ok = true;
+    while (ok) {
+        if (m_state == state::magic) {
+            if (available() < 8) {
+                if (available() >= 4 && read_u32(data()) == frame_magic) {
+                    m_state = state::descriptor;
+                    pos += 4;
+                    continue;
+                }
+                break;
+            }
+
+            const auto magic = read_u32(data());
+            if (magic == frame_magic) {
+                m_state = state::descriptor;
+                pos += 4;
+            } else if ((magic & 0xfffffff0) == skippable_magic) {
+                m_state = state::skip;
+                m_skip = read_u32(data() + 4);
+                pos += 8;
+            } else {
+                ok = false;
+            }
+            continue;
+        }
+
+        if (m_state == state::skip) {
+            const auto size = std::min(m_skip, available());
+            pos += size;
+            m_skip -= size;
+            if (m_skip != 0) {
+                break;
+            }
+            m_state = state::magic;
+            continue;
+        }
+
+        if (m_state == state::descriptor) {
+            if (available() < 2) {
+                break;
+            }
+
+            const auto flags = static_cast<uint8_t>(data()[0]);
+            const auto block_id = (static_cast<uint8_t>(data()[1]) >> 4) & 7;
+            const auto has_size = (flags & 0x08) != 0;
+            const auto has_dict = (flags & 0x01) != 0;
+            const auto length =
+                size_t{3} + (has_size ? 8 : 0) + (has_dict ? 4 : 0);
+            if (available() < length) {
+                break;
+            }
+
+            if ((flags >> 6) != 1 || block_id < 4) {
+                ok = false;
+                continue;
+            }
+
+            m_block_checksum = (flags & 0x10) != 0;
+            m_content_checksum = (flags & 0x04) != 0;
+            m_block_max = size_t{1} << (8 + 2 * block_id);
+            pos += length;
+            m_state = state::block;
+            continue;
+        }
+
+        // state::block
+        if (available() < 4) {
+            break;
+        }
+
+        const auto header = read_u32(data());
+        const auto size = header & 0x7fffffffU;
+
+        if (size == 0) {
+            const auto length = size_t{4} + (m_content_checksum ? 4 : 0);
+            if (available() < length) {
+                break;
+            }
+            pos += length;
+            m_window.clear();
+            m_state = state::magic;
+            continue;
+        }
+
+        if (size > m_block_max) {
+            ok = false;
+            continue;
+        }
+
+        const auto length = size_t{4} + size + (m_block_checksum ? 4 : 0);
+        if (available() < length) {
+            break;
+        }
+
+        const auto block = std::string_view(data() + 4, size);
+        const auto start = m_window.size();
+        if (header & 0x80000000U) {
+            m_window.append(block);
+        } else if (!decode_block(block)) {
+            ok = false;
+            continue;
+        }
+        pos += length;
+
+        sink(std::string_view(m_window).substr(start));
+
+        if (m_window.size() > 2 * window_size) {
+            m_window.erase(0, m_window.size() - window_size);
+        }
+    }
+
+    m_input.erase(0, pos);
+    return ok;
+}
+
+bool frame_decoder::decode_block(std::string_view block) {
+    // Matches copy from the window itself, which must not be reallocated.
+    m_window.reserve(m_window.size() + m_block_max);
+    const auto limit = m_window.size() + m_block_max;
+
+    const auto read_length = [&](size_t& i, size_t& length) {
+        uint8_t byte = 255;
+        while (byte == 255) {
+            if (i >= block.size()) {
+                return false;
+            }
+            byte = static_cast<uint8_t>(block[i++]);
+            length += byte;
+        }
+        return true;
+    };
+
+    size_t i = 0;
+    while (i < block.size()) {
+        const auto token = static_cast<uint8_t>(block[i++]);
+
+        size_t literal_length = token >> 4;
+        if (literal_length == 15 && !read_length(i, literal_length)) {
+            return false;
+        }
+        if (literal_length > block.size() - i ||
+            m_window.size() + literal_length > limit) {
+            return false;
+        }
+        m_window.append(block.substr(i, literal_length));
+        i += literal_length;
+
+        // The last sequence has no match.
+        if (i == block.size()) {
+            break;
+        }
+
+        if (block.size() - i < 2) {
+            return false;
+        }
+        const size_t offset = static_cast<uint8_t>(block[i]) |
+                              (static_cast<uint8_t>(block[i + 1]) << 8);
+        i += 2;
+
+        size_t match_length = token & 15;
+        if (match_length == 15 && !read_length(i, match_length)) {
+            return false;
+        }
+        match_length += min_match;
+
+        if (offset == 0 || offset > m_window.size() ||
+            m_window.size() + match_length > limit) {
+            return false;
+        }
+
+        auto from = m_window.size() - offset;
+        if (offset >= match_length) {
+            m_window.append(m_window.data() + from, match_length);
+        } else {
+            // Overlapping matches repeat the last offset bytes.
+            for (size_t n = 0; n < match_length; n++) {
+                m_window.push_back(m_window[from++]);
+            }
+        }
+    }
+
+    return true;
+}
+
+} // namespace adb::lz4
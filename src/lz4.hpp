@@ -0,0 +1,91 @@
+#pragma once
+
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace adb::lz4 {
+
+/// Maximum size of an LZ4 block produced by frame_encoder.
+static constexpr size_t block_size = 64 * 1024;
+
+/// Streaming encoder of the LZ4 frame format.
+/**
+ * @note Blocks are independent and carry no checksums, which is what adbd
+ * expects from `sendrecv_v2_lz4`.
+ */
+class frame_encoder {
+  public:
+    /// Compress data and append the frame bytes to the output.
+    /**
+     * @param input Data to compress. Split into blocks of block_size.
+     * @param output String to append the compressed bytes to.
+     * @note The frame header is emitted before the first block.
+     */
+    void write(std::string_view input, std::string& output);
+
+    /// Finish the frame.
+    /**
+     * @param output String to append the end mark to.
+     */
+    void finish(std::string& output);
+
+  private:
+    bool m_started = false;
+
+    /// Hash table of the block compressor, reused across blocks.
+    std::vector<int32_t> m_table;
+
+    /// Emit the frame header once.
+    void begin(std::string& output);
+};
+
+/// Streaming decoder of the LZ4 frame format.
+/**
+ * @note Input may be split anywhere. Linked blocks, checksums, content sizes
+ * and concatenated or skippable frames are accepted.
+ */
+class frame_decoder {
+  public:
+    /// Function called with each chunk of decompressed data.
+    typedef std::function<void(std::string_view)> sink_t;
+
+    /// Feed compressed data to the decoder.
+    /**
+     * @return false if the data is not a valid LZ4 frame.
+     * @param input Compressed data.
+     * @param sink Function called with the decompressed data.
+     */
+    bool feed(std::string_view input, const sink_t& sink);
+
+    /// Check whether the last frame has been completely decoded.
+    bool finished() const { return m_state == state::magic; }
+
+  private:
+    enum class state { magic, descriptor, block, skip };
+
+    state m_state = state::magic;
+
+    /// Input not yet consumed.
+    std::string m_input;
+
+    /// Flags of the current frame.
+    bool m_block_checksum = false;
+    bool m_content_checksum = false;
+    size_t m_block_max = 0;
+
+    /// Bytes left in a skippable frame.
+    size_t m_skip = 0;
+
+    /// Decoded data, keeping the last 64 KB for linked blocks.
+    std::string m_window;
+
+    /// Parse as much of the input as possible.
+    bool parse(const sink_t& sink);
+
+    /// Decompress one block into the window.
+    bool decode_block(std::string_view block);
+};
+
+} // namespace adb::lz4
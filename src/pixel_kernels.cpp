@@ -0,0 +1,473 @@
+#include <algorithm>
+#include <array>
+#include <cstring>
+
+#include "pixel_kernels.hpp"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) ||            \
+    defined(_M_IX86)
+#define ADB_PIXEL_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+// Kernels of an instruction set are compiled for it alone, and only called
+// after the CPU is probed.
+#if defined(__GNUC__) || defined(__clang__)
+#define ADB_TARGET(isa) __attribute__((target(isa)))
+#else
+#define ADB_TARGET(isa)
+#endif
+
+namespace adb::pixel {
+
+/// Luma weights in 1/128, in the order of R, G and B.
+static constexpr int gray_r = 38;
+static constexpr int gray_g = 75;
+static constexpr int gray_b = 15;
+
+static void to_bgr_scalar(const uint8_t* src, uint8_t* dst, size_t pixels,
+                          bool red_first) {
+    const auto r = red_first ? 0 : 2;
+    const auto b = red_first ? 2 : 0;
+    for (size_t i = 0; i < pixels; i++, src += 4, dst += 3) {
+        dst[0] = src[b];
+        dst[1] = src[1];
+        dst[2] = src[r];
+    }
+}
+
+static void to_gray_scalar(const uint8_t* src, uint8_t* dst, size_t pixels,
+                           bool red_first) {
+    const auto r = red_first ? 0 : 2;
+    const auto b = red_first ? 2 : 0;
+    for (size_t i = 0; i < pixels; i++, src += 4) {
+        dst[i] = static_cast<uint8_t>(
+            (gray_r * src[r] + gray_g * src[1] + gray_b * src[b] + 64) >> 7);
+    }
+}
+
+static void accumulate_scalar(const uint8_t* src, uint16_t* sums,
+                              size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        sums[i] = static_cast<uint16_t>(sums[i] + src[i]);
+    }
+}
+
+static void average_scalar(const uint16_t* sums, uint8_t* dst, size_t boxes,
+                           uint32_t scale) {
+    // Exact for sums of up to 255 per pixel of the box.
+    const auto area = scale * scale;
+    const uint64_t reciprocal = ((1 << 24) + area - 1) / area;
+
+    for (size_t x = 0; x < boxes; x++, dst += 4) {
+        const auto box = sums + x * scale * 4;
+        for (size_t c = 0; c < 4; c++) {
+            uint64_t sum = area / 2;
+            for (size_t k = 0; k < scale; k++) {
+                sum += box[k * 4 + c];
+            }
+            dst[c] = static_cast<uint8_t>((sum * reciprocal) >> 24);
+        }
+    }
+}
+
+/// Keys of the 64-bit words of a 256-byte stripe, so that blocks moved
+/// within a tile change its hash.
+static constexpr auto hash_keys = [] {
+    std::array<uint64_t, 32> keys{};
+    uint64_t x = 0;
+    for (auto& key : keys) {
+        // splitmix64
+        x += 0x9e3779b97f4a7c15;
+        auto z = x;
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+        key = z ^ (z >> 31);
+    }
+    return keys;
+}();
+
+/// Add 64-bit words to the 4 lanes of a hash.
+/**
+ * @param src First byte of the words.
+ * @param size Number of bytes, padded with zeros to whole words.
+ * @param word Index of the first word in the segment.
+ * @param lanes Lanes of the hash, which word i goes to lane i % 4 of.
+ * @note The SIMD kernels do the same on 32-byte blocks.
+ */
+static void hash_words(const uint8_t* src, size_t size, size_t word,
+                       uint64_t* lanes) {
+    for (size_t i = 0; i < size; i += 8, word++) {
+        uint64_t value = 0;
+        std::memcpy(&value, src + i, std::min<size_t>(8, size - i));
+        const auto mixed = value ^ hash_keys[word % hash_keys.size()];
+        lanes[word % 4] += (mixed & 0xffffffff) * (mixed >> 32) + value;
+    }
+}
+
+/// Fold the lanes of a segment into the hash of a tile.
+static inline uint64_t hash_fold(uint64_t hash, const uint64_t* lanes) {
+    const auto rotl = [](const uint64_t v, const int n) {
+        return (v << n) | (v >> (64 - n));
+    };
+
+    const auto digest = lanes[0] ^ rotl(lanes[1], 16) ^ rotl(lanes[2], 32) ^
+                        rotl(lanes[3], 48);
+    hash = (hash ^ digest) * 0x9e3779b97f4a7c15;
+    return hash ^ (hash >> 29);
+}
+
+static void hash_tiles_scalar(const uint8_t* src, size_t size,
+                              size_t tile_size, uint64_t* hashes) {
+    for (size_t offset = 0; offset < size; offset += tile_size, hashes++) {
+        uint64_t lanes[4] = {};
+        hash_words(src + offset, std::min(tile_size, size - offset), 0, lanes);
+        *hashes = hash_fold(*hashes, lanes);
+    }
+}
+
+#ifdef ADB_PIXEL_X86
+
+/// Luma of 4 pixels as 32-bit lanes.
+ADB_TARGET("sse2")
+static inline __m128i luma4_sse2(const uint8_t* src, const __m128i weights) {
+    const auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+    const auto zero = _mm_setzero_si128();
+
+    // Each pixel gives two sums, R and G, then B and A.
+    auto lo = _mm_madd_epi16(_mm_unpacklo_epi8(v, zero), weights);
+    auto hi = _mm_madd_epi16(_mm_unpackhi_epi8(v, zero), weights);
+    lo = _mm_add_epi32(lo, _mm_srli_epi64(lo, 32));
+    hi = _mm_add_epi32(hi, _mm_srli_epi64(hi, 32));
+    lo = _mm_shuffle_epi32(lo, _MM_SHUFFLE(3, 1, 2, 0));
+    hi = _mm_shuffle_epi32(hi, _MM_SHUFFLE(3, 1, 2, 0));
+
+    const auto sum = _mm_unpacklo_epi64(lo, hi);
+    return _mm_srli_epi32(_mm_add_epi32(sum, _mm_set1_epi32(64)), 7);
+}
+
+ADB_TARGET("sse2")
+static void to_gray_sse2(const uint8_t* src, uint8_t* dst, size_t pixels,
+                         bool red_first) {
+    const auto weights =
+        red_first ? _mm_setr_epi16(gray_r, gray_g, gray_b, 0, gray_r, gray_g,
+                                   gray_b, 0)
+                  : _mm_setr_epi16(gray_b, gray_g, gray_r, 0, gray_b, gray_g,
+                                   gray_r, 0);
+
+    size_t i = 0;
+    for (; i + 8 <= pixels; i += 8) {
+        const auto p = src + i * 4;
+        const auto words = _mm_packs_epi32(luma4_sse2(p, weights),
+                                           luma4_sse2(p + 16, weights));
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(dst + i),
+                         _mm_packus_epi16(words, words));
+    }
+    to_gray_scalar(src + i * 4, dst + i, pixels - i, red_first);
+}
+
+ADB_TARGET("sse2")
+static void accumulate_sse2(const uint8_t* src, uint16_t* sums, size_t size) {
+    const auto zero = _mm_setzero_si128();
+
+    size_t i = 0;
+    for (; i + 16 <= size; i += 16) {
+        const auto v =
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        const auto p = reinterpret_cast<__m128i*>(sums + i);
+        const auto lo = _mm_add_epi16(_mm_loadu_si128(p),
+                                      _mm_unpacklo_epi8(v, zero));
+        const auto hi = _mm_add_epi16(_mm_loadu_si128(p + 1),
+                                      _mm_unpackhi_epi8(v, zero));
+        _mm_storeu_si128(p, lo);
+        _mm_storeu_si128(p + 1, hi);
+    }
+    accumulate_scalar(src + i, sums + i, size - i);
+}
+
+ADB_TARGET("sse2")
+static void average_sse2(const uint16_t* sums, uint8_t* dst, size_t boxes,
+                         uint32_t scale) {
+    // Halving is the common case, e.g. 1080p to 540p.
+    if (scale != 2) {
+        average_scalar(sums, dst, boxes, scale);
+        return;
+    }
+
+    const auto round = _mm_set1_epi16(2);
+
+    size_t x = 0;
+    for (; x + 2 <= boxes; x += 2) {
+        // 2 boxes of 2 pixels each.
+        const auto p = reinterpret_cast<const __m128i*>(sums + x * 8);
+        const auto a = _mm_loadu_si128(p);
+        const auto b = _mm_loadu_si128(p + 1);
+        auto sum = _mm_add_epi16(_mm_unpacklo_epi64(a, b),
+                                 _mm_unpackhi_epi64(a, b));
+        sum = _mm_srli_epi16(_mm_add_epi16(sum, round), 2);
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(dst + x * 4),
+                         _mm_packus_epi16(sum, sum));
+    }
+    average_scalar(sums + x * 8, dst + x * 4, boxes - x, scale);
+}
+
+ADB_TARGET("sse2")
+static void hash_tiles_sse2(const uint8_t* src, size_t size, size_t tile_size,
+                            uint64_t* hashes) {
+    const auto keys = reinterpret_cast<const __m128i*>(hash_keys.data());
+
+    for (size_t offset = 0; offset < size; offset += tile_size, hashes++) {
+        const auto p = src + offset;
+        const auto n = std::min(tile_size, size - offset);
+
+        // Lanes 0 and 1, then lanes 2 and 3.
+        auto lo = _mm_setzero_si128();
+        auto hi = _mm_setzero_si128();
+
+        size_t i = 0;
+        for (; i + 32 <= n; i += 32) {
+            const auto block = reinterpret_cast<const __m128i*>(p + i);
+            const auto key = keys + (i / 32) % 8 * 2;
+            const auto a = _mm_loadu_si128(block);
+            const auto b = _mm_loadu_si128(block + 1);
+            const auto ma = _mm_xor_si128(a, _mm_loadu_si128(key));
+            const auto mb = _mm_xor_si128(b, _mm_loadu_si128(key + 1));
+            const auto pa = _mm_mul_epu32(ma, _mm_srli_epi64(ma, 32));
+            const auto pb = _mm_mul_epu32(mb, _mm_srli_epi64(mb, 32));
+            lo = _mm_add_epi64(lo, _mm_add_epi64(pa, a));
+            hi = _mm_add_epi64(hi, _mm_add_epi64(pb, b));
+        }
+
+        uint64_t lanes[4];
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), lo);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes + 2), hi);
+        hash_words(p + i, n - i, i / 8, lanes);
+        *hashes = hash_fold(*hashes, lanes);
+    }
+}
+
+ADB_TARGET("ssse3")
+static void to_bgr_ssse3(const uint8_t* src, uint8_t* dst, size_t pixels,
+                         bool red_first) {
+    // 4 pixels to 12 bytes, and zeros in the last 4 bytes.
+    const auto mask =
+        red_first ? _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1,
+                                  -1, -1, -1)
+                  : _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1,
+                                  -1, -1, -1);
+
+    size_t i = 0;
+    for (; i + 16 <= pixels; i += 16) {
+        const auto p = reinterpret_cast<const __m128i*>(src + i * 4);
+        const auto a = _mm_shuffle_epi8(_mm_loadu_si128(p), mask);
+        const auto b = _mm_shuffle_epi8(_mm_loadu_si128(p + 1), mask);
+        const auto c = _mm_shuffle_epi8(_mm_loadu_si128(p + 2), mask);
+        const auto d = _mm_shuffle_epi8(_mm_loadu_si128(p + 3), mask);
+
+        const auto q = reinterpret_cast<__m128i*>(dst + i * 3);
+        _mm_storeu_si128(q, _mm_or_si128(a, _mm_slli_si128(b, 12)));
+        _mm_storeu_si128(q + 1, _mm_or_si128(_mm_srli_si128(b, 4),
+                                             _mm_slli_si128(c, 8)));
+        _mm_storeu_si128(q + 2, _mm_or_si128(_mm_srli_si128(c, 8),
+                                             _mm_slli_si128(d, 4)));
+    }
+    to_bgr_scalar(src + i * 4, dst + i * 3, pixels - i, red_first);
+}
+
+ADB_TARGET("avx2")
+static void to_bgr_avx2(const uint8_t* src, uint8_t* dst, size_t pixels,
+                        bool red_first) {
+    // 4 pixels to 12 bytes in each lane, which are then packed together.
+    const auto mask =
+        red_first ? _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12,
+                                     -1, -1, -1, -1, 2, 1, 0, 6, 5, 4, 10, 9,
+                                     8, 14, 13, 12, -1, -1, -1, -1)
+                  : _mm256_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14,
+                                     -1, -1, -1, -1, 0, 1, 2, 4, 5, 6, 8, 9,
+                                     10, 12, 13, 14, -1, -1, -1, -1);
+    const auto pack = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7);
+
+    size_t i = 0;
+    for (; i + 8 <= pixels; i += 8) {
+        auto v = _mm256_loadu_si256(
+            reinterpret_cast<const __m256i*>(src + i * 4));
+        v = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(v, mask), pack);
+
+        const auto q = dst + i * 3;
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(q),
+                         _mm256_castsi256_si128(v));
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(q + 16),
+                         _mm256_extracti128_si256(v, 1));
+    }
+    to_bgr_scalar(src + i * 4, dst + i * 3, pixels - i, red_first);
+}
+
+/// Luma of 8 pixels as 32-bit lanes.
+ADB_TARGET("avx2")
+static inline __m256i luma8_avx2(const uint8_t* src, const __m256i weights) {
+    const auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src));
+
+    // Each pixel gives two sums, R and G, then B and A.
+    const auto pairs = _mm256_maddubs_epi16(v, weights);
+    const auto sum = _mm256_madd_epi16(pairs, _mm256_set1_epi16(1));
+    return _mm256_srli_epi32(_mm256_add_epi32(sum, _mm256_set1_epi32(64)), 7);
+}
+
+ADB_TARGET("avx2")
+static void to_gray_avx2(const uint8_t* src, uint8_t* dst, size_t pixels,
+                         bool red_first) {
+    const auto weights = red_first
+                             ? _mm256_set1_epi32(gray_r | gray_g << 8 |
+                                                 gray_b << 16)
+                             : _mm256_set1_epi32(gray_b | gray_g << 8 |
+                                                 gray_r << 16);
+
+    // Packing works within lanes, so the groups of 4 bytes are reordered.
+    const auto order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+
+    size_t i = 0;
+    for (; i + 32 <= pixels; i += 32) {
+        const auto p = src + i * 4;
+        const auto ab = _mm256_packs_epi32(luma8_avx2(p, weights),
+                                           luma8_avx2(p + 32, weights));
+        const auto cd = _mm256_packs_epi32(luma8_avx2(p + 64, weights),
+                                           luma8_avx2(p + 96, weights));
+        const auto bytes = _mm256_permutevar8x32_epi32(
+            _mm256_packus_epi16(ab, cd), order);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), bytes);
+    }
+    to_gray_scalar(src + i * 4, dst + i, pixels - i, red_first);
+}
+
+ADB_TARGET("avx2")
+static void accumulate_avx2(const uint8_t* src, uint16_t* sums, size_t size) {
+    size_t i = 0;
+    for (; i + 16 <= size; i += 16) {
+        const auto v = _mm256_cvtepu8_epi16(
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i)));
+        const auto p = reinterpret_cast<__m256i*>(sums + i);
+        _mm256_storeu_si256(p, _mm256_add_epi16(_mm256_loadu_si256(p), v));
+    }
+    accumulate_scalar(src + i, sums + i, size - i);
+}
+
+ADB_TARGET("avx2")
+static void hash_tiles_avx2(const uint8_t* src, size_t size, size_t tile_size,
+                            uint64_t* hashes) {
+    const auto keys = reinterpret_cast<const __m256i*>(hash_keys.data());
+
+    for (size_t offset = 0; offset < size; offset += tile_size, hashes++) {
+        const auto p = src + offset;
+        const auto n = std::min(tile_size, size - offset);
+        auto acc = _mm256_setzero_si256();
+
+        size_t i = 0;
+        for (; i + 32 <= n; i += 32) {
+            const auto v =
+                _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i));
+            const auto key = _mm256_loadu_si256(keys + (i / 32) % 8);
+            const auto mixed = _mm256_xor_si256(v, key);
+            const auto product =
+                _mm256_mul_epu32(mixed, _mm256_srli_epi64(mixed, 32));
+            acc = _mm256_add_epi64(acc, _mm256_add_epi64(product, v));
+        }
+
+        uint64_t lanes[4];
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), acc);
+        hash_words(p + i, n - i, i / 8, lanes);
+        *hashes = hash_fold(*hashes, lanes);
+    }
+}
+
+/// Instruction sets that the kernels use.
+enum class isa { sse2, ssse3, avx2 };
+
+/// Check whether the CPU and the OS support an instruction set.
+static bool cpu_supports(const isa set) {
+#if defined(__GNUC__) || defined(__clang__)
+    switch (set) {
+    case isa::sse2:
+        return __builtin_cpu_supports("sse2");
+    case isa::ssse3:
+        return __builtin_cpu_supports("ssse3");
+    case isa::avx2:
+        return __builtin_cpu_supports("avx2");
+    }
+    return false;
+#elif defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 1);
+    const bool sse2 = (info[3] & (1 << 26)) != 0;
+    const bool ssse3 = (info[2] & (1 << 9)) != 0;
+    const bool osxsave = (info[2] & (1 << 27)) != 0;
+
+    switch (set) {
+    case isa::sse2:
+        return sse2;
+    case isa::ssse3:
+        return ssse3;
+    case isa::avx2:
+        // The OS has to save the YMM registers too.
+        if (!osxsave || (_xgetbv(0) & 6) != 6) {
+            return false;
+        }
+        __cpuidex(info, 7, 0);
+        return (info[1] & (1 << 5)) != 0;
+    }
+    return false;
+#else
+    (void)set;
+    return false;
+#endif
+}
+
+#endif // ADB_PIXEL_X86
+
+const kernels& scalar_kernels() {
+    static const kernels table = {
+        "scalar", to_bgr_scalar, to_gray_scalar, accumulate_scalar,
+        average_scalar, hash_tiles_scalar,
+    };
+    return table;
+}
+
+std::vector<const kernels*> supported_kernels() {
+    std::vector<const kernels*> result = {&scalar_kernels()};
+
+#ifdef ADB_PIXEL_X86
+    static const kernels sse2 = {
+        "sse2", to_bgr_scalar, to_gray_sse2, accumulate_sse2, average_sse2,
+        hash_tiles_sse2,
+    };
+    static const kernels ssse3 = {
+        "ssse3", to_bgr_ssse3, to_gray_sse2, accumulate_sse2, average_sse2,
+        hash_tiles_sse2,
+    };
+    static const kernels avx2 = {
+        "avx2", to_bgr_avx2, to_gray_avx2, accumulate_avx2, average_sse2,
+        hash_tiles_avx2,
+    };
+
+    if (cpu_supports(isa::sse2)) {
+        result.push_back(&sse2);
+    }
+    if (cpu_supports(isa::ssse3)) {
+        result.push_back(&ssse3);
+    }
+    if (cpu_supports(isa::avx2)) {
+        result.push_back(&avx2);
+    }
+#endif
+
+    return result;
+}
+
+const kernels& best_kernels() {
+    static const kernels* table = supported_kernels().back();
+    return *table;
+}
+
+} // namespace adb::pixel
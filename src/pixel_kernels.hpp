@@ -0,0 +1,83 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace adb::pixel {
+
+/// Kernels on rows of 4-byte pixels.
+/**
+ * @note All variants give the same bytes as the scalar ones.
+ */
+struct kernels {
+    /// Instruction set of the kernels, e.g. `avx2`.
+    const char* name;
+
+    /// Convert RGBA or BGRA pixels to BGR.
+    /**
+     * @param src Source pixels.
+     * @param dst Destination of 3 bytes per pixel.
+     * @param pixels Number of pixels.
+     * @param red_first Whether the source is RGBA, otherwise BGRA.
+     */
+    void (*to_bgr)(const uint8_t* src, uint8_t* dst, size_t pixels,
+                   bool red_first);
+
+    /// Convert RGBA or BGRA pixels to 8-bit luma.
+    /**
+     * @param src Source pixels.
+     * @param dst Destination of 1 byte per pixel.
+     * @param pixels Number of pixels.
+     * @param red_first Whether the source is RGBA, otherwise BGRA.
+     * @note Luma is `(38 R + 75 G + 15 B + 64) >> 7`, i.e. BT.601 weights.
+     */
+    void (*to_gray)(const uint8_t* src, uint8_t* dst, size_t pixels,
+                    bool red_first);
+
+    /// Add bytes to 16-bit sums, to average boxes of rows.
+    /**
+     * @param src Source bytes.
+     * @param sums Sums of the bytes, one per byte.
+     * @param size Number of bytes.
+     */
+    void (*accumulate)(const uint8_t* src, uint16_t* sums, size_t size);
+
+    /// Average boxes of 4-byte pixels from their column sums.
+    /**
+     * @param sums Column sums of the rows of the boxes, one per byte.
+     * @param dst Destination of 4 bytes per box.
+     * @param boxes Number of boxes.
+     * @param scale Width and height of a box, from 1 to 16.
+     * @note Averages are rounded to the nearest.
+     */
+    void (*average)(const uint16_t* sums, uint8_t* dst, size_t boxes,
+                    uint32_t scale);
+
+    /// Fold a row into the hashes of the tiles it crosses.
+    /**
+     * @param src First byte of the row.
+     * @param size Size of the row in bytes.
+     * @param tile_size Bytes of the row in each tile. The last tile may be
+     * narrower.
+     * @param hashes Hash of each tile, updated in place.
+     * @note The hashes depend on the order of the rows and of the bytes, and
+     * are only meant to detect changes between frames.
+     */
+    void (*hash_tiles)(const uint8_t* src, size_t size, size_t tile_size,
+                       uint64_t* hashes);
+};
+
+/// Get the portable kernels.
+const kernels& scalar_kernels();
+
+/// Get the fastest kernels supported by the CPU.
+/**
+ * @note The CPU is probed on the first call.
+ */
+const kernels& best_kernels();
+
+/// Get all kernels supported by the CPU, from the slowest.
+std::vector<const kernels*> supported_kernels();
+
+} // namespace adb::pixel
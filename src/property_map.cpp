@@ -0,0 +1,127 @@
+#include <algorithm>
+#include <bit>
+#include <functional>
+
+#include "property_map_impl.hpp"
+
+namespace adb {
+
+std::shared_ptr<property_map> property_map::parse(std::string output) {
+    return std::make_shared<property_map_impl>(std::move(output));
+}
+
+property_map_impl::property_map_impl(std::string output)
+    : m_output(std::move(output)) {
+    split();
+    index();
+}
+
+std::optional<std::string_view>
+property_map_impl::get(const std::string_view name) const {
+    const auto mask = m_slots.size() - 1;
+    auto slot = std::hash<std::string_view>()(name) & mask;
+    while (m_slots[slot] != empty_slot) {
+        const auto& entry = m_entries[m_slots[slot]];
+        if (entry.name == name) {
+            return entry.value;
+        }
+        slot = (slot + 1) & mask;
+    }
+    return std::nullopt;
+}
+
+std::string_view property_map_impl::get(const std::string_view name,
+                                        const std::string_view fallback) const {
+    return get(name).value_or(fallback);
+}
+
+void property_map_impl::split() {
+    const std::string_view text = m_output;
+    constexpr auto npos = std::string_view::npos;
+
+    // End of the line at a position, before its `\n` or `\r\n`.
+    const auto line_end = [&](const size_t pos) {
+        auto end = std::min(text.find('\n', pos), text.size());
+        if (end > pos && text[end - 1] == '\r') {
+            end--;
+        }
+        return end;
+    };
+    const auto next_line = [&](const size_t pos) {
+        const auto end = text.find('\n', pos);
+        return end == npos ? text.size() : end + 1;
+    };
+
+    // Position of the `]: [` of a line starting an entry, or npos.
+    const auto separator = [&](const size_t pos, const size_t end) {
+        if (pos == end || text[pos] != '[') {
+            return npos;
+        }
+        return text.substr(0, end).find("]: [", pos);
+    };
+
+    size_t pos = 0;
+    while (pos < text.size()) {
+        const auto end = line_end(pos);
+        const auto found = separator(pos, end);
+        if (found == npos) {
+            // Noise, e.g. a `WARNING: linker:` line.
+            pos = next_line(pos);
+            continue;
+        }
+
+        // A value may go on over the next lines that do not start an entry,
+        // up to the last one ending with `]`.
+        const auto begin = found + 4;
+        auto last = pos;
+        auto value_end = end > begin && text[end - 1] == ']' ? end - 1 : npos;
+        for (auto line = next_line(pos); line < text.size();
+             line = next_line(line)) {
+            const auto stop = line_end(line);
+            if (separator(line, stop) != npos) {
+                break;
+            }
+            if (stop > line && text[stop - 1] == ']') {
+                last = line;
+                value_end = stop - 1;
+            }
+        }
+
+        // A value never closed is cut at the end of its first line.
+        if (value_end == npos) {
+            value_end = end;
+        }
+
+        m_entries.push_back({text.substr(pos + 1, found - pos - 1),
+                             text.substr(begin, value_end - begin)});
+        pos = next_line(last);
+    }
+
+    // getprop sorts its output, but the first of duplicates is kept anyway.
+    const auto by_name = [](const property& a, const property& b) {
+        return a.name < b.name;
+    };
+    const auto same_name = [](const property& a, const property& b) {
+        return a.name == b.name;
+    };
+    std::stable_sort(m_entries.begin(), m_entries.end(), by_name);
+    m_entries.erase(
+        std::unique(m_entries.begin(), m_entries.end(), same_name),
+        m_entries.end());
+}
+
+void property_map_impl::index() {
+    m_slots.assign(std::bit_ceil(std::max<size_t>(m_entries.size() * 2, 8)),
+                   empty_slot);
+
+    const auto mask = m_slots.size() - 1;
+    for (uint32_t i = 0; i < m_entries.size(); i++) {
+        auto slot = std::hash<std::string_view>()(m_entries[i].name) & mask;
+        while (m_slots[slot] != empty_slot) {
+            slot = (slot + 1) & mask;
+        }
+        m_slots[slot] = i;
+    }
+}
+
+} // namespace adb
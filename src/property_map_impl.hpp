@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstdint>
+
+#include "property_map.hpp"
+
+namespace adb {
+
+/// Pimpl class for property_map.
+class property_map_impl : public property_map {
+  public:
+    property_map_impl(std::string output);
+
+    std::optional<std::string_view>
+    get(const std::string_view name) const override;
+    std::string_view get(const std::string_view name,
+                         const std::string_view fallback) const override;
+    const std::vector<property>& entries() const override { return m_entries; }
+
+  private:
+    /// Slot of the hash table without an entry.
+    static constexpr uint32_t empty_slot = UINT32_MAX;
+
+    /// Output of `getprop`, viewed by the entries.
+    const std::string m_output;
+
+    std::vector<property> m_entries;
+
+    /// Open-addressing hash table of the indices of the entries, with a
+    /// power-of-two size at least twice the number of entries.
+    std::vector<uint32_t> m_slots;
+
+    /// Split the output into the entries.
+    void split();
+
+    /// Build the hash table of the entries.
+    void index();
+};
+
+} // namespace adb
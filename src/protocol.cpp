@@ -1,15 +1,140 @@
+#include <charconv>
+#include <cstdlib>
 #include <fstream>
 #include <iomanip>
+#include <mutex>
+#include <unordered_map>
+
+#include <asio/post.hpp>
+#include <asio/read.hpp>
+#include <asio/write.hpp>
 
 #include "protocol.hpp"
 
 namespace adb::protocol {
 
-/// Adb host endpoint, which is `127.0.0.1:5037`.
-static inline const asio::ip::tcp::endpoint host_endpoint = [] {
+asio::ip::tcp::endpoint parse_endpoint(std::string_view address,
+                                       std::error_code& ec) {
+    if (address.substr(0, 4) == "tcp:") {
+        address.remove_prefix(4);
+    }
+
+    std::string_view host = "127.0.0.1";
+    auto port = address;
+    const auto colon = address.rfind(':');
+    if (colon != std::string_view::npos) {
+        host = address.substr(0, colon);
+        port = address.substr(colon + 1);
+    }
+    if (host.size() >= 2 && host.front() == '[' && host.back() == ']') {
+        host = host.substr(1, host.size() - 2);
+    }
+    if (host == "localhost") {
+        host = "127.0.0.1";
+    }
+
+    uint16_t number = 0;
+    const auto last = port.data() + port.size();
+    const auto [end, error] = std::from_chars(port.data(), last, number);
+    asio::error_code invalid;
+    const auto ip = asio::ip::make_address(std::string(host), invalid);
+    if (error != std::errc() || end != last || number == 0 || invalid) {
+        ec = asio::error::invalid_argument;
+        return {};
+    }
+
+    ec.clear();
+    return {ip, number};
+}
+
+/// Read the default adb host endpoint from the environment.
+static asio::ip::tcp::endpoint environment_endpoint() {
     auto localhost = asio::ip::address_v4({127, 0, 0, 1});
-    return asio::ip::tcp::endpoint(localhost, 5037);
-}();
+    const auto fallback = asio::ip::tcp::endpoint(localhost, 5037);
+
+    // Same settings as the adb command line, the socket taking precedence.
+    // The first one set is the only one read, even if it is malformed.
+    for (const auto name : {"ADB_SERVER_SOCKET", "ANDROID_ADB_SERVER_PORT"}) {
+        const auto value = std::getenv(name);
+        if (value == nullptr || *value == '\0') {
+            continue;
+        }
+
+        std::error_code ec;
+        const auto endpoint = parse_endpoint(value, ec);
+        return ec ? fallback : endpoint;
+    }
+    return fallback;
+}
+
+const asio::ip::tcp::endpoint& default_endpoint() {
+    static const auto endpoint = environment_endpoint();
+    return endpoint;
+}
+
+/// Operations registered for abort_all(), by key.
+static std::mutex tracked_mutex;
+static std::unordered_map<const void*,
+                          std::pair<asio::execution_context*, abort_t>>
+    tracked;
+
+void track(asio::execution_context& context, const void* key, abort_t abort) {
+    std::lock_guard lock(tracked_mutex);
+    tracked.insert_or_assign(key, std::make_pair(&context, std::move(abort)));
+}
+
+void untrack(const void* key) {
+    std::lock_guard lock(tracked_mutex);
+    tracked.erase(key);
+}
+
+void abort_all(asio::io_context& context, const std::error_code& reason) {
+    // Sockets are only touched on their event loop.
+    asio::post(context, [&context, reason] {
+        std::lock_guard lock(tracked_mutex);
+        for (const auto& [key, entry] : tracked) {
+            if (entry.first == &context) {
+                entry.second(reason);
+            }
+        }
+    });
+}
+
+/// Seconds of silence before the first probe, between probes, and probes
+/// lost before the connection is dropped.
+static constexpr int keepalive_idle = 5;
+static constexpr int keepalive_interval = 2;
+static constexpr int keepalive_count = 3;
+
+/// Milliseconds data may stay unacknowledged before the connection is
+/// dropped.
+static constexpr int user_timeout = 10000;
+
+void set_liveness(asio::ip::tcp::socket& socket) {
+    using asio::detail::socket_option::integer;
+
+    asio::error_code ignored;
+    socket.set_option(asio::socket_base::keep_alive(true), ignored);
+#if defined(TCP_KEEPIDLE)
+    socket.set_option(integer<IPPROTO_TCP, TCP_KEEPIDLE>(keepalive_idle),
+                      ignored);
+#elif defined(TCP_KEEPALIVE)
+    socket.set_option(integer<IPPROTO_TCP, TCP_KEEPALIVE>(keepalive_idle),
+                      ignored);
+#endif
+#if defined(TCP_KEEPINTVL)
+    socket.set_option(
+        integer<IPPROTO_TCP, TCP_KEEPINTVL>(keepalive_interval), ignored);
+#endif
+#if defined(TCP_KEEPCNT)
+    socket.set_option(integer<IPPROTO_TCP, TCP_KEEPCNT>(keepalive_count),
+                      ignored);
+#endif
+#if defined(TCP_USER_TIMEOUT)
+    socket.set_option(integer<IPPROTO_TCP, TCP_USER_TIMEOUT>(user_timeout),
+                      ignored);
+#endif
+}
 
 /// Encoded the ADB host request.
 /**
@@ -22,6 +147,27 @@ static inline std::string host_request(const std::string_view body) {
     return ss.str();
 }
 
+/// Encode a little-endian 32-bit field of the sync protocol.
+static inline std::string sync_u32(const uint32_t value) {
+    const auto bytes = {
+        static_cast<char>(value & 0xff),
+        static_cast<char>((value >> 8) & 0xff),
+        static_cast<char>((value >> 16) & 0xff),
+        static_cast<char>((value >> 24) & 0xff),
+    };
+
+    return std::string(bytes.begin(), bytes.end());
+}
+
+/// Decode a little-endian 32-bit field of the sync protocol.
+static inline uint32_t sync_u32(const char* p) {
+    uint32_t value = 0;
+    for (int i = 3; i >= 0; i--) {
+        value = (value << 8) | static_cast<uint8_t>(p[i]);
+    }
+    return value;
+}
+
 /// Encode the ADB sync request.
 /**
  * @param id 4-byte string of the request id.
@@ -29,25 +175,21 @@ static inline std::string host_request(const std::string_view body) {
  */
 static inline std::string sync_request(const std::string_view id,
                                        const uint32_t length) {
-    const auto len = {
-        static_cast<char>(length & 0xff),
-        static_cast<char>((length >> 8) & 0xff),
-        static_cast<char>((length >> 16) & 0xff),
-        static_cast<char>((length >> 24) & 0xff),
-    };
-
-    return std::string(id) + std::string(len.begin(), len.end());
+    return std::string(id) + sync_u32(length);
 }
 
-async_handle::async_handle(asio::io_context& context)
-    : m_context(context), m_socket(context) {
+async_handle::async_handle(asio::io_context& context,
+                           const asio::ip::tcp::endpoint& endpoint)
+    : m_context(context), m_endpoint(endpoint), m_socket(context) {
     m_buffer = std::make_unique<std::array<char, buf_size>>();
     m_file = nullptr;
 }
 
 std::string async_handle::value() const { return m_data; }
 
-std::error_code async_handle::error() const { return m_error; }
+std::error_code async_handle::error() const {
+    return m_aborted ? m_aborted : m_error;
+}
 
 #define CB this, callback = std::move(callback)
 #define TOKEN const auto& ec
@@ -60,8 +202,11 @@ void async_handle::connect(const callback_t&& callback) {
         return;
     }
 
-    m_socket.async_connect(host_endpoint, [CB](TOKEN) {
+    m_socket.async_connect(m_endpoint, [CB](TOKEN) {
         m_error = ec;
+        if (!ec) {
+            set_liveness(m_socket);
+        }
         callback();
     });
 }
@@ -167,32 +312,88 @@ void async_handle::host_data(const callback_t&& callback) {
         }
 
         m_data.append(m_buffer->data(), size);
-        host_data(std::move(callback));
+        pace(size, [CB] { host_data(std::move(callback)); });
     });
 }
 
-void async_handle::sync_request(const std::string_view id,
-                                const uint32_t length, const char* body,
-                                const callback_t&& callback) {
+void async_handle::host_read(char* data, const size_t size,
+                             const callback_t&& callback) {
     if (m_error) {
         callback();
         return;
     }
 
-    auto header = ::adb::protocol::sync_request(id, length);
-    m_socket.async_write_some(asio::buffer(header), [=, CB](TOKEN1) {
-        if (ec || body == nullptr) {
+    const auto buffer = asio::buffer(data, size);
+    asio::async_read(m_socket, buffer, [CB](TOKEN2) {
+        m_received = size;
+        if (ec && ec != asio::error::eof) {
             m_error = ec;
-            callback();
-            return;
         }
+        pace(size, std::move(callback));
+    });
+}
+
+void async_handle::host_read_some(char* data, const size_t size,
+                                  const callback_t&& callback) {
+    if (m_error) {
+        callback();
+        return;
+    }
 
-        auto buffers = asio::buffer(body, length);
-        m_socket.async_write_some(buffers, [CB](TOKEN2) {
+    const auto buffer = asio::buffer(data, size);
+    m_socket.async_read_some(buffer, [CB](TOKEN2) {
+        m_received = size;
+        if (ec && ec != asio::error::eof) {
             m_error = ec;
-            m_buffer_ptr += size;
-            callback();
-        });
+        }
+        callback();
+    });
+}
+
+void async_handle::sync_request(const std::string_view id,
+                                const uint32_t length, const char* body,
+                                const callback_t&& callback) {
+    if (m_error) {
+        callback();
+        return;
+    }
+
+    const auto header = ::adb::protocol::sync_request(id, length);
+    std::copy_n(header.data(), m_sync_header.size(), m_sync_header.data());
+
+    // One write, as a small body sent apart would wait for the ACK of the
+    // header on a socket with Nagle's algorithm.
+    const auto body_size = body == nullptr ? 0 : length;
+    const std::array<asio::const_buffer, 2> buffers = {
+        asio::buffer(m_sync_header), asio::buffer(body, body_size)};
+    asio::async_write(m_socket, buffers, [CB](TOKEN2) {
+        m_error = ec;
+        m_buffer_ptr += size - std::min(size, m_sync_header.size());
+        callback();
+    });
+}
+
+void async_handle::sync_request_v2(const std::string_view id,
+                                   const std::string_view path,
+                                   const std::vector<uint32_t>& args,
+                                   const callback_t&& callback) {
+    if (m_error) {
+        callback();
+        return;
+    }
+
+    const auto length = static_cast<uint32_t>(path.size());
+    auto request = ::adb::protocol::sync_request(id, length);
+    request.append(path);
+    request.append(id);
+    for (const auto arg : args) {
+        request += sync_u32(arg);
+    }
+
+    auto data = std::make_shared<std::string>(std::move(request));
+    asio::async_write(m_socket, asio::buffer(*data), [CB, data](TOKEN1) {
+        m_error = ec;
+        callback();
     });
 }
 
@@ -222,6 +423,7 @@ void async_handle::sync_response(const callback_t&& callback) {
 }
 
 void async_handle::sync_send_file(const std::filesystem::path& path,
+                                  const bool compress,
                                   const callback_t&& callback) {
     if (m_error) {
         callback();
@@ -229,21 +431,132 @@ void async_handle::sync_send_file(const std::filesystem::path& path,
     }
 
     m_file = std::make_unique<std::ifstream>(path, std::ios::binary);
+    if (!*m_file) {
+        m_file = nullptr;
+        m_error = asio::error::not_found;
+        callback();
+        return;
+    }
+
+    m_raw = false;
+    m_compress = compress;
+    if (compress) {
+        m_encoder = std::make_unique<lz4::frame_encoder>();
+        m_pending.clear();
+    }
+
     m_buffer_ptr = m_buffer_size = 0;
+    m_transferred = 0;
     sync_write_data(std::move(callback));
 }
 
+void async_handle::stream_send_file(const std::filesystem::path& path,
+                                    const callback_t&& callback) {
+    if (m_error) {
+        callback();
+        return;
+    }
+
+    m_file = std::make_unique<std::ifstream>(path, std::ios::binary);
+    if (!*m_file) {
+        m_file = nullptr;
+        m_error = asio::error::not_found;
+        callback();
+        return;
+    }
+
+    m_raw = true;
+    m_compress = false;
+    m_buffer_ptr = m_buffer_size = 0;
+    m_transferred = 0;
+    sync_write_data(std::move(callback));
+}
+
+void async_handle::sync_recv_file(const std::filesystem::path& path,
+                                  const bool decompress,
+                                  const callback_t&& callback) {
+    if (m_error) {
+        callback();
+        return;
+    }
+
+    m_output = std::make_unique<std::ofstream>(path, std::ios::binary);
+    if (!*m_output) {
+        m_output = nullptr;
+        m_error = asio::error::access_denied;
+        callback();
+        return;
+    }
+
+    if (decompress) {
+        m_decoder = std::make_unique<lz4::frame_decoder>();
+    }
+
+    m_transferred = 0;
+    sync_read_data(std::move(callback));
+}
+
 void async_handle::run(const int64_t timeout) {
+    // The wait is cut short if the device goes away meanwhile.
+    track(m_context, this,
+          [this](const std::error_code& reason) { abort(reason); });
+
     auto future = m_promise.get_future();
     auto status = future.wait_for(std::chrono::milliseconds(timeout));
+    untrack(this);
 
     if (status == std::future_status::timeout) {
-        m_socket.cancel(m_error);
-        m_error = asio::error::timed_out;
+        cancel();
     }
 }
 
-void async_handle::finish() { m_promise.set_value(); }
+void async_handle::cancel() {
+    m_socket.cancel(m_error);
+    if (m_pace_timer) {
+        m_pace_timer->cancel();
+    }
+    m_error = asio::error::timed_out;
+}
+
+void async_handle::abort(const std::error_code& reason) {
+    if (m_finished) {
+        return;
+    }
+
+    asio::error_code ignored;
+    m_socket.cancel(ignored);
+    if (m_pace_timer) {
+        m_pace_timer->cancel();
+    }
+    m_aborted = reason;
+    m_error = asio::error::operation_aborted;
+}
+
+void async_handle::finish() {
+    m_finished = true;
+    m_promise.set_value();
+}
+
+asio::ip::tcp::socket async_handle::release_socket() {
+    return std::move(m_socket);
+}
+
+void async_handle::pace(const size_t size, const callback_t&& callback) {
+    const auto delay = m_pacer && !m_error ? m_pacer(size)
+                                           : std::chrono::nanoseconds(0);
+    if (delay.count() <= 0) {
+        callback();
+        return;
+    }
+
+    if (!m_pace_timer) {
+        m_pace_timer = std::make_unique<asio::steady_timer>(m_context);
+    }
+
+    // A cancelled wait leaves the error set by cancel().
+    m_pace_timer->expires_after(delay);
+    m_pace_timer->async_wait([CB](auto) { callback(); });
+}
 
 void async_handle::host_read_data(const callback_t&& callback) {
     if (m_error) {
@@ -268,8 +581,9 @@ void async_handle::host_read_data(const callback_t&& callback) {
 }
 
 void async_handle::sync_write_data(const callback_t&& callback) {
-    if (m_error || m_file->eof()) {
+    if (m_error) {
         m_file = nullptr;
+        m_encoder = nullptr;
         callback();
         return;
     }
@@ -287,14 +601,150 @@ void async_handle::sync_write_data(const callback_t&& callback) {
         return;
     }
 
-    m_file->read(m_buffer->data(), buf_size);
-
     m_buffer_ptr = 0;
-    m_buffer_size = m_file->gcount();
+    m_buffer_size = sync_fill_buffer();
+
+    if (m_buffer_size == 0) {
+        m_file = nullptr;
+        callback();
+        return;
+    }
+
+    m_transferred += m_buffer_size;
 
     // DATA request: file data trunk, trunk size
-    sync_request("DATA", static_cast<uint32_t>(m_buffer_size), m_buffer->data(),
-                 [CB] { sync_write_data(std::move(callback)); });
+    pace(m_buffer_size, [CB] {
+        // Raw chunks are written by the next call, as what is left.
+        if (m_raw) {
+            sync_write_data(std::move(callback));
+            return;
+        }
+
+        sync_request("DATA", static_cast<uint32_t>(m_buffer_size),
+                     m_buffer->data(),
+                     [CB] { sync_write_data(std::move(callback)); });
+    });
+}
+
+size_t async_handle::sync_fill_buffer() {
+    const auto read = [this]() -> size_t {
+        if (!*m_file) {
+            return 0;
+        }
+        m_file->read(m_buffer->data(), buf_size);
+        return m_file->gcount();
+    };
+
+    if (!m_compress) {
+        return read();
+    }
+
+    // The frame is cut into DATA packets regardless of its block boundaries.
+    while (m_pending.empty() && m_encoder) {
+        const auto size = read();
+        if (size == 0) {
+            m_encoder->finish(m_pending);
+            m_encoder = nullptr;
+        } else {
+            const auto chunk = std::string_view(m_buffer->data(), size);
+            m_encoder->write(chunk, m_pending);
+        }
+    }
+
+    const auto size = std::min(m_pending.size(), buf_size);
+    std::copy_n(m_pending.data(), size, m_buffer->data());
+    m_pending.erase(0, size);
+    return size;
+}
+
+void async_handle::sync_read_data(const callback_t&& callback) {
+    if (m_error) {
+        m_output = nullptr;
+        m_decoder = nullptr;
+        callback();
+        return;
+    }
+
+    // Response header: id, length
+    auto header = asio::buffer(m_buffer->data(), 8);
+    asio::async_read(m_socket, header, [CB](TOKEN1) {
+        if (ec) {
+            m_error = ec;
+            sync_read_data(std::move(callback));
+            return;
+        }
+
+        const auto id = std::string_view(m_buffer->data(), 4);
+        const auto length = sync_u32(m_buffer->data() + 4);
+
+        if (id == "DATA") {
+            m_data_size = length;
+            sync_read_payload(std::move(callback));
+            return;
+        }
+
+        if (id == "DONE") {
+            if (m_decoder && !m_decoder->finished()) {
+                m_error = asio::error::invalid_argument;
+            } else if (!m_output->flush()) {
+                m_error = asio::error::access_denied;
+            }
+            m_output = nullptr;
+            m_decoder = nullptr;
+            callback();
+            return;
+        }
+
+        if (id != "FAIL") {
+            m_error = asio::error::invalid_argument;
+            sync_read_data(std::move(callback));
+            return;
+        }
+
+        // FAIL response: message
+        m_data.resize(length);
+        auto message = asio::buffer(m_data);
+        asio::async_read(m_socket, message, [CB](TOKEN1) {
+            m_error = ec ? ec : asio::error::fault;
+            sync_read_data(std::move(callback));
+        });
+    });
+}
+
+void async_handle::sync_read_payload(const callback_t&& callback) {
+    if (m_data_size == 0) {
+        sync_read_data(std::move(callback));
+        return;
+    }
+
+    // DATA packets can be larger than the buffer.
+    const auto length = std::min(m_data_size, buf_size);
+    auto payload = asio::buffer(m_buffer->data(), length);
+    asio::async_read(m_socket, payload, [CB](TOKEN2) {
+        if (ec) {
+            m_error = ec;
+            sync_read_data(std::move(callback));
+            return;
+        }
+
+        m_data_size -= size;
+        m_transferred += size;
+
+        const auto chunk = std::string_view(m_buffer->data(), size);
+        const auto write = [this](const std::string_view data) {
+            m_output->write(data.data(), data.size());
+        };
+
+        if (!m_decoder) {
+            write(chunk);
+        } else if (!m_decoder->feed(chunk, write)) {
+            m_error = asio::error::invalid_argument;
+            sync_read_data(std::move(callback));
+            return;
+        }
+
+        pace(size, [CB] { sync_read_payload(std::move(callback)); });
+    });
 }
 
 } // namespace adb::protocol
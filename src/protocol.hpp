@@ -2,10 +2,15 @@
 
 #include <filesystem>
 #include <fstream>
+#include <functional>
 #include <future>
 #include <string_view>
+#include <vector>
 
 #include <asio/ip/tcp.hpp>
+#include <asio/steady_timer.hpp>
+
+#include "lz4.hpp"
 
 namespace adb {
 class io_handle_impl;
@@ -13,14 +18,72 @@ class io_handle_impl;
 
 namespace adb::protocol {
 
+/// Get the default adb host endpoint.
+/**
+ * @return `127.0.0.1:5037` unless set by the `ADB_SERVER_SOCKET` or
+ * `ANDROID_ADB_SERVER_PORT` environment variables, read on first use.
+ * @note `ADB_SERVER_SOCKET` wins if it is set. If the variable read is
+ * malformed, the result is `127.0.0.1:5037`, without trying the other one.
+ * @note A function-local static, so it is safe to use during static
+ * initialization.
+ */
+const asio::ip::tcp::endpoint& default_endpoint();
+
+/// Parse the address of an adb server.
+/**
+ * @return Endpoint of the server.
+ * @param address `[tcp:][host:]port`, e.g. `tcp:127.0.0.1:5038` or `5038`.
+ * The host is an IP address, in brackets for IPv6, or `localhost`, and
+ * defaults to `127.0.0.1`.
+ * @param ec asio::error::invalid_argument if the address is malformed.
+ */
+asio::ip::tcp::endpoint parse_endpoint(std::string_view address,
+                                       std::error_code& ec);
+
+/// Function failing the operations of a socket, with the reason given.
+typedef std::function<void(const std::error_code&)> abort_t;
+
+/// Register the operations of a socket to be failed by abort_all().
+/**
+ * @param context Event loop of the socket.
+ * @param key Key of the registration, e.g. the owner of the socket.
+ * @param abort Function called on the event loop by abort_all(). It must not
+ * register or unregister anything.
+ */
+void track(asio::execution_context& context, const void* key, abort_t abort);
+
+/// Unregister the operations of a socket.
+/**
+ * @param key Key of the registration.
+ * @note Once returned, the abort function is not called anymore.
+ */
+void untrack(const void* key);
+
+/// Fail at once the operations registered on an event loop.
+/**
+ * @param context Event loop of the operations.
+ * @param reason Error the operations fail with.
+ */
+void abort_all(asio::io_context& context, const std::error_code& reason);
+
+/// Tune the TCP keepalive and user timeout of a connected socket.
+/**
+ * @param socket Socket to tune.
+ * @note A dead peer is then found in about 10 seconds, instead of the hours
+ * of the system defaults. Options missing on the platform are skipped.
+ */
+void set_liveness(asio::ip::tcp::socket& socket);
+
 /// Handle that manages async methods for socket transports.
 class async_handle {
   public:
     /// Construct an async_handle.
     /**
      * @param context Reference to the socket I/O event loop.
+     * @param endpoint Endpoint of the adb server to connect to.
      */
-    async_handle(asio::io_context& context);
+    async_handle(asio::io_context& context,
+                 const asio::ip::tcp::endpoint& endpoint = default_endpoint());
 
     /// Get the data received from the host.
     /**
@@ -39,6 +102,16 @@ class async_handle {
     /// Callback function type for async operations.
     typedef std::function<void()> callback_t;
 
+    /// Function giving how long to wait before moving bulk bytes.
+    typedef std::function<std::chrono::nanoseconds(size_t)> pacer_t;
+
+    /// Pace the bulk data of the handle.
+    /**
+     * @param pacer Function called with the size of each DATA packet sent or
+     * received, and of each chunk read by host_read() and host_data().
+     */
+    void set_pacer(pacer_t pacer) { m_pacer = std::move(pacer); }
+
     /// Connect to the adbd.
     /**
      * @param callback Function called when the connection is established.
@@ -68,6 +141,29 @@ class async_handle {
      */
     void host_data(const callback_t&& callback);
 
+    /// Receive data from the host into a buffer owned by the caller.
+    /**
+     * @param data Buffer to receive the data.
+     * @param size Size of the buffer.
+     * @param callback Function called when the buffer is full, or at EOF.
+     * @note EOF is not an error. The size received is given by received().
+     */
+    void host_read(char* data, const size_t size, const callback_t&& callback);
+
+    /// Receive the data available from the host, at least one byte.
+    /**
+     * @param data Buffer to receive the data.
+     * @param size Size of the buffer.
+     * @param callback Function called when some data is received, or at EOF.
+     * @note EOF is not an error. The size received is given by received(),
+     * and is 0 at EOF.
+     */
+    void host_read_some(char* data, const size_t size,
+                        const callback_t&& callback);
+
+    /// Get the size of the data received by the last host_read().
+    size_t received() const { return m_received; }
+
     /// Send an ADB sync request.
     /**
      * @param id 4-byte string of the request id.
@@ -78,6 +174,18 @@ class async_handle {
     void sync_request(const std::string_view id, const uint32_t length,
                       const char* body, const callback_t&& callback);
 
+    /// Send an ADB sync v2 request, followed by its setup message.
+    /**
+     * @param id 4-byte string of the request id, e.g. `SND2`.
+     * @param path Remote path of the request.
+     * @param args Fields of the setup message after the id, e.g. mode and
+     * flags.
+     * @param callback Function called when the request is sent.
+     */
+    void sync_request_v2(const std::string_view id, const std::string_view path,
+                         const std::vector<uint32_t>& args,
+                         const callback_t&& callback);
+
     /// Receive the sync response.
     /**
      * @param callback Function called when the response is received.
@@ -87,11 +195,39 @@ class async_handle {
     /// Send the content of file with sync requests.
     /**
      * @param path Path to the file.
+     * @param compress Whether to send the content as an LZ4 frame.
      * @param callback Function called when the file is sent.
      */
-    void sync_send_file(const std::filesystem::path& path,
+    void sync_send_file(const std::filesystem::path& path, const bool compress,
                         const callback_t&& callback);
 
+    /// Send the content of file as is, e.g. to the input of an `exec:`.
+    /**
+     * @param path Path to the file.
+     * @param callback Function called when the file is sent.
+     * @note The file is read and paced in the chunks of sync_send_file(),
+     * without the DATA requests around them.
+     */
+    void stream_send_file(const std::filesystem::path& path,
+                          const callback_t&& callback);
+
+    /// Receive the content of file from sync responses, until DONE.
+    /**
+     * @param path Path to the local file to write.
+     * @param decompress Whether the content is an LZ4 frame.
+     * @param callback Function called when the file is received.
+     * @note On FAIL, the error is set to asio::error::fault, and the message
+     * is available with value().
+     */
+    void sync_recv_file(const std::filesystem::path& path,
+                        const bool decompress, const callback_t&& callback);
+
+    /// Get the size of the file content sent or received on the wire.
+    /**
+     * @return Bytes in the DATA packets of the last file transfer.
+     */
+    uint64_t sync_transferred() const { return m_transferred; }
+
     /// Run the wait for the tasks in the handle.
     /**
      * @param timeout Timeout in milliseconds.
@@ -100,16 +236,35 @@ class async_handle {
      */
     void run(const int64_t timeout);
 
+    /// Cancel the pending operations of the handle.
+    /**
+     * @note The error is set to asio::error::timed_out. Call it on the event
+     * loop if the handle is used asynchronously.
+     */
+    void cancel();
+
     /// Mark the tasks in the handle resolved.
     /**
      * @note This function should be called in the callback of the last task.
      */
     void finish();
 
+    /// Take over the socket of the handle.
+    /**
+     * @return Socket connected to the adbd, after the last response.
+     * @note Used when the stream is relayed elsewhere. The handle should not
+     * be used afterwards.
+     */
+    asio::ip::tcp::socket release_socket();
+
   protected:
     /// Error code of the last operation.
     asio::error_code m_error;
 
+    /// Reason given by abort_all(), which wins over the error of the
+    /// operation it cancelled.
+    std::error_code m_aborted;
+
     /// Data or message received from the host.
     std::string m_data;
 
@@ -117,6 +272,9 @@ class async_handle {
     /// Socket I/O event loop.
     asio::io_context& m_context;
 
+    /// Endpoint of the adb server.
+    const asio::ip::tcp::endpoint m_endpoint;
+
     /// Socket for the adb connection.
     asio::ip::tcp::socket m_socket;
 
@@ -126,6 +284,9 @@ class async_handle {
      */
     std::array<char, 4> m_header;
 
+    /// Header of the sync request being sent: id and length.
+    std::array<char, 8> m_sync_header;
+
     /// Buffer size for regular transportations.
     static constexpr size_t buf_size = 64000;
 
@@ -153,10 +314,16 @@ class async_handle {
     /// Promise to wait for the tasks in the handle.
     std::promise<void> m_promise;
 
+    /// Whether finish() was called, after which abort() does nothing.
+    /**
+     * @note Only used on the event loop.
+     */
+    bool m_finished = false;
+
     /// Size of the data received from the host.
     /**
-     * @note Exclusively used in host_message(), whose size has been encoded in
-     * the response header.
+     * @note Used in host_message(), whose size has been encoded in the
+     * response header, and in sync_read_payload() for the payload left.
      */
     size_t m_data_size;
 
@@ -166,6 +333,54 @@ class async_handle {
      */
     std::unique_ptr<std::ifstream> m_file;
 
+    /// File written with the DATA sync responses.
+    /**
+     * @note Exclusively used in sync_recv_file and sync_read_data.
+     */
+    std::unique_ptr<std::ofstream> m_output;
+
+    /// Whether the file content is sent without sync requests.
+    bool m_raw = false;
+
+    /// Whether the file content is sent as an LZ4 frame.
+    bool m_compress = false;
+
+    /// Encoder of the file content, until the frame is finished.
+    std::unique_ptr<lz4::frame_encoder> m_encoder;
+
+    /// Decoder of the received content, if it is compressed.
+    std::unique_ptr<lz4::frame_decoder> m_decoder;
+
+    /// Compressed data not sent yet.
+    std::string m_pending;
+
+    /// Bytes of DATA payload in the last file transfer.
+    uint64_t m_transferred = 0;
+
+    /// Bytes received by the last host_read() or host_read_some().
+    size_t m_received = 0;
+
+    /// Pacer of the bulk data, if any.
+    pacer_t m_pacer;
+
+    /// Timer of the wait imposed by the pacer, created on first use.
+    std::unique_ptr<asio::steady_timer> m_pace_timer;
+
+    /// Fail the pending operations of the handle, from abort_all().
+    /**
+     * @param reason Error the operations fail with.
+     * @note An operation finished before the abort keeps its result, even
+     * if run() has not returned yet.
+     */
+    void abort(const std::error_code& reason);
+
+    /// Wait as long as the pacer asks for a chunk of bulk data.
+    /**
+     * @param size Size of the chunk.
+     * @param callback Function called after the wait.
+     */
+    void pace(const size_t size, const callback_t&& callback);
+
     /// Receive and check the response.
     /**
      * @param callback Function called when the response is received.
@@ -183,10 +398,31 @@ class async_handle {
     /// Send the content of file with DATA sync request.
     /**
      * @param callback Function called when the data is sent.
-     * @note This function is called internally by sync_send_file().
+     * @note This function is called internally by sync_send_file() and
+     * stream_send_file().
      */
     void sync_write_data(const callback_t&& callback);
 
+    /// Fill the buffer with the next chunk of file content.
+    /**
+     * @return Size of the chunk. 0 if the file has been sent.
+     */
+    size_t sync_fill_buffer();
+
+    /// Receive the next sync response of a file.
+    /**
+     * @param callback Function called when the file is received.
+     * @note This function is called internally by sync_recv_file().
+     */
+    void sync_read_data(const callback_t&& callback);
+
+    /// Receive the payload of a DATA sync response, in chunks.
+    /**
+     * @param callback Function called when the file is received.
+     * @note This function is called internally by sync_read_data().
+     */
+    void sync_read_payload(const callback_t&& callback);
+
     /// Allow io_handle_impl to contruct from this class.
     friend class ::adb::io_handle_impl;
 };
@@ -0,0 +1,139 @@
+#include <asio/post.hpp>
+
+#include "receive_channel_impl.hpp"
+
+namespace adb {
+
+using asio::ip::tcp;
+
+receive_channel_impl::pointer
+receive_channel_impl::create(asio::io_context& context, sink_t sink,
+                             std::error_code& ec) {
+    auto channel = std::make_shared<receive_channel_impl>(context, sink);
+
+    asio::error_code error;
+    auto& acceptor = channel->m_acceptor;
+    acceptor.open(tcp::v4(), error);
+    if (!error) {
+        acceptor.bind(tcp::endpoint(tcp::v4(), 0), error);
+    }
+    if (!error) {
+        acceptor.listen(asio::socket_base::max_listen_connections, error);
+    }
+    if (!error) {
+        channel->m_port = acceptor.local_endpoint(error).port();
+    }
+
+    ec = error;
+    if (ec) {
+        return nullptr;
+    }
+
+    channel->start();
+    return channel;
+}
+
+receive_channel_impl::receive_channel_impl(asio::io_context& context,
+                                           sink_t sink)
+    : m_acceptor(context), m_socket(context), m_sink(std::move(sink)) {
+    m_buffer = std::make_unique<std::array<char, buf_size>>();
+}
+
+std::string
+receive_channel_impl::nc_command(const std::string_view host) const {
+    return "nc -w 3 " + std::string(host) + " " + std::to_string(m_port);
+}
+
+std::string receive_channel_impl::receive(std::error_code& ec,
+                                          const int64_t timeout) {
+    std::unique_lock lock(m_mutex);
+
+    const auto done = [this] { return m_done; };
+    if (!m_cv.wait_for(lock, std::chrono::milliseconds(timeout), done)) {
+        lock.unlock();
+        close();
+        ec = asio::error::timed_out;
+        return {};
+    }
+
+    ec = m_error;
+    return std::move(m_data);
+}
+
+std::string receive_channel_impl::retarget(const std::string_view command,
+                                           std::error_code& ec) const {
+    // Same form as `(.+nc -w 3 .+ ).+`: a pipeline into nc, a host and a port.
+    constexpr std::string_view nc = "nc -w 3 ";
+    const auto pos = command.rfind(nc);
+    const auto last = command.find_last_of(' ');
+    if (pos == std::string_view::npos || pos == 0 ||
+        last <= pos + nc.size() || last + 1 == command.size()) {
+        ec = asio::error::invalid_argument;
+        return {};
+    }
+
+    ec.clear();
+    const auto prefix = command.substr(0, last + 1);
+    return std::string(prefix) + std::to_string(m_port);
+}
+
+void receive_channel_impl::start() {
+    m_acceptor.async_accept(
+        m_socket, [self = shared_from_this()](const auto& error) {
+            // Only one transfer per channel.
+            asio::error_code ignored;
+            self->m_acceptor.close(ignored);
+
+            if (error) {
+                self->complete(error);
+                return;
+            }
+
+            self->read();
+        });
+}
+
+void receive_channel_impl::read() {
+    m_socket.async_read_some(
+        asio::buffer(*m_buffer),
+        [self = shared_from_this()](const auto& error, auto size) {
+            if (size > 0) {
+                const auto data = self->m_buffer->data();
+                const auto chunk = std::string_view(data, size);
+                if (self->m_sink) {
+                    self->m_sink(chunk);
+                } else {
+                    self->m_data.append(chunk);
+                }
+            }
+
+            if (error == asio::error::eof) {
+                self->complete({});
+                return;
+            }
+
+            if (error) {
+                self->complete(error);
+                return;
+            }
+
+            self->read();
+        });
+}
+
+void receive_channel_impl::complete(const std::error_code& error) {
+    std::lock_guard lock(m_mutex);
+    m_error = error;
+    m_done = true;
+    m_cv.notify_all();
+}
+
+void receive_channel_impl::close() {
+    asio::post(m_socket.get_executor(), [self = shared_from_this()] {
+        asio::error_code ignored;
+        self->m_acceptor.close(ignored);
+        self->m_socket.close(ignored);
+    });
+}
+
+} // namespace adb
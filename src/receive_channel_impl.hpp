@@ -0,0 +1,78 @@
+#pragma once
+
+#include <condition_variable>
+#include <mutex>
+
+#include <asio/ip/tcp.hpp>
+
+#include "receive_channel.hpp"
+
+namespace adb {
+
+/// Pimpl class for receive_channel.
+class receive_channel_impl
+    : public receive_channel,
+      public std::enable_shared_from_this<receive_channel_impl> {
+  public:
+    typedef std::shared_ptr<receive_channel_impl> pointer;
+
+    /// Create a channel and start listening on an ephemeral port.
+    /**
+     * @param context io_context to run the transfer on.
+     * @param sink Function called with each chunk. May be empty to collect
+     * the data into the channel.
+     * @param ec std::error_code to indicate what error occurred, if any.
+     */
+    static pointer create(asio::io_context& context, sink_t sink,
+                          std::error_code& ec);
+
+    receive_channel_impl(asio::io_context& context, sink_t sink);
+
+    uint16_t port() const override { return m_port; }
+    std::string nc_command(const std::string_view host) const override;
+    std::string receive(std::error_code& ec, const int64_t timeout) override;
+
+    /// Point a legacy socket-mode command at this channel.
+    /**
+     * @param command Command piping into `nc -w 3 <host> <port>`, e.g.
+     * `screencap -p | nc -w 3 10.0.2.2 0`.
+     * @param ec asio::error::invalid_argument if the command does not end
+     * with the nc pipeline.
+     * @return Command with the port replaced by the channel's port.
+     */
+    std::string retarget(const std::string_view command,
+                         std::error_code& ec) const;
+
+    /// Close the acceptor and the socket on the io_context.
+    void close();
+
+  private:
+    asio::ip::tcp::acceptor m_acceptor;
+    asio::ip::tcp::socket m_socket;
+    uint16_t m_port = 0;
+
+    sink_t m_sink;
+
+    /// Data collected when there is no sink.
+    std::string m_data;
+
+    static constexpr size_t buf_size = 64000;
+    std::unique_ptr<std::array<char, buf_size>> m_buffer;
+
+    /// Completion state, shared with the waiting thread.
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    bool m_done = false;
+    std::error_code m_error;
+
+    /// Accept the single connection of the transfer.
+    void start();
+
+    /// Read the next chunk from the device.
+    void read();
+
+    /// Mark the transfer completed.
+    void complete(const std::error_code& error);
+};
+
+} // namespace adb
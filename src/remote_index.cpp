@@ -0,0 +1,399 @@
+#include <algorithm>
+#include <cstring>
+
+#include <asio/post.hpp>
+
+#include "remote_index_impl.hpp"
+
+namespace adb {
+
+/// Decode a little-endian field of a sync response.
+template <typename T> static inline T field(const char* p) {
+    T value = 0;
+    for (int i = sizeof(T) - 1; i >= 0; i--) {
+        value = static_cast<T>((value << 8) | static_cast<uint8_t>(p[i]));
+    }
+    return value;
+}
+
+/// Match the start of a path with a `[...]` set of a pattern.
+/**
+ * @return Size of the set in the pattern if it matches the character, 0 if
+ * not, or npos if the set is not closed.
+ */
+static size_t match_set(const std::string_view pattern, const char c) {
+    size_t i = 1;
+    const auto negate = i < pattern.size() &&
+                        (pattern[i] == '!' || pattern[i] == '^');
+    if (negate) {
+        i++;
+    }
+
+    // A `]` right after the opening is part of the set.
+    auto matched = false;
+    for (auto first = true; i < pattern.size(); first = false, i++) {
+        if (pattern[i] == ']' && !first) {
+            return matched != negate ? i + 1 : 0;
+        }
+        if (i + 2 < pattern.size() && pattern[i + 1] == '-' &&
+            pattern[i + 2] != ']') {
+            matched |= pattern[i] <= c && c <= pattern[i + 2];
+            i += 2;
+        } else {
+            matched |= pattern[i] == c;
+        }
+    }
+    return std::string_view::npos;
+}
+
+/// Match a path with a glob pattern.
+static bool glob_match(std::string_view pattern, std::string_view path) {
+    while (!pattern.empty()) {
+        if (pattern.front() == '*') {
+            const auto deep = pattern.size() > 1 && pattern[1] == '*';
+            pattern.remove_prefix(deep ? 2 : 1);
+
+            // Try the shortest match first, within the component unless deep.
+            for (size_t i = 0; i <= path.size(); i++) {
+                if (glob_match(pattern, path.substr(i))) {
+                    return true;
+                }
+                if (i < path.size() && path[i] == '/' && !deep) {
+                    return false;
+                }
+            }
+            return false;
+        }
+
+        if (path.empty()) {
+            return false;
+        }
+
+        size_t consumed = 1;
+        if (pattern.front() == '?') {
+            if (path.front() == '/') {
+                return false;
+            }
+        } else if (pattern.front() == '[' &&
+                   (consumed = match_set(pattern, path.front())) !=
+                       std::string_view::npos) {
+            if (consumed == 0 || path.front() == '/') {
+                return false;
+            }
+        } else if (pattern.front() != path.front()) {
+            return false;
+        } else {
+            consumed = 1;
+        }
+
+        pattern.remove_prefix(consumed);
+        path.remove_prefix(1);
+    }
+    return path.empty();
+}
+
+remote_index_impl::remote_index_impl(std::string arena,
+                                     std::vector<remote_record> records)
+    : m_arena(std::move(arena)), m_records(std::move(records)) {
+    std::sort(m_records.begin(), m_records.end(),
+              [this](const remote_record& a, const remote_record& b) {
+                  return path(a) < path(b);
+              });
+}
+
+remote_entry remote_index_impl::operator[](const size_t pos) const {
+    const auto& record = m_records[pos];
+    return {path(record), record.mode, record.size, record.mtime};
+}
+
+std::vector<remote_entry>
+remote_index_impl::glob(const std::string_view pattern) const {
+    // Only the paths starting with the literal prefix can match.
+    const auto prefix = pattern.substr(0, pattern.find_first_of("*?["));
+    const auto first = std::lower_bound(
+        m_records.begin(), m_records.end(), prefix,
+        [this](const remote_record& record, const std::string_view prefix) {
+            return path(record) < prefix;
+        });
+
+    std::vector<remote_entry> result;
+    for (auto it = first; it != m_records.end(); it++) {
+        const auto path = this->path(*it);
+        if (path.substr(0, prefix.size()) != prefix) {
+            break;
+        }
+        if (glob_match(pattern, path)) {
+            result.push_back((*this)[it - m_records.begin()]);
+        }
+    }
+    return result;
+}
+
+remote_walker::remote_walker(asio::io_context& context,
+                             const asio::ip::tcp::endpoint& endpoint,
+                             const std::string_view serial,
+                             const std::string_view root, const bool v2,
+                             const size_t connections)
+    : m_context(context), m_serial(serial),
+      m_root(root.substr(0, root.find_last_not_of('/') + 1)), m_v2(v2) {
+    for (size_t i = 0; i < std::max<size_t>(connections, 1); i++) {
+        m_lanes.push_back(std::make_unique<lane>(context, endpoint));
+    }
+}
+
+std::shared_ptr<remote_index> remote_walker::run(std::error_code& ec,
+                                                 const int64_t timeout) {
+    auto future = m_promise.get_future();
+
+    // The check of the root counts as a listing until it is queued.
+    m_listing = 1;
+    asio::post(m_context, [self = shared_from_this()] {
+        for (size_t i = 0; i < self->m_lanes.size(); i++) {
+            self->open(*self->m_lanes[i], i == 0);
+        }
+    });
+
+    protocol::track(m_context, this,
+                    [self = shared_from_this()](const std::error_code& reason) {
+                        self->fail(reason);
+                    });
+
+    const auto status = future.wait_for(std::chrono::milliseconds(timeout));
+    protocol::untrack(this);
+    if (status == std::future_status::timeout) {
+        asio::post(m_context, [self = shared_from_this()] {
+            self->fail(asio::error::timed_out);
+        });
+        ec = asio::error::timed_out;
+        return nullptr;
+    }
+
+    ec = m_error;
+    if (ec) {
+        return nullptr;
+    }
+    return std::make_shared<remote_index_impl>(std::move(m_arena),
+                                               std::move(m_records));
+}
+
+void remote_walker::open(lane& lane, const bool first) {
+    auto& handle = lane.handle;
+    auto self = shared_from_this();
+    handle.connect_device(m_serial, [&lane, first, self] {
+        lane.handle.host_request("sync:", [&lane, first, self] {
+            if (lane.handle.error()) {
+                self->fail(lane.handle.error());
+                return;
+            }
+
+            if (first) {
+                self->stat_root(lane);
+            } else {
+                self->next(lane);
+            }
+        });
+    });
+}
+
+void remote_walker::stat_root(lane& lane) {
+    lane.path = m_root.empty() ? "/" : m_root;
+    const auto size = static_cast<uint32_t>(lane.path.size());
+
+    // STAT response: id, mode, size, time
+    auto& handle = lane.handle;
+    auto self = shared_from_this();
+    handle.sync_request("STAT", size, lane.path.data(), [&lane, self] {
+        lane.handle.host_read(lane.buffer.data(), 16, [&lane, self] {
+            const auto data = lane.buffer.data();
+            if (lane.handle.error() || lane.handle.received() < 16) {
+                const auto ec = lane.handle.error();
+                self->fail(ec ? ec : asio::error::eof);
+                return;
+            }
+            if (std::string_view(data, 4) != "STAT") {
+                self->fail(asio::error::invalid_argument);
+                return;
+            }
+            if (field<uint32_t>(data + 4) == 0) {
+                self->fail(asio::error::not_found);
+                return;
+            }
+
+            // Symbolic links to directories are listed as directories.
+            self->m_listing--;
+            self->m_pending.push_back(std::string_view::npos);
+            self->next(lane);
+        });
+    });
+}
+
+void remote_walker::next(lane& lane) {
+    if (m_finished) {
+        return;
+    }
+
+    if (m_pending.empty()) {
+        if (m_listing == 0) {
+            finish();
+        } else {
+            m_idle.push_back(&lane);
+        }
+        return;
+    }
+
+    lane.dir = m_pending.front();
+    m_pending.pop_front();
+    m_listing++;
+
+    if (lane.dir == std::string_view::npos) {
+        lane.path = m_root + "/";
+    } else {
+        const auto& record = m_records[lane.dir];
+        lane.path.assign(m_arena, record.offset, record.length);
+        lane.path += '/';
+    }
+
+    lane.end = 0;
+    const auto id = m_v2 ? "LIS2" : "LIST";
+    const auto size = static_cast<uint32_t>(lane.path.size());
+    auto self = shared_from_this();
+    lane.handle.sync_request(id, size, lane.path.data(),
+                             [&lane, self] { self->read(lane); });
+}
+
+void remote_walker::read(lane& lane) {
+    if (lane.handle.error()) {
+        fail(lane.handle.error());
+        return;
+    }
+
+    const auto data = lane.buffer.data() + lane.end;
+    const auto size = lane.buffer.size() - lane.end;
+    auto self = shared_from_this();
+    lane.handle.host_read_some(data, size, [&lane, self] {
+        const auto ec = lane.handle.error();
+        const auto size = lane.handle.received();
+        if (ec || size == 0) {
+            self->fail(ec ? ec : asio::error::eof);
+            return;
+        }
+
+        lane.end += size;
+        const auto done = self->parse(lane);
+        if (self->m_finished) {
+            return;
+        }
+
+        // Subdirectories found may be listed by the idle connections.
+        auto& idle = self->m_idle;
+        while (!idle.empty() && !self->m_pending.empty()) {
+            const auto other = idle.back();
+            idle.pop_back();
+            self->next(*other);
+        }
+
+        if (!done) {
+            self->read(lane);
+            return;
+        }
+
+        self->m_listing--;
+        self->next(lane);
+    });
+}
+
+bool remote_walker::parse(lane& lane) {
+    const auto data = lane.buffer.data();
+    const auto header = m_v2 ? dnt2_size : dent_size;
+    const auto entry_id = m_v2 ? "DNT2" : "DENT";
+
+    size_t pos = 0;
+    auto done = false;
+    while (lane.end - pos >= 8) {
+        const auto entry = data + pos;
+        const auto available = lane.end - pos;
+        const auto id = std::string_view(entry, 4);
+        if (id == "FAIL") {
+            fail(asio::error::fault);
+            return false;
+        }
+        if (available < header) {
+            break;
+        }
+        if (id == "DONE") {
+            pos += header;
+            done = true;
+            break;
+        }
+        if (id != entry_id) {
+            fail(asio::error::invalid_argument);
+            return false;
+        }
+
+        const auto name_size = field<uint32_t>(entry + header - 4);
+        if (name_size > buffer_size - header) {
+            fail(asio::error::invalid_argument);
+            return false;
+        }
+        if (available < header + name_size) {
+            break;
+        }
+        pos += header + name_size;
+
+        // DNT2: error, dev, ino, mode, nlink, uid, gid, size, atime, mtime
+        // DENT: mode, size, mtime
+        const auto name = std::string_view(entry + header, name_size);
+        if (name == "." || name == ".." ||
+            (m_v2 && field<uint32_t>(entry + 4) != 0)) {
+            continue;
+        }
+
+        remote_record record;
+        record.offset = m_arena.size();
+        record.length = static_cast<uint32_t>(lane.path.size() + name.size());
+        if (m_v2) {
+            record.mode = field<uint32_t>(entry + 24);
+            record.size = field<uint64_t>(entry + 40);
+            record.mtime = field<int64_t>(entry + 56);
+        } else {
+            record.mode = field<uint32_t>(entry + 4);
+            record.size = field<uint32_t>(entry + 8);
+            record.mtime = field<uint32_t>(entry + 12);
+        }
+
+        m_arena += lane.path;
+        m_arena += name;
+        m_records.push_back(record);
+
+        if ((record.mode & 0170000) == 0040000) {
+            m_pending.push_back(m_records.size() - 1);
+        }
+    }
+
+    std::memmove(data, data + pos, lane.end - pos);
+    lane.end -= pos;
+    return done;
+}
+
+void remote_walker::fail(const std::error_code& ec) {
+    if (m_finished) {
+        return;
+    }
+
+    m_error = ec;
+    for (const auto& lane : m_lanes) {
+        lane->handle.cancel();
+    }
+    finish();
+}
+
+void remote_walker::finish() {
+    if (m_finished) {
+        return;
+    }
+
+    m_finished = true;
+    m_promise.set_value();
+}
+
+} // namespace adb
@@ -0,0 +1,159 @@
+#pragma once
+
+#include <array>
+#include <deque>
+#include <future>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "client_impl.hpp"
+#include "remote_index.hpp"
+
+namespace adb {
+
+/// Entry of a remote_index, with its path in the arena of the index.
+struct remote_record {
+    uint64_t offset;
+    uint32_t length;
+    uint32_t mode;
+    uint64_t size;
+    int64_t mtime;
+};
+
+/// Pimpl class for remote_index.
+class remote_index_impl : public remote_index {
+  public:
+    /// Construct a remote_index_impl.
+    /**
+     * @param arena Paths of the entries, one after another.
+     * @param records Entries, sorted here by path.
+     */
+    remote_index_impl(std::string arena, std::vector<remote_record> records);
+
+    size_t size() const override { return m_records.size(); }
+    remote_entry operator[](const size_t pos) const override;
+    std::vector<remote_entry>
+    glob(const std::string_view pattern) const override;
+
+  private:
+    const std::string m_arena;
+    std::vector<remote_record> m_records;
+
+    /// Get the path of an entry.
+    std::string_view path(const remote_record& record) const {
+        return std::string_view(m_arena).substr(record.offset, record.length);
+    }
+};
+
+/// Walker of a directory tree, with sync LIST requests on several
+/// connections at once.
+/**
+ * @note The directories found are queued, and every connection lists the
+ * next one as soon as it is done with its own. All the work runs on the
+ * event loop of the client.
+ */
+class remote_walker : public std::enable_shared_from_this<remote_walker> {
+  public:
+    /// Construct a remote_walker.
+    /**
+     * @param context io_context of the client.
+     * @param endpoint Endpoint of the adb server.
+     * @param serial Serial of the device.
+     * @param root Directory to walk.
+     * @param v2 Whether to use LIS2, with 64-bit sizes and times.
+     * @param connections Number of sync connections, from 1.
+     */
+    remote_walker(asio::io_context& context,
+                  const asio::ip::tcp::endpoint& endpoint,
+                  const std::string_view serial, const std::string_view root,
+                  const bool v2, const size_t connections);
+
+    /// Walk the tree.
+    /**
+     * @return Index of the entries below the root, or nullptr on error.
+     * @param ec std::error_code to indicate what error occurred, if any.
+     * asio::error::not_found if the root does not exist.
+     * @param timeout Timeout in milliseconds.
+     */
+    std::shared_ptr<remote_index> run(std::error_code& ec,
+                                      const int64_t timeout);
+
+  private:
+    /// Size of the buffer of a connection, which holds a whole entry.
+    static constexpr size_t buffer_size = 64 * 1024;
+
+    /// Size of a DENT entry before the name, and of a DNT2 one.
+    static constexpr size_t dent_size = 20;
+    static constexpr size_t dnt2_size = 76;
+
+    /// Sync connection, listing one directory at a time.
+    struct lane {
+        lane(asio::io_context& context,
+             const asio::ip::tcp::endpoint& endpoint)
+            : handle(context, endpoint), buffer(buffer_size) {}
+
+        client_handle handle;
+
+        /// Directory being listed, as an entry, or npos for the root.
+        size_t dir = 0;
+
+        /// Path of the request, which must outlive it.
+        std::string path;
+
+        /// Data received and not parsed yet, from the start of the buffer.
+        std::vector<char> buffer;
+        size_t end = 0;
+    };
+
+    asio::io_context& m_context;
+    const std::string m_serial;
+
+    /// Root without its trailing slash, empty for `/`.
+    const std::string m_root;
+
+    const bool m_v2;
+    std::vector<std::unique_ptr<lane>> m_lanes;
+
+    std::string m_arena;
+    std::vector<remote_record> m_records;
+
+    /// Directories to list, as entries. npos is the root.
+    std::deque<size_t> m_pending;
+
+    /// Connections waiting for a directory to list.
+    std::vector<lane*> m_idle;
+
+    /// Directories being listed.
+    size_t m_listing = 0;
+
+    std::error_code m_error;
+    bool m_finished = false;
+    std::promise<void> m_promise;
+
+    /// Connect a lane and switch it to sync mode.
+    void open(lane& lane, const bool first);
+
+    /// Check that the root exists, and queue it.
+    void stat_root(lane& lane);
+
+    /// List the next directory, or wait for one.
+    void next(lane& lane);
+
+    /// Receive the entries of the directory being listed.
+    void read(lane& lane);
+
+    /// Parse the entries received.
+    /**
+     * @return Whether the listing is done.
+     */
+    bool parse(lane& lane);
+
+    /// Stop the walk with an error.
+    void fail(const std::error_code& ec);
+
+    /// Resolve the walk, once.
+    void finish();
+};
+
+} // namespace adb
@@ -0,0 +1,235 @@
+#include <charconv>
+
+#include <asio/post.hpp>
+
+#include "result_cache.hpp"
+
+namespace adb {
+
+void result_cache::enroll(const std::string_view command,
+                          const std::chrono::milliseconds ttl) {
+    std::lock_guard lock(m_mutex);
+
+    const auto it = m_entries.find(command);
+    if (it != m_entries.end()) {
+        erase(it);
+    }
+
+    if (ttl.count() <= 0) {
+        const auto ttl = m_ttls.find(command);
+        if (ttl != m_ttls.end()) {
+            m_ttls.erase(ttl);
+        }
+        return;
+    }
+    m_ttls.insert_or_assign(std::string(command), ttl);
+}
+
+bool result_cache::lookup(const std::string_view command, std::string& result,
+                          uint64_t& generation) {
+    std::lock_guard lock(m_mutex);
+    generation = m_generation;
+
+    if (m_ttls.find(command) == m_ttls.end()) {
+        return false;
+    }
+
+    const auto it = m_entries.find(command);
+    if (it == m_entries.end() || it->second.expiry <= clock::now()) {
+        if (it != m_entries.end()) {
+            erase(it);
+        }
+        m_stats.misses++;
+        return false;
+    }
+
+    m_used.splice(m_used.begin(), m_used, it->second.used);
+    m_stats.hits++;
+    result = it->second.result;
+    return true;
+}
+
+void result_cache::store(const std::string_view command,
+                         const std::string& result, const uint64_t generation) {
+    std::lock_guard lock(m_mutex);
+
+    // The answer may predate a root() or a re-attach.
+    const auto ttl = m_ttls.find(command);
+    if (ttl == m_ttls.end() || generation != m_generation) {
+        return;
+    }
+
+    const auto existing = m_entries.find(command);
+    if (existing != m_entries.end()) {
+        erase(existing);
+    }
+
+    entry value{result, clock::now() + ttl->second, {}};
+    if (footprint(command, value) > m_limit) {
+        return;
+    }
+
+    const auto [it, _] = m_entries.emplace(command, std::move(value));
+    m_used.push_front(it->first);
+    it->second.used = m_used.begin();
+    m_stats.entries++;
+    m_stats.bytes += footprint(it->first, it->second);
+    evict();
+}
+
+void result_cache::limit(const size_t bytes) {
+    std::lock_guard lock(m_mutex);
+    m_limit = bytes;
+    evict();
+}
+
+void result_cache::invalidate() {
+    std::lock_guard lock(m_mutex);
+    m_entries.clear();
+    m_used.clear();
+    m_generation++;
+    m_stats.entries = 0;
+    m_stats.bytes = 0;
+    m_stats.invalidations++;
+}
+
+cache_stats result_cache::stats() const {
+    std::lock_guard lock(m_mutex);
+    return m_stats;
+}
+
+uint64_t result_cache::generation() const {
+    std::lock_guard lock(m_mutex);
+    return m_generation;
+}
+
+void result_cache::erase(
+    std::map<std::string, entry, std::less<>>::iterator it) {
+    m_stats.entries--;
+    m_stats.bytes -= footprint(it->first, it->second);
+    m_used.erase(it->second.used);
+    m_entries.erase(it);
+}
+
+void result_cache::evict() {
+    while (m_stats.bytes > m_limit) {
+        erase(m_entries.find(m_used.back()));
+        m_stats.evictions++;
+    }
+}
+
+attach_watch::attach_watch(asio::io_context& context,
+                           const asio::ip::tcp::endpoint& endpoint,
+                           const std::string_view serial, handler_t handler)
+    : m_context(context), m_endpoint(endpoint), m_serial(serial),
+      m_handler(std::move(handler)), m_timer(context) {}
+
+void attach_watch::start() {
+    asio::post(m_context, [self = shared_from_this()] { self->track(); });
+}
+
+void attach_watch::close() {
+    m_closed = true;
+
+    asio::post(m_context, [self = shared_from_this()] {
+        self->m_timer.cancel();
+        if (self->m_handle) {
+            self->m_handle->cancel();
+        }
+    });
+}
+
+void attach_watch::track() {
+    if (m_closed) {
+        return;
+    }
+
+    m_handle = std::make_unique<protocol::async_handle>(m_context, m_endpoint);
+    m_handle->connect([self = shared_from_this()] {
+        self->m_handle->host_request("host:track-devices",
+                                     [self] { self->read(); });
+    });
+}
+
+void attach_watch::read() {
+    if (m_handle->error()) {
+        retry();
+        return;
+    }
+
+    // Every list is sent whole, as a length in 4 hex digits and the lines.
+    m_handle->host_read(
+        m_length.data(), m_length.size(), [self = shared_from_this()] {
+            auto& handle = *self->m_handle;
+            const auto& length = self->m_length;
+
+            size_t size = 0;
+            const auto [end, ec] =
+                std::from_chars(length.data(), length.data() + length.size(),
+                                size, 16);
+            if (handle.error() || handle.received() < length.size() ||
+                ec != std::errc() || end != length.data() + length.size()) {
+                self->retry();
+                return;
+            }
+
+            self->m_list.resize(size);
+            handle.host_read(self->m_list.data(), size, [self] {
+                const auto& handle = *self->m_handle;
+                if (handle.error() ||
+                    handle.received() < self->m_list.size()) {
+                    self->retry();
+                    return;
+                }
+
+                self->update();
+                self->read();
+            });
+        });
+}
+
+void attach_watch::update() {
+    std::string state;
+
+    // Lines are `<serial>\t<state>`.
+    std::string_view list = m_list;
+    while (!list.empty()) {
+        const auto end = list.find('\n');
+        const auto line = list.substr(0, end);
+        list.remove_prefix(std::min(end, list.size() - 1) + 1);
+
+        const auto tab = line.find('\t');
+        if (tab != std::string_view::npos && line.substr(0, tab) == m_serial) {
+            state = line.substr(tab + 1);
+            break;
+        }
+    }
+
+    // The first list only tells where the device stands.
+    const auto changed = m_state && *m_state != state;
+    m_state = std::move(state);
+    if (changed && !m_closed) {
+        m_handler(*m_state);
+    }
+}
+
+void attach_watch::retry() {
+    if (m_closed) {
+        return;
+    }
+
+    // The device may re-attach while the adb server is away.
+    if (m_state && !m_state->empty()) {
+        m_state = "";
+        m_handler(*m_state);
+    }
+
+    m_timer.expires_after(retry_delay);
+    m_timer.async_wait([self = shared_from_this()](const auto& ec) {
+        if (!ec) {
+            self->track();
+        }
+    });
+}
+
+} // namespace adb
@@ -0,0 +1,178 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include <asio/steady_timer.hpp>
+
+#include "client.hpp"
+#include "protocol.hpp"
+
+namespace adb {
+
+/// Cache of the results of the idempotent shell commands of a client.
+/**
+ * @note Results are kept per command until their TTL expires, and the least
+ * recently used ones are dropped to stay within the size limit. A result
+ * obtained across an invalidation is not kept, as it may be stale.
+ */
+class result_cache {
+  public:
+    /// Default size limit of the results and their commands.
+    static constexpr size_t default_limit = 1024 * 1024;
+
+    /// Start or stop caching the results of a command.
+    /**
+     * @param command Command exactly as requested.
+     * @param ttl Time a result stays valid, or 0 to stop caching it.
+     */
+    void enroll(const std::string_view command,
+                const std::chrono::milliseconds ttl);
+
+    /// Get the cached result of a command.
+    /**
+     * @return Whether a valid result was found.
+     * @param command Command exactly as requested.
+     * @param result Set to the result if found.
+     * @param generation Set to the generation to give to store() on a miss.
+     */
+    bool lookup(const std::string_view command, std::string& result,
+                uint64_t& generation);
+
+    /// Keep the result of a command, if it is cached.
+    /**
+     * @param command Command exactly as requested.
+     * @param result Result of the command.
+     * @param generation Generation given by lookup() before the request.
+     */
+    void store(const std::string_view command, const std::string& result,
+               const uint64_t generation);
+
+    /// Change the size limit, dropping results if needed.
+    void limit(const size_t bytes);
+
+    /// Drop all the results.
+    void invalidate();
+
+    /// Get the metrics of the cache.
+    cache_stats stats() const;
+
+    /// Get the number of invalidations so far, to tell whether a result
+    /// kept elsewhere is still valid.
+    uint64_t generation() const;
+
+  private:
+    typedef std::chrono::steady_clock clock;
+
+    /// Result of a command.
+    struct entry {
+        std::string result;
+        clock::time_point expiry;
+
+        /// Position in the LRU list.
+        std::list<std::string_view>::iterator used;
+    };
+
+    mutable std::mutex m_mutex;
+
+    /// TTLs of the cached commands.
+    std::map<std::string, std::chrono::milliseconds, std::less<>> m_ttls;
+
+    std::map<std::string, entry, std::less<>> m_entries;
+
+    /// Commands of the entries, the most recently used first.
+    std::list<std::string_view> m_used;
+
+    size_t m_limit = default_limit;
+
+    /// Incremented by every invalidation.
+    uint64_t m_generation = 0;
+
+    cache_stats m_stats;
+
+    /// Size of an entry counted against the limit.
+    static size_t footprint(const std::string_view command,
+                            const entry& entry) {
+        return command.size() + entry.result.size();
+    }
+
+    /// Drop an entry.
+    void erase(std::map<std::string, entry, std::less<>>::iterator it);
+
+    /// Drop the least recently used entries until within the limit.
+    void evict();
+};
+
+/// Watch of the device list of the adb server, to notice re-attaches and
+/// lost devices.
+class attach_watch : public std::enable_shared_from_this<attach_watch> {
+  public:
+    typedef std::shared_ptr<attach_watch> pointer;
+
+    /// Function called with the new state of the device, e.g. `device` or
+    /// `offline`, empty if it is gone.
+    typedef std::function<void(const std::string& state)> handler_t;
+
+    /// Construct an attach_watch.
+    /**
+     * @param context io_context of the client.
+     * @param endpoint Endpoint of the adb server.
+     * @param serial Serial of the device.
+     * @param handler Function called on the event loop when the device
+     * detaches, attaches or changes state, or when the adb server is lost.
+     */
+    attach_watch(asio::io_context& context,
+                 const asio::ip::tcp::endpoint& endpoint,
+                 const std::string_view serial, handler_t handler);
+
+    /// Start tracking the devices.
+    void start();
+
+    /// Stop tracking the devices.
+    void close();
+
+  private:
+    /// Delay before tracking again after the adb server is lost.
+    static constexpr auto retry_delay = std::chrono::seconds(1);
+
+    asio::io_context& m_context;
+    const asio::ip::tcp::endpoint m_endpoint;
+    const std::string m_serial;
+    const handler_t m_handler;
+
+    /// Connection of the current attempt, replaced on every retry.
+    std::unique_ptr<protocol::async_handle> m_handle;
+    asio::steady_timer m_timer;
+
+    /// Length and content of the device list being received.
+    std::array<char, 4> m_length;
+    std::string m_list;
+
+    /// State of the device, empty if absent. Unknown until the first list.
+    std::optional<std::string> m_state;
+
+    std::atomic<bool> m_closed = false;
+
+    /// Connect and request `host:track-devices`.
+    void track();
+
+    /// Receive the next device list.
+    void read();
+
+    /// Compare the state of the device in the list with the last one.
+    void update();
+
+    /// Handle the loss of the adb server, and try again later.
+    void retry();
+};
+
+} // namespace adb
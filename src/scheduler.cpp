@@ -0,0 +1,176 @@
+#include <algorithm>
+#include <map>
+#include <string>
+
+#include <asio/error.hpp>
+
+#include "scheduler.hpp"
+
+namespace adb {
+
+/// Schedulers by device key, alive while a client of the device is.
+static std::mutex schedulers_mutex;
+static std::map<std::string, std::weak_ptr<traffic_scheduler>, std::less<>>
+    schedulers;
+
+traffic_scheduler::ticket&
+traffic_scheduler::ticket::operator=(ticket&& other) noexcept {
+    if (this != &other) {
+        release();
+        m_scheduler = std::exchange(other.m_scheduler, nullptr);
+        m_class = other.m_class;
+        m_waited = other.m_waited;
+    }
+    return *this;
+}
+
+int64_t traffic_scheduler::ticket::remaining(const int64_t timeout) const {
+    return std::max<int64_t>(timeout - m_waited.count(), 0);
+}
+
+void traffic_scheduler::ticket::release() {
+    if (m_scheduler) {
+        m_scheduler->release(m_class);
+        m_scheduler = nullptr;
+    }
+}
+
+std::shared_ptr<traffic_scheduler>
+traffic_scheduler::of(const std::string_view device) {
+    std::lock_guard lock(schedulers_mutex);
+
+    auto& entry = schedulers[std::string(device)];
+    auto scheduler = entry.lock();
+    if (!scheduler) {
+        scheduler = std::make_shared<traffic_scheduler>();
+        entry = scheduler;
+    }
+    return scheduler;
+}
+
+void traffic_scheduler::configure(const scheduler_config& config) {
+    {
+        std::lock_guard lock(m_mutex);
+        m_config = config;
+        m_tokens = std::min(m_tokens, static_cast<double>(config.burst));
+    }
+
+    // More bulk operations may be allowed now.
+    m_cv.notify_all();
+}
+
+scheduler_stats traffic_scheduler::stats() const {
+    std::lock_guard lock(m_mutex);
+    auto stats = m_stats;
+    stats.bulk_queued = static_cast<uint32_t>(m_waiting.size());
+    return stats;
+}
+
+traffic_scheduler::ticket traffic_scheduler::admit(const traffic_class traffic,
+                                                   const int64_t timeout,
+                                                   std::error_code& ec) {
+    std::unique_lock lock(m_mutex);
+
+    ticket result;
+    result.m_class = traffic;
+
+    if (traffic == traffic_class::interactive) {
+        m_stats.interactive_active++;
+        m_stats.interactive_total++;
+        result.m_scheduler = this;
+        return result;
+    }
+
+    const auto start = clock::now();
+    const auto number = m_next++;
+    m_waiting.push_back(number);
+
+    const auto turn = [&] {
+        const auto limit = m_config.max_bulk_streams;
+        return m_waiting.front() == number &&
+               (limit == 0 || m_stats.bulk_active < limit);
+    };
+    const auto admitted =
+        m_cv.wait_for(lock, std::chrono::milliseconds(timeout), turn);
+
+    m_waiting.erase(std::find(m_waiting.begin(), m_waiting.end(), number));
+
+    const auto waited = clock::now() - start;
+    const auto seconds = std::chrono::duration<double>(waited).count();
+    m_stats.bulk_wait += seconds;
+    m_stats.bulk_wait_max = std::max(m_stats.bulk_wait_max, seconds);
+
+    if (!admitted) {
+        // The next one in line may be admitted instead.
+        lock.unlock();
+        m_cv.notify_all();
+        ec = asio::error::timed_out;
+        return result;
+    }
+
+    m_stats.bulk_active++;
+    m_stats.bulk_total++;
+    result.m_scheduler = this;
+    result.m_waited =
+        std::chrono::duration_cast<std::chrono::milliseconds>(waited);
+
+    // The next one in line may have a free slot too.
+    lock.unlock();
+    m_cv.notify_all();
+    return result;
+}
+
+std::chrono::nanoseconds traffic_scheduler::pace(const size_t size) {
+    using namespace std::chrono;
+    const auto now = clock::now();
+
+    std::lock_guard lock(m_mutex);
+
+    const auto window = milliseconds(m_config.interactive_window);
+    const auto touched = clock::time_point(nanoseconds(m_touched.load()));
+    const auto contended =
+        m_stats.interactive_active > 0 || now - touched < window;
+    const auto rate = contended ? m_config.contended_rate : m_config.bulk_rate;
+
+    // Refill the bucket, up to the burst.
+    const auto burst = static_cast<double>(m_config.burst);
+    const auto elapsed = duration<double>(now - m_refilled).count();
+    m_refilled = now;
+    m_stats.paced_bytes += size;
+    if (rate <= 0) {
+        m_tokens = burst;
+        return nanoseconds(0);
+    }
+    m_tokens = std::min(burst, m_tokens + elapsed * rate);
+
+    // The bytes are taken at once, and the debt is paid by waiting.
+    m_tokens -= static_cast<double>(size);
+    if (m_tokens >= 0) {
+        return nanoseconds(0);
+    }
+
+    const auto delay = -m_tokens / rate;
+    m_stats.paced += delay;
+    return duration_cast<nanoseconds>(duration<double>(delay));
+}
+
+void traffic_scheduler::touch() {
+    const auto now = clock::now().time_since_epoch();
+    m_touched = std::chrono::duration_cast<std::chrono::nanoseconds>(now)
+                    .count();
+}
+
+void traffic_scheduler::release(const traffic_class traffic) {
+    {
+        std::lock_guard lock(m_mutex);
+        if (traffic == traffic_class::interactive) {
+            m_stats.interactive_active--;
+            return;
+        }
+        m_stats.bulk_active--;
+    }
+
+    m_cv.notify_all();
+}
+
+} // namespace adb
@@ -0,0 +1,122 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <system_error>
+
+#include "client.hpp"
+
+namespace adb {
+
+/// Class of the traffic of an operation.
+enum class traffic_class {
+    /// Short requests whose latency matters, e.g. shell commands and input.
+    interactive,
+
+    /// Large transfers, e.g. files and screenshots.
+    bulk,
+};
+
+/// Scheduler of the traffic of one device, shared by its clients.
+/**
+ * @note Bulk operations are admitted up to a limit, in FIFO order, and their
+ * data is paced with a token bucket. Interactive operations are never held
+ * back, and slow the bulk data down while they are active.
+ */
+class traffic_scheduler {
+  public:
+    /// Admission of an operation, released when destroyed.
+    class ticket {
+      public:
+        ticket() = default;
+        ticket(ticket&& other) noexcept { *this = std::move(other); }
+        ticket& operator=(ticket&& other) noexcept;
+        ~ticket() { release(); }
+
+        /// Check whether the operation was admitted.
+        explicit operator bool() const { return m_scheduler != nullptr; }
+
+        /// Get the time left of a timeout after the wait for admission.
+        /**
+         * @return Milliseconds left, at least 0.
+         * @param timeout Timeout of the operation in milliseconds.
+         */
+        int64_t remaining(const int64_t timeout) const;
+
+      private:
+        traffic_scheduler* m_scheduler = nullptr;
+        traffic_class m_class = traffic_class::interactive;
+        std::chrono::milliseconds m_waited{0};
+
+        void release();
+
+        friend class traffic_scheduler;
+    };
+
+    /// Get the scheduler of a device.
+    /**
+     * @return The scheduler shared by the clients of the device.
+     * @param device Key of the device, its server and serial, or its address
+     * if connected directly.
+     */
+    static std::shared_ptr<traffic_scheduler>
+    of(const std::string_view device);
+
+    /// Change the settings, applied to the operations that follow.
+    void configure(const scheduler_config& config);
+
+    /// Get the metrics of the scheduler.
+    scheduler_stats stats() const;
+
+    /// Admit an operation.
+    /**
+     * @return A ticket held while the operation runs. Empty if a bulk
+     * operation did not get its turn before the timeout.
+     * @param traffic Class of the operation.
+     * @param timeout Timeout in milliseconds.
+     * @param ec std::error_code set to timed_out if not admitted.
+     */
+    ticket admit(const traffic_class traffic, const int64_t timeout,
+                 std::error_code& ec);
+
+    /// Take bulk bytes from the token bucket.
+    /**
+     * @return Time to wait before moving the bytes.
+     * @param size Number of bytes.
+     */
+    std::chrono::nanoseconds pace(const size_t size);
+
+    /// Mark interactive traffic outside of an admitted operation, e.g. a
+    /// write to an interactive shell.
+    void touch();
+
+  private:
+    typedef std::chrono::steady_clock clock;
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_cv;
+    scheduler_config m_config;
+    scheduler_stats m_stats;
+
+    /// Numbers of the bulk operations waiting, in order of arrival.
+    std::deque<uint64_t> m_waiting;
+    uint64_t m_next = 0;
+
+    /// Tokens of the bucket in bytes. Negative while in debt.
+    double m_tokens = 0;
+    clock::time_point m_refilled = clock::now();
+
+    /// Time of the last interactive write, in nanoseconds since the epoch of
+    /// the clock.
+    std::atomic<int64_t> m_touched = 0;
+
+    /// Release the admission of an operation.
+    void release(const traffic_class traffic);
+};
+
+} // namespace adb
@@ -0,0 +1,378 @@
+#include <algorithm>
+#include <cstring>
+
+#include <asio/post.hpp>
+
+#include "h264.hpp"
+#include "screen_record_impl.hpp"
+
+namespace adb {
+
+bool nal_reader_impl::next(nal_unit& unit, const int64_t timeout) {
+    return m_stream->next(*this, unit, timeout);
+}
+
+screen_record_impl::screen_record_impl(asio::io_context& context,
+                                       const asio::ip::tcp::endpoint& endpoint,
+                                       const std::string_view serial,
+                                       const std::string_view command,
+                                       const size_t capacity)
+    : m_context(context), m_endpoint(endpoint), m_serial(serial),
+      m_command(command), m_idle(context), m_retry(context),
+      m_ring(std::max<size_t>(capacity, 1)) {
+    protocol::track(context, this,
+                    [this](const std::error_code& reason) { abort(reason); });
+}
+
+screen_record_impl::~screen_record_impl() { protocol::untrack(this); }
+
+void screen_record_impl::start() {
+    asio::post(m_context, [self = shared_from_this()] { self->record(); });
+}
+
+std::shared_ptr<nal_reader> screen_record_impl::attach() {
+    std::lock_guard lock(m_mutex);
+    return std::make_shared<nal_reader_impl>(shared_from_this(),
+                                             m_written + 1);
+}
+
+screen_record_stats screen_record_impl::stats() const {
+    std::lock_guard lock(m_mutex);
+    return m_stats;
+}
+
+std::error_code screen_record_impl::error() const {
+    std::lock_guard lock(m_mutex);
+    return m_error;
+}
+
+void screen_record_impl::close() {
+    {
+        std::lock_guard lock(m_mutex);
+        m_closed = true;
+    }
+    m_cv.notify_all();
+
+    asio::post(m_context, [self = shared_from_this()] {
+        self->m_idle.cancel();
+        self->m_retry.cancel();
+        if (self->m_handle) {
+            self->m_handle->cancel();
+        }
+    });
+}
+
+bool screen_record_impl::next(nal_reader_impl& reader, nal_unit& unit,
+                              const int64_t timeout) {
+    std::unique_lock lock(m_mutex);
+
+    if (!reader.m_pending.empty()) {
+        unit = std::move(reader.m_pending.front());
+        reader.m_pending.pop_front();
+        return true;
+    }
+
+    const auto capacity = m_ring.size();
+    const auto ready = [&] { return reader.m_cursor <= m_written || m_closed; };
+    const auto deadline = clock::now() + std::chrono::milliseconds(timeout);
+
+    while (m_cv.wait_until(lock, deadline, ready)) {
+        if (reader.m_cursor > m_written) {
+            // Closed, and every unit has been read.
+            return false;
+        }
+
+        // Units older than the ring have been overwritten.
+        const auto oldest = m_written >= capacity ? m_written - capacity + 1
+                                                  : 1;
+        if (reader.m_cursor < oldest) {
+            reader.m_dropped += oldest - reader.m_cursor;
+            m_stats.dropped += oldest - reader.m_cursor;
+            reader.m_cursor = oldest;
+            reader.m_synced = false;
+        }
+
+        const auto& next = m_ring[reader.m_cursor++ % capacity];
+        if (reader.m_synced || next.type == h264::nal_type::sps) {
+            reader.m_synced = true;
+            unit = next;
+            return true;
+        }
+
+        if (!next.keyframe) {
+            reader.m_dropped++;
+            m_stats.dropped++;
+            continue;
+        }
+
+        // Give the parameter sets of the recording before the keyframe.
+        reader.m_synced = true;
+        for (const auto& config : {m_sps, m_pps}) {
+            if (config.sequence != 0 && config.recording == next.recording) {
+                reader.m_pending.push_back(config);
+            }
+        }
+        reader.m_pending.push_back(next);
+
+        unit = std::move(reader.m_pending.front());
+        reader.m_pending.pop_front();
+        return true;
+    }
+
+    return false;
+}
+
+void screen_record_impl::record() {
+    if (m_closed) {
+        return;
+    }
+
+    m_recording++;
+    m_recorded = 0;
+    {
+        std::lock_guard lock(m_mutex);
+        m_stats.recordings = m_recording;
+        m_sps = {};
+        m_pps = {};
+    }
+
+    // Data left from the previous recording is incomplete.
+    m_begin = m_end;
+    m_started = false;
+    m_flushed = false;
+
+    m_handle = std::make_unique<client_handle>(m_context, m_endpoint);
+    m_handle->connect_device(m_serial, [self = shared_from_this()] {
+        self->m_handle->host_request(self->m_command,
+                                     [self] { self->read(); });
+    });
+}
+
+void screen_record_impl::read() {
+    // The device went away after the last chunk was received.
+    if (m_aborted) {
+        asio::post(m_context, [self = shared_from_this(), ec = m_aborted] {
+            self->restart(ec);
+        });
+        return;
+    }
+
+    if (!m_block || m_block->size() - m_end < min_read) {
+        renew();
+    }
+
+    const auto data = reinterpret_cast<char*>(m_block->data()) + m_end;
+    m_handle->host_read_some(data, m_block->size() - m_end,
+                             [self = shared_from_this()] {
+                                 self->received();
+                             });
+}
+
+void screen_record_impl::received() {
+    auto ec = m_handle->error();
+    const auto size = m_handle->received();
+    if (m_aborted && (ec || size == 0)) {
+        ec = m_aborted;
+    }
+    if (ec || size == 0 || m_closed) {
+        // The handle is still in its own handler, so release it afterwards.
+        asio::post(m_context,
+                   [self = shared_from_this(), ec] { self->restart(ec); });
+        return;
+    }
+
+    const auto now = clock::now();
+    if (m_end == m_begin) {
+        m_arrival = now;
+    }
+    m_end += size;
+    split(now);
+
+    m_idle.expires_after(flush_delay);
+    m_idle.async_wait([self = shared_from_this()](const auto& ec) {
+        if (!ec) {
+            self->flush();
+        }
+    });
+
+    read();
+}
+
+void screen_record_impl::split(const clock::time_point now) {
+    const auto data = m_block->data();
+
+    while (true) {
+        if (!m_started) {
+            // Skip to the first start code, keeping what may be its start.
+            const auto pos = h264::find_start_code(data, m_begin, m_end);
+            const auto begin =
+                pos == std::string_view::npos
+                    ? std::max(m_begin, m_end - std::min<size_t>(m_end, 2))
+                : pos > m_begin && data[pos - 1] == 0 ? pos - 1
+                                                      : pos;
+
+            // The rest of a unit flushed too early.
+            if (begin > m_begin && m_flushed) {
+                std::lock_guard lock(m_mutex);
+                m_stats.truncated++;
+            }
+            m_flushed = false;
+            m_begin = begin;
+
+            if (pos == std::string_view::npos) {
+                return;
+            }
+
+            m_started = true;
+            m_arrival = now;
+            m_scanned = m_begin + h264::start_code_size(data + m_begin) + 1;
+            continue;
+        }
+
+        const auto pos = h264::find_start_code(data, m_scanned, m_end);
+        if (pos == std::string_view::npos) {
+            m_scanned = std::max(m_scanned, m_end - std::min<size_t>(m_end, 2));
+            return;
+        }
+
+        // Trailing zeros belong to no unit. The last one before the start
+        // code makes it a 4-byte one.
+        auto end = pos;
+        while (end > m_scanned && data[end - 1] == 0) {
+            end--;
+        }
+        const auto next = end < pos ? pos - 1 : pos;
+
+        publish(end);
+        m_begin = next;
+        m_arrival = now;
+        m_scanned = m_begin + h264::start_code_size(data + m_begin) + 1;
+    }
+}
+
+void screen_record_impl::publish(const size_t end, const bool truncated) {
+    const auto data = m_block->data() + m_begin;
+    const auto size = end - m_begin;
+    const auto header = h264::start_code_size(data);
+    m_begin = end;
+    if (size <= header) {
+        return;
+    }
+
+    nal_unit unit;
+    unit.data = std::span<const uint8_t>(data, size);
+    unit.owner = m_block;
+    unit.type = data[header] & 0x1f;
+    unit.keyframe = unit.type == h264::nal_type::idr;
+    unit.truncated = truncated;
+    unit.recording = m_recording;
+    unit.arrival = m_arrival;
+    m_recorded++;
+
+    {
+        std::lock_guard lock(m_mutex);
+        unit.sequence = ++m_written;
+        m_stats.units++;
+        m_stats.bytes += size;
+        if (unit.keyframe) {
+            m_stats.keyframes++;
+        } else if (unit.type == h264::nal_type::sps) {
+            m_sps = unit;
+        } else if (unit.type == h264::nal_type::pps) {
+            m_pps = unit;
+        }
+        m_ring[unit.sequence % m_ring.size()] = std::move(unit);
+    }
+    m_cv.notify_all();
+}
+
+void screen_record_impl::flush() {
+    if (!m_started || m_end == m_begin) {
+        return;
+    }
+
+    // Nothing tells whether the device paused in the middle of the unit.
+    publish(m_end, true);
+    m_started = false;
+    m_flushed = true;
+}
+
+void screen_record_impl::renew() {
+    const auto pending = m_end - m_begin;
+    const auto size = std::max(block_size, pending * 2 + min_read);
+
+    // A retired block is free once the ring and the readers let go of it.
+    std::shared_ptr<block> next;
+    const auto free = std::find_if(
+        m_spare.begin(), m_spare.end(), [size](const auto& spare) {
+            return spare.use_count() == 1 && spare->size() >= size;
+        });
+    if (free != m_spare.end()) {
+        std::atomic_thread_fence(std::memory_order_acquire);
+        next = std::move(*free);
+        m_spare.erase(free);
+    } else {
+        next = std::make_shared<block>(size);
+    }
+
+    if (m_block) {
+        std::memcpy(next->data(), m_block->data() + m_begin, pending);
+        if (m_spare.size() < spare_blocks) {
+            m_spare.push_back(std::move(m_block));
+        }
+    }
+
+    m_block = std::move(next);
+    m_scanned = m_scanned > m_begin ? m_scanned - m_begin : 0;
+    m_begin = 0;
+    m_end = pending;
+}
+
+void screen_record_impl::restart(const std::error_code& ec) {
+    m_idle.cancel();
+    m_handle.reset();
+    m_aborted.clear();
+
+    if (m_closed) {
+        return;
+    }
+
+    // The device ends the recording cleanly at its time limit, after a
+    // complete unit.
+    auto error = ec;
+    if (!error && m_started) {
+        publish(m_end);
+        m_started = false;
+    }
+
+    // A recording without any unit means screenrecord could not run.
+    if (!error && m_recorded == 0) {
+        error = asio::error::eof;
+    }
+
+    {
+        std::lock_guard lock(m_mutex);
+        m_error = error;
+    }
+
+    if (!error) {
+        record();
+        return;
+    }
+
+    m_retry.expires_after(retry_delay);
+    m_retry.async_wait([self = shared_from_this()](const auto& ec) {
+        if (!ec) {
+            self->record();
+        }
+    });
+}
+
+void screen_record_impl::abort(const std::error_code& reason) {
+    if (m_handle) {
+        m_aborted = reason;
+        m_handle->cancel();
+    }
+}
+
+} // namespace adb
@@ -0,0 +1,211 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <asio/steady_timer.hpp>
+
+#include "client_impl.hpp"
+#include "screen_record.hpp"
+
+namespace adb {
+
+class screen_record_impl;
+
+/// Pimpl class for nal_reader.
+class nal_reader_impl : public nal_reader {
+  public:
+    nal_reader_impl(std::shared_ptr<screen_record_impl> stream,
+                    const uint64_t cursor)
+        : m_stream(std::move(stream)), m_cursor(cursor) {}
+
+    bool next(nal_unit& unit, const int64_t timeout) override;
+    uint64_t dropped() const override { return m_dropped; }
+
+  private:
+    std::shared_ptr<screen_record_impl> m_stream;
+
+    /// Sequence number of the next unit to read.
+    uint64_t m_cursor;
+
+    /// Whether a keyframe or parameter sets have been read since the start
+    /// or the last gap.
+    bool m_synced = false;
+
+    /// Units to give before the next one of the ring, e.g. SPS and PPS.
+    std::deque<nal_unit> m_pending;
+
+    std::atomic<uint64_t> m_dropped = 0;
+
+    friend class screen_record_impl;
+};
+
+/// Pimpl class for screen_record.
+class screen_record_impl
+    : public screen_record,
+      public std::enable_shared_from_this<screen_record_impl> {
+  public:
+    typedef std::shared_ptr<screen_record_impl> pointer;
+
+    /// Construct a screen_record_impl.
+    /**
+     * @param context io_context of the client.
+     * @param endpoint Endpoint of the adb server.
+     * @param serial Serial of the device.
+     * @param command `screenrecord` command writing to stdout.
+     * @param capacity Number of units in the ring.
+     */
+    screen_record_impl(asio::io_context& context,
+                       const asio::ip::tcp::endpoint& endpoint,
+                       const std::string_view serial,
+                       const std::string_view command, const size_t capacity);
+    ~screen_record_impl();
+
+    /// Start recording.
+    void start();
+
+    std::shared_ptr<nal_reader> attach() override;
+    screen_record_stats stats() const override;
+    std::error_code error() const override;
+    void close() override;
+
+    /// Get the next unit for a reader.
+    /**
+     * @return false on timeout, or if the stream is closed and drained.
+     * @param reader Reader whose cursor is advanced.
+     * @param unit Unit to fill.
+     * @param timeout Timeout in milliseconds.
+     */
+    bool next(nal_reader_impl& reader, nal_unit& unit, const int64_t timeout);
+
+  private:
+    typedef std::chrono::steady_clock clock;
+    typedef std::vector<uint8_t> block;
+
+    /// Size of the blocks the stream is received into.
+    static constexpr size_t block_size = 1 << 20;
+
+    /// Smallest free space of a block worth reading into.
+    static constexpr size_t min_read = 64 * 1024;
+
+    /// Blocks kept for reuse once the ring no longer holds them.
+    static constexpr size_t spare_blocks = 8;
+
+    /// Time without data after which the pending unit is taken as complete.
+    /**
+     * @note The end of a unit is only known from the next start code, and
+     * the encoder sends nothing while the screen is still.
+     */
+    static constexpr auto flush_delay = std::chrono::milliseconds(20);
+
+    /// Delay before starting a failed recording again.
+    static constexpr auto retry_delay = std::chrono::seconds(1);
+
+    asio::io_context& m_context;
+    const asio::ip::tcp::endpoint m_endpoint;
+    const std::string m_serial;
+    const std::string m_command;
+
+    /// Recording in progress, if any.
+    std::unique_ptr<client_handle> m_handle;
+
+    /// Block being received into, owned by the event loop.
+    std::shared_ptr<block> m_block;
+
+    /// Retired blocks, reused when no unit refers to them anymore.
+    std::vector<std::shared_ptr<block>> m_spare;
+
+    /// Start of the pending unit, and end of the data received in m_block.
+    size_t m_begin = 0;
+    size_t m_end = 0;
+
+    /// Offset from which the pending unit is searched for a start code.
+    size_t m_scanned = 0;
+
+    /// Whether the pending data starts with a start code.
+    bool m_started = false;
+
+    /// Whether the last unit was flushed by the idle timer.
+    bool m_flushed = false;
+
+    /// Arrival of the first byte of the pending unit.
+    clock::time_point m_arrival;
+
+    /// Number of the recording in progress, and its units so far.
+    uint32_t m_recording = 0;
+    uint64_t m_recorded = 0;
+
+    /// Timer of the idle flush.
+    asio::steady_timer m_idle;
+
+    /// Timer of the retry of a failed recording.
+    asio::steady_timer m_retry;
+
+    /// Ring of the last units, shared with the readers.
+    mutable std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::vector<nal_unit> m_ring;
+
+    /// Units published so far. Unit n is at m_ring[n % capacity].
+    uint64_t m_written = 0;
+
+    /// Parameter sets of the current recording.
+    nal_unit m_sps;
+    nal_unit m_pps;
+
+    screen_record_stats m_stats;
+    std::error_code m_error;
+
+    /// Reason given by abort_all(), which ends the recording in progress.
+    std::error_code m_aborted;
+
+    std::atomic<bool> m_closed = false;
+
+    /// Start the next recording.
+    /**
+     * @note Called on the event loop, like the methods below.
+     */
+    void record();
+
+    /// Receive the next chunk of the stream into m_block.
+    void read();
+
+    /// Split the chunk just received, and start the next read.
+    void received();
+
+    /// Publish the units completed by the data received.
+    void split(const clock::time_point now);
+
+    /// Publish the pending unit, up to a given end.
+    /**
+     * @param end End of the unit in the block.
+     * @param truncated Whether the end was not marked by a start code, see
+     * nal_unit::truncated.
+     */
+    void publish(const size_t end, const bool truncated = false);
+
+    /// Publish the pending unit if no data came for flush_delay.
+    void flush();
+
+    /// Move the pending unit to a block with room for the next read.
+    void renew();
+
+    /// End the recording, and start the next one.
+    /**
+     * @param ec Error of the recording, if any.
+     */
+    void restart(const std::error_code& ec);
+
+    /// End the recording in progress as the device went away, from
+    /// abort_all(). The next one is still tried after retry_delay.
+    /**
+     * @param reason Error the recording ends with.
+     */
+    void abort(const std::error_code& reason);
+};
+
+} // namespace adb
@@ -0,0 +1,69 @@
+#include <system_error>
+
+#include "client.hpp"
+#include "protocol.hpp"
+#include "server_shards_impl.hpp"
+
+namespace adb {
+
+/// Hash a string with 64-bit FNV-1a, which is the same in every process.
+static uint64_t fnv1a(const std::string_view data) {
+    uint64_t hash = 0xcbf29ce484222325;
+    for (const auto c : data) {
+        hash ^= static_cast<uint8_t>(c);
+        hash *= 0x100000001b3;
+    }
+    return hash;
+}
+
+/// Mix the bits of a value, as the finalizer of SplitMix64.
+static uint64_t mix(uint64_t x) {
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111eb;
+    return x ^ (x >> 31);
+}
+
+std::shared_ptr<server_shards>
+server_shards::create(std::vector<std::string> servers) {
+    return std::make_shared<server_shards_impl>(std::move(servers));
+}
+
+server_shards_impl::server_shards_impl(std::vector<std::string> servers)
+    : m_servers(std::move(servers)) {
+    if (m_servers.empty()) {
+        throw std::system_error(asio::error::invalid_argument,
+                                "no adb server to assign devices to");
+    }
+
+    for (const auto& server : m_servers) {
+        std::error_code ec;
+        protocol::parse_endpoint(server, ec);
+        if (ec) {
+            throw std::system_error(ec, "invalid adb server address");
+        }
+        m_seeds.push_back(fnv1a(server));
+    }
+}
+
+const std::string&
+server_shards_impl::assign(const std::string_view serial) const {
+    // The server with the highest score wins, the first one on a tie.
+    const auto hash = fnv1a(serial);
+    size_t best = 0;
+    uint64_t best_score = 0;
+    for (size_t i = 0; i < m_seeds.size(); i++) {
+        const auto score = mix(m_seeds[i] ^ hash);
+        if (i == 0 || score > best_score) {
+            best = i;
+            best_score = score;
+        }
+    }
+    return m_servers[best];
+}
+
+std::shared_ptr<client>
+server_shards_impl::create_client(const std::string_view serial) const {
+    return client::create(serial, assign(serial));
+}
+
+} // namespace adb
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstdint>
+
+#include "server_shards.hpp"
+
+namespace adb {
+
+/// Pimpl class for server_shards.
+class server_shards_impl : public server_shards {
+  public:
+    server_shards_impl(std::vector<std::string> servers);
+
+    const std::vector<std::string>& servers() const override {
+        return m_servers;
+    }
+    const std::string& assign(const std::string_view serial) const override;
+    std::shared_ptr<client>
+    create_client(const std::string_view serial) const override;
+
+  private:
+    const std::vector<std::string> m_servers;
+
+    /// Hashes of the addresses, seeding the score of each server.
+    std::vector<uint64_t> m_seeds;
+};
+
+} // namespace adb
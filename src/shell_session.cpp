@@ -0,0 +1,230 @@
+#include <charconv>
+#include <chrono>
+#include <random>
+
+#include <asio/error.hpp>
+
+#include "shell_session_impl.hpp"
+
+namespace adb {
+
+using std::chrono::steady_clock;
+
+/// Milliseconds left until the deadline, or 0 if it has passed.
+static inline unsigned remaining_ms(const steady_clock::time_point deadline) {
+    using namespace std::chrono;
+    const auto left =
+        duration_cast<milliseconds>(deadline - steady_clock::now());
+    return left.count() > 0 ? static_cast<unsigned>(left.count()) : 0;
+}
+
+shell_session_impl::shell_session_impl(std::shared_ptr<io_handle> handle)
+    : m_handle(std::move(handle)) {
+    // Output is drained while the caller is busy between commands.
+    m_handle->read_ahead(read_ahead_size);
+
+    std::random_device rd;
+    std::uniform_int_distribution<uint32_t> dist;
+
+    char id[9] = {};
+    std::to_chars(id, id + 8, dist(rd), 16);
+    m_marker = std::string("__adb_lite_") + id + "_";
+}
+
+shell_result shell_session_impl::run(const std::string_view command,
+                                     std::error_code& ec,
+                                     const int64_t timeout) {
+    auto results = run_batch({std::string(command)}, ec, timeout);
+    if (results.empty()) {
+        return {};
+    }
+    return std::move(results.front());
+}
+
+std::vector<shell_result>
+shell_session_impl::run_batch(const std::vector<std::string>& commands,
+                              std::error_code& ec, const int64_t timeout) {
+    std::lock_guard lock(m_mutex);
+    std::vector<shell_result> results;
+
+    if (!m_alive) {
+        ec = asio::error::not_connected;
+        return results;
+    }
+
+    const auto deadline =
+        steady_clock::now() + std::chrono::milliseconds(timeout);
+    const auto first = m_seq;
+
+    // All commands go down in one write.
+    std::string payload;
+    for (const auto& command : commands) {
+        payload += wrap(command, m_seq++);
+    }
+
+    try {
+        m_handle->write(payload);
+
+        for (auto seq = first; seq < m_seq; seq++) {
+            shell_result result;
+            while (!extract(seq, result)) {
+                const auto left = remaining_ms(deadline);
+                if (left == 0) {
+                    ec = asio::error::timed_out;
+                    return results;
+                }
+
+                const auto data = m_handle->read(left);
+                if (data.empty()) {
+                    if (remaining_ms(deadline) == 0) {
+                        ec = asio::error::timed_out;
+                    } else {
+                        ec = asio::error::eof;
+                        m_alive = false;
+                    }
+                    return results;
+                }
+
+                m_pending.append(data);
+            }
+            results.push_back(std::move(result));
+        }
+    } catch (const std::system_error& e) {
+        ec = e.code();
+        m_alive = false;
+        return results;
+    }
+
+    ec.clear();
+    return results;
+}
+
+std::string shell_session_impl::wrap(const std::string_view command,
+                                     const uint64_t seq) const {
+    // Braces keep `$?` bound to the whole command, and stdin is detached so
+    // that the command cannot consume the following ones.
+    std::string wrapped = "{ ";
+    wrapped += command.empty() ? ":" : command;
+    wrapped += "\n} </dev/null 2>&1; echo \"\n";
+    wrapped += m_marker + std::to_string(seq) + " $?\"\n";
+    return wrapped;
+}
+
+bool shell_session_impl::extract(const uint64_t seq, shell_result& result) {
+    const auto pattern = "\n" + m_marker;
+
+    size_t pos;
+    while ((pos = m_pending.find(pattern)) != std::string::npos) {
+        const auto line = pos + pattern.size();
+        const auto end = m_pending.find('\n', line);
+        if (end == std::string::npos) {
+            return false;
+        }
+
+        // Sentinel: <marker><seq> <exit code>
+        const auto first = m_pending.data() + line;
+        const auto last = m_pending.data() + end;
+
+        uint64_t got = 0;
+        auto [ptr, err] = std::from_chars(first, last, got);
+        int exit_code = -1;
+        if (err == std::errc() && ptr < last && *ptr == ' ') {
+            std::from_chars(ptr + 1, last, exit_code);
+        }
+
+        if (got == seq) {
+            result.output = m_pending.substr(0, pos);
+            result.exit_code = exit_code;
+        }
+
+        m_pending.erase(0, end + 1);
+
+        if (got >= seq) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+std::shared_ptr<shell_pool> shell_pool::create(std::shared_ptr<client> client,
+                                               const size_t size) {
+    return std::make_shared<shell_pool_impl>(std::move(client), size);
+}
+
+shell_pool_impl::shell_pool_impl(std::shared_ptr<client> client,
+                                 const size_t size)
+    : m_client(std::move(client)), m_size(size > 0 ? size : 1) {}
+
+shell_result shell_pool_impl::run(const std::string_view command,
+                                  std::error_code& ec, const int64_t timeout) {
+    auto results = run_batch({std::string(command)}, ec, timeout);
+    if (results.empty()) {
+        return {};
+    }
+    return std::move(results.front());
+}
+
+std::vector<shell_result>
+shell_pool_impl::run_batch(const std::vector<std::string>& commands,
+                           std::error_code& ec, const int64_t timeout) {
+    const auto deadline =
+        steady_clock::now() + std::chrono::milliseconds(timeout);
+
+    auto session = acquire(ec, timeout);
+    if (!session) {
+        return {};
+    }
+
+    auto results = session->run_batch(commands, ec, remaining_ms(deadline));
+    release(std::move(session));
+    return results;
+}
+
+std::shared_ptr<shell_session> shell_pool_impl::acquire(std::error_code& ec,
+                                                        const int64_t timeout) {
+    const auto deadline =
+        steady_clock::now() + std::chrono::milliseconds(timeout);
+    std::unique_lock lock(m_mutex);
+
+    const auto ready = [this] { return !m_idle.empty() || m_opened < m_size; };
+    if (!m_cv.wait_until(lock, deadline, ready)) {
+        ec = asio::error::timed_out;
+        return nullptr;
+    }
+
+    if (!m_idle.empty()) {
+        auto session = std::move(m_idle.back());
+        m_idle.pop_back();
+        return session;
+    }
+
+    // Open the session outside the lock, as it takes a round-trip.
+    m_opened++;
+    lock.unlock();
+
+    // The wait for a free slot counts against the timeout.
+    auto session = m_client->open_shell_session(ec, remaining_ms(deadline));
+    if (ec || !session) {
+        lock.lock();
+        m_opened--;
+        m_cv.notify_one();
+        return nullptr;
+    }
+
+    return session;
+}
+
+void shell_pool_impl::release(std::shared_ptr<shell_session> session) {
+    std::lock_guard lock(m_mutex);
+
+    if (session->alive()) {
+        m_idle.push_back(std::move(session));
+    } else {
+        m_opened--;
+    }
+
+    m_cv.notify_one();
+}
+
+} // namespace adb
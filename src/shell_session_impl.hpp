@@ -0,0 +1,92 @@
+#pragma once
+
+#include <condition_variable>
+#include <mutex>
+
+#include "client.hpp"
+#include "shell_session.hpp"
+
+namespace adb {
+
+/// Pimpl class for shell_session.
+class shell_session_impl : public shell_session {
+  public:
+    shell_session_impl(std::shared_ptr<io_handle> handle);
+
+    shell_result run(const std::string_view command, std::error_code& ec,
+                     const int64_t timeout) override;
+    std::vector<shell_result>
+    run_batch(const std::vector<std::string>& commands, std::error_code& ec,
+              const int64_t timeout) override;
+
+    bool alive() const override { return m_alive; }
+
+    /// Shell command that starts the session process.
+    static constexpr auto shell_command = "sh";
+
+    /// Size of the buffer of the output read ahead.
+    static constexpr size_t read_ahead_size = 256 * 1024;
+
+  private:
+    /// Interactive connection to the shell process.
+    std::shared_ptr<io_handle> m_handle;
+
+    /// Serialize batches, since the outputs are parsed in order.
+    std::mutex m_mutex;
+
+    /// Prefix of the sentinels, unique to the session.
+    std::string m_marker;
+
+    /// Sequence number of the next command.
+    uint64_t m_seq = 0;
+
+    /// Output received but not yet assigned to a command.
+    std::string m_pending;
+
+    /// Whether the session is still usable.
+    bool m_alive = true;
+
+    /// Wrap a command so that it is followed by its sentinel.
+    std::string wrap(const std::string_view command, const uint64_t seq) const;
+
+    /// Extract the result of a command from the pending output.
+    /**
+     * @return true if the sentinel of the command has been received.
+     * @note Outputs of earlier commands, e.g. those timed out, are discarded.
+     */
+    bool extract(const uint64_t seq, shell_result& result);
+};
+
+/// Pimpl class for shell_pool.
+class shell_pool_impl : public shell_pool {
+  public:
+    shell_pool_impl(std::shared_ptr<client> client, const size_t size);
+
+    shell_result run(const std::string_view command, std::error_code& ec,
+                     const int64_t timeout) override;
+    std::vector<shell_result>
+    run_batch(const std::vector<std::string>& commands, std::error_code& ec,
+              const int64_t timeout) override;
+
+  private:
+    const std::shared_ptr<client> m_client;
+    const size_t m_size;
+
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+
+    /// Sessions ready for a new command.
+    std::vector<std::shared_ptr<shell_session>> m_idle;
+
+    /// Number of sessions opened, including the busy ones.
+    size_t m_opened = 0;
+
+    /// Take an idle session, or open a new one if the pool is not full.
+    std::shared_ptr<shell_session> acquire(std::error_code& ec,
+                                           const int64_t timeout);
+
+    /// Return a session to the pool.
+    void release(std::shared_ptr<shell_session> session);
+};
+
+} // namespace adb
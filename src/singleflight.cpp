@@ -0,0 +1,64 @@
+#include <asio/error.hpp>
+
+#include "singleflight.hpp"
+
+namespace adb {
+
+std::string singleflight::run(const std::string& key, const call_t& call,
+                              std::error_code& ec, const int64_t timeout) {
+    std::unique_lock lock(m_mutex);
+    m_stats.requests++;
+
+    const auto found = m_flights.find(key);
+    if (found != m_flights.end()) {
+        // Keep the flight alive, as the leader removes it when done.
+        const auto joined = found->second;
+        m_stats.saved++;
+
+        const auto done = [&joined] { return joined->done; };
+        if (!m_cv.wait_for(lock, std::chrono::milliseconds(timeout), done)) {
+            ec = asio::error::timed_out;
+            return "";
+        }
+
+        ec = joined->error;
+        return joined->result;
+    }
+
+    const auto leader = std::make_shared<flight>();
+    m_flights.emplace(key, leader);
+    m_stats.round_trips++;
+    lock.unlock();
+
+    const auto complete = [&](const std::string& result,
+                              const std::error_code& error) {
+        lock.lock();
+        leader->done = true;
+        leader->result = result;
+        leader->error = error;
+        m_flights.erase(key);
+        lock.unlock();
+        m_cv.notify_all();
+    };
+
+    // The callers that joined must not wait for a request that threw.
+    std::error_code error;
+    std::string result;
+    try {
+        result = call(error);
+    } catch (...) {
+        complete({}, asio::error::fault);
+        throw;
+    }
+
+    complete(result, error);
+    ec = error;
+    return result;
+}
+
+coalescing_stats singleflight::stats() const {
+    std::lock_guard lock(m_mutex);
+    return m_stats;
+}
+
+} // namespace adb
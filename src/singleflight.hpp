@@ -0,0 +1,55 @@
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <unordered_map>
+
+#include "client.hpp"
+
+namespace adb {
+
+/// Coalescing of identical requests in flight.
+/**
+ * @note The first caller of a key runs the request. Callers of the same key
+ * that arrive before it completes wait for its result instead of running
+ * their own. Results are not kept once the request completes.
+ */
+class singleflight {
+  public:
+    /// Function running a request.
+    typedef std::function<std::string(std::error_code&)> call_t;
+
+    /// Run a request, or join the identical one in flight.
+    /**
+     * @return Result of the request.
+     * @param key Key of the request, e.g. its serial and service.
+     * @param call Function running the request, if none is in flight.
+     * @param ec std::error_code of the request, or timed_out if a joined
+     * request did not complete in time.
+     * @param timeout Timeout in milliseconds to wait for a joined request.
+     */
+    std::string run(const std::string& key, const call_t& call,
+                    std::error_code& ec, const int64_t timeout);
+
+    /// Get the counters of the requests run so far.
+    coalescing_stats stats() const;
+
+  private:
+    /// A request in flight.
+    struct flight {
+        bool done = false;
+        std::string result;
+        std::error_code error;
+    };
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::unordered_map<std::string, std::shared_ptr<flight>> m_flights;
+    coalescing_stats m_stats;
+};
+
+} // namespace adb
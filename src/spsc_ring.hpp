@@ -0,0 +1,137 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstring>
+#include <memory>
+#include <span>
+#include <string_view>
+
+namespace adb {
+
+/// Lock-free byte ring buffer for one producer and one consumer.
+/**
+ * @note The producer only calls write_regions() and commit_write(). The
+ * consumer calls the other methods. Both may call size().
+ */
+class spsc_ring {
+  public:
+    /// Construct a ring buffer.
+    /**
+     * @param capacity Size of the buffer, rounded up to a power of 2.
+     */
+    explicit spsc_ring(const size_t capacity)
+        : m_capacity(std::bit_ceil(std::max<size_t>(capacity, 64))),
+          m_data(std::make_unique<char[]>(m_capacity)) {}
+
+    /// Get the size of the buffer.
+    size_t capacity() const { return m_capacity; }
+
+    /// Get the number of bytes buffered.
+    size_t size() const {
+        return m_tail.load(std::memory_order_acquire) -
+               m_head.load(std::memory_order_acquire);
+    }
+
+    /// Get the free space to fill, as up to two contiguous regions.
+    std::array<std::span<char>, 2> write_regions() {
+        const auto head = m_head.load(std::memory_order_acquire);
+        const auto tail = m_tail.load(std::memory_order_relaxed);
+        const auto free = m_capacity - (tail - head);
+        const auto offset = tail & (m_capacity - 1);
+        const auto first = std::min(free, m_capacity - offset);
+        return {std::span(m_data.get() + offset, first),
+                std::span(m_data.get(), free - first)};
+    }
+
+    /// Publish bytes written into the free space.
+    void commit_write(const size_t size) {
+        const auto tail = m_tail.load(std::memory_order_relaxed);
+        m_tail.store(tail + size, std::memory_order_release);
+    }
+
+    /// Get the buffered data, as up to two contiguous regions.
+    std::array<std::span<const char>, 2> read_regions() const {
+        const auto head = m_head.load(std::memory_order_relaxed);
+        const auto tail = m_tail.load(std::memory_order_acquire);
+        const auto size = tail - head;
+        const auto offset = head & (m_capacity - 1);
+        const auto first = std::min(size, m_capacity - offset);
+        return {std::span<const char>(m_data.get() + offset, first),
+                std::span<const char>(m_data.get(), size - first)};
+    }
+
+    /// Release bytes read from the buffered data.
+    void commit_read(const size_t size) {
+        const auto head = m_head.load(std::memory_order_relaxed);
+        m_head.store(head + size, std::memory_order_release);
+    }
+
+    /// Copy buffered data out and release it.
+    /**
+     * @return Bytes copied.
+     */
+    size_t read(char* data, const size_t size) {
+        size_t copied = 0;
+        for (const auto region : read_regions()) {
+            const auto n = std::min(region.size(), size - copied);
+            std::memcpy(data + copied, region.data(), n);
+            copied += n;
+        }
+        commit_read(copied);
+        return copied;
+    }
+
+    /// Find a pattern in the buffered data.
+    /**
+     * @return Offset of the pattern from the oldest byte, or npos.
+     * @param pattern Pattern to find. Must not be empty.
+     * @param from Offset to start from.
+     */
+    size_t find(const std::string_view pattern, size_t from) const {
+        const auto head = m_head.load(std::memory_order_relaxed);
+        const auto size = this->size();
+        const auto mask = m_capacity - 1;
+
+        while (from + pattern.size() <= size) {
+            // Look for the first byte in the contiguous run.
+            const auto offset = (head + from) & mask;
+            const auto run = std::min(size - from, m_capacity - offset);
+            const auto start = m_data.get() + offset;
+            const auto hit = std::memchr(start, pattern.front(), run);
+            if (hit == nullptr) {
+                from += run;
+                continue;
+            }
+
+            from += static_cast<const char*>(hit) - start;
+            if (from + pattern.size() > size) {
+                break;
+            }
+
+            size_t i = 1;
+            while (i < pattern.size() &&
+                   m_data[(head + from + i) & mask] == pattern[i]) {
+                i++;
+            }
+            if (i == pattern.size()) {
+                return from;
+            }
+            from++;
+        }
+
+        return std::string_view::npos;
+    }
+
+  private:
+    const size_t m_capacity;
+    std::unique_ptr<char[]> m_data;
+
+    /// Positions of the consumer and the producer, on separate cache lines.
+    alignas(64) std::atomic<size_t> m_head = 0;
+    alignas(64) std::atomic<size_t> m_tail = 0;
+};
+
+} // namespace adb
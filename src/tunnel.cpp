@@ -0,0 +1,313 @@
+#include <asio/post.hpp>
+#include <asio/write.hpp>
+
+#if defined(__linux__)
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "client_impl.hpp"
+#include "tunnel_impl.hpp"
+
+namespace adb {
+
+using asio::ip::tcp;
+
+/// Maximum bytes moved by one splice() or read.
+static constexpr size_t chunk_size = 64000;
+
+/// Maximum chunks relayed in a row before yielding to other handlers.
+static constexpr int chunks_per_turn = 16;
+
+tunnel_connection::tunnel_connection(std::shared_ptr<tunnel_impl> tunnel,
+                                     tcp::socket&& local, tcp::socket&& remote)
+    : m_tunnel(std::move(tunnel)), m_local(std::move(local)),
+      m_remote(std::move(remote)),
+      m_up{m_local, m_remote, m_tunnel->m_bytes_sent},
+      m_down{m_remote, m_local, m_tunnel->m_bytes_received} {
+    m_tunnel->m_active++;
+    m_tunnel->m_total++;
+}
+
+tunnel_connection::~tunnel_connection() {
+#if defined(__linux__)
+    for (auto dir : {&m_up, &m_down}) {
+        for (auto fd : dir->pipe) {
+            if (fd >= 0) {
+                ::close(fd);
+            }
+        }
+    }
+#endif
+    m_tunnel->m_active--;
+}
+
+void tunnel_connection::start() {
+#if defined(__linux__)
+    for (auto dir : {&m_up, &m_down}) {
+        if (::pipe2(dir->pipe, O_NONBLOCK | O_CLOEXEC) != 0) {
+            close();
+            return;
+        }
+        ::fcntl(dir->pipe[1], F_SETPIPE_SZ, static_cast<int>(chunk_size));
+    }
+
+    // splice() is driven by readiness, so the sockets must not block.
+    m_local.native_non_blocking(true);
+    m_remote.native_non_blocking(true);
+#else
+    m_up.buffer = std::make_unique<std::array<char, chunk_size>>();
+    m_down.buffer = std::make_unique<std::array<char, chunk_size>>();
+#endif
+
+    pump(m_up);
+    pump(m_down);
+}
+
+void tunnel_connection::close() {
+    asio::error_code ignored;
+    m_local.close(ignored);
+    m_remote.close(ignored);
+}
+
+#if defined(__linux__)
+
+void tunnel_connection::pump(direction& dir) {
+    constexpr auto flags = SPLICE_F_MOVE | SPLICE_F_NONBLOCK;
+
+    for (int turn = 0; turn < chunks_per_turn; turn++) {
+        // Drain the pipe into the destination first.
+        while (dir.pending > 0) {
+            const auto to = dir.to.native_handle();
+            const auto n =
+                ::splice(dir.pipe[0], nullptr, to, nullptr, dir.pending, flags);
+
+            if (n > 0) {
+                dir.pending -= n;
+                dir.counter += n;
+                continue;
+            }
+
+            if (n < 0 && errno == EAGAIN) {
+                const auto wait = tcp::socket::wait_write;
+                dir.to.async_wait(wait, [self = shared_from_this(),
+                                         &dir](const auto& ec) {
+                    if (ec) {
+                        self->close();
+                        return;
+                    }
+                    self->pump(dir);
+                });
+                return;
+            }
+
+            close();
+            return;
+        }
+
+        if (dir.eof) {
+            finish(dir);
+            return;
+        }
+
+        const auto from = dir.from.native_handle();
+        const auto n =
+            ::splice(from, nullptr, dir.pipe[1], nullptr, chunk_size, flags);
+
+        if (n > 0) {
+            dir.pending = n;
+            continue;
+        }
+
+        if (n == 0) {
+            dir.eof = true;
+            finish(dir);
+            return;
+        }
+
+        if (errno == EAGAIN) {
+            const auto wait = tcp::socket::wait_read;
+            dir.from.async_wait(wait, [self = shared_from_this(),
+                                       &dir](const auto& ec) {
+                if (ec) {
+                    self->close();
+                    return;
+                }
+                self->pump(dir);
+            });
+            return;
+        }
+
+        close();
+        return;
+    }
+
+    // Let the other direction and connections run.
+    asio::post(dir.from.get_executor(),
+               [self = shared_from_this(), &dir] { self->pump(dir); });
+}
+
+#else
+
+void tunnel_connection::pump(direction& dir) {
+    auto buffer = asio::buffer(*dir.buffer);
+    dir.from.async_read_some(buffer, [self = shared_from_this(),
+                                      &dir](const auto& ec, auto size) {
+        if (ec == asio::error::eof) {
+            dir.eof = true;
+            self->finish(dir);
+            return;
+        }
+
+        if (ec) {
+            self->close();
+            return;
+        }
+
+        auto data = asio::buffer(dir.buffer->data(), size);
+        asio::async_write(dir.to, data, [self, &dir](const auto& ec,
+                                                     auto size) {
+            if (ec) {
+                self->close();
+                return;
+            }
+
+            dir.counter += size;
+            self->pump(dir);
+        });
+    });
+}
+
+#endif
+
+void tunnel_connection::finish(direction& dir) {
+    asio::error_code ignored;
+    dir.to.shutdown(tcp::socket::shutdown_send, ignored);
+
+    if (--m_running == 0) {
+        close();
+    }
+}
+
+tunnel_impl::pointer tunnel_impl::create(
+    asio::io_context& context, const asio::ip::tcp::endpoint& endpoint,
+    const std::string_view serial, const std::string_view remote,
+    const uint16_t local_port, std::error_code& ec) {
+    auto tunnel =
+        std::make_shared<tunnel_impl>(context, endpoint, serial, remote);
+
+    const auto localhost = asio::ip::address_v4::loopback();
+    const auto local = tcp::endpoint(localhost, local_port);
+
+    asio::error_code error;
+    auto& acceptor = tunnel->m_acceptor;
+    acceptor.open(local.protocol(), error);
+    if (!error) {
+        acceptor.set_option(tcp::acceptor::reuse_address(true), error);
+    }
+    if (!error) {
+        acceptor.bind(local, error);
+    }
+    if (!error) {
+        acceptor.listen(asio::socket_base::max_listen_connections, error);
+    }
+    if (!error) {
+        tunnel->m_port = acceptor.local_endpoint(error).port();
+    }
+
+    ec = error;
+    if (ec) {
+        return nullptr;
+    }
+
+    tunnel->accept();
+    return tunnel;
+}
+
+tunnel_impl::tunnel_impl(asio::io_context& context,
+                         const asio::ip::tcp::endpoint& endpoint,
+                         const std::string_view serial,
+                         const std::string_view remote)
+    : m_context(context), m_acceptor(context), m_endpoint(endpoint),
+      m_serial(serial), m_remote(remote),
+      m_start(std::chrono::steady_clock::now()) {}
+
+tunnel_stats tunnel_impl::stats() const {
+    using namespace std::chrono;
+
+    tunnel_stats stats;
+    stats.bytes_sent = m_bytes_sent;
+    stats.bytes_received = m_bytes_received;
+    stats.active_connections = m_active;
+    stats.total_connections = m_total;
+
+    const auto elapsed = steady_clock::now() - m_start;
+    stats.elapsed = duration_cast<duration<double>>(elapsed).count();
+    if (stats.elapsed > 0) {
+        stats.send_rate = stats.bytes_sent / stats.elapsed;
+        stats.receive_rate = stats.bytes_received / stats.elapsed;
+    }
+
+    return stats;
+}
+
+void tunnel_impl::close() {
+    asio::post(m_context, [self = shared_from_this()] {
+        asio::error_code ignored;
+        self->m_acceptor.close(ignored);
+
+        std::lock_guard lock(self->m_mutex);
+        for (const auto& weak : self->m_connections) {
+            if (auto connection = weak.lock()) {
+                connection->close();
+            }
+        }
+        self->m_connections.clear();
+    });
+}
+
+void tunnel_impl::accept() {
+    m_acceptor.async_accept([self = shared_from_this()](const auto& ec,
+                                                        auto socket) {
+        if (ec) {
+            // The acceptor is closed with the tunnel.
+            return;
+        }
+
+        asio::error_code ignored;
+        socket.set_option(tcp::no_delay(true), ignored);
+
+        self->open_stream(std::move(socket));
+        self->accept();
+    });
+}
+
+void tunnel_impl::open_stream(tcp::socket&& local) {
+    auto handle = std::make_shared<client_handle>(m_context, m_endpoint);
+    auto socket = std::make_shared<tcp::socket>(std::move(local));
+
+    handle->connect_device(m_serial, [self = shared_from_this(), handle,
+                                      socket] {
+        handle->host_request(self->m_remote, [self, handle, socket] {
+            if (handle->error()) {
+                asio::error_code ignored;
+                socket->close(ignored);
+                return;
+            }
+
+            auto connection = std::make_shared<tunnel_connection>(
+                self, std::move(*socket), handle->release_socket());
+
+            {
+                std::lock_guard lock(self->m_mutex);
+                std::erase_if(self->m_connections,
+                              [](const auto& weak) { return weak.expired(); });
+                self->m_connections.push_back(connection);
+            }
+
+            connection->start();
+        });
+    });
+}
+
+} // namespace adb
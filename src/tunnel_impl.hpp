@@ -0,0 +1,134 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <vector>
+
+#include <asio/ip/tcp.hpp>
+
+#include "tunnel.hpp"
+
+namespace adb {
+
+class tunnel_impl;
+
+/// A pair of sockets whose payload is relayed in both directions.
+class tunnel_connection
+    : public std::enable_shared_from_this<tunnel_connection> {
+  public:
+    typedef std::shared_ptr<tunnel_connection> pointer;
+
+    tunnel_connection(std::shared_ptr<tunnel_impl> tunnel,
+                      asio::ip::tcp::socket&& local,
+                      asio::ip::tcp::socket&& remote);
+    ~tunnel_connection();
+
+    /// Start relaying in both directions.
+    void start();
+
+    /// Close both sockets.
+    void close();
+
+  private:
+    /// State of one direction of the relay.
+    struct direction {
+        direction(asio::ip::tcp::socket& from, asio::ip::tcp::socket& to,
+                  std::atomic<uint64_t>& counter)
+            : from(from), to(to), counter(counter) {}
+
+        asio::ip::tcp::socket& from;
+        asio::ip::tcp::socket& to;
+        std::atomic<uint64_t>& counter;
+
+        /// Pipe that holds the payload between the two splice() calls.
+        int pipe[2] = {-1, -1};
+
+        /// Bytes in the pipe not yet written to the destination.
+        size_t pending = 0;
+
+        /// Buffer for the portable relay.
+        std::unique_ptr<std::array<char, 64000>> buffer;
+
+        /// Whether the source has reached EOF.
+        bool eof = false;
+    };
+
+    std::shared_ptr<tunnel_impl> m_tunnel;
+
+    asio::ip::tcp::socket m_local;
+    asio::ip::tcp::socket m_remote;
+
+    direction m_up;
+    direction m_down;
+
+    /// Number of directions still running.
+    int m_running = 2;
+
+    /// Relay one direction until it would block.
+    void pump(direction& dir);
+
+    /// Mark one direction finished, and half-close its destination.
+    void finish(direction& dir);
+};
+
+/// Pimpl class for tunnel.
+class tunnel_impl : public tunnel,
+                    public std::enable_shared_from_this<tunnel_impl> {
+  public:
+    typedef std::shared_ptr<tunnel_impl> pointer;
+
+    /// Create a tunnel and start accepting connections.
+    /**
+     * @param context io_context of the client.
+     * @param endpoint Endpoint of the adb server.
+     * @param serial Serial of the device.
+     * @param remote Device service to connect to, e.g. `tcp:1717` or
+     * `localabstract:minitouch`.
+     * @param local_port Port on 127.0.0.1 to listen on. 0 to pick any.
+     * @param ec std::error_code to indicate what error occurred, if any.
+     */
+    static pointer create(asio::io_context& context,
+                          const asio::ip::tcp::endpoint& endpoint,
+                          const std::string_view serial,
+                          const std::string_view remote,
+                          const uint16_t local_port, std::error_code& ec);
+
+    tunnel_impl(asio::io_context& context,
+                const asio::ip::tcp::endpoint& endpoint,
+                const std::string_view serial, const std::string_view remote);
+
+    uint16_t port() const override { return m_port; }
+    tunnel_stats stats() const override;
+    void close() override;
+
+  private:
+    friend class tunnel_connection;
+
+    asio::io_context& m_context;
+    asio::ip::tcp::acceptor m_acceptor;
+    uint16_t m_port = 0;
+
+    const asio::ip::tcp::endpoint m_endpoint;
+    const std::string m_serial;
+    const std::string m_remote;
+
+    const std::chrono::steady_clock::time_point m_start;
+
+    std::atomic<uint64_t> m_bytes_sent = 0;
+    std::atomic<uint64_t> m_bytes_received = 0;
+    std::atomic<uint32_t> m_active = 0;
+    std::atomic<uint32_t> m_total = 0;
+
+    /// Connections being relayed, to be closed with the tunnel.
+    std::mutex m_mutex;
+    std::vector<std::weak_ptr<tunnel_connection>> m_connections;
+
+    /// Accept the next local connection.
+    void accept();
+
+    /// Open an adb stream to the device service for a local connection.
+    void open_stream(asio::ip::tcp::socket&& local);
+};
+
+} // namespace adb
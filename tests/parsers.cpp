@@ -0,0 +1,381 @@
+#include <cstdint>
+#include <iostream>
+#include <string>
+
+#include "gzip.hpp"
+#include "logcat_stream_impl.hpp"
+#include "lz4.hpp"
+#include "property_map.hpp"
+
+/// Number of failed checks.
+static int failures = 0;
+
+/// Report a failed check, and keep going.
+#define CHECK(condition)                                                       \
+    do {                                                                       \
+        if (!(condition)) {                                                    \
+            std::cerr << __FILE__ << ":" << __LINE__                           \
+                      << ": check failed: " #condition << std::endl;          \
+            failures++;                                                        \
+        }                                                                      \
+    } while (false)
+
+/// Append a little-endian field.
+template <typename T> static void put(std::string& data, const T value) {
+    for (size_t i = 0; i < sizeof(T); i++) {
+        data += static_cast<char>((value >> (8 * i)) & 0xff);
+    }
+}
+
+/// Encode a text `logger_entry` record.
+/**
+ * @param header Size of the header: 20, 24 or 28.
+ * @param field20 euid in version 2, lid from version 3.
+ * @param uid uid of version 4.
+ */
+static std::string log_entry(const uint16_t header, const uint32_t field20,
+                             const uint32_t uid) {
+    const std::string payload = std::string("\x04") + "tag" + '\0' + "hi\n" +
+                                '\0';
+
+    std::string data;
+    put<uint16_t>(data, static_cast<uint16_t>(payload.size()));
+    put<uint16_t>(data, header == 20 ? 0 : header);
+    put<int32_t>(data, 42);
+    put<uint32_t>(data, 43);
+    put<uint32_t>(data, 1700000000);
+    put<uint32_t>(data, 0);
+    if (header >= 24) {
+        put<uint32_t>(data, field20);
+    }
+    if (header >= 28) {
+        put<uint32_t>(data, uid);
+    }
+    return data + payload;
+}
+
+static void test_logcat() {
+    using namespace adb;
+
+    const auto parse = [](const std::string& data, log_record& record) {
+        return logcat::parse(data.data(), data.size(), record);
+    };
+
+    log_record record;
+    const auto v1 = log_entry(20, 0, 0);
+    CHECK(parse(v1, record) == v1.size());
+    CHECK(record.buffer == log_buffer::main);
+    CHECK(record.tag == "tag" && record.message == "hi");
+
+    // Version 2 has the euid where version 3 has the lid.
+    const auto v2 = log_entry(24, 10057, 0);
+    CHECK(parse(v2, record) == v2.size());
+    CHECK(record.buffer == log_buffer::main);
+    CHECK(record.uid == 10057);
+    CHECK(record.pid == 42 && record.tid == 43);
+    CHECK(record.tag == "tag" && record.message == "hi");
+
+    const auto v2_shell = log_entry(24, 2000, 0);
+    CHECK(parse(v2_shell, record) == v2_shell.size());
+    CHECK(record.buffer == log_buffer::main);
+
+    const auto v3 = log_entry(24, 3, 0);
+    CHECK(parse(v3, record) == v3.size());
+    CHECK(record.buffer == log_buffer::system);
+    CHECK(record.uid == 0);
+
+    const auto v4 = log_entry(28, 4, 1000);
+    CHECK(parse(v4, record) == v4.size());
+    CHECK(record.buffer == log_buffer::crash);
+    CHECK(record.uid == 1000);
+
+    CHECK(parse(v4.substr(0, v4.size() - 1), record) == 0);
+}
+
+static void test_property_map() {
+    using namespace adb;
+
+    // Noise between entries, e.g. from the linker, is skipped.
+    auto map = property_map::parse(
+        "[a]: [1]\nWARNING: linker: x\n[b]: [2]\n[c]: [3]\n");
+    CHECK(map->entries().size() == 3);
+    CHECK(map->get("a", "") == "1");
+    CHECK(map->get("b", "") == "2");
+    CHECK(map->get("c", "") == "3");
+
+    map = property_map::parse("[a]: [1\r\n2]\r\n[b]: []\r\n[c]: [3");
+    CHECK(map->get("a", "") == "1\r\n2");
+    CHECK(map->get("b", "?").empty());
+    CHECK(map->get("c", "") == "3");
+
+    map = property_map::parse("[a]: [1\n2 [x]\n]\nnoise\n[b]: [2]\n");
+    CHECK(map->get("a", "") == "1\n2 [x]\n");
+    CHECK(map->get("b", "") == "2");
+
+    // A value never closed does not take the next entries.
+    map = property_map::parse("[a]: [1\nnoise\n[b]: [2]\n");
+    CHECK(map->get("a", "") == "1");
+    CHECK(map->get("b", "") == "2");
+
+    CHECK(property_map::parse("")->entries().empty());
+}
+
+/// Bytes of a literal, which may hold NULs.
+template <size_t N> static std::string bytes(const char (&data)[N]) {
+    return std::string(data, N - 1);
+}
+
+/// Text the fixed vectors below were made from, 2110 bytes.
+static std::string lines() {
+    std::string text;
+    for (int i = 0; i < 40; i++) {
+        text += "line " + std::to_string(i) +
+                ": the quick brown fox jumps over the lazy dog\n";
+    }
+    return text;
+}
+
+/// Bytes that do not compress, from a xorshift generator.
+static std::string noise(const size_t size) {
+    std::string data;
+    uint32_t x = 2463534242;
+    for (size_t i = 0; i < size; i++) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        data += static_cast<char>(x & 0xff);
+    }
+    return data;
+}
+
+/// `lz4 -9 -B4 -BD -BX --content-size` of lines() repeated 60 times: linked
+/// blocks, with checksums and the content size.
+static constexpr char lines_lz4[] =
+    "\x04\x22\x4d\x18\x5c\x40\x88\xee\x01\x00\x00\x00\x00\x00\x28\xf7\x01\x00"
+    "\x00\xf1\x17\x6c\x69\x6e\x65\x20\x30\x3a\x20\x74\x68\x65\x20\x71\x75\x69"
+    "\x63\x6b\x20\x62\x72\x6f\x77\x6e\x20\x66\x6f\x78\x20\x6a\x75\x6d\x70\x73"
+    "\x20\x6f\x76\x65\x72\x1f\x00\x91\x6c\x61\x7a\x79\x20\x64\x6f\x67\x0a\x34"
+    "\x00\x1f\x31\x34\x00\x20\x1f\x32\x34\x00\x20\x1f\x33\x34\x00\x20\x1f\x34"
+    "\x34\x00\x20\x1f\x35\x34\x00\x20\x1f\x36\x34\x00\x20\x1f\x37\x34\x00\x20"
+    "\x1f\x38\x34\x00\x20\x1f\x39\xd4\x01\x21\x0f\x09\x02\x22\x0f\x0a\x02\x21"
+    "\x1f\x31\x0b\x02\x21\x1f\x31\x0c\x02\x21\x1f\x31\x0d\x02\x21\x1f\x31\x0e"
+    "\x02\x21\x1f\x31\x0f\x02\x21\x1f\x31\x10\x02\x21\x1f\x31\x11\x02\x21\x1f"
+    "\x31\x12\x02\x21\x1f\x32\x12\x02\x21\x1f\x32\x1c\x04\x22\x0f\x12\x02\x21"
+    "\x1f\x32\x12\x02\x21\x1f\x32\x12\x02\x21\x1f\x32\x12\x02\x21\x1f\x32\x12"
+    "\x02\x21\x1f\x32\x12\x02\x21\x1f\x32\x12\x02\x21\x1f\x32\x12\x02\x21\x1f"
+    "\x33\x12\x02\x21\x1f\x33\x12\x02\x21\x1f\x33\x2f\x06\x22\x0f\x12\x02\x21"
+    "\x1f\x33\x12\x02\x21\x1f\x33\x12\x02\x21\x1f\x33\x12\x02\x21\x1f\x33\x12"
+    "\x02\x21\x1f\x33\x12\x02\x21\x1f\x33\x12\x02\x1c\x0f\x3e\x08\xff\xff\xff"
+    "\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff"
+    "\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff"
+    "\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff"
+    "\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff"
+    "\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff"
+    "\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff"
+    "\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff"
+    "\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff"
+    "\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff"
+    "\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff"
+    "\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff"
+    "\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff"
+    "\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff"
+    "\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xa2\x50\x20\x62\x72\x6f\x77"
+    "\x57\xec\x49\xe0\xf9\x00\x00\x00\x0f\x3e\x08\xff\xff\xff\xff\xff\xff\xff"
+    "\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff"
+    "\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff"
+    "\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff"
+    "\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff"
+    "\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff"
+    "\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff"
+    "\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff"
+    "\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff"
+    "\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff"
+    "\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff"
+    "\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff"
+    "\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff"
+    "\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\x5f\x50"
+    "\x20\x64\x6f\x67\x0a\x0e\xb8\x90\x70\x00\x00\x00\x00\x7f\xcf\xc5\x4a";
+
+/// Compress data into an LZ4 frame, written in chunks.
+static std::string lz4_encode(const std::string_view data,
+                              const size_t chunk) {
+    adb::lz4::frame_encoder encoder;
+    std::string frame;
+    for (size_t pos = 0; pos < data.size(); pos += chunk) {
+        encoder.write(data.substr(pos, chunk), frame);
+    }
+    encoder.finish(frame);
+    return frame;
+}
+
+/// Decompress an LZ4 stream, fed in two parts split at an offset.
+/**
+ * @return false if the stream is invalid or not finished.
+ */
+static bool lz4_decode(const std::string_view frame, const size_t split,
+                       std::string& output) {
+    adb::lz4::frame_decoder decoder;
+    output.clear();
+    const auto sink = [&](const std::string_view data) { output += data; };
+    return decoder.feed(frame.substr(0, split), sink) &&
+           decoder.feed(frame.substr(split), sink) && decoder.finished();
+}
+
+static void test_lz4() {
+    std::string text;
+    for (int i = 0; i < 60; i++) {
+        text += lines();
+    }
+
+    // Several blocks, compressed and stored.
+    const std::string inputs[] = {"", "a", text, noise(100000),
+                                  noise(3000) + text + noise(70000)};
+    for (const auto& input : inputs) {
+        for (const size_t chunk : {size_t{1000}, adb::lz4::block_size + 1}) {
+            const auto frame = lz4_encode(input, chunk);
+            std::string output;
+            CHECK(lz4_decode(frame, frame.size(), output));
+            CHECK(output == input);
+        }
+    }
+    CHECK(lz4_encode(text, text.size()).size() < text.size() / 10);
+
+    // Input split at every offset, over blocks of a few bytes too.
+    const auto mixed = noise(500) + lines() + noise(300);
+    for (const size_t chunk : {size_t{1}, size_t{7}, mixed.size()}) {
+        const auto frame = lz4_encode(mixed, chunk);
+        for (size_t split = 0; split <= frame.size(); split++) {
+            std::string output;
+            CHECK(lz4_decode(frame, split, output) && output == mixed);
+        }
+    }
+
+    // Frames one after another, and a truncated frame.
+    const auto frame = lz4_encode(mixed, mixed.size());
+    std::string output;
+    CHECK(lz4_decode(frame + frame, frame.size() / 2, output));
+    CHECK(output == mixed + mixed);
+    CHECK(!lz4_decode(frame.substr(0, frame.size() - 1), 0, output));
+
+    // Output of the reference tool, at every offset.
+    const auto reference = bytes(lines_lz4);
+    for (size_t split = 0; split <= reference.size(); split++) {
+        CHECK(lz4_decode(reference, split, output) && output == text);
+    }
+    CHECK(!lz4_decode("not an lz4 frame", 0, output));
+}
+
+/// `gzip -1 -n` of lines(), a dynamic Huffman block.
+static constexpr char lines_gzip_1[] =
+    "\x1f\x8b\x08\x00\x00\x00\x00\x00\x04\x03\x9d\xd2\x49\x16\xc1\x60\x14\x05"
+    "\xe1\xb9\x55\xbc\x25\x78\xf7\xea\x77\xa3\x09\x42\xe4\x27\x44\xb7\x7a\x87"
+    "\x1d\xa8\x71\x9d\x9a\x7d\x4d\xdd\x56\x31\x5c\xc4\x6d\x5f\xc5\xa5\xaf\xd7"
+    "\xc7\x58\x75\xe5\xd1\xc6\xb6\x3c\xe3\xd0\x9f\xce\xd7\x28\xf7\xaa\xfb\xe5"
+    "\x66\xf9\x7e\xc5\xa6\xec\x06\xcd\xf7\x49\xf0\x08\x3c\x06\xcf\x08\x3c\x63"
+    "\xf0\x4c\xc0\x33\x05\xcf\x0c\x3c\x73\xf0\x24\x82\x40\x24\x24\xa1\x90\xc4"
+    "\x42\x12\x0c\x49\x34\x24\xe1\x90\xc4\x43\x12\x10\x49\x44\x88\x88\x10\x11"
+    "\x21\x22\x42\x44\x84\x88\x08\x11\x11\x22\x22\x44\x44\x88\x88\x10\x11\x61"
+    "\x22\xc2\x44\x84\x89\x08\x13\x11\x26\x22\x4c\x44\x98\x88\x30\x11\x61\x22"
+    "\xc2\x7f\x8a\xf8\x00\x64\x58\x7b\x18\x3e\x08\x00\x00";
+
+/// `gzip -9` of lines() from `lines.txt`, with the name in the header.
+static constexpr char lines_gzip_9[] =
+    "\x1f\x8b\x08\x08\x37\xb4\xd4\x6a\x02\x03\x6c\x69\x6e\x65\x73\x2e\x74\x78"
+    "\x74\x00\x9d\xd5\x5b\x16\xc1\x50\x0c\x46\xe1\x77\xa3\xc8\x10\xe4\x0f\x2d"
+    "\x66\xe3\x72\x68\x39\x7a\x68\xd5\x6d\xf4\x16\x33\xb0\x9f\xb3\xf6\x53\xbe"
+    "\x95\xe4\xb6\x4b\x36\x5d\xd9\xad\x49\x76\x1d\xdb\xed\xc9\x36\x7d\x79\x74"
+    "\xb6\x2f\x4f\x3b\x8e\xe7\xcb\x60\xe5\x9e\xfa\xdf\x38\xaf\xdf\x2f\xdb\x95"
+    "\xc3\x24\x7f\x1b\x07\x8d\x40\x13\xa0\x99\x81\x66\x0e\x9a\x0a\x34\x35\x68"
+    "\x16\xa0\x59\x92\x9d\x22\x08\x44\x82\x13\x0a\x4e\x2c\x38\xc1\xe0\x44\x83"
+    "\x13\x0e\x4e\x3c\x38\x01\xe1\x44\x84\x88\x08\xa1\xdb\x40\x44\x88\x88\x10"
+    "\x11\x21\x22\x42\x44\x84\x88\x08\x11\x11\x22\x22\x82\x88\x08\x22\x22\xd0"
+    "\xbb\x20\x22\x82\x88\x08\x22\x22\x88\x88\x20\x22\x82\x88\x88\x3f\x45\x7c"
+    "\x00\x64\x58\x7b\x18\x3e\x08\x00\x00";
+
+/// `gzip -9 -n` of `adb-lite adb-lite adb`, a fixed Huffman block.
+static constexpr char short_gzip[] =
+    "\x1f\x8b\x08\x00\x00\x00\x00\x00\x02\x03\x4b\x4c\x49\xd2\xcd\xc9\x2c\x49"
+    "\x55\x48\x44\x62\x00\x00\xa4\xa8\x7b\xbe\x15\x00\x00\x00";
+
+/// `gzip -1 -n` of 200 bytes `(i * 167 + 13) % 256`, a stored block.
+static constexpr char stored_gzip[] =
+    "\x1f\x8b\x08\x00\x00\x00\x00\x00\x04\x03\x01\xc8\x00\x37\xff\x0d\xb4\x5b"
+    "\x02\xa9\x50\xf7\x9e\x45\xec\x93\x3a\xe1\x88\x2f\xd6\x7d\x24\xcb\x72\x19"
+    "\xc0\x67\x0e\xb5\x5c\x03\xaa\x51\xf8\x9f\x46\xed\x94\x3b\xe2\x89\x30\xd7"
+    "\x7e\x25\xcc\x73\x1a\xc1\x68\x0f\xb6\x5d\x04\xab\x52\xf9\xa0\x47\xee\x95"
+    "\x3c\xe3\x8a\x31\xd8\x7f\x26\xcd\x74\x1b\xc2\x69\x10\xb7\x5e\x05\xac\x53"
+    "\xfa\xa1\x48\xef\x96\x3d\xe4\x8b\x32\xd9\x80\x27\xce\x75\x1c\xc3\x6a\x11"
+    "\xb8\x5f\x06\xad\x54\xfb\xa2\x49\xf0\x97\x3e\xe5\x8c\x33\xda\x81\x28\xcf"
+    "\x76\x1d\xc4\x6b\x12\xb9\x60\x07\xae\x55\xfc\xa3\x4a\xf1\x98\x3f\xe6\x8d"
+    "\x34\xdb\x82\x29\xd0\x77\x1e\xc5\x6c\x13\xba\x61\x08\xaf\x56\xfd\xa4\x4b"
+    "\xf2\x99\x40\xe7\x8e\x35\xdc\x83\x2a\xd1\x78\x1f\xc6\x6d\x14\xbb\x62\x09"
+    "\xb0\x57\xfe\xa5\x4c\xf3\x9a\x41\xe8\x8f\x36\xdd\x84\x2b\xd2\x79\x20\xc7"
+    "\x6e\x15\xbc\x63\x0a\xb1\x58\xff\xa6\x4d\xf4\x9b\x42\xe9\x90\x37\xde\x81"
+    "\xc3\x09\x10\xc8\x00\x00\x00";
+
+/// Decompress a gzip stream, fed in two parts split at an offset.
+/**
+ * @return false if the stream is invalid. finished is set to whether the
+ * last member is complete.
+ */
+static bool gunzip(const std::string_view data, const size_t split,
+                   std::string& output, bool& finished) {
+    adb::gzip::decoder decoder;
+    output.clear();
+    const auto sink = [&](const std::string_view data) { output += data; };
+    const auto valid = decoder.feed(data.substr(0, split), sink) &&
+                       decoder.feed(data.substr(split), sink);
+    finished = decoder.finished();
+    return valid;
+}
+
+static void test_gzip() {
+    const auto text = lines();
+    const auto fast = bytes(lines_gzip_1);
+    const auto best = bytes(lines_gzip_9);
+
+    std::string stored;
+    for (int i = 0; i < 200; i++) {
+        stored += static_cast<char>((i * 167 + 13) % 256);
+    }
+
+    std::string output;
+    bool finished = false;
+    for (const auto& [data, expected] :
+         {std::pair(fast, text), std::pair(best, text),
+          std::pair(bytes(short_gzip), std::string("adb-lite adb-lite adb")),
+          std::pair(bytes(stored_gzip), stored)}) {
+        for (size_t split = 0; split <= data.size(); split++) {
+            CHECK(gunzip(data, split, output, finished));
+            CHECK(finished && output == expected);
+        }
+    }
+
+    // Members one after another.
+    CHECK(gunzip(fast + best, fast.size() + 3, output, finished));
+    CHECK(finished && output == text + text);
+
+    // A truncated stream is valid so far, but not finished.
+    for (const size_t cut : {size_t{1}, size_t{4}, size_t{8}, size_t{100}}) {
+        const auto truncated = best.substr(0, best.size() - cut);
+        CHECK(gunzip(truncated, truncated.size(), output, finished));
+        CHECK(!finished);
+    }
+    CHECK(gunzip(fast + best.substr(0, 50), 0, output, finished));
+    CHECK(!finished);
+
+    CHECK(!gunzip("not a gzip stream", 0, output, finished));
+}
+
+int main() {
+    test_logcat();
+    test_property_map();
+    test_lz4();
+    test_gzip();
+
+    if (failures > 0) {
+        std::cerr << failures << " checks failed" << std::endl;
+        return 1;
+    }
+    return 0;
+}